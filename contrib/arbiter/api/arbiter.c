@@ -40,70 +40,159 @@ static char *arbiter_unix_sock_dir;
 
 typedef unsigned xid_t;
 
+/*
+ * The set of active global transactions as of the last snapshot received from
+ * the arbiter. The arbiter only sends the changes since this version, if it
+ * still remembers them.
+ */
+static xid_t snapshot_epoch = 0;
+static xid_t snapshot_version = 0; // 0 means no snapshot received yet
+static int snapshot_nactive = 0;
+static xid_t snapshot_active[MAX_TRANSACTIONS]; // ascending
+
+/*
+ * Every request goes out with a tag in the 'code' field of the message header,
+ * and the arbiter tags the reply in the same way, so several requests can be
+ * in flight at once. The replies to requests other than the awaited one are
+ * stashed until asked for, or dropped if forgotten. Tag 0 is MSG_DISCONNECT,
+ * so 1..255 are usable.
+ */
+#define MAX_TAGS 256
+
+typedef struct ArbiterReply
+{
+	bool inflight;  // a request with this tag has been sent
+	bool forgotten; // nobody is interested, drop the reply on arrival
+	xid_t *results; // the stashed reply, NULL if not arrived yet
+	int reslen;
+} ArbiterReply;
+
+static ArbiterReply replies[MAX_TAGS];
+static int last_tag = 0;
+
+// Returns a free tag, or 0 if all of them are in flight.
+static int arbiter_new_tag()
+{
+	int i;
+	for (i = 1; i < MAX_TAGS; i++)
+	{
+		last_tag = last_tag % (MAX_TAGS - 1) + 1;
+		if (!replies[last_tag].inflight)
+		{
+			replies[last_tag].inflight = true;
+			replies[last_tag].forgotten = false;
+			return last_tag;
+		}
+	}
+	return 0;
+}
+
+static void arbiter_release_tag(int tag)
+{
+	ArbiterReply *r = replies + tag;
+	if (r->results)
+	{
+		free(r->results);
+		r->results = NULL;
+	}
+	r->inflight = false;
+}
+
 static void DiscardConnection()
 {
+	int tag;
 	if (connected)
 	{
 		close(conns[leader].sock);
 		conns[leader].sock = -1;
 		connected = false;
 	}
+	for (tag = 1; tag < MAX_TAGS; tag++)
+		arbiter_release_tag(tag);
+	snapshot_version = 0;
 	leader = (leader + 1) % connum;
 	fprintf(stderr, "pid=%d: next candidate is %s:%d (%d of %d)\n", getpid(), conns[leader].host, conns[leader].port, leader, connum);
 }
 
-static int arbiter_recv_results(ArbiterConn arbiter, int maxlen, xid_t *results)
+static bool arbiter_read(ArbiterConn arbiter, void *buf, int needed, char const *what)
 {
-	ShubMessageHdr msg;
-	int recved;
-	int needed;
-
-	recved = 0;
-	needed = sizeof(ShubMessageHdr);
+	int recved = 0;
 	while (recved < needed)
 	{
-		int newbytes = read(arbiter->sock, (char*)&msg + recved, needed - recved);
+		int newbytes = read(arbiter->sock, (char*)buf + recved, needed - recved);
 		if (newbytes == -1)
 		{
 			DiscardConnection();
-			elog(WARNING, "Failed to recv results header from arbiter");
-			return 0;
+			elog(WARNING, "Failed to recv %s from arbiter", what);
+			return false;
 		}
 		if (newbytes == 0)
 		{
 			DiscardConnection();
 			elog(WARNING, "Arbiter closed connection during recv");
-			return 0;
+			return false;
 		}
 		recved += newbytes;
 	}
+	return true;
+}
 
-	recved = 0;
-	needed = msg.size;
-	assert(needed % sizeof(xid_t) == 0);
-	if (needed > maxlen * sizeof(xid_t))
-	{
-		elog(ERROR, "The message body will not fit into the results array");
-		return 0;
-	}
-	while (recved < needed)
+// Waits for the reply to the request with the given 'tag' and copies it to
+// 'results'. Returns the number of results, or 0 on failure.
+static int arbiter_recv_results(ArbiterConn arbiter, int tag, int maxlen, xid_t *results)
+{
+	ArbiterReply *r = replies + tag;
+	int reslen;
+
+	assert(r->inflight);
+	while (r->results == NULL)
 	{
-		int newbytes = read(arbiter->sock, (char*)results + recved, needed - recved);
-		if (newbytes == -1)
+		ShubMessageHdr msg;
+		ArbiterReply *other;
+		xid_t *body;
+
+		if (!arbiter_read(arbiter, &msg, sizeof(ShubMessageHdr), "results header"))
+			return 0;
+		assert(msg.size % sizeof(xid_t) == 0);
+
+		body = malloc(msg.size + sizeof(xid_t));
+		if (body == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_OUT_OF_MEMORY),
+					 errmsg("out of memory")));
+		if (!arbiter_read(arbiter, body, msg.size, "results body"))
 		{
-			DiscardConnection();
-			elog(WARNING, "Failed to recv results body from arbiter");
+			free(body);
 			return 0;
 		}
-		if (newbytes == 0)
+
+		other = replies + msg.code;
+		if (!other->inflight || other->results != NULL)
 		{
-			DiscardConnection();
-			elog(WARNING, "Arbiter closed connection during recv");
-			return 0;
+			free(body);
+			elog(WARNING, "Unexpected reply with tag %d from arbiter", msg.code);
+			continue;
 		}
-		recved += newbytes;
+		if (other->forgotten)
+		{
+			free(body);
+			arbiter_release_tag(msg.code);
+			continue;
+		}
+		other->results = body;
+		other->reslen = msg.size / sizeof(xid_t);
 	}
-	return needed / sizeof(xid_t);
+
+	reslen = r->reslen;
+	if (reslen > maxlen)
+	{
+		arbiter_release_tag(tag);
+		elog(ERROR, "The message body will not fit into the results array");
+		return 0;
+	}
+	memcpy(results, r->results, reslen * sizeof(xid_t));
+	arbiter_release_tag(tag);
+	return reslen;
 }
 
 // Connects to the specified Arbiter.
@@ -187,7 +276,9 @@ static bool ArbiterConnect(ArbiterConn conn)
 	return false;
 }
 
-static bool arbiter_send_command(ArbiterConn arbiter, xid_t cmd, int argc, ...)
+// Sends the command without waiting for the reply. Returns the tag of the
+// request, or 0 on failure.
+static int arbiter_send_command(ArbiterConn arbiter, xid_t cmd, int argc, ...)
 {
 	va_list argv;
 	int i;
@@ -195,10 +286,16 @@ static bool arbiter_send_command(ArbiterConn arbiter, xid_t cmd, int argc, ...)
 	char buf[COMMAND_BUFFER_SIZE];
 	int datasize;
 	char *cursor = buf;
+	int tag = arbiter_new_tag();
 
 	ShubMessageHdr *msg = (ShubMessageHdr*)cursor;
+	if (!tag)
+	{
+		elog(WARNING, "Too many requests in flight to arbiter");
+		return 0;
+	}
 	msg->chan = 0;
-	msg->code = MSG_FIRST_USER_CODE;
+	msg->code = tag;
 	msg->size = sizeof(xid_t) * (argc + 1);
 	cursor += sizeof(ShubMessageHdr);
 
@@ -225,11 +322,11 @@ static bool arbiter_send_command(ArbiterConn arbiter, xid_t cmd, int argc, ...)
 		{
 			DiscardConnection();
 			elog(ERROR, "Failed to send a command to arbiter");
-			return false;
+			return 0;
 		}
 		sent += newbytes;
 	}
-	return true;
+	return tag;
 }
 
 void ArbiterConfig(char *servers, char *sock_dir)
@@ -285,12 +382,13 @@ static ArbiterConn GetConnection()
 		{
 			xid_t results[RESULTS_SIZE];
 			int reslen;
-			if (!arbiter_send_command(c, CMD_HELLO, 0))
+			int tag = arbiter_send_command(c, CMD_HELLO, 0);
+			if (!tag)
 			{
 				tries--;
 				continue;
 			}
-			reslen = arbiter_recv_results(c, RESULTS_SIZE, results);
+			reslen = arbiter_recv_results(c, tag, RESULTS_SIZE, results);
 			if ((reslen < 1) || (results[0] != RES_OK))
 			{
 				tries--;
@@ -345,10 +443,99 @@ void ArbiterInitSnapshot(Snapshot snapshot)
 	}
 }
 
+static int compare_xid(void const* x, void const* y)
+{
+	xid_t xid1 = *(xid_t*)x;
+	xid_t xid2 = *(xid_t*)y;
+	return xid1 < xid2 ? -1 : xid1 == xid2 ? 0 : 1;
+}
+
+/*
+ * Updates the known active set from a versioned snapshot reply
+ * [epoch, version, kind, ...] and fills the 'snapshot' in the same way the
+ * arbiter does it for unversioned replies. Returns 'false' if the reply is
+ * malformed.
+ */
+static bool ArbiterReceiveSnapshot(Snapshot snapshot, xid_t *results, int reslen)
+{
+	int i, n;
+
+	if (reslen < 3)
+		return false;
+
+	if (results[2] == SNAPSHOT_FULL)
+	{
+		n = reslen - 3;
+		if (n > MAX_TRANSACTIONS)
+			return false;
+		memcpy(snapshot_active, results + 3, n * sizeof(xid_t));
+		snapshot_nactive = n;
+	}
+	else if (results[2] == SNAPSHOT_DELTA)
+	{
+		int nadded;
+		xid_t *added, *removed;
+		int nremoved;
+
+		if ((reslen < 4) || (snapshot_version == 0))
+			return false;
+		nadded = results[3];
+		if (nadded > reslen - 4)
+			return false;
+		added = results + 4;
+		removed = added + nadded;
+		nremoved = reslen - 4 - nadded;
+		if (snapshot_nactive + nadded > MAX_TRANSACTIONS)
+			return false;
+
+		for (i = 0; i < nremoved; i++)
+		{
+			xid_t *found = bsearch(removed + i, snapshot_active, snapshot_nactive,
+								   sizeof(xid_t), compare_xid);
+			if (found == NULL)
+				return false;
+			memmove(found, found + 1, (snapshot_active + snapshot_nactive - found - 1) * sizeof(xid_t));
+			snapshot_nactive--;
+		}
+		if (nadded > 0)
+		{
+			memcpy(snapshot_active + snapshot_nactive, added, nadded * sizeof(xid_t));
+			snapshot_nactive += nadded;
+			qsort(snapshot_active, snapshot_nactive, sizeof(xid_t), compare_xid);
+		}
+	}
+	else
+	{
+		return false;
+	}
+	snapshot_epoch = results[0];
+	snapshot_version = results[1];
+
+	/* the tail of successive xids is covered by xmax */
+	n = snapshot_nactive;
+	while (n > 1 && snapshot_active[n-2] + 1 == snapshot_active[n-1])
+		n--;
+
+	ArbiterInitSnapshot(snapshot);
+	if (n > 0)
+	{
+		snapshot->xmin = snapshot_active[0];
+		snapshot->xmax = snapshot_active[--n];
+	}
+	else
+	{
+		snapshot->xmin = snapshot->xmax = 0;
+	}
+	snapshot->xcnt = n;
+	memcpy(snapshot->xip, snapshot_active, n * sizeof(TransactionId));
+
+	return true;
+}
+
 TransactionId ArbiterStartTransaction(Snapshot snapshot, TransactionId *gxmin, int nParticipants)
 {
-	int i;
 	xid_t xid;
+	int tag;
 	int reslen;
 	xid_t results[RESULTS_SIZE];
 	ArbiterConn arbiter = GetConnection();
@@ -359,28 +546,17 @@ TransactionId ArbiterStartTransaction(Snapshot snapshot, TransactionId *gxmin, i
 	assert(snapshot != NULL);
 
 	// command
-	if (nParticipants) {
-		if (!arbiter_send_command(arbiter, CMD_BEGIN, 1, nParticipants)) goto failure;
-	} else {
-		if (!arbiter_send_command(arbiter, CMD_BEGIN, 0)) goto failure;
-	}
+	tag = arbiter_send_command(arbiter, CMD_BEGIN, 3, nParticipants, snapshot_epoch, snapshot_version);
+	if (!tag) goto failure;
 
 	// results
-	reslen = arbiter_recv_results(arbiter, RESULTS_SIZE, results);
-	if (reslen < 5) goto failure;
+	reslen = arbiter_recv_results(arbiter, tag, RESULTS_SIZE, results);
+	if (reslen < 3) goto failure;
 	if (results[0] != RES_OK) goto failure;
 	xid = results[1];
 	*gxmin = results[2];
 
-	ArbiterInitSnapshot(snapshot);
-	snapshot->xmin = results[3];
-	snapshot->xmax = results[4];
-	snapshot->xcnt = reslen - 5;
-
-	for (i = 0; i < snapshot->xcnt; i++)
-	{
-		snapshot->xip[i] = results[5 + i];
-	}
+	if (!ArbiterReceiveSnapshot(snapshot, results + 3, reslen - 3)) goto failure;
 
 	return xid;
 failure:
@@ -391,7 +567,7 @@ failure:
 
 void ArbiterGetSnapshot(TransactionId xid, Snapshot snapshot, TransactionId *gxmin)
 {
-	int i;
+	int tag;
 	int reslen;
 	xid_t results[RESULTS_SIZE];
 	ArbiterConn arbiter = GetConnection();
@@ -402,22 +578,16 @@ void ArbiterGetSnapshot(TransactionId xid, Snapshot snapshot, TransactionId *gxm
 	assert(snapshot != NULL);
 
 	// command
-	if (!arbiter_send_command(arbiter, CMD_SNAPSHOT, 1, xid)) goto failure;
+	tag = arbiter_send_command(arbiter, CMD_SNAPSHOT, 3, xid, snapshot_epoch, snapshot_version);
+	if (!tag) goto failure;
 
 	// response
-	reslen = arbiter_recv_results(arbiter, RESULTS_SIZE, results);
-	if (reslen < 4) goto failure;
+	reslen = arbiter_recv_results(arbiter, tag, RESULTS_SIZE, results);
+	if (reslen < 2) goto failure;
 	if (results[0] != RES_OK) goto failure;
 	*gxmin = results[1];
-	ArbiterInitSnapshot(snapshot);
-	snapshot->xmin = results[2];
-	snapshot->xmax = results[3];
-	snapshot->xcnt = reslen - 4;
 
-	for (i = 0; i < snapshot->xcnt; i++)
-	{
-		snapshot->xip[i] = results[4 + i];
-	}
+	if (!ArbiterReceiveSnapshot(snapshot, results + 2, reslen - 2)) goto failure;
 
 	return;
 failure:
@@ -429,10 +599,9 @@ failure:
 	);
 }
 
-XidStatus ArbiterSetTransStatus(TransactionId xid, XidStatus status, bool wait)
+int ArbiterSendSetTransStatus(TransactionId xid, XidStatus status, bool wait)
 {
-	int reslen;
-	xid_t results[RESULTS_SIZE];
+	int tag;
 	ArbiterConn arbiter = GetConnection();
 	if (!arbiter) {
 		goto failure;
@@ -441,56 +610,64 @@ XidStatus ArbiterSetTransStatus(TransactionId xid, XidStatus status, bool wait)
 	switch (status)
 	{
 		case TRANSACTION_STATUS_COMMITTED:
-			if (!arbiter_send_command(arbiter, CMD_FOR, 2, xid, wait)) goto failure;
+			tag = arbiter_send_command(arbiter, CMD_FOR, 2, xid, wait);
 			break;
 		case TRANSACTION_STATUS_ABORTED:
-			if (!arbiter_send_command(arbiter, CMD_AGAINST, 2, xid, wait)) goto failure;
+			tag = arbiter_send_command(arbiter, CMD_AGAINST, 2, xid, wait);
 			break;
 		default:
 			assert(false); // should not happen
 			goto failure;
 	}
+	if (!tag) goto failure;
 
-	// response
-	reslen = arbiter_recv_results(arbiter, RESULTS_SIZE, results);
-	if (reslen != 1) goto failure;
-	switch (results[0])
-	{
-		case RES_TRANSACTION_COMMITTED:
-			return TRANSACTION_STATUS_COMMITTED;
-		case RES_TRANSACTION_ABORTED:
-			return TRANSACTION_STATUS_ABORTED;
-		case RES_TRANSACTION_INPROGRESS:
-			return TRANSACTION_STATUS_IN_PROGRESS;
-		default:
-			goto failure;
-	}
+	return tag;
 failure:
 	DiscardConnection();
 	fprintf(
 		stderr,
-		"ArbiterSetTransStatus: failed to vote"
+		"ArbiterSendSetTransStatus: failed to vote"
 		" %s the transaction xid = %d\n",
 		(status == TRANSACTION_STATUS_COMMITTED) ? "for" : "against",
 		xid
 	);
-	return -1;
+	return 0;
 }
 
-XidStatus ArbiterGetTransStatus(TransactionId xid, bool wait)
+int ArbiterSendGetTransStatus(TransactionId xid, bool wait)
 {
-	int reslen;
-	xid_t results[RESULTS_SIZE];
+	int tag;
 	ArbiterConn arbiter = GetConnection();
 	if (!arbiter) {
 		goto failure;
 	}
 
-	// command
-	if (!arbiter_send_command(arbiter, CMD_STATUS, 2, xid, wait)) goto failure;
+	tag = arbiter_send_command(arbiter, CMD_STATUS, 2, xid, wait);
+	if (!tag) goto failure;
 
-	// response
-	reslen = arbiter_recv_results(arbiter, RESULTS_SIZE, results);
+	return tag;
+failure:
+	DiscardConnection();
+	fprintf(
+		stderr,
+		"ArbiterSendGetTransStatus: failed to ask"
+		" for the status of xid = %d\n",
+		xid
+	);
+	return 0;
+}
+
+XidStatus ArbiterRecvTransStatus(int tag)
+{
+	int reslen;
+	xid_t results[RESULTS_SIZE];
+
+	// the tag is stale if the connection has been discarded since the send
+	if (!connected || tag <= 0 || tag >= MAX_TAGS || !replies[tag].inflight) {
+		goto failure;
+	}
+
+	reslen = arbiter_recv_results(conns + leader, tag, RESULTS_SIZE, results);
 	if (reslen != 1) goto failure;
 	switch (results[0])
 	{
@@ -509,17 +686,43 @@ failure:
 	DiscardConnection();
 	fprintf(
 		stderr,
-		"ArbiterGetTransStatus: failed to get"
-		" the status of xid = %d\n",
-		xid
+		"ArbiterRecvTransStatus: failed to get"
+		" the reply to request %d\n",
+		tag
 	);
 	return -1;
 }
 
+void ArbiterForgetReply(int tag)
+{
+	if (tag <= 0 || tag >= MAX_TAGS || !replies[tag].inflight)
+		return;
+
+	if (replies[tag].results)
+		arbiter_release_tag(tag);
+	else
+		replies[tag].forgotten = true;
+}
+
+XidStatus ArbiterSetTransStatus(TransactionId xid, XidStatus status, bool wait)
+{
+	int tag = ArbiterSendSetTransStatus(xid, status, wait);
+	if (!tag) return -1;
+	return ArbiterRecvTransStatus(tag);
+}
+
+XidStatus ArbiterGetTransStatus(TransactionId xid, bool wait)
+{
+	int tag = ArbiterSendGetTransStatus(xid, wait);
+	if (!tag) return -1;
+	return ArbiterRecvTransStatus(tag);
+}
+
 int ArbiterReserve(TransactionId xid, int nXids, TransactionId *first)
 {
 	xid_t xmin, xmax;
 	int count;
+	int tag;
 	int reslen;
 	xid_t results[RESULTS_SIZE];
 	ArbiterConn arbiter = GetConnection();
@@ -528,10 +731,11 @@ int ArbiterReserve(TransactionId xid, int nXids, TransactionId *first)
 	}
 
 	// command
-	if (!arbiter_send_command(arbiter, CMD_RESERVE, 2, xid, nXids)) goto failure;
+	tag = arbiter_send_command(arbiter, CMD_RESERVE, 2, xid, nXids);
+	if (!tag) goto failure;
 
 	// response
-	reslen = arbiter_recv_results(arbiter, RESULTS_SIZE, results);
+	reslen = arbiter_recv_results(arbiter, tag, RESULTS_SIZE, results);
 	if (reslen != 3) goto failure;
 	if (results[0] != RES_OK) goto failure;
 	xmin = results[1];
@@ -561,12 +765,21 @@ bool ArbiterDetectDeadLock(int port, TransactionId xid, void* data, int size)
 	ShubMessageHdr* msg = (ShubMessageHdr*)buf;
 	xid_t* body = (xid_t*)(msg+1);
 	int sent;
+	int tag;
 	int reslen;
 	xid_t results[RESULTS_SIZE];
 	ArbiterConn arbiter = GetConnection();
 
+	tag = arbiter_new_tag();
+	if (!tag)
+	{
+		free(buf);
+		elog(WARNING, "Too many requests in flight to arbiter");
+		return false;
+	}
+
 	msg->chan = 0;
-	msg->code = MSG_FIRST_USER_CODE;
+	msg->code = tag;
 	msg->size = msg_size;
 
 	*body++ = CMD_DEADLOCK;
@@ -580,13 +793,17 @@ bool ArbiterDetectDeadLock(int port, TransactionId xid, void* data, int size)
 		int new_bytes = write(arbiter->sock, buf + sent, data_size - sent);
 		if (new_bytes == -1)
 		{
+			free(buf);
+			DiscardConnection();
 			elog(ERROR, "Failed to send a command to arbiter");
 			return false;
 		}
 		sent += new_bytes;
 	}
 
-	reslen = arbiter_recv_results(arbiter, RESULTS_SIZE, results);
+	free(buf);
+
+	reslen = arbiter_recv_results(arbiter, tag, RESULTS_SIZE, results);
 	if (reslen != 1 || (results[0] != RES_OK && results[0] != RES_DEADLOCK))
 	{
 		fprintf(
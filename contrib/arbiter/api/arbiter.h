@@ -44,6 +44,23 @@ XidStatus ArbiterSetTransStatus(TransactionId xid, XidStatus status, bool wait);
  */
 XidStatus ArbiterGetTransStatus(TransactionId xid, bool wait);
 
+/**
+ * The pipelined variants of the above. Several requests may be in flight at
+ * once: the Send functions return a tag (0 on failure) without waiting for the
+ * reply, which is later collected by ArbiterRecvTransStatus(tag). Only one
+ * request with 'wait' set may be in flight at a time. Tags become invalid once
+ * the connection is discarded after any failure.
+ */
+int ArbiterSendSetTransStatus(TransactionId xid, XidStatus status, bool wait);
+int ArbiterSendGetTransStatus(TransactionId xid, bool wait);
+XidStatus ArbiterRecvTransStatus(int tag);
+
+/**
+ * Declares that the reply to the request identified by 'tag' is of no
+ * interest, so that it is dropped on arrival.
+ */
+void ArbiterForgetReply(int tag);
+
 /**
  * Reserves at least 'nXids' successive xids for local transactions. The xids
  * reserved are not less than 'xid' in value. Returns the actual number of xids
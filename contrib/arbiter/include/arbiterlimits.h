@@ -9,6 +9,7 @@
 
 #define MAX_TRANSACTIONS 4096
 #define MAX_SNAPSHOTS_PER_TRANS 8
+#define SNAPSHOT_HISTORY_SIZE 4096 /* how many active set changes to remember for delta snapshots */
 
 #define BUFFER_SIZE (256 * 1024)
 #define LISTEN_QUEUE_SIZE 100
@@ -21,5 +22,6 @@
 #define ELECTION_TIMEOUT_MS_MAX 300
 #define RAFT_LOGLEN 1024
 #define RAFT_KEEP_APPLIED 512 /* how many applied entries to keep during compaction */
+#define RAFT_MAX_UPDATES 64 /* how many updates a single log entry can carry */
 
 #endif
@@ -31,6 +31,10 @@ int clog_read(clog_t clog, xid_t xid);
 // 'false' otherwise.
 bool clog_write(clog_t clog, xid_t xid, int status);
 
+// Make all the statuses written since the last sync durable. Return 'true' on
+// success, 'false' otherwise.
+bool clog_sync(clog_t clog);
+
 // Forget about the commits before the given one ('until'), and free the
 // occupied space if possible. Return 'true' on success, 'false' otherwise.
 bool clog_forget(clog_t clog, xid_t until);
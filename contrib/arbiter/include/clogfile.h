@@ -3,6 +3,7 @@
  */
 
 #include <stdbool.h>
+#include <sys/types.h>
 #include "int.h"
 
 #ifndef CLOGFILE_H
@@ -22,6 +23,8 @@ typedef struct clogfile_t {
 	xid_t min;
 	xid_t max;
 	void *data; // ptr for mmap
+	off64_t dirty_from; // the range of bytes modified since the last sync
+	off64_t dirty_to;
 } clogfile_t;
 
 // Open a clog file with the gived id. Create before opening if 'create' is
@@ -38,8 +41,13 @@ bool clogfile_close(clogfile_t *clogfile);
 // Get the status of the specified global commit from the clog file.
 int clogfile_get_status(clogfile_t *clogfile, xid_t xid);
 
-// Set the status of the specified global commit in the clog file. Return
-// 'true' on success, 'false' otherwise.
+// Set the status of the specified global commit in the clog file. The change
+// is not durable until clogfile_sync() is called. Return 'true' on success,
+// 'false' otherwise.
 bool clogfile_set_status(clogfile_t *clogfile, xid_t xid, int status);
 
+// Flush the changes made to the clog file since the last sync. Return 'true'
+// on success, 'false' otherwise.
+bool clogfile_sync(clogfile_t *clogfile);
+
 #endif
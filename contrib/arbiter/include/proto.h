@@ -19,4 +19,8 @@
 #define RES_TRANSACTION_INPROGRESS 3
 #define RES_TRANSACTION_UNKNOWN 4
 
+/* kinds of versioned snapshot replies */
+#define SNAPSHOT_FULL  0
+#define SNAPSHOT_DELTA 1
+
 #endif
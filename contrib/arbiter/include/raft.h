@@ -29,13 +29,18 @@
 #endif
 
 // raft module does not care what you mean by action and argument
+typedef struct raft_update_t {
+	int action;
+	int argument;
+} raft_update_t;
+
 typedef struct raft_entry_t {
 	int term;
 	bool snapshot; // true if this is a snapshot entry
 	union {
 		struct { // snapshot == false
-			int action;
-			int argument;
+			int nupdates;
+			raft_update_t updates[RAFT_MAX_UPDATES];
 		};
 		struct { // snapshot == true
 			int minarg;
@@ -133,6 +138,7 @@ bool raft_set_myid(raft_t *r, int myid);
 
 // log actions
 bool raft_emit(raft_t *r, int action, int argument);
+bool raft_emit_batch(raft_t *r, int nupdates, raft_update_t *updates);
 int raft_apply(raft_t *r, raft_applier_t applier);
 
 // control
@@ -54,9 +54,18 @@ bool server_start(server_t server);
 /*
  * The main server loop. Returns true if there is a raft message ready, or NULL
  * if timed out. Use the callbacks and signal handlers to add more logic.
+ *
+ * The replies produced by the callbacks stay buffered until server_flush() is
+ * called, so that the caller can make the effects of the whole tick durable
+ * before anything gets reported to the clients.
  */
 bool server_tick(server_t server, int timeout_ms);
 
+/*
+ * Sends out everything buffered for the clients.
+ */
+void server_flush(server_t server);
+
 /*
  * Closes all client connections on the server and refuses to accept new ones.
  */
@@ -119,6 +128,16 @@ bool client_message_finish(client_t client);
  */
 bool client_message_shortcut(client_t client, xid_t arg);
 
+/*
+ * Every request carries a tag in the 'code' field of its header, and a reply
+ * goes out with the tag of the request it answers, so that a client can have
+ * several requests in flight. The tag is set to the one of the request being
+ * handled. Save it and set it back to answer the request later, when other
+ * requests of the same client may have been handled.
+ */
+unsigned int client_get_tag(client_t client);
+void client_set_tag(client_t client, unsigned int tag);
+
 /*
  * A shortcut to send the 'redirect' message.
  *
@@ -1,17 +1,50 @@
 #ifndef SNAPSHOT_H
 #define SNAPSHOT_H
 
+#include <stdbool.h>
 #include "int.h"
 #include "arbiterlimits.h"
 
 typedef struct Snapshot {
 	xid_t xmin;
 	xid_t xmax;
-	int nactive;
-	xid_t active[MAX_TRANSACTIONS];
+	int nactive; // number of active xids below xmax
+	int nall;    // number of all active xids, including those from xmax on
+	xid_t active[MAX_TRANSACTIONS]; // ascending, the first 'nactive' are below xmax
+	xid_t version; // version of the active set the snapshot was taken from
 	int times_sent;
 } Snapshot;
 
 void snapshot_sort(Snapshot *s);
 
+/*
+ * Every change of the set of active transactions increments its version. The
+ * last SNAPSHOT_HISTORY_SIZE changes are remembered, so that a client holding
+ * a snapshot of a recent version can be sent only the difference.
+ */
+
+// Start a new history, tagged with the given 'epoch'. Versions from another
+// epoch are never used as a base for the difference.
+void snapshot_history_init(xid_t epoch);
+
+xid_t snapshot_epoch(void);
+xid_t snapshot_version(void);
+
+// Record that 'xid' became active. Returns the version this change has got.
+xid_t snapshot_note_added(xid_t xid);
+
+// Record that 'xid', which became active at 'added_at', is not active any
+// more.
+void snapshot_note_removed(xid_t xid, xid_t added_at);
+
+// Find out which xids have to be added to and removed from the active set of
+// version 'from' to turn it into the active set of version 'to'. Return
+// 'false' if the history is not long enough or if there are more than 'limit'
+// changes in total, 'true' otherwise.
+bool snapshot_delta(
+	xid_t from, xid_t to, int limit,
+	xid_t *added, int *nadded,
+	xid_t *removed, int *nremoved
+);
+
 #endif
@@ -20,6 +20,7 @@ typedef struct Transaction {
     struct Transaction* collision;
 	xid_t xid;
     xid_t xmin;
+	xid_t added_at; // version of the active set where this xid appeared
 
 	int size; // number of participants
 	bool fixed_size;
@@ -23,6 +23,7 @@ bool test_clog(char *datadir) {
 	printf("commit %d status %d\n", 1000, clog_read(clog, 1000));
 	if (!clog_write(clog, 1000, POSITIVE)) return false;
 	if (!clog_write(clog, 1500, DOUBT)) return false;
+	if (!clog_sync(clog)) return false;
 
 	if (!clog_close(clog)) return false;
 	if (!(clog = clog_open(datadir))) return false;
@@ -162,6 +162,17 @@ bool clog_write(clog_t clog, xid_t xid, int status) {
 	return clogfile_set_status(file, xid, status);
 }
 
+// Make all the statuses written since the last sync durable. Return 'true' on
+// success, 'false' otherwise.
+bool clog_sync(clog_t clog) {
+	clogfile_chain_t *cur;
+	bool ok = true;
+	for (cur = clog->lastfile; cur; cur = cur->prev) {
+		ok &= clogfile_sync(&cur->file);
+	}
+	return ok;
+}
+
 // Forget about the commits before the given one ('until'), and free the
 // occupied space if possible. Return 'true' on success, 'false' otherwise.
 bool clog_forget(clog_t clog, xid_t until) {
@@ -27,6 +27,8 @@ bool clogfile_open_by_id(clogfile_t *clogfile, char *datadir, int fileid, bool c
 	clogfile->path = clogfile_get_path(datadir, fileid);
 	clogfile->min = COMMITS_PER_FILE * fileid;
 	clogfile->max = clogfile->min + COMMITS_PER_FILE - 1;
+	clogfile->dirty_from = BYTES_PER_FILE;
+	clogfile->dirty_to = -1;
 
 	if (create) {
 		fd = open(clogfile->path, O_RDWR | O_CREAT | O_EXCL, 0660);
@@ -93,19 +95,41 @@ int clogfile_get_status(clogfile_t *clogfile, xid_t xid) {
 	return ((*p) >> (BITS_PER_COMMIT * suboffset)) & COMMIT_MASK; // AND-out all other status
 }
 
-// Set the status of the specified global commit in the clog file. Return
-// 'true' on success, 'false' otherwise.
+// Set the status of the specified global commit in the clog file. The change
+// is not durable until clogfile_sync() is called. Return 'true' on success,
+// 'false' otherwise.
 bool clogfile_set_status(clogfile_t *clogfile, xid_t xid, int status) {
 	off64_t offset = XID_TO_OFFSET(xid);
 	int suboffset = XID_TO_SUBOFFSET(xid);
 	char *p = ((char*)clogfile->data + offset);
 	*p &= ~(COMMIT_MASK << (BITS_PER_COMMIT * suboffset));   // AND-out the old status
 	*p |= status << (BITS_PER_COMMIT * suboffset); // OR-in the new status
+	if (offset < clogfile->dirty_from) clogfile->dirty_from = offset;
+	if (offset > clogfile->dirty_to) clogfile->dirty_to = offset;
+	return true;
+}
+
+// Flush the changes made to the clog file since the last sync. Only the pages
+// in the modified range get synced, so a group of nearby updates costs a
+// single msync. Return 'true' on success, 'false' otherwise.
+bool clogfile_sync(clogfile_t *clogfile) {
+	#ifdef SYNC
+	off64_t pagesize;
+	off64_t from;
+	#endif
+
+	if (clogfile->dirty_from > clogfile->dirty_to) {
+		return true; // nothing changed
+	}
 	#ifdef SYNC
-	if (msync(clogfile->data, BYTES_PER_FILE, MS_SYNC)) {
+	pagesize = sysconf(_SC_PAGESIZE);
+	from = clogfile->dirty_from - clogfile->dirty_from % pagesize;
+	if (msync((char*)clogfile->data + from, clogfile->dirty_to - from + 1, MS_SYNC)) {
 		shout("cannot msync clog file '%s': %s\n", clogfile->path, strerror(errno));
 		return false;
 	}
 	#endif
+	clogfile->dirty_from = BYTES_PER_FILE;
+	clogfile->dirty_to = -1;
 	return true;
 }
@@ -50,6 +50,7 @@ typedef struct client_userdata_t {
 	 */
 	Transaction *xpart; /* the transaction this client is participating in */
 	Transaction *xwait; /* the transaction this client is waiting for */
+	unsigned int xwait_tag; /* the tag of the request waiting for 'xwait' */
 } client_userdata_t;
 
 clog_t clg;
@@ -61,6 +62,7 @@ bool use_raft;
 #define CLIENT_SNAPSENT(CLIENT) (CLIENT_USERDATA(CLIENT)->snapshots_sent)
 #define CLIENT_XPART(CLIENT) (CLIENT_USERDATA(CLIENT)->xpart)
 #define CLIENT_XWAIT(CLIENT) (CLIENT_USERDATA(CLIENT)->xwait)
+#define CLIENT_XWAIT_TAG(CLIENT) (CLIENT_USERDATA(CLIENT)->xwait_tag)
 
 static client_userdata_t *create_client_userdata(int id) {
 	client_userdata_t *cd = malloc(sizeof(client_userdata_t));
@@ -68,6 +70,7 @@ static client_userdata_t *create_client_userdata(int id) {
 	cd->snapshots_sent = 0;
 	cd->xpart = NULL;
 	cd->xwait = NULL;
+	cd->xwait_tag = 0;
 	return cd;
 }
 
@@ -81,6 +84,7 @@ inline static void free_transaction(Transaction* t) {
 	for (tpp = &transaction_hash[t->xid % MAX_TRANSACTIONS]; *tpp != t; tpp = &(*tpp)->collision);
 	*tpp = t->collision;
 	l2_list_unlink(&t->elem);
+	snapshot_note_removed(t->xid, t->added_at);
 	t->elem.next = free_transactions;
 	free_transactions = &t->elem;
 	if (t->xmin == global_xmin) { 
@@ -88,51 +92,82 @@ inline static void free_transaction(Transaction* t) {
 	}
 }
 
+inline static char *status_name(int status) {
+	switch (status) {
+		case BLANK: return "unknown";
+		case NEGATIVE: return "aborted";
+		case POSITIVE: return "committed";
+		case DOUBT: return "inprogress";
+		default: return "?";
+	}
+}
+
 static void notify_listeners(Transaction *t, int status) {
 	void *listener;
+	xid_t response;
 	switch (status) {
-		/* notify 'status' listeners about the transaction status */
 		case BLANK:
-			while ((listener = transaction_pop_listener(t, 's'))) {
-				debug("[%d] notifying the client about xid=%u (unknown)\n", CLIENT_ID(listener), t->xid);
-				CLIENT_XWAIT(listener) = NULL;
-				client_message_shortcut(
-					(client_t)listener,
-					RES_TRANSACTION_UNKNOWN
-				);
-			}
+			response = RES_TRANSACTION_UNKNOWN;
 			break;
 		case NEGATIVE:
-			while ((listener = transaction_pop_listener(t, 's'))) {
-				debug("[%d] notifying the client about xid=%u (aborted)\n", CLIENT_ID(listener), t->xid);
-				CLIENT_XWAIT(listener) = NULL;
-				client_message_shortcut(
-					(client_t)listener,
-					RES_TRANSACTION_ABORTED
-				);
-			}
+			response = RES_TRANSACTION_ABORTED;
 			break;
 		case POSITIVE:
-			while ((listener = transaction_pop_listener(t, 's'))) {
-				debug("[%d] notifying the client about xid=%u (committed)\n", CLIENT_ID(listener), t->xid);
-				CLIENT_XWAIT(listener) = NULL;
-				client_message_shortcut(
-					(client_t)listener,
-					RES_TRANSACTION_COMMITTED
-				);
-			}
+			response = RES_TRANSACTION_COMMITTED;
 			break;
 		case DOUBT:
-			while ((listener = transaction_pop_listener(t, 's'))) {
-				debug("[%d] notifying the client about xid=%u (inprogress)\n", CLIENT_ID(listener), t->xid);
-				CLIENT_XWAIT(listener) = NULL;
-				client_message_shortcut(
-					(client_t)listener,
-					RES_TRANSACTION_INPROGRESS
-				);
-			}
+			response = RES_TRANSACTION_INPROGRESS;
 			break;
+		default:
+			return;
+	}
+
+	/* notify 'status' listeners about the transaction status */
+	while ((listener = transaction_pop_listener(t, 's'))) {
+		debug("[%d] notifying the client about xid=%u (%s)\n", CLIENT_ID(listener), t->xid, status_name(status));
+		CLIENT_XWAIT(listener) = NULL;
+		/* the client may have sent other requests since it started waiting */
+		client_set_tag((client_t)listener, CLIENT_XWAIT_TAG(listener));
+		client_message_shortcut((client_t)listener, response);
+	}
+}
+
+/*
+ * The transaction statuses decided during one server tick are committed as a
+ * group: they are replicated in as few raft entries as possible, written to
+ * the clog and synced once, and only then the waiting clients get notified.
+ */
+static raft_update_t emitted_updates[MAX_TRANSACTIONS]; /* not replicated yet */
+static int emitted_num = 0;
+static raft_update_t applied_updates[MAX_TRANSACTIONS]; /* not synced yet */
+static int applied_num = 0;
+
+static void sync_applied_updates() {
+	int i;
+
+	/* Also covers the xid reservations and DOUBT marks made by BEGIN. */
+	if (!clog_sync(clg)) {
+		shout("SYNC: failed to sync clog, %d updates may be lost\n", applied_num);
+	}
+
+	if (applied_num == 0) return;
+
+	if (!use_raft || (raft.role == ROLE_LEADER)) {
+		for (i = 0; i < applied_num; i++) {
+			xid_t xid = applied_updates[i].argument;
+			Transaction *t = find_transaction(xid);
+			if (t == NULL) {
+				debug("SYNC: xid=%u is not active\n", xid);
+				continue;
+			}
+
+			notify_listeners(t, applied_updates[i].action);
+			free_transaction(t);
+		}
 	}
+
+	debug("synced %d updates\n", applied_num);
+	applied_num = 0;
 }
 
 static void apply_clog_update(int action, int argument) {
@@ -145,16 +180,51 @@ static void apply_clog_update(int action, int argument) {
 		shout("APPLY: failed to write to clog, xid=%u\n", xid);
 	}
 
-	if (!use_raft || (raft.role == ROLE_LEADER)) {
-		Transaction *t = find_transaction(xid);
-		if (t == NULL) {
-			debug("APPLY: xid=%u is not active\n", xid);
-			return;
+	if (applied_num == MAX_TRANSACTIONS) {
+		sync_applied_updates();
+	}
+	applied_updates[applied_num].action = action;
+	applied_updates[applied_num].argument = argument;
+	applied_num++;
+}
+
+static void replicate_emitted_updates() {
+	int i, n;
+	if (raft.role != ROLE_LEADER) {
+		/* leadership lost, the new leader decides on its own */
+		emitted_num = 0;
+		return;
+	}
+
+	for (i = 0; i < emitted_num; i += n) {
+		n = min(emitted_num - i, RAFT_MAX_UPDATES);
+		if (!raft_emit_batch(&raft, n, emitted_updates + i)) {
+			shout("EMIT: failed to emit %d updates\n", n);
 		}
+	}
+	emitted_num = 0;
+}
 
-		notify_listeners(t, status);
-		free_transaction(t);
+/*
+ * Decides the status of the transaction. Gets applied to the clog right away
+ * without raft, or after the whole group gets replicated with raft.
+ */
+static void emit_clog_update(int status, xid_t xid) {
+	if (!use_raft) {
+		apply_clog_update(status, xid);
+		return;
+	}
+
+	if (raft.role != ROLE_LEADER) {
+		return;
+	}
+
+	if (emitted_num == MAX_TRANSACTIONS) {
+		replicate_emitted_updates();
 	}
+	emitted_updates[emitted_num].action = status;
+	emitted_updates[emitted_num].argument = xid;
+	emitted_num++;
 }
 
 static int next_client_id = 0;
@@ -170,13 +240,7 @@ static void ondisconnect(client_t client) {
 	
 	if ((t = CLIENT_XPART(client))) {
 		transaction_remove_listener(t, 's', client);
-		if (use_raft) {
-			if (raft.role == ROLE_LEADER) {
-				raft_emit(&raft, NEGATIVE, t->xid);
-			}
-		} else {
-			apply_clog_update(NEGATIVE, t->xid);
-		}
+		emit_clog_update(NEGATIVE, t->xid);
 	}
 
 	if ((t = CLIENT_XWAIT(client))) {
@@ -229,24 +293,75 @@ static xid_t max_of_xids(xid_t a, xid_t b) {
 	return a > b ? a : b;
 }
 
+/* the last generated snapshot, reused until the active set changes */
+static Snapshot cached_snapshot;
+
 static void gen_snapshot(Snapshot *s) {
-	Transaction* t;
-    int n = 0;
-	s->times_sent = 0;
-	for (t = (Transaction*)active_transactions.prev; t != (Transaction*)&active_transactions; t = (Transaction*)t->elem.prev) {
-		s->active[n++] = t->xid;
-	}
-	while (n > 1 && s->active[n-2]+1 == s->active[n-1]) { 
-		n -= 1;
+	Snapshot *c = &cached_snapshot;
+
+	if (c->version != snapshot_version()) {
+		Transaction* t;
+		int n = 0;
+		for (t = (Transaction*)active_transactions.prev; t != (Transaction*)&active_transactions; t = (Transaction*)t->elem.prev) {
+			c->active[n++] = t->xid;
+		}
+		c->nall = n;
+		while (n > 1 && c->active[n-2]+1 == c->active[n-1]) { 
+			n -= 1;
+		}
+		if (n > 0) {
+			c->xmin = c->active[0];
+			c->xmax = c->active[--n];
+			assert(c->xmin <= c->xmax);
+		} else {
+			c->xmin = c->xmax = 0;
+		} 
+		c->nactive = n;
+		c->version = snapshot_version();
 	}
-	if (n > 0) {
-        s->xmin = s->active[0];
-        s->xmax = s->active[--n];
-		assert(s->xmin <= s->xmax);
+
+	s->xmin = c->xmin;
+	s->xmax = c->xmax;
+	s->nactive = c->nactive;
+	s->nall = c->nall;
+	memcpy(s->active, c->active, sizeof(xid_t) * c->nall);
+	s->version = c->version;
+	s->times_sent = 0;
+}
+
+/*
+ * Appends the snapshot in the versioned format: [epoch, version, kind, ...].
+ * If the client already has a snapshot of a recent version ('base') from the
+ * same epoch, and the difference is smaller than the snapshot itself, the
+ * kind is SNAPSHOT_DELTA followed by [nadded, added..., removed...].
+ * Otherwise it is SNAPSHOT_FULL followed by all the active xids, including
+ * the ones from xmax on, so that the client can apply deltas later.
+ */
+static void append_versioned_snapshot(client_t client, Snapshot *snap, xid_t epoch, xid_t base) {
+	static xid_t added[MAX_TRANSACTIONS];
+	static xid_t removed[MAX_TRANSACTIONS];
+	int nadded, nremoved;
+	xid_t myepoch = snapshot_epoch();
+	xid_t kind;
+
+	client_message_append(client, sizeof(xid_t), &myepoch);
+	client_message_append(client, sizeof(xid_t), &snap->version);
+
+	if ((epoch == myepoch) && snapshot_delta(
+		base, snap->version, snap->nall - 1,
+		added, &nadded, removed, &nremoved
+	)) {
+		xid_t count = nadded;
+		kind = SNAPSHOT_DELTA;
+		client_message_append(client, sizeof(xid_t), &kind);
+		client_message_append(client, sizeof(xid_t), &count);
+		client_message_append(client, sizeof(xid_t) * nadded, added);
+		client_message_append(client, sizeof(xid_t) * nremoved, removed);
 	} else {
-		s->xmin = s->xmax = 0;
-	} 
-	s->nactive = n;
+		kind = SNAPSHOT_FULL;
+		client_message_append(client, sizeof(xid_t), &kind);
+		client_message_append(client, sizeof(xid_t) * snap->nall, snap->active);
+	}
 }
 
 static void onhello(client_t client, int argc, xid_t *argv) {
@@ -387,11 +502,14 @@ static xid_t get_global_xmin() {
 
 static void onbegin(client_t client, int argc, xid_t *argv) {
 	Transaction *t;
+	bool versioned;
+
 	CHECK(
-		(argc == 1) || (argc == 2),
+		(argc == 1) || (argc == 2) || (argc == 4),
 		client,
 		"BEGIN: wrong number of arguments"
 	);
+	versioned = (argc == 4);
 
 	CHECK(
 		CLIENT_XPART(client) == NULL,
@@ -409,6 +527,7 @@ static void onbegin(client_t client, int argc, xid_t *argv) {
 	l2_list_link(&active_transactions, &t->elem);
 
 	t->xid = next_gxid;
+	t->added_at = snapshot_note_added(t->xid);
 	CHECK(
 		use_xid(next_gxid),
 		client,
@@ -417,7 +536,7 @@ static void onbegin(client_t client, int argc, xid_t *argv) {
 	prev_gxid = t->xid;
 	t->snapshots_count = 0;
 
-	if (argc == 2) {
+	if ((argc >= 2) && (argv[1] > 0)) {
 		t->size = argv[1];
 		t->fixed_size = true;
 	} else {
@@ -454,9 +573,13 @@ static void onbegin(client_t client, int argc, xid_t *argv) {
 		client_message_append(client, sizeof(xid_t), &ok);
 		client_message_append(client, sizeof(xid_t), &t->xid);
 		client_message_append(client, sizeof(xid_t), &global_xmin);
-		client_message_append(client, sizeof(xid_t), &snap->xmin);
-		client_message_append(client, sizeof(xid_t), &snap->xmax);
-		client_message_append(client, sizeof(xid_t) * snap->nactive, snap->active);
+		if (versioned) {
+			append_versioned_snapshot(client, snap, argv[2], argv[3]);
+		} else {
+			client_message_append(client, sizeof(xid_t), &snap->xmin);
+			client_message_append(client, sizeof(xid_t), &snap->xmax);
+			client_message_append(client, sizeof(xid_t) * snap->nactive, snap->active);
+		}
 	} client_message_finish(client);
 }
 
@@ -465,6 +588,16 @@ static bool queue_for_transaction_finish(client_t client, xid_t xid, char cmd) {
 
 	debug("[%d] QUEUE for xid=%u status\n", CLIENT_ID(client), xid);
 
+	if (CLIENT_XWAIT(client) != NULL) {
+		shout(
+			"[%d] QUEUE: already waiting for xid=%u,"
+			" only one waiting request may be in flight\n",
+			CLIENT_ID(client), CLIENT_XWAIT(client)->xid
+		);
+		client_message_shortcut(client, RES_FAILED);
+		return false;
+	}
+
 	Transaction *t = find_transaction(xid);
 	if (t == NULL) {
 		shout(
@@ -482,6 +615,7 @@ static bool queue_for_transaction_finish(client_t client, xid_t xid, char cmd) {
 	 */
 
 	CLIENT_XWAIT(client) = t;
+	CLIENT_XWAIT_TAG(client) = client_get_tag(client);
 	transaction_push_listener(t, cmd, client);
 	return true;
 }
@@ -524,29 +658,36 @@ static void onvote(client_t client, int argc, xid_t *argv, int vote) {
 	switch (s) {
 		case NEGATIVE:
 		case POSITIVE:
-			if (use_raft) {
-				CHECK(
-					queue_for_transaction_finish(client, xid, 's'),
+			/*
+			 * A waiting voter gets notified once the status is synced. The
+			 * others don't care for the reply, so don't keep them listening:
+			 * each client may only wait for one transaction at a time.
+			 */
+			if (wait) {
+				if (!queue_for_transaction_finish(client, xid, 's')) {
+					/* the failure has been replied already */
+					shout(
+						"[%d] VOTE: couldn't queue for transaction finish\n",
+						CLIENT_ID(client)
+					);
+				}
+			} else {
+				client_message_shortcut(
 					client,
-					"VOTE: couldn't queue for transaction finish"
+					s == POSITIVE ? RES_TRANSACTION_COMMITTED : RES_TRANSACTION_ABORTED
 				);
-				raft_emit(&raft, s, t->xid);
-			} else {
-				apply_clog_update(s, t->xid);
-				if (s == POSITIVE) {
-					client_message_shortcut(client, RES_TRANSACTION_COMMITTED);
-				} else {
-					client_message_shortcut(client, RES_TRANSACTION_ABORTED);
-				}
 			}
+			emit_clog_update(s, t->xid);
 			return;
 		case DOUBT:
 			if (wait) {
-				CHECK(
-					queue_for_transaction_finish(client, xid, 's'),
-					client,
-					"VOTE: couldn't queue for transaction finish"
-				);
+				if (!queue_for_transaction_finish(client, xid, 's')) {
+					/* the failure has been replied already */
+					shout(
+						"[%d] VOTE: couldn't queue for transaction finish\n",
+						CLIENT_ID(client)
+					);
+				}
 			} else {
 				client_message_shortcut(client, RES_TRANSACTION_INPROGRESS);
 			}
@@ -559,12 +700,14 @@ static void onvote(client_t client, int argc, xid_t *argv, int vote) {
 
 static void onsnapshot(client_t client, int argc, xid_t *argv) {
 	Snapshot snapshot_now;
+	bool versioned;
 
 	CHECK(
-		argc == 2,
+		(argc == 2) || (argc == 4),
 		client,
 		"SNAPSHOT: wrong number of arguments"
 	);
+	versioned = (argc == 4);
 
 	xid_t xid = argv[1];
 	Snapshot *snap;
@@ -606,9 +749,13 @@ static void onsnapshot(client_t client, int argc, xid_t *argv) {
 	client_message_start(client); {
 		client_message_append(client, sizeof(xid_t), &ok);
 		client_message_append(client, sizeof(xid_t), &global_xmin);
-		client_message_append(client, sizeof(xid_t), &snap->xmin);
-		client_message_append(client, sizeof(xid_t), &snap->xmax);
-		client_message_append(client, sizeof(xid_t) * snap->nactive, snap->active);
+		if (versioned) {
+			append_versioned_snapshot(client, snap, argv[2], argv[3]);
+		} else {
+			client_message_append(client, sizeof(xid_t), &snap->xmin);
+			client_message_append(client, sizeof(xid_t), &snap->xmax);
+			client_message_append(client, sizeof(xid_t) * snap->nactive, snap->active);
+		}
 	} client_message_finish(client);
 }
 
@@ -638,12 +785,11 @@ static void onstatus(client_t client, int argc, xid_t *argv) {
 		case DOUBT:
 			if (wait) {
 				if (!queue_for_transaction_finish(client, xid, 's')) {
+					/* the failure has been replied already */
 					shout(
 						"[%d] STATUS: couldn't queue for transaction finish\n",
 						CLIENT_ID(client)
 					);
-					client_message_shortcut(client, RES_FAILED);
-					return;
 				}
 				return;
 			} else {
@@ -926,6 +1072,9 @@ int main(int argc, char **argv) {
 	next_gxid = MIN_XID;
 	clg = clog_open(datadir);
 
+	/* a fresh epoch, so that clients never apply deltas from another run */
+	snapshot_history_init((xid_t)time(NULL) ^ (xid_t)getpid());
+
 	xid_t last_used_xid = clog_find_last_used(clg);
 	shout("will use %u\n", last_used_xid);
 	if (!use_xid(last_used_xid)) {
@@ -989,7 +1138,12 @@ int main(int argc, char **argv) {
 		}
 
 		if (use_raft) {
-			int applied = raft_apply(&raft, apply_clog_update);
+			int applied;
+
+			/* All the votes of this tick go as a single group. */
+			replicate_emitted_updates();
+
+			applied = raft_apply(&raft, apply_clog_update);
 			if (applied) {
 				debug("applied %d updates\n", applied);
 			}
@@ -1017,6 +1171,10 @@ int main(int argc, char **argv) {
 		} else {
 			server_set_enabled(server, true);
 		}
+
+		/* Make the statuses durable before replying to anybody. */
+		sync_applied_updates();
+		server_flush(server);
 	}
 
 	clog_close(clg);
@@ -84,12 +84,13 @@ void raft_init(raft_t *r) {
 int raft_apply(raft_t *r, raft_applier_t applier) {
 	int applied_now = 0;
 	while (r->log.acked > r->log.applied) {
-		applier(
-			RAFT_LOG(r, r->log.applied).action,
-			RAFT_LOG(r, r->log.applied).argument
-		);
+		raft_entry_t *e = &RAFT_LOG(r, r->log.applied);
+		int i;
+		for (i = 0; i < e->nupdates; i++) {
+			applier(e->updates[i].action, e->updates[i].argument);
+			applied_now++;
+		}
 		r->log.applied++;
-		applied_now++;
 	}
 	return applied_now;
 }
@@ -318,8 +319,11 @@ static int raft_log_compact(raft_log_t *l, int keep_applied) {
 			snap.minarg = min(snap.minarg, e->minarg);
 			snap.maxarg = max(snap.maxarg, e->maxarg);
 		} else {
-			snap.minarg = min(snap.minarg, e->argument);
-			snap.maxarg = max(snap.maxarg, e->argument);
+			int j;
+			for (j = 0; j < e->nupdates; j++) {
+				snap.minarg = min(snap.minarg, e->updates[j].argument);
+				snap.maxarg = max(snap.maxarg, e->updates[j].argument);
+			}
 		}
 		compacted++;
 	}
@@ -333,8 +337,18 @@ static int raft_log_compact(raft_log_t *l, int keep_applied) {
 }
 
 bool raft_emit(raft_t *r, int action, int argument) {
+	raft_update_t update;
+	update.action = action;
+	update.argument = argument;
+	return raft_emit_batch(r, 1, &update);
+}
+
+// Emit several updates as a single log entry, so that they get replicated
+// and acknowledged together.
+bool raft_emit_batch(raft_t *r, int nupdates, raft_update_t *updates) {
 	assert(r->leader == r->me);
 	assert(r->role == ROLE_LEADER);
+	assert((nupdates > 0) && (nupdates <= RAFT_MAX_UPDATES));
 
 	if (r->log.size == RAFT_LOGLEN) {
 		int compacted = raft_log_compact(&r->log, RAFT_KEEP_APPLIED);
@@ -352,8 +366,8 @@ bool raft_emit(raft_t *r, int action, int argument) {
 	raft_entry_t *e = &RAFT_LOG(r, r->log.first + r->log.size);
 	e->snapshot = false;
 	e->term = r->term;
-	e->action = action;
-	e->argument = argument;
+	e->nupdates = nupdates;
+	memcpy(e->updates, updates, nupdates * sizeof(raft_update_t));
 	r->log.size++;
 
 	raft_beat(r, NOBODY);
@@ -367,9 +381,9 @@ static bool log_append(raft_log_t *l, int previndex, int prevterm, raft_entry_t
 	}
 	debug(
 		"log_append(%p, previndex=%d, prevterm=%d,"
-		" term=%d, action=%d, argument=%d)\n",
+		" term=%d, nupdates=%d)\n",
 		l, previndex, prevterm,
-		e->term, e->action, e->argument
+		e->term, e->nupdates
 	);
 	if (previndex != -1) {
 		if (previndex < l->first) {
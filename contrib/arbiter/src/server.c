@@ -34,6 +34,7 @@ typedef struct client_data_t {
 	stream_t stream; /* NULL: client value is empty */
 	void *userdata;
 	unsigned int chan;
+	unsigned int tag; /* the tag of the request being answered */
 } client_data_t;
 
 typedef struct stream_data_t {
@@ -231,7 +232,7 @@ static bool stream_flush(stream_t stream) {
 	return true;
 }
 
-static void server_flush(server_t server) {
+void server_flush(server_t server) {
 	stream_t s;
 	debug("flushing the streams\n");
 	for (s = server->used_chain; s != NULL; s = s->next) { 
@@ -299,7 +300,7 @@ static void server_close_bad_streams(server_t server) {
 	}
 }
 
-static bool stream_message_start(stream_t stream, unsigned int chan) {
+static bool stream_message_start(stream_t stream, unsigned int chan, unsigned int tag) {
 	ShubMessageHdr *msg;
 
 	if (!stream->good) {
@@ -322,7 +323,7 @@ static bool stream_message_start(stream_t stream, unsigned int chan) {
 
 	msg = stream->output.curmessage = (ShubMessageHdr*)(stream->output.data + stream->output.ready);
 	msg->size = 0;
-	msg->code = 'r';
+	msg->code = tag;
 	msg->chan = chan;
 
 	return true;
@@ -378,7 +379,7 @@ static bool stream_message_finish(stream_t stream) {
 }
 
 bool client_message_start(client_t client) {
-	return stream_message_start(client->stream, client->chan);
+	return stream_message_start(client->stream, client->chan, client->tag);
 }
 
 bool client_message_append(client_t client, size_t len, void *data) {
@@ -390,7 +391,7 @@ bool client_message_finish(client_t client) {
 }
 
 bool client_message_shortcut(client_t client, xid_t arg) {
-	if (!stream_message_start(client->stream, client->chan)) {
+	if (!stream_message_start(client->stream, client->chan, client->tag)) {
 		return false;
 	}
 	if (!stream_message_append(client->stream, sizeof(arg), &arg)) {
@@ -402,6 +403,14 @@ bool client_message_shortcut(client_t client, xid_t arg) {
 	return true;
 }
 
+unsigned int client_get_tag(client_t client) {
+	return client->tag;
+}
+
+void client_set_tag(client_t client, unsigned int tag) {
+	client->tag = tag;
+}
+
 bool client_redirect(client_t client, unsigned addr, int port) {
 	assert(false); // FIXME: implement
 	return true;
@@ -510,6 +519,7 @@ static bool server_stream_handle(server_t server, stream_t stream) {
 				}
 				client->stream = NULL;
 			} else {
+				client->tag = msg->code;
 				server->onmessage(client, msg->size, (char*)msg + sizeof(ShubMessageHdr));
 			}
 			cursor += header_and_data;
@@ -593,7 +603,6 @@ bool server_tick(server_t server, int timeout_ms) {
 #endif
 
 	server_close_bad_streams(server);
-	server_flush(server);
 
 	return raft_ready;
 }
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+#define STEPS 3000
+#define MAXACTIVE 64
+
+// the active sets at each version, sorted
+static xid_t sets[STEPS + 1][MAXACTIVE];
+static int setsizes[STEPS + 1];
+
+static int compare_xid(void const* x, void const* y) {
+	xid_t xid1 = *(xid_t*)x;
+	xid_t xid2 = *(xid_t*)y;
+	return xid1 < xid2 ? -1 : xid1 == xid2 ? 0 : 1;
+}
+
+// Apply the delta to the set of version 'from' and compare with 'to'.
+bool check_delta(xid_t from, xid_t to) {
+	xid_t added[MAXACTIVE * 2], removed[MAXACTIVE * 2];
+	xid_t result[MAXACTIVE * 2];
+	int nadded, nremoved, n, i, j;
+
+	if (!snapshot_delta(from, to, MAXACTIVE * 2, added, &nadded, removed, &nremoved)) {
+		printf("delta %u -> %u not available (FAILED)\n", from, to);
+		return false;
+	}
+
+	n = 0;
+	for (i = 0; i < setsizes[from - 1]; i++) {
+		bool gone = false;
+		for (j = 0; j < nremoved; j++) {
+			gone |= removed[j] == sets[from - 1][i];
+		}
+		if (!gone) result[n++] = sets[from - 1][i];
+	}
+	for (i = 0; i < nadded; i++) {
+		result[n++] = added[i];
+	}
+	qsort(result, n, sizeof(xid_t), compare_xid);
+
+	if ((n != setsizes[to - 1]) || memcmp(result, sets[to - 1], n * sizeof(xid_t))) {
+		printf("delta %u -> %u gives a wrong set (FAILED)\n", from, to);
+		return false;
+	}
+	return true;
+}
+
+int main() {
+	bool ok = true;
+	xid_t active[MAXACTIVE], added_at[MAXACTIVE];
+	int nactive = 0;
+	xid_t next = 100;
+	int step, i;
+
+	snapshot_history_init(1);
+	srand(42);
+
+	// version 1 is the empty set
+	setsizes[0] = 0;
+	for (step = 1; step <= STEPS; step++) {
+		if ((nactive < MAXACTIVE) && ((nactive == 0) || (rand() % 2))) {
+			active[nactive] = next++;
+			added_at[nactive] = snapshot_note_added(active[nactive]);
+			nactive++;
+		} else {
+			int victim = rand() % nactive;
+			snapshot_note_removed(active[victim], added_at[victim]);
+			active[victim] = active[nactive - 1];
+			added_at[victim] = added_at[nactive - 1];
+			nactive--;
+		}
+		memcpy(sets[step], active, nactive * sizeof(xid_t));
+		qsort(sets[step], nactive, sizeof(xid_t), compare_xid);
+		setsizes[step] = nactive;
+	}
+
+	if (snapshot_version() != STEPS + 1) {
+		printf("version %u, expected %u (FAILED)\n", snapshot_version(), STEPS + 1);
+		ok = false;
+	}
+
+	// forward, backward and empty deltas within the history
+	for (i = 0; i < 1000; i++) {
+		xid_t from = rand() % STEPS + 1;
+		xid_t to = rand() % STEPS + 1;
+		ok &= check_delta(from, to);
+	}
+
+	// unknown versions must not produce deltas
+	{
+		xid_t added[1], removed[1];
+		int nadded, nremoved;
+		if (snapshot_delta(0, 10, 1000, added, &nadded, removed, &nremoved)) {
+			printf("delta from version 0 (FAILED)\n");
+			ok = false;
+		}
+		if (snapshot_delta(10, STEPS + 2, 1000, added, &nadded, removed, &nremoved)) {
+			printf("delta to a future version (FAILED)\n");
+			ok = false;
+		}
+	}
+
+	if (ok) {
+		printf("snapshot-test passed\n");
+		return EXIT_SUCCESS;
+	} else {
+		printf("snapshot-test FAILED\n");
+		return EXIT_FAILURE;
+	}
+}
@@ -14,3 +14,116 @@ static int compare_xid(void const* x, void const* y) {
 void snapshot_sort(Snapshot *s) {
 	qsort(s->active, s->nactive, sizeof(xid_t), compare_xid);
 }
+
+typedef struct active_set_change_t {
+	xid_t xid;
+	bool added; // 'xid' became active if true, stopped being active otherwise
+
+	// For an addition: the version of the corresponding removal, or 0 if
+	// the xid is still active. For a removal: the version of the addition.
+	xid_t paired;
+} active_set_change_t;
+
+static active_set_change_t history[SNAPSHOT_HISTORY_SIZE];
+static xid_t history_epoch = 0;
+static xid_t history_version = 1; // 0 is reserved for 'no version'
+
+#define HISTORY_CHANGE(VERSION) (history + ((VERSION) % SNAPSHOT_HISTORY_SIZE))
+
+// Check if the change with the given version is still in the history.
+static bool history_has(xid_t version) {
+	return (version > 0)
+		&& (version < history_version)
+		&& (history_version - version <= SNAPSHOT_HISTORY_SIZE);
+}
+
+void snapshot_history_init(xid_t epoch) {
+	history_epoch = epoch;
+	history_version = 1;
+}
+
+xid_t snapshot_epoch(void) {
+	return history_epoch;
+}
+
+xid_t snapshot_version(void) {
+	return history_version;
+}
+
+xid_t snapshot_note_added(xid_t xid) {
+	active_set_change_t *c = HISTORY_CHANGE(history_version);
+	c->xid = xid;
+	c->added = true;
+	c->paired = 0;
+	return history_version++;
+}
+
+void snapshot_note_removed(xid_t xid, xid_t added_at) {
+	active_set_change_t *c;
+
+	if (history_has(added_at)) {
+		HISTORY_CHANGE(added_at)->paired = history_version;
+	}
+
+	c = HISTORY_CHANGE(history_version);
+	c->xid = xid;
+	c->added = false;
+	c->paired = added_at;
+	history_version++;
+}
+
+bool snapshot_delta(
+	xid_t from, xid_t to, int limit,
+	xid_t *added, int *nadded,
+	xid_t *removed, int *nremoved
+) {
+	xid_t lo = (from < to) ? from : to;
+	xid_t hi = (from < to) ? to : from;
+	xid_t v;
+
+	*nadded = 0;
+	*nremoved = 0;
+
+	if ((lo == 0) || (hi > history_version)) {
+		return false;
+	}
+	if ((lo < hi) && !history_has(lo)) {
+		return false;
+	}
+
+	for (v = lo; v < hi; v++) {
+		active_set_change_t *c = HISTORY_CHANGE(v);
+		bool add;
+
+		if (from < to) {
+			// moving forward: report the changes which survive until 'to'
+			if (c->added) {
+				if ((c->paired != 0) && (c->paired < to)) continue;
+				add = true;
+			} else {
+				if (c->paired >= from) continue;
+				add = false;
+			}
+		} else {
+			// moving backward: undo the changes visible at 'from'
+			if (c->added) {
+				if ((c->paired != 0) && (c->paired < from)) continue;
+				add = false;
+			} else {
+				if (c->paired >= to) continue;
+				add = true;
+			}
+		}
+
+		if (*nadded + *nremoved >= limit) {
+			return false;
+		}
+		if (add) {
+			added[(*nadded)++] = c->xid;
+		} else {
+			removed[(*nremoved)++] = c->xid;
+		}
+	}
+
+	return true;
+}
@@ -38,6 +38,7 @@ void transaction_clear(Transaction *t) {
 
 	t->xid = INVALID_XID;
 	t->xmin = INVALID_XID;
+	t->added_at = 0;
 	t->size = 0;
 	t->fixed_size = false;
 	t->votes_for = 0;
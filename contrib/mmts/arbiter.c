@@ -35,6 +35,7 @@
 #include "access/subtrans.h"
 #include "access/commit_ts.h"
 #include "access/xlog.h"
+#include "access/hash.h"
 #include "storage/proc.h"
 #include "storage/procarray.h"
 #include "executor/executor.h"
@@ -86,11 +87,44 @@ static TimeoutId   heartbeat_timer;
 static nodemask_t  busy_mask;
 static timestamp_t last_heartbeat_to_node[MAX_NODES];
 
+/*
+ * State of compact arbiter protocol (version 2) for one direction of connection with a node.
+ * Each message is encoded as one byte length followed by code, flags and fields:
+ * xids and CSNs are sent as zigzag varint deltas from the previous message,
+ * masks and oldest snapshot are sent only when they are changed and
+ * GIDs are replaced with reference to the slot of per-connection dictionary.
+ * New GIDs are sent as length of common prefix with previous GID and remaining suffix.
+ */
+typedef struct
+{
+	int            protocol;  /* Negotiated protocol version */
+	bool           newConnection; /* Connection was reestablished: data received from the old one should be discarded */
+	TransactionId  dxid;
+	TransactionId  sxid;
+	csn_t          csn;
+	csn_t          oldestSnapshot;
+	nodemask_t     disabledNodeMask;
+	nodemask_t     connectivityMask;
+	pgid_t         lastGid;
+	pgid_t         gids[MULTIMASTER_ARBITER_GID_DICT_SIZE];
+} MtmArbiterCodec;
+
+#define MTM_CODEC_MASKS    0x01 /* disabled and connectivity masks are present */
+#define MTM_CODEC_SNAPSHOT 0x02 /* oldest snapshot is present */
+#define MTM_CODEC_GID_NEW  0x04 /* new GID follows: dictionary slot, common prefix length and suffix */
+#define MTM_CODEC_GID_REF  0x08 /* reference to GID in dictionary */
+
+#define MTM_MAX_ENCODED_MESSAGE_SIZE 128
+
+static MtmArbiterCodec* codecs;
+static MtmBuffer        encodeBuffer;
+
 static void MtmSender(Datum arg);
 static void MtmReceiver(Datum arg);
 static void MtmMonitor(Datum arg);
 static void MtmSendHeartbeat(void);
 static bool MtmSendToNode(int node, void const* buf, int size, time_t reconnectTimeout);
+static bool MtmWriteToNode(int node, void const* buf, int size);
 
 char const* const MtmMessageKindMnem[] = 
 {
@@ -103,7 +137,9 @@ char const* const MtmMessageKindMnem[] =
 	"STATUS",
 	"HEARTBEAT",
 	"POLL_REQUEST",
-	"POLL_STATUS"
+	"POLL_STATUS",
+	"VOTES",
+	"GRAPH_RESYNC"
 };
 
 static BackgroundWorker MtmSenderWorker = {
@@ -318,6 +354,34 @@ static void MtmSetSocketOptions(int sd)
 #endif
 }
 
+/*
+ * Arbiter protocol version is passed in gid field of handshake request and response.
+ * Old nodes do not set it, so absence of the tag means raw protocol (version 1).
+ */
+static void MtmSetProtocolVersion(MtmArbiterMessage* msg, int protocol)
+{
+	snprintf(msg->gid, sizeof(msg->gid), "%s%d", MULTIMASTER_ARBITER_PROTO_TAG, protocol);
+}
+
+static int MtmGetProtocolVersion(MtmArbiterMessage* msg)
+{
+	size_t tagLen = strlen(MULTIMASTER_ARBITER_PROTO_TAG);
+	if (strncmp(msg->gid, MULTIMASTER_ARBITER_PROTO_TAG, tagLen) == 0) { 
+		int protocol = atoi(msg->gid + tagLen);
+		if (protocol >= 1) { 
+			return protocol;
+		}
+	}
+	return 1;
+}
+
+static void MtmResetCodec(MtmArbiterCodec* codec, int protocol)
+{
+	memset(codec, 0, sizeof(MtmArbiterCodec));
+	codec->protocol = protocol;
+	codec->newConnection = true;
+}
+
 static void MtmCheckResponse(MtmArbiterMessage* resp)
 {
 	if (BIT_CHECK(resp->disabledNodeMask, MtmNodeId-1) 
@@ -359,6 +423,10 @@ static void MtmSendHeartbeat()
 	msg.oldestSnapshot = Mtm->nodes[MtmNodeId-1].oldestSnapshot;
 	msg.node = MtmNodeId;
 	msg.csn = now;
+	msg.dxid = 0;
+	msg.sxid = 0;
+	msg.status = 0;
+	msg.gid[0] = '\0';
 	if (last_sent_heartbeat != 0 && last_sent_heartbeat + MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2 < now) { 
 		MTM_LOG1("More than %lld microseconds since last heartbeat", now - last_sent_heartbeat);
 	}
@@ -376,6 +444,17 @@ static void MtmSendHeartbeat()
 				if (!MtmSendToNode(i, &msg, sizeof(msg), MtmHeartbeatSendTimeout)) { 
 					elog(LOG, "Arbiter failed to send heartbeat to node %d", i+1);
 				} else {
+					if (BIT_CHECK(Mtm->lockGraphResyncMask, i)) { 
+						/* 
+						 * Ask node to publish its full lock graph as we have lost some delta of it.
+						 * Nodes using protocol 1 do not know this message, but they never send deltas either.
+						 */
+						MtmArbiterMessage resync = msg;
+						resync.code = MSG_GRAPH_RESYNC;
+						if (codecs[i].protocol < 2 || MtmSendToNode(i, &resync, sizeof(resync), MtmHeartbeatSendTimeout)) { 
+							BIT_CLEAR(Mtm->lockGraphResyncMask, i);
+						}
+					}
 					if (last_heartbeat_to_node[i] + MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2 < now) { 
 						MTM_LOG1("Last heartbeat to node %d was sent %lld microseconds ago", i+1, now - last_heartbeat_to_node[i]);
 					}
@@ -501,6 +580,7 @@ static int MtmConnectSocket(int node, int port, time_t timeout)
 	req.hdr.csn  = MtmGetCurrentTime();
 	req.hdr.disabledNodeMask = Mtm->disabledNodeMask;
 	req.hdr.connectivityMask = SELF_CONNECTIVITY_MASK;
+	MtmSetProtocolVersion(&req.hdr, MULTIMASTER_ARBITER_PROTO_VERSION);
 	strcpy(req.connStr, Mtm->nodes[MtmNodeId-1].con.connStr);
 	if (!MtmWriteSocket(sd, &req, sizeof req)) { 
 		elog(WARNING, "Arbiter failed to send handshake message to %s:%d: %d", host, port, errno);
@@ -522,6 +602,9 @@ static int MtmConnectSocket(int node, int port, time_t timeout)
 	MtmCheckResponse(&resp);
 	MtmUnlock();
 
+	MtmResetCodec(&codecs[node], Min(MtmGetProtocolVersion(&resp), MULTIMASTER_ARBITER_PROTO_VERSION));
+	MTM_LOG1("Arbiter is using protocol version %d for connection to node %d", codecs[node].protocol, node+1);
+
 	MtmOnNodeConnect(node+1);
 
 	busy_mask = save_mask;
@@ -536,6 +619,7 @@ static void MtmOpenConnections()
 	int i;
 
 	sockets = (int*)palloc(sizeof(int)*nNodes);
+	codecs = (MtmArbiterCodec*)palloc0(sizeof(MtmArbiterCodec)*nNodes);
 
 	for (i = 0; i < nNodes; i++) {
 		sockets[i] = -1;
@@ -578,7 +662,7 @@ static bool MtmSendToNode(int node, void const* buf, int size, time_t reconnectT
 			BIT_CLEAR(Mtm->reconnectMask, node);
 			MtmUnlock();
 		}
-		if (sockets[node] < 0 || !MtmWriteSocket(sockets[node], buf, size)) {
+		if (sockets[node] < 0 || !MtmWriteToNode(node, buf, size)) {
 			if (sockets[node] >= 0) { 
 				elog(WARNING, "Arbiter fail to write to node %d: %d", node+1, errno);
 				close(sockets[node]);
@@ -630,6 +714,7 @@ static void MtmAcceptOneConnection()
 			close(fd);
 		} else { 
 			int node = req.hdr.node-1;
+			int protocol = Min(MtmGetProtocolVersion(&req.hdr), MULTIMASTER_ARBITER_PROTO_VERSION);
 			Assert(node >= 0 && node < Mtm->nAllNodes && node+1 != MtmNodeId);
 
 			MtmLock(LW_EXCLUSIVE);
@@ -643,6 +728,7 @@ static void MtmAcceptOneConnection()
 			resp.sxid = ShmemVariableCache->nextXid;
 			resp.csn  = MtmGetCurrentTime();
 			resp.node = MtmNodeId;
+			MtmSetProtocolVersion(&resp, protocol);
 			MtmUpdateNodeConnectionInfo(&Mtm->nodes[node].con, req.connStr);
 			if (!MtmWriteSocket(fd, &resp, sizeof resp)) { 
 				elog(WARNING, "Arbiter failed to write response for handshake message to node %d", node+1);
@@ -653,6 +739,8 @@ static void MtmAcceptOneConnection()
 					MtmUnregisterSocket(sockets[node]);
 				}
 				sockets[node] = fd;
+				MtmResetCodec(&codecs[node], protocol);
+				MTM_LOG1("Arbiter is using protocol version %d for connection from node %d", protocol, node+1);
 				MtmRegisterSocket(fd, node);
 				MtmOnNodeConnect(node+1);
 			}
@@ -669,6 +757,7 @@ static void MtmAcceptIncomingConnections()
 	int nNodes = MtmMaxNodes;
 
 	sockets = (int*)palloc(sizeof(int)*nNodes);
+	codecs = (MtmArbiterCodec*)palloc0(sizeof(MtmArbiterCodec)*nNodes);
 	for (i = 0; i < nNodes; i++) { 
 		sockets[i] = -1;
 	}
@@ -694,20 +783,322 @@ static void MtmAcceptIncomingConnections()
 }
 
 
-static void MtmAppendBuffer(MtmBuffer* txBuffer, MtmArbiterMessage* msg)
+static void MtmAppendBuffer(MtmBuffer* buf, void const* data, int size)
 {
-	MtmBuffer* buf = &txBuffer[msg->node-1];
-	if (buf->used == buf->size) {
+	while (buf->used + size > buf->size) {
 		if (buf->size == 0) { 
-			buf->size = INIT_BUFFER_SIZE;
-			buf->data = palloc(buf->size * sizeof(MtmArbiterMessage));
+			buf->size = INIT_BUFFER_SIZE*sizeof(MtmArbiterMessage);
+			buf->data = palloc(buf->size);
 		} else { 
 			buf->size *= 2;
-			buf->data = repalloc(buf->data, buf->size * sizeof(MtmArbiterMessage));
+			buf->data = repalloc(buf->data, buf->size);
+		}
+	}
+	memcpy(buf->data + buf->used, data, size);
+	buf->used += size;
+}
+
+static void MtmGetVote(MtmArbiterMessage* hdr, MtmArbiterVote* vote, MtmArbiterMessage* msg)
+{
+	*msg = *hdr;
+	msg->code = vote->code;
+	msg->dxid = vote->dxid;
+	msg->sxid = vote->sxid;
+	msg->csn = vote->csn;
+}
+
+static uint8* MtmEncodeVarint(uint8* dst, uint64 val)
+{
+	while (val >= 0x80) { 
+		*dst++ = (uint8)(val | 0x80);
+		val >>= 7;
+	}
+	*dst++ = (uint8)val;
+	return dst;
+}
+
+static uint8 const* MtmDecodeVarint(uint8 const* src, uint8 const* end, uint64* val)
+{
+	uint64 result = 0;
+	int shift = 0;
+	while (src < end && shift < 64) { 
+		uint8 b = *src++;
+		result |= (uint64)(b & 0x7F) << shift;
+		if (!(b & 0x80)) { 
+			*val = result;
+			return src;
 		}
+		shift += 7;
 	}
-	msg->node = MtmNodeId;
-	buf->data[buf->used++] = *msg;
+	return NULL;
+}
+
+#define MTM_ZIGZAG(diff)   (((uint64)(diff) << 1) ^ (uint64)((int64)(diff) >> 63))
+#define MTM_UNZIGZAG(val)  ((int64)((val) >> 1) ^ -(int64)((val) & 1))
+
+static void MtmEncodeMessage(MtmArbiterCodec* codec, MtmBuffer* out, MtmArbiterMessage* msg)
+{
+	uint8  frame[MTM_MAX_ENCODED_MESSAGE_SIZE];
+	uint8* dst = frame + 3; /* skip length, code and flags */
+	uint8  flags = 0;
+
+	if (msg->code != MSG_HEARTBEAT) { 
+		/* heartbeats carry only masks, oldest snapshot and timestamp */
+		dst = MtmEncodeVarint(dst, MTM_ZIGZAG((int32)(msg->dxid - codec->dxid)));
+		dst = MtmEncodeVarint(dst, MTM_ZIGZAG((int32)(msg->sxid - codec->sxid)));
+		dst = MtmEncodeVarint(dst, (uint64)msg->status);
+		codec->dxid = msg->dxid;
+		codec->sxid = msg->sxid;
+	}
+	dst = MtmEncodeVarint(dst, MTM_ZIGZAG((int64)(msg->csn - codec->csn)));
+	codec->csn = msg->csn;
+
+	if (msg->oldestSnapshot != codec->oldestSnapshot) { 
+		flags |= MTM_CODEC_SNAPSHOT;
+		dst = MtmEncodeVarint(dst, MTM_ZIGZAG((int64)(msg->oldestSnapshot - codec->oldestSnapshot)));
+		codec->oldestSnapshot = msg->oldestSnapshot;
+	}
+	if (msg->disabledNodeMask != codec->disabledNodeMask || msg->connectivityMask != codec->connectivityMask) { 
+		flags |= MTM_CODEC_MASKS;
+		dst = MtmEncodeVarint(dst, msg->disabledNodeMask);
+		dst = MtmEncodeVarint(dst, msg->connectivityMask);
+		codec->disabledNodeMask = msg->disabledNodeMask;
+		codec->connectivityMask = msg->connectivityMask;
+	}
+	if (msg->code != MSG_HEARTBEAT && msg->gid[0] != '\0') { 
+		int gidLen = strnlen(msg->gid, MULTIMASTER_MAX_GID_SIZE-1);
+		uint32 slot = hash_any((unsigned char*)msg->gid, gidLen) % MULTIMASTER_ARBITER_GID_DICT_SIZE;
+		if (strncmp(codec->gids[slot], msg->gid, MULTIMASTER_MAX_GID_SIZE) == 0) { 
+			flags |= MTM_CODEC_GID_REF;
+			dst = MtmEncodeVarint(dst, slot);
+		} else { 
+			int prefixLen = 0;
+			while (prefixLen < gidLen && codec->lastGid[prefixLen] == msg->gid[prefixLen]) { 
+				prefixLen += 1;
+			}
+			flags |= MTM_CODEC_GID_NEW;
+			dst = MtmEncodeVarint(dst, slot);
+			*dst++ = (uint8)prefixLen;
+			*dst++ = (uint8)(gidLen - prefixLen);
+			memcpy(dst, msg->gid + prefixLen, gidLen - prefixLen);
+			dst += gidLen - prefixLen;
+			memcpy(codec->gids[slot], msg->gid, gidLen);
+			codec->gids[slot][gidLen] = '\0';
+		}
+		memcpy(codec->lastGid, msg->gid, gidLen);
+		codec->lastGid[gidLen] = '\0';
+	}
+	Assert(dst - frame <= MTM_MAX_ENCODED_MESSAGE_SIZE);
+	frame[0] = (uint8)(dst - frame - 1);
+	frame[1] = (uint8)msg->code;
+	frame[2] = flags;
+	MtmAppendBuffer(out, frame, dst - frame);
+}
+
+/*
+ * Decode one message from compact representation.
+ * Returns number of consumed bytes, 0 if message is not completely received yet and -1 if message is corrupted.
+ */
+static int MtmDecodeMessage(MtmArbiterCodec* codec, uint8 const* src, int size, MtmArbiterMessage* msg, int node)
+{
+	uint8 const* start = src;
+	uint8 const* end;
+	uint8 flags;
+	uint64 val;
+
+	if (size < 1 || size < 1 + src[0]) { 
+		return 0;
+	}
+	end = src + 1 + src[0];
+	src += 1;
+	if (end - src < 2) { 
+		return -1;
+	}
+	memset(msg, 0, sizeof(MtmArbiterMessage));
+	msg->node = node+1;
+	msg->code = (MtmMessageCode)*src++;
+	flags = *src++;
+
+	if (msg->code != MSG_HEARTBEAT) { 
+		if ((src = MtmDecodeVarint(src, end, &val)) == NULL) return -1;
+		codec->dxid += (TransactionId)MTM_UNZIGZAG(val);
+		if ((src = MtmDecodeVarint(src, end, &val)) == NULL) return -1;
+		codec->sxid += (TransactionId)MTM_UNZIGZAG(val);
+		if ((src = MtmDecodeVarint(src, end, &val)) == NULL) return -1;
+		msg->status = (XidStatus)val;
+		msg->dxid = codec->dxid;
+		msg->sxid = codec->sxid;
+	}
+	if ((src = MtmDecodeVarint(src, end, &val)) == NULL) return -1;
+	codec->csn += (csn_t)MTM_UNZIGZAG(val);
+	msg->csn = codec->csn;
+
+	if (flags & MTM_CODEC_SNAPSHOT) { 
+		if ((src = MtmDecodeVarint(src, end, &val)) == NULL) return -1;
+		codec->oldestSnapshot += (csn_t)MTM_UNZIGZAG(val);
+	}
+	msg->oldestSnapshot = codec->oldestSnapshot;
+
+	if (flags & MTM_CODEC_MASKS) { 
+		if ((src = MtmDecodeVarint(src, end, &val)) == NULL) return -1;
+		codec->disabledNodeMask = val;
+		if ((src = MtmDecodeVarint(src, end, &val)) == NULL) return -1;
+		codec->connectivityMask = val;
+	}
+	msg->disabledNodeMask = codec->disabledNodeMask;
+	msg->connectivityMask = codec->connectivityMask;
+
+	if (flags & (MTM_CODEC_GID_REF|MTM_CODEC_GID_NEW)) { 
+		if ((src = MtmDecodeVarint(src, end, &val)) == NULL || val >= MULTIMASTER_ARBITER_GID_DICT_SIZE) return -1;
+		if (flags & MTM_CODEC_GID_NEW) { 
+			int prefixLen, suffixLen;
+			if (end - src < 2) return -1;
+			prefixLen = src[0];
+			suffixLen = src[1];
+			src += 2;
+			if (prefixLen + suffixLen >= MULTIMASTER_MAX_GID_SIZE || end - src < suffixLen) return -1;
+			memcpy(codec->gids[val], codec->lastGid, prefixLen);
+			memcpy(codec->gids[val] + prefixLen, src, suffixLen);
+			codec->gids[val][prefixLen + suffixLen] = '\0';
+			src += suffixLen;
+		}
+		strcpy(codec->lastGid, codec->gids[val]);
+		strcpy(msg->gid, codec->gids[val]);
+	}
+	if (src != end) { 
+		return -1;
+	}
+	return (int)(end - start);
+}
+
+/*
+ * Encode buffer of raw messages (including MSG_VOTES frames) using compact protocol
+ */
+static void MtmEncodeMessages(MtmArbiterCodec* codec, MtmBuffer* out, char const* buf, int size)
+{
+	int pos = 0;
+	out->used = 0;
+	while (pos < size) { 
+		MtmArbiterMessage* msg = (MtmArbiterMessage*)(buf + pos);
+		pos += sizeof(MtmArbiterMessage);
+		if (msg->code == MSG_VOTES) { 
+			MtmArbiterVote* votes = (MtmArbiterVote*)(buf + pos);
+			int j, nVotes = msg->dxid;
+			for (j = 0; j < nVotes; j++) { 
+				MtmArbiterMessage vote;
+				MtmGetVote(msg, &votes[j], &vote);
+				MtmEncodeMessage(codec, out, &vote);
+			}
+			pos += nVotes*sizeof(MtmArbiterVote);
+		} else { 
+			MtmEncodeMessage(codec, out, msg);
+		}
+	}
+}
+
+/*
+ * Replace MSG_VOTES frames in buffer of raw messages with the votes they contain,
+ * for nodes using raw protocol (version 1) which do not know such frames.
+ * Returns false if there are no frames in the buffer, so it can be sent as is.
+ */
+static bool MtmExpandVotes(MtmBuffer* out, char const* buf, int size)
+{
+	int pos = 0;
+	bool expanded = false;
+	out->used = 0;
+	while (pos < size) { 
+		MtmArbiterMessage* msg = (MtmArbiterMessage*)(buf + pos);
+		pos += sizeof(MtmArbiterMessage);
+		if (msg->code == MSG_VOTES) { 
+			MtmArbiterVote* votes = (MtmArbiterVote*)(buf + pos);
+			int j, nVotes = msg->dxid;
+			for (j = 0; j < nVotes; j++) { 
+				MtmArbiterMessage vote;
+				MtmGetVote(msg, &votes[j], &vote);
+				MtmAppendBuffer(out, &vote, sizeof(vote));
+			}
+			pos += nVotes*sizeof(MtmArbiterVote);
+			expanded = true;
+		} else { 
+			MtmAppendBuffer(out, msg, sizeof(MtmArbiterMessage));
+		}
+	}
+	return expanded;
+}
+
+static bool MtmWriteToNode(int node, void const* buf, int size)
+{
+	if (codecs[node].protocol >= 2) { 
+		MtmEncodeMessages(&codecs[node], &encodeBuffer, buf, size);
+		return MtmWriteSocket(sockets[node], encodeBuffer.data, encodeBuffer.used);
+	}
+	/* votes may have been batched before reconnect to the node downgraded the protocol */
+	if (MtmExpandVotes(&encodeBuffer, buf, size)) { 
+		return MtmWriteSocket(sockets[node], encodeBuffer.data, encodeBuffer.used);
+	}
+	return MtmWriteSocket(sockets[node], buf, size);
+}
+
+static bool MtmIsVote(MtmArbiterMessage* msg)
+{
+	return msg->code == MSG_PREPARED || msg->code == MSG_PRECOMMITTED || msg->code == MSG_ABORTED;
+}
+
+/*
+ * Append vote to the per-node vote buffer. First vote is saved in voteHeader as is:
+ * if it is the only vote for this node, it is sent as normal message.
+ * Masks and oldest snapshot in header are refreshed by each next vote. 
+ */
+static void MtmAppendVote(MtmBuffer* voteBuffer, MtmArbiterMessage* voteHeader, MtmArbiterMessage* msg)
+{
+	int node = msg->node-1;
+	MtmArbiterVote vote;
+	if (voteBuffer[node].used == 0) { 
+		voteHeader[node] = *msg;
+		voteHeader[node].node = MtmNodeId;
+	} else { 
+		voteHeader[node].disabledNodeMask = msg->disabledNodeMask;
+		voteHeader[node].connectivityMask = msg->connectivityMask;
+		voteHeader[node].oldestSnapshot = msg->oldestSnapshot;
+	}
+	vote.csn = msg->csn;
+	vote.dxid = msg->dxid;
+	vote.sxid = msg->sxid;
+	vote.code = msg->code;
+	MtmAppendBuffer(&voteBuffer[node], &vote, sizeof(vote));
+}
+
+/*
+ * Pack votes collected for the node in one MSG_VOTES frame and append it to the transmit buffer.
+ * Nodes using raw protocol (version 1) do not understand such frames, so they get
+ * the votes as separate messages.
+ */
+static void MtmFlushVotes(MtmBuffer* txBuffer, MtmBuffer* voteBuffer, MtmArbiterMessage* voteHeader, int node)
+{
+	int nVotes = voteBuffer[node].used / sizeof(MtmArbiterVote);
+	if (nVotes == 1) { 
+		MtmAppendBuffer(&txBuffer[node], &voteHeader[node], sizeof(MtmArbiterMessage));
+	} else if (nVotes > 1 && codecs[node].protocol < 2) { 
+		MtmArbiterVote* votes = (MtmArbiterVote*)voteBuffer[node].data;
+		MtmArbiterMessage hdr = voteHeader[node];
+		int j;
+		hdr.gid[0] = '\0';
+		for (j = 0; j < nVotes; j++) { 
+			MtmArbiterMessage vote;
+			MtmGetVote(&hdr, &votes[j], &vote);
+			MtmAppendBuffer(&txBuffer[node], &vote, sizeof(vote));
+		}
+	} else if (nVotes > 1) { 
+		MtmArbiterMessage hdr = voteHeader[node];
+		hdr.code = MSG_VOTES;
+		hdr.dxid = nVotes;
+		hdr.sxid = InvalidTransactionId;
+		hdr.gid[0] = '\0';
+		MtmAppendBuffer(&txBuffer[node], &hdr, sizeof(hdr));
+		MtmAppendBuffer(&txBuffer[node], voteBuffer[node].data, voteBuffer[node].used);
+		MTM_LOG2("Send %d votes to node %d in one frame", nVotes, node+1);
+	}
+	voteBuffer[node].used = 0;
 }
 
 
@@ -718,6 +1109,8 @@ static void MtmSender(Datum arg)
 	int i;
 
 	MtmBuffer* txBuffer = (MtmBuffer*)palloc0(sizeof(MtmBuffer)*nNodes);
+	MtmBuffer* voteBuffer = (MtmBuffer*)palloc0(sizeof(MtmBuffer)*nNodes);
+	MtmArbiterMessage* voteHeader = (MtmArbiterMessage*)palloc(sizeof(MtmArbiterMessage)*nNodes);
 	elog(LOG, "Start arbiter sender %d", MyProcPid);
 	InitializeTimeouts();
 
@@ -745,6 +1138,14 @@ static void MtmSender(Datum arg)
 		CHECK_FOR_INTERRUPTS();
 
 		MtmCheckHeartbeat();
+
+		if (MtmVoteBatchDelay > 0 && Mtm->sendQueue != NULL) { 
+			/* 
+			 * Group commit window: give concurrent transactions a chance to enqueue their votes,
+			 * so that they are sent to coordinator in one frame
+			 */
+			MtmSleep(MtmVoteBatchDelay);
+		}
 		/* 
 		 * Use shared lock to improve locality,
 		 * because all other process modifying this list are using exclusive lock 
@@ -753,7 +1154,13 @@ static void MtmSender(Datum arg)
 
 		for (curr = Mtm->sendQueue; curr != NULL; curr = next) {
 			next = curr->next;
-			MtmAppendBuffer(txBuffer, &curr->msg);
+			if (MtmIsVote(&curr->msg)) { 
+				MtmAppendVote(voteBuffer, voteHeader, &curr->msg);
+			} else { 
+				int node = curr->msg.node-1;
+				curr->msg.node = MtmNodeId;
+				MtmAppendBuffer(&txBuffer[node], &curr->msg, sizeof(MtmArbiterMessage));
+			}
 			curr->next = Mtm->freeQueue;
 			Mtm->freeQueue = curr;
 		}
@@ -762,8 +1169,9 @@ static void MtmSender(Datum arg)
 		SpinLockRelease(&Mtm->queueSpinlock);
 
 		for (i = 0; i < Mtm->nAllNodes; i++) { 
+			MtmFlushVotes(txBuffer, voteBuffer, voteHeader, i);
 			if (txBuffer[i].used != 0) { 
-				MtmSendToNode(i, txBuffer[i].data, txBuffer[i].used*sizeof(MtmArbiterMessage), MtmReconnectTimeout);
+				MtmSendToNode(i, txBuffer[i].data, txBuffer[i].used, MtmReconnectTimeout);
 				txBuffer[i].used = 0;
 			}
 		}		
@@ -825,16 +1233,67 @@ static void MtmMonitor(Datum arg)
 	}
 }
 
+/*
+ * Extract all complete messages from receive buffer, decoding compact protocol
+ * and expanding MSG_VOTES frames into normal messages.
+ * Returns number of consumed bytes or -1 if received data is corrupted.
+ */
+static int MtmUnpackMessages(MtmBuffer* rxBuffer, MtmBuffer* msgBuffer, int node)
+{
+	int pos = 0;
+	msgBuffer->used = 0;
+	if (codecs[node].protocol >= 2) { 
+		while (pos < rxBuffer->used) { 
+			MtmArbiterMessage msg;
+			int rc = MtmDecodeMessage(&codecs[node], (uint8*)rxBuffer->data + pos, rxBuffer->used - pos, &msg, node);
+			if (rc <= 0) { 
+				if (rc < 0) { 
+					return -1;
+				}
+				break;
+			}
+			MtmAppendBuffer(msgBuffer, &msg, sizeof(msg));
+			pos += rc;
+		}
+		return pos;
+	}
+	while (rxBuffer->used - pos >= (int)sizeof(MtmArbiterMessage)) { 
+		MtmArbiterMessage* msg = (MtmArbiterMessage*)(rxBuffer->data + pos);
+		if (msg->code == MSG_VOTES) { 
+			MtmArbiterVote* votes = (MtmArbiterVote*)(msg + 1);
+			int nVotes = msg->dxid;
+			int frameSize = sizeof(MtmArbiterMessage) + nVotes*sizeof(MtmArbiterVote);
+			int j;
+			if (rxBuffer->used - pos < frameSize) { 
+				break;
+			}
+			for (j = 0; j < nVotes; j++) { 
+				MtmArbiterMessage vote;
+				MtmGetVote(msg, &votes[j], &vote);
+				MtmAppendBuffer(msgBuffer, &vote, sizeof(vote));
+			}
+			pos += frameSize;
+		} else { 
+			MtmAppendBuffer(msgBuffer, msg, sizeof(MtmArbiterMessage));
+			pos += sizeof(MtmArbiterMessage);
+		}
+	}
+	return pos;
+}
+
 static void MtmReceiver(Datum arg)
 {
 	sigset_t sset;
 	int nNodes = MtmMaxNodes;
 	int nResponses;
+	int nConsumed;
 	int i, j, n, rc;
 	MtmBuffer* rxBuffer = (MtmBuffer*)palloc0(sizeof(MtmBuffer)*nNodes);
+	MtmBuffer msgBuffer = {0, 0, NULL};
 	timestamp_t lastHeartbeatCheck = MtmGetSystemTime();
 	timestamp_t now;
-	timestamp_t selectTimeout = MtmHeartbeatRecvTimeout;
+	timestamp_t precommitStart;
+	timestamp_t selectTimeout = MtmGetWatchdogPeriod();
 
 #if USE_EPOLL
 	struct epoll_event* events = (struct epoll_event*)palloc(sizeof(struct epoll_event)*nNodes);
@@ -859,8 +1318,8 @@ static void MtmReceiver(Datum arg)
 	MtmAcceptIncomingConnections();
 
 	for (i = 0; i < nNodes; i++) { 
-		rxBuffer[i].size = INIT_BUFFER_SIZE;
-		rxBuffer[i].data = palloc(INIT_BUFFER_SIZE*sizeof(MtmArbiterMessage));
+		rxBuffer[i].size = INIT_BUFFER_SIZE*sizeof(MtmArbiterMessage);
+		rxBuffer[i].data = palloc(rxBuffer[i].size);
 	}
 
 	while (!stop) {
@@ -906,20 +1365,38 @@ static void MtmReceiver(Datum arg)
 					continue;
 				}  
 				
-				rc = MtmReadFromNode(i, (char*)rxBuffer[i].data + rxBuffer[i].used, rxBuffer[i].size-rxBuffer[i].used);
+				if (codecs[i].newConnection) { 
+					/* discard incomplete data received from the previous connection */
+					rxBuffer[i].used = 0;
+					codecs[i].newConnection = false;
+				}
+				if (rxBuffer[i].used == rxBuffer[i].size) { 
+					/* buffer is full but contains incomplete MSG_VOTES frame */
+					rxBuffer[i].size *= 2;
+					rxBuffer[i].data = repalloc(rxBuffer[i].data, rxBuffer[i].size);
+				}
+				rc = MtmReadFromNode(i, rxBuffer[i].data + rxBuffer[i].used, rxBuffer[i].size-rxBuffer[i].used);
 				if (rc <= 0) {
 					MTM_LOG1("Failed to read response from node %d", i+1);
 					continue;
 				}
 
 				rxBuffer[i].used += rc;
-				nResponses = rxBuffer[i].used/sizeof(MtmArbiterMessage);
+				nConsumed = MtmUnpackMessages(&rxBuffer[i], &msgBuffer, i);
+				if (nConsumed < 0) { 
+					elog(WARNING, "Arbiter receive corrupted message from node %d", i+1);
+					MtmDisconnect(i);
+					rxBuffer[i].used = 0;
+					continue;
+				}
+				nResponses = msgBuffer.used/sizeof(MtmArbiterMessage);
 
-				
+				/* Wakeup all backends which voting is completed by this batch of responses at once, after releasing the lock */
+				MtmBeginWakeUpBatch();
 				MtmLock(LW_EXCLUSIVE);						
 
 				for (j = 0; j < nResponses; j++) { 
-					MtmArbiterMessage* msg = &rxBuffer[i].data[j];
+					MtmArbiterMessage* msg = (MtmArbiterMessage*)msgBuffer.data + j;
 					MtmTransState* ts;
 					MtmTransMap* tm;
 					int node = msg->node;
@@ -940,9 +1417,13 @@ static void MtmReceiver(Datum arg)
 
 					switch (msg->code) {
 					  case MSG_HEARTBEAT:
+						MtmUpdateHeartbeatStatistics(node, Mtm->nodes[node-1].lastHeartbeat);
 						MTM_LOG4("Receive HEARTBEAT from node %d with timestamp %lld delay %lld", 
 								 node, msg->csn, USEC_TO_MSEC(MtmGetSystemTime() - msg->csn)); 
 						continue;
+					  case MSG_GRAPH_RESYNC:
+						MtmRequestFullLockGraph();
+						continue;
 					  case MSG_POLL_REQUEST:
 						Assert(*msg->gid);
 						tm = (MtmTransMap*)hash_search(MtmGid2State, msg->gid, HASH_FIND, NULL);
@@ -1020,7 +1501,7 @@ static void MtmReceiver(Datum arg)
 						elog(WARNING, "Ignore response for unexisted transaction %llu from node %d", (long64)msg->dxid, node);
 						continue;
 					}
-					Assert(msg->code == MSG_ABORTED || strcmp(msg->gid, ts->gid) == 0);
+					Assert(msg->code == MSG_ABORTED || *msg->gid == '\0' || strcmp(msg->gid, ts->gid) == 0);
 					if (BIT_CHECK(ts->votedMask, node-1)) {
 						elog(WARNING, "Receive deteriorated %s response for transaction %s (%llu) from node %d",
 							 MtmMessageKindMnem[msg->code], ts->gid, (long64)ts->xid, node);
@@ -1038,6 +1519,7 @@ static void MtmReceiver(Datum arg)
 								continue;
 							}
 							Mtm->nodes[node-1].transDelay += MtmGetCurrentTime() - ts->csn;
+							MtmLatencyAddSince(node, MTM_LATENCY_VOTE, ts->votingStart);
 							ts->xids[node-1] = msg->sxid;
 							
 							if ((~msg->disabledNodeMask & Mtm->disabledNodeMask) != 0) { 
@@ -1066,12 +1548,15 @@ static void MtmReceiver(Datum arg)
 										MTM_LOG2("SetPreparedTransactionState for %s", ts->gid);
 										MtmUnlock();
 										MtmResetTransaction();
+										precommitStart = MtmGetCurrentTime();
 										StartTransactionCommand();
 										SetPreparedTransactionState(ts->gid, MULTIMASTER_PRECOMMITTED);	
 										CommitTransactionCommand();
+										MtmLatencyAddSince(MtmNodeId, MTM_LATENCY_PRECOMMIT, precommitStart);
 										MtmLock(LW_EXCLUSIVE);						
 									} else { 
 										ts->status = TRANSACTION_STATUS_UNKNOWN;
+										MtmInDoubtListInsert(ts);
 										MtmWakeUpBackend(ts);
 									}
 								}
@@ -1107,6 +1592,7 @@ static void MtmReceiver(Datum arg)
 								if ((ts->participantsMask & ~Mtm->disabledNodeMask & ~ts->votedMask) == 0) {
 									ts->csn = MtmAssignCSN();
 									ts->status = TRANSACTION_STATUS_UNKNOWN;
+									MtmInDoubtListInsert(ts);
 									MtmWakeUpBackend(ts);
 								}
 							} else { 
@@ -1128,6 +1614,7 @@ static void MtmReceiver(Datum arg)
 							if (ts->status == TRANSACTION_STATUS_IN_PROGRESS) {
 								ts->status = TRANSACTION_STATUS_UNKNOWN;
 								ts->csn = MtmAssignCSN();
+								MtmInDoubtListInsert(ts);
 								MtmAdjustSubtransactions(ts);
 								MtmSend2PCMessage(ts, MSG_PRECOMMITTED);
 							} else if (ts->status == TRANSACTION_STATUS_ABORTED) {
@@ -1142,10 +1629,11 @@ static void MtmReceiver(Datum arg)
 					}
 				}
 				MtmUnlock();
+				MtmEndWakeUpBatch();
 				
-				rxBuffer[i].used -= nResponses*sizeof(MtmArbiterMessage);
+				rxBuffer[i].used -= nConsumed;
 				if (rxBuffer[i].used != 0) { 
-					memmove(rxBuffer[i].data, (char*)rxBuffer[i].data + nResponses*sizeof(MtmArbiterMessage), rxBuffer[i].used);
+					memmove(rxBuffer[i].data, rxBuffer[i].data + nConsumed, rxBuffer[i].used);
 				}
 			}
 		}
@@ -1155,8 +1643,8 @@ static void MtmReceiver(Datum arg)
 			 * It helps to avoid false node failure detection because of blocking receiver.
 			 */
 			if (n == 0) {
-				selectTimeout = MtmHeartbeatRecvTimeout; /* restore select timeout */ 
-				if (now > lastHeartbeatCheck + MSEC_TO_USEC(MtmHeartbeatRecvTimeout)) { 
+				selectTimeout = MtmGetWatchdogPeriod(); /* restore select timeout */ 
+				if (now > lastHeartbeatCheck + MSEC_TO_USEC(MtmGetWatchdogPeriod())) { 
 					if (!MtmWatchdog(now)) { 
 						for (i = 0; i < nNodes; i++) { 
 							if (Mtm->nodes[i].lastHeartbeat != 0 && sockets[i] >= 0) {
@@ -1167,13 +1655,13 @@ static void MtmReceiver(Datum arg)
 					lastHeartbeatCheck = now;
 				}
 			} else {
-				if (now > lastHeartbeatCheck + MSEC_TO_USEC(MtmHeartbeatRecvTimeout)) { 
+				if (now > lastHeartbeatCheck + MSEC_TO_USEC(MtmGetWatchdogPeriod())) { 
 					/* Switch to non-blocking mode to proceed all pending requests before doing watchdog check */
 					selectTimeout = 0;
 				}
 			}
 		} else if (n == 0) { 
-			selectTimeout = MtmHeartbeatRecvTimeout; /* restore select timeout */ 
+			selectTimeout = MtmGetWatchdogPeriod(); /* restore select timeout */ 
 		}
 	}
 	proc_exit(1); /* force restart of this bgwroker */
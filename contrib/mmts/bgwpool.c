@@ -5,8 +5,9 @@
 #include "postmaster/bgworker.h"
 #include "storage/s_lock.h"
 #include "storage/spin.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
 #include "storage/proc.h"
-#include "storage/pg_sema.h"
 #include "storage/shmem.h"
 #include "datatype/timestamp.h"
 #include "utils/portal.h"
@@ -16,22 +17,268 @@
 
 bool MtmIsLogicalReceiver;
 int  MtmMaxWorkers;
+int         BgwPoolItemProducerId;
+timestamp_t BgwPoolItemQueueTime;
 
 static BgwPool* MtmPool;
 
+static BgwPoolWaiter* MtmPoolWaiter; /* wait slot of this process (worker or producer) */
+static BgwPoolItem*   MtmPoolItem;   /* item currently executed by this worker */
+static bool           MtmPoolOnExitRegistered;
+
+static void BgwPoolRelease(BgwPool* pool, BgwPoolItem* item);
+
 static void BgwShutdownWorker(int sig)
 {
-	if (MtmPool) { 
+	if (MtmPool) {
 		BgwPoolStop(MtmPool);
 	}
 }
 
+/*
+ * Release resources hold by this process in the pool: if worker is terminated in the middle of
+ * executing some item, then space of this item should be returned to the ring buffer, otherwise queue will be blocked forever.
+ */
+static void BgwPoolOnExit(int code, Datum arg)
+{
+	BgwPool* pool = (BgwPool*)DatumGetPointer(arg);
+	if (MtmPoolItem != NULL) {
+		BgwPoolRelease(pool, MtmPoolItem);
+		MtmPoolItem = NULL;
+	}
+	if (MtmPoolWaiter != NULL) {
+		pg_atomic_write_u32(&MtmPoolWaiter->waiting, 0);
+		pg_atomic_write_u32(&MtmPoolWaiter->owner, 0);
+		MtmPoolWaiter = NULL;
+	}
+}
+
+/*
+ * Assign wait slot to the current process. Returns NULL if there are no free slots: in this case
+ * process has to poll pool state.
+ */
+static BgwPoolWaiter* BgwPoolRegisterWaiter(BgwPool* pool, BgwPoolWaiter* waiters, size_t nWaiters)
+{
+	size_t i;
+	if (!MtmPoolOnExitRegistered) {
+		before_shmem_exit(BgwPoolOnExit, PointerGetDatum(pool));
+		MtmPoolOnExitRegistered = true;
+	}
+	if (MtmPoolWaiter == NULL) {
+		for (i = 0; i < nWaiters; i++) {
+			uint32 free = 0;
+			if (pg_atomic_compare_exchange_u32(&waiters[i].owner, &free, MyProc->pgprocno + 1)) {
+				pg_atomic_write_u32(&waiters[i].waiting, 0);
+				MtmPoolWaiter = &waiters[i];
+				break;
+			}
+		}
+	}
+	return MtmPoolWaiter;
+}
+
+/*
+ * Announce that this process is going to sleep. Condition has to be rechecked after this call:
+ * either it will see the change or the process making this change will see our waiting flag.
+ */
+static void BgwPoolPrepareToSleep(BgwPoolWaiter* waiter, pg_atomic_uint32* nSleeping)
+{
+	ResetLatch(MyLatch);
+	if (waiter != NULL) {
+		pg_atomic_write_u32(&waiter->waiting, 1);
+		pg_atomic_fetch_add_u32(nSleeping, 1);
+	}
+}
+
+static void BgwPoolCancelSleep(BgwPoolWaiter* waiter, pg_atomic_uint32* nSleeping)
+{
+	uint32 waiting = 1;
+	if (waiter != NULL && pg_atomic_compare_exchange_u32(&waiter->waiting, &waiting, 0)) {
+		pg_atomic_fetch_sub_u32(nSleeping, 1);
+	}
+}
+
+static void BgwPoolSleep(BgwPoolWaiter* waiter, pg_atomic_uint32* nSleeping)
+{
+	int rc = WaitLatch(MyLatch, WL_LATCH_SET|WL_POSTMASTER_DEATH|(waiter == NULL ? WL_TIMEOUT : 0), 1);
+	if (rc & WL_POSTMASTER_DEATH) {
+		proc_exit(1);
+	}
+	BgwPoolCancelSleep(waiter, nSleeping);
+}
+
+/*
+ * Wakeup one or all processes sleeping on the specified wait list.
+ * Wakeup is performed by the process which succeeds to clear waiting flag, so the same process is never woken twice.
+ */
+static void BgwPoolWakeup(BgwPoolWaiter* waiters, size_t nWaiters, pg_atomic_uint32* nSleeping, bool all)
+{
+	size_t i;
+	if (pg_atomic_read_u32(nSleeping) == 0) {
+		return;
+	}
+	for (i = 0; i < nWaiters; i++) {
+		uint32 waiting = 1;
+		if (pg_atomic_compare_exchange_u32(&waiters[i].waiting, &waiting, 0)) {
+			uint32 owner = pg_atomic_read_u32(&waiters[i].owner);
+			pg_atomic_fetch_sub_u32(nSleeping, 1);
+			if (owner != 0) {
+				SetLatch(&ProcGlobal->allProcs[owner-1].procLatch);
+			}
+			if (!all) {
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Reserve space for the item in the ring buffer. If there is not enough space till the end of buffer,
+ * then rest of the buffer is filled with padding item and item is placed at the beginning of buffer.
+ * Returns false if queue is full.
+ */
+static bool BgwPoolReserve(BgwPool* pool, size_t size, uint64* pos, uint64* end, BgwPoolItem** item)
+{
+	uint64 len = BGW_POOL_ITEM_LEN(size);
+	while (true) {
+		uint64 tail = pg_atomic_read_u64(&pool->tail);
+		uint64 free = pg_atomic_read_u64(&pool->free);
+		size_t offs = tail % pool->size;
+		size_t padding = offs + len > pool->size ? pool->size - offs : 0;
+		if (tail + padding + len - free > pool->size) {
+			return false;
+		}
+		if (pg_atomic_compare_exchange_u64(&pool->tail, &tail, tail + padding + len)) {
+			if (padding != 0) {
+				BgwPoolItem* pad = (BgwPoolItem*)&pool->queue[offs];
+				pad->size = padding - BGW_POOL_ITEM_HDRSZ;
+				pg_atomic_write_u32(&pad->state, BGW_POOL_ITEM_PADDING);
+			}
+			*item = (BgwPoolItem*)&pool->queue[(tail + padding) % pool->size];
+			(*item)->size = size;
+			pg_atomic_write_u32(&(*item)->state, BGW_POOL_ITEM_READY);
+			*pos = tail;
+			*end = tail + padding + len;
+			return true;
+		}
+	}
+}
+
+/*
+ * Make reserved item visible to workers. Items are published in order of reservation,
+ * so producer has to wait until all preceding producers complete copying of their data.
+ */
+static void BgwPoolPublish(BgwPool* pool, uint64 pos, uint64 end)
+{
+	uint64 expected = pos;
+	if (!pg_atomic_compare_exchange_u64(&pool->published, &expected, end)) {
+		SpinDelayStatus delay;
+		init_local_spin_delay(&delay);
+		do {
+			perform_spin_delay(&delay);
+			expected = pos;
+		} while (!pg_atomic_compare_exchange_u64(&pool->published, &expected, end));
+		finish_spin_delay(&delay);
+	}
+}
+
+/*
+ * Take next published item. Returns NULL if there are no items available.
+ */
+static BgwPoolItem* BgwPoolDequeue(BgwPool* pool)
+{
+	while (true) {
+		uint64 head = pg_atomic_read_u64(&pool->head);
+		BgwPoolItem* item;
+		if (head == pg_atomic_read_u64(&pool->published)) {
+			return NULL;
+		}
+		pg_read_barrier();
+		item = (BgwPoolItem*)&pool->queue[head % pool->size];
+		/* size may be garbage if head was concurrently moved, but then CAS fails */
+		if (pg_atomic_compare_exchange_u64(&pool->head, &head, head + BGW_POOL_ITEM_LEN(item->size))) {
+			if (pg_atomic_read_u32(&item->state) == BGW_POOL_ITEM_PADDING) {
+				BgwPoolRelease(pool, item);
+				continue;
+			}
+			pg_atomic_fetch_sub_u32(&pool->pending, 1);
+			return item;
+		}
+	}
+}
+
+/*
+ * Mark item as processed and return to producers space of all completed items at the beginning of the queue.
+ * Only one worker at a time advances free position; if some other worker is doing it,
+ * it is responsible to notice our item.
+ */
+static void BgwPoolRelease(BgwPool* pool, BgwPoolItem* item)
+{
+	pg_atomic_write_u32(&item->state, BGW_POOL_ITEM_DONE);
+	pg_memory_barrier();
+
+	while (pg_atomic_test_set_flag(&pool->reclaiming)) {
+		bool reclaimed = false;
+		uint64 free;
+		while (true) {
+			free = pg_atomic_read_u64(&pool->free);
+			if (free == pg_atomic_read_u64(&pool->head)) {
+				break;
+			}
+			item = (BgwPoolItem*)&pool->queue[free % pool->size];
+			if (pg_atomic_read_u32(&item->state) != BGW_POOL_ITEM_DONE) {
+				break;
+			}
+			pg_atomic_fetch_add_u64(&pool->free, BGW_POOL_ITEM_LEN(item->size));
+			reclaimed = true;
+		}
+		pg_atomic_clear_flag(&pool->reclaiming);
+		pg_memory_barrier();
+
+		if (reclaimed && pg_atomic_read_u32(&pool->nBlockedProducers) != 0) {
+			pool->lastPeakTime = 0;
+			BgwPoolWakeup(pool->producers, MAX_NODES, &pool->nBlockedProducers, true);
+		}
+		/* Recheck if some item was completed while we were holding the flag */
+		free = pg_atomic_read_u64(&pool->free);
+		if (free == pg_atomic_read_u64(&pool->head)
+			|| pg_atomic_read_u32(&((BgwPoolItem*)&pool->queue[free % pool->size])->state) != BGW_POOL_ITEM_DONE)
+		{
+			break;
+		}
+	}
+}
+
+static void BgwPoolExecuteItem(BgwPool* pool, BgwPoolItem* item)
+{
+	uint32 active;
+
+	timestamp_t now = MtmGetSystemTime();
+
+	MtmPoolItem = item;
+	pg_atomic_write_u32(&item->state, BGW_POOL_ITEM_BUSY);
+	active = pg_atomic_add_fetch_u32(&pool->active, 1);
+	if (pool->lastPeakTime == 0 && active == pool->nWorkers && pg_atomic_read_u32(&pool->pending) != 0) {
+		pool->lastPeakTime = now;
+	}
+	BgwPoolItemProducerId = item->producerId;
+	BgwPoolItemQueueTime = now > item->enqueueTime ? now - item->enqueueTime : 0;
+
+	pool->executor(BGW_POOL_ITEM_DATA(item), item->size);
+
+	BgwPoolItemProducerId = 0;
+
+	pg_atomic_fetch_sub_u32(&pool->active, 1);
+	pool->lastPeakTime = 0;
+	MtmPoolItem = NULL;
+	BgwPoolRelease(pool, item);
+}
+
 static void BgwPoolMainLoop(BgwPool* pool)
 {
-    int size;
-    void* work;
 	static PortalData fakePortal;
 	sigset_t sset;
+	BgwPoolWaiter* waiter;
 
 	MtmIsLogicalReceiver = true;
 	MtmPool = pool;
@@ -49,70 +296,63 @@ static void BgwPoolMainLoop(BgwPool* pool)
 	ActivePortal->status = PORTAL_ACTIVE;
 	ActivePortal->sourceText = "";
 
-    while (true) { 
-        PGSemaphoreLock(&pool->available);
-        SpinLockAcquire(&pool->lock);
-		if (pool->shutdown) { 
-			break;
-		}
-        size = *(int*)&pool->queue[pool->head];
-        Assert(size < pool->size);
-        work = malloc(size);
-        pool->pending -= 1;
-        pool->active += 1;
-		if (pool->lastPeakTime == 0 && pool->active == pool->nWorkers && pool->pending != 0) {
-			pool->lastPeakTime = MtmGetSystemTime();
+	waiter = BgwPoolRegisterWaiter(pool, pool->workers, pool->maxWorkers);
+
+    while (!pool->shutdown) {
+		BgwPoolItem* item = BgwPoolDequeue(pool);
+		if (item == NULL) {
+			BgwPoolPrepareToSleep(waiter, &pool->nSleepingWorkers);
+			item = BgwPoolDequeue(pool);
+			if (item == NULL) {
+				if (!pool->shutdown) {
+					BgwPoolSleep(waiter, &pool->nSleepingWorkers);
+				} else {
+					BgwPoolCancelSleep(waiter, &pool->nSleepingWorkers);
+				}
+				continue;
+			}
+			BgwPoolCancelSleep(waiter, &pool->nSleepingWorkers);
 		}
-        if (pool->head + size + 4 > pool->size) { 
-            memcpy(work, pool->queue, size);
-            pool->head = INTALIGN(size);
-        } else { 
-            memcpy(work, &pool->queue[pool->head+4], size);
-            pool->head += 4 + INTALIGN(size);
-        }
-        if (pool->size == pool->head) { 
-            pool->head = 0;
-        }
-        if (pool->producerBlocked) {
-            pool->producerBlocked = false;
-            PGSemaphoreUnlock(&pool->overflow);
-			pool->lastPeakTime = 0;
-        }
-        SpinLockRelease(&pool->lock);
-        pool->executor(work, size);
-        free(work);
-        SpinLockAcquire(&pool->lock);
-        pool->active -= 1;
-		pool->lastPeakTime = 0;
-        SpinLockRelease(&pool->lock);
+		BgwPoolExecuteItem(pool, item);
     }
-	SpinLockRelease(&pool->lock);
 }
 
 void BgwPoolInit(BgwPool* pool, BgwPoolExecutor executor, char const* dbname,  char const* dbuser, size_t queueSize, size_t nWorkers)
 {
+	size_t i;
 	MtmPool = pool;
+	queueSize = TYPEALIGN_DOWN(MAXIMUM_ALIGNOF, queueSize);
     pool->queue = (char*)ShmemAlloc(queueSize);
     pool->executor = executor;
-    PGSemaphoreCreate(&pool->available);
-    PGSemaphoreCreate(&pool->overflow);
-    PGSemaphoreReset(&pool->available);
-    PGSemaphoreReset(&pool->overflow);
     SpinLockInit(&pool->lock);
+	pg_atomic_init_u64(&pool->head, 0);
+	pg_atomic_init_u64(&pool->tail, 0);
+	pg_atomic_init_u64(&pool->published, 0);
+	pg_atomic_init_u64(&pool->free, 0);
+	pg_atomic_init_flag(&pool->reclaiming);
+	pg_atomic_init_u32(&pool->active, 0);
+	pg_atomic_init_u32(&pool->pending, 0);
+	pg_atomic_init_u32(&pool->nSleepingWorkers, 0);
+	pg_atomic_init_u32(&pool->nBlockedProducers, 0);
 	pool->shutdown = false;
-    pool->producerBlocked = false;
-    pool->head = 0;
-    pool->tail = 0;
     pool->size = queueSize;
-    pool->active = 0;
-    pool->pending = 0;
 	pool->nWorkers = nWorkers;
+	pool->maxWorkers = Max(nWorkers, MtmMaxWorkers);
 	pool->lastPeakTime = 0;
 	pool->lastDynamicWorkerStartTime = 0;
+	pool->workers = (BgwPoolWaiter*)ShmemAlloc(pool->maxWorkers*sizeof(BgwPoolWaiter));
+	for (i = 0; i < pool->maxWorkers; i++) {
+		pg_atomic_init_u32(&pool->workers[i].owner, 0);
+		pg_atomic_init_u32(&pool->workers[i].waiting, 0);
+	}
+	for (i = 0; i < MAX_NODES; i++) {
+		pg_atomic_init_u32(&pool->producers[i].owner, 0);
+		pg_atomic_init_u32(&pool->producers[i].waiting, 0);
+	}
 	strncpy(pool->dbname, dbname, MAX_DBNAME_LEN);
 	strncpy(pool->dbuser, dbuser, MAX_DBUSER_LEN);
 }
- 
+
 timestamp_t BgwGetLastPeekTime(BgwPool* pool)
 {
 	return pool->lastPeakTime;
@@ -140,7 +380,7 @@ void BgwPoolStart(int nWorkers, BgwPoolConstructor constructor)
 	worker.bgw_main = BgwPoolStaticWorkerMainLoop;
 	worker.bgw_restart_time = MULTIMASTER_BGW_RESTART_TIMEOUT;
 
-    for (i = 0; i < nWorkers; i++) { 
+    for (i = 0; i < nWorkers; i++) {
         snprintf(worker.bgw_name, BGW_MAXLEN, "bgw_pool_worker_%d", i+1);
         worker.bgw_main_arg = PointerGetDatum(constructor);
         RegisterBackgroundWorker(&worker);
@@ -149,91 +389,97 @@ void BgwPoolStart(int nWorkers, BgwPoolConstructor constructor)
 
 size_t BgwPoolGetQueueSize(BgwPool* pool)
 {
-	size_t used;
-    SpinLockAcquire(&pool->lock);
-	used = pool->head <= pool->tail ? pool->tail - pool->head : pool->size - pool->head + pool->tail;
-    SpinLockRelease(&pool->lock);            
-	return used;
+	uint64 free = pg_atomic_read_u64(&pool->free);
+	return (size_t)(pg_atomic_read_u64(&pool->tail) - free);
 }
 
 
 static void BgwStartExtraWorker(BgwPool* pool)
 {
-	if (pool->nWorkers < MtmMaxWorkers) { 
-		timestamp_t now = MtmGetSystemTime();
+	int workerId = 0;
+	timestamp_t now = MtmGetSystemTime();
+
+	SpinLockAcquire(&pool->lock);
+	if (pool->nWorkers < MtmMaxWorkers) {
 		/*if (pool->lastDynamicWorkerStartTime + MULTIMASTER_BGW_RESTART_TIMEOUT*USECS_PER_SEC < now)*/
-		{ 
-			BackgroundWorker worker;
-			BackgroundWorkerHandle* handle;
-			MemSet(&worker, 0, sizeof(BackgroundWorker));
-			worker.bgw_flags = BGWORKER_SHMEM_ACCESS |  BGWORKER_BACKEND_DATABASE_CONNECTION;
-			worker.bgw_start_time = BgWorkerStart_ConsistentState;
-			worker.bgw_main = BgwPoolDynamicWorkerMainLoop;
-			worker.bgw_restart_time = MULTIMASTER_BGW_RESTART_TIMEOUT;
-			snprintf(worker.bgw_name, BGW_MAXLEN, "bgw_pool_dynworker_%d", (int)++pool->nWorkers);
-			worker.bgw_main_arg = PointerGetDatum(pool);
+		{
+			workerId = (int)++pool->nWorkers;
 			pool->lastDynamicWorkerStartTime = now;
-			if (!RegisterDynamicBackgroundWorker(&worker, &handle)) { 
-				elog(WARNING, "Failed to start dynamic background worker");
-			}
+		}
+	}
+	SpinLockRelease(&pool->lock);
+
+	if (workerId != 0) {
+		BackgroundWorker worker;
+		BackgroundWorkerHandle* handle;
+		MemSet(&worker, 0, sizeof(BackgroundWorker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS |  BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+		worker.bgw_main = BgwPoolDynamicWorkerMainLoop;
+		worker.bgw_restart_time = MULTIMASTER_BGW_RESTART_TIMEOUT;
+		snprintf(worker.bgw_name, BGW_MAXLEN, "bgw_pool_dynworker_%d", workerId);
+		worker.bgw_main_arg = PointerGetDatum(pool);
+		if (!RegisterDynamicBackgroundWorker(&worker, &handle)) {
+			elog(WARNING, "Failed to start dynamic background worker");
 		}
 	}
 }
 
-void BgwPoolExecute(BgwPool* pool, void* work, size_t size)
+void BgwPoolExecute(BgwPool* pool, void* work, size_t size, int producerId)
 {
-    if (size+4 > pool->size) {
-		/* 
-		 * Size of work is larger than size of shared buffer: 
-		 * run it immediately
+	BgwPoolItem* item;
+	BgwPoolWaiter* waiter = NULL;
+	uint64 pos, end;
+	uint32 pending;
+
+    if (BGW_POOL_ITEM_LEN(size) > pool->size/2) {
+		/*
+		 * Work is too large for the shared buffer: run it immediately.
+		 * An item may need padding up to its own length to wrap around to the
+		 * beginning of the ring, so only items of at most half of the buffer
+		 * are guaranteed to fit once the queue is drained.
 		 */
 		pool->executor(work, size);
 		return;
 	}
- 
-    SpinLockAcquire(&pool->lock);
-    while (!pool->shutdown) { 
-        if ((pool->head <= pool->tail && pool->size - pool->tail < size + 4 && pool->head < size) 
-            || (pool->head > pool->tail && pool->head - pool->tail < size + 4))
-        {
-            if (pool->lastPeakTime == 0) {
-				pool->lastPeakTime = MtmGetSystemTime();
-			}
-			pool->producerBlocked = true;
-            SpinLockRelease(&pool->lock);
-            PGSemaphoreLock(&pool->overflow);
-            SpinLockAcquire(&pool->lock);
-        } else {
-            pool->pending += 1;
-			if (pool->active + pool->pending > pool->nWorkers) { 
-				BgwStartExtraWorker(pool);				
-			}
-			if (pool->lastPeakTime == 0 && pool->active == pool->nWorkers && pool->pending != 0) {
-				pool->lastPeakTime = MtmGetSystemTime();
-			}
-            *(int*)&pool->queue[pool->tail] = size;
-            if (pool->size - pool->tail >= size + 4) { 
-                memcpy(&pool->queue[pool->tail+4], work, size);
-                pool->tail += 4 + INTALIGN(size);
-            } else { 
-                memcpy(pool->queue, work, size);
-                pool->tail = INTALIGN(size);
-            }
-            if (pool->tail == pool->size) {
-                pool->tail = 0;
-            }
-            PGSemaphoreUnlock(&pool->available);
-            break;
-        }
-    }
-    SpinLockRelease(&pool->lock);            
+
+	while (!BgwPoolReserve(pool, size, &pos, &end, &item)) {
+		if (pool->shutdown) {
+			return;
+		}
+		if (pool->lastPeakTime == 0) {
+			pool->lastPeakTime = MtmGetSystemTime();
+		}
+		if (waiter == NULL) {
+			waiter = BgwPoolRegisterWaiter(pool, pool->producers, MAX_NODES);
+		}
+		BgwPoolPrepareToSleep(waiter, &pool->nBlockedProducers);
+		if (BgwPoolReserve(pool, size, &pos, &end, &item)) {
+			BgwPoolCancelSleep(waiter, &pool->nBlockedProducers);
+			break;
+		}
+		BgwPoolSleep(waiter, &pool->nBlockedProducers);
+	}
+	memcpy(BGW_POOL_ITEM_DATA(item), work, size);
+	item->producerId = producerId;
+	item->enqueueTime = MtmGetSystemTime();
+
+	pending = pg_atomic_add_fetch_u32(&pool->pending, 1);
+	BgwPoolPublish(pool, pos, end);
+
+	if (pg_atomic_read_u32(&pool->active) + pending > pool->nWorkers) {
+		BgwStartExtraWorker(pool);
+	}
+	if (pool->lastPeakTime == 0 && pg_atomic_read_u32(&pool->active) == pool->nWorkers && pending != 0) {
+		pool->lastPeakTime = MtmGetSystemTime();
+	}
+	BgwPoolWakeup(pool->workers, pool->maxWorkers, &pool->nSleepingWorkers, false);
 }
 
 void BgwPoolStop(BgwPool* pool)
 {
-    SpinLockAcquire(&pool->lock);
 	pool->shutdown = true;
-    SpinLockRelease(&pool->lock);            
-	PGSemaphoreUnlock(&pool->available);
-	PGSemaphoreUnlock(&pool->overflow);
+	pg_memory_barrier();
+	BgwPoolWakeup(pool->workers, pool->maxWorkers, &pool->nSleepingWorkers, true);
+	BgwPoolWakeup(pool->producers, MAX_NODES, &pool->nBlockedProducers, true);
 }
@@ -1,9 +1,9 @@
 #ifndef __BGWPOOL_H__
 #define __BGWPOOL_H__
 
+#include "port/atomics.h"
 #include "storage/s_lock.h"
 #include "storage/spin.h"
-#include "storage/pg_sema.h"
 #include "bkb.h"
 
 typedef void(*BgwPoolExecutor)(void* work, size_t size);
@@ -21,24 +21,73 @@ extern timestamp_t MtmGetCurrentTime(void);  /* adjusted current system time */
 extern bool MtmIsLogicalReceiver;
 extern int  MtmMaxWorkers;
 
+extern int         BgwPoolItemProducerId; /* producer of the item executed by this worker, 0 if work is executed directly */
+extern timestamp_t BgwPoolItemQueueTime;  /* time spent by this item in the queue */
+
+/*
+ * Work item in the pool queue. Items are stored back to back in the ring buffer,
+ * payload follows MAXALIGNed header and is executed by worker in place.
+ */
+typedef struct
+{
+	pg_atomic_uint32 state;  /* BGW_POOL_ITEM_* */
+	uint32 size;             /* size of payload */
+	int    producerId;       /* identifier of producer passed to BgwPoolExecute */
+	timestamp_t enqueueTime; /* time when item was placed in the queue */
+} BgwPoolItem;
+
+#define BGW_POOL_ITEM_READY   0 /* published and waiting for worker */
+#define BGW_POOL_ITEM_PADDING 1 /* skipped space at the end of ring buffer */
+#define BGW_POOL_ITEM_BUSY    2 /* executed by worker */
+#define BGW_POOL_ITEM_DONE    3 /* processed, space can be reused */
+
+#define BGW_POOL_ITEM_HDRSZ  MAXALIGN(sizeof(BgwPoolItem))
+#define BGW_POOL_ITEM_LEN(size) (BGW_POOL_ITEM_HDRSZ + MAXALIGN(size))
+#define BGW_POOL_ITEM_DATA(item) ((char*)(item) + BGW_POOL_ITEM_HDRSZ)
+
+/*
+ * Slot of process which can sleep on its latch waiting for pool state change
+ */
+typedef struct
+{
+	pg_atomic_uint32 owner;   /* pgprocno+1 of owner process or 0 if slot is free */
+	pg_atomic_uint32 waiting; /* owner is going to sleep on its latch */
+} BgwPoolWaiter;
+
+/*
+ * Multi-producer/multi-consumer queue of variable length items.
+ * All positions are monotonically increasing byte offsets, position in ring buffer is (pos % size):
+ *   free <= head <= published <= tail
+ * [free, head)      - items taken by workers (some of them may be already done)
+ * [head, published) - items available for workers
+ * [published, tail) - space reserved by producers which are still copying their data
+ * Producers reserve space with CAS on tail and publish items in reservation order.
+ * Workers take items with CAS on head and execute them in place.
+ * Space is returned to producers by advancing free over completed items.
+ */
 typedef struct
 {
     BgwPoolExecutor executor;
-    volatile slock_t lock;
-    PGSemaphoreData available;
-    PGSemaphoreData overflow;
-    size_t head;
-    size_t tail;
+    volatile slock_t lock;           /* protects only starting of dynamic workers */
+	pg_atomic_uint64 head;
+	pg_atomic_uint64 tail;
+	pg_atomic_uint64 published;
+	pg_atomic_uint64 free;
+	pg_atomic_flag   reclaiming;     /* set while some worker is advancing free position */
+	pg_atomic_uint32 active;
+	pg_atomic_uint32 pending;
+	pg_atomic_uint32 nSleepingWorkers;
+	pg_atomic_uint32 nBlockedProducers;
     size_t size;
-    size_t active;
-    size_t pending;
 	size_t nWorkers;
-	time_t lastPeakTime;
+	size_t maxWorkers;
+	timestamp_t lastPeakTime;
 	timestamp_t lastDynamicWorkerStartTime;
-    bool   producerBlocked;
 	bool   shutdown;
     char   dbname[MAX_DBNAME_LEN];
 	char   dbuser[MAX_DBUSER_LEN];
+	BgwPoolWaiter  producers[MAX_NODES];
+	BgwPoolWaiter* workers;
     char*  queue;
 } BgwPool;
 
@@ -48,7 +97,7 @@ extern void BgwPoolStart(int nWorkers, BgwPoolConstructor constructor);
 
 extern void BgwPoolInit(BgwPool* pool, BgwPoolExecutor executor, char const* dbname, char const* dbuser, size_t queueSize, size_t nWorkers);
 
-extern void BgwPoolExecute(BgwPool* pool, void* work, size_t size);
+extern void BgwPoolExecute(BgwPool* pool, void* work, size_t size, int producerId);
 
 extern size_t BgwPoolGetQueueSize(BgwPool* pool);
 
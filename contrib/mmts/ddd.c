@@ -1,74 +1,191 @@
 #include "postgres.h"
 #include "access/clog.h"
+#include "access/hash.h"
 #include "storage/lwlock.h"
 #include "utils/hsearch.h"
 
 #include "ddd.h"
 
 
-void MtmGraphInit(MtmGraph* graph)
+static int compareGtid(GlobalTransactionId const* a, GlobalTransactionId const* b)
 {
-    memset(graph->hashtable, 0, sizeof(graph->hashtable));
+	return a->node < b->node ? -1 : a->node > b->node ? 1 
+		: a->xid < b->xid ? -1 : a->xid > b->xid ? 1 : 0;
 }
 
-static inline MtmVertex* findVertex(MtmGraph* graph, GlobalTransactionId* gtid)
+static int compareEdges(void const* p, void const* q)
 {
-    uint32 h = gtid->xid % MAX_TRANSACTIONS;
-    MtmVertex* v;
-    for (v = graph->hashtable[h]; v != NULL; v = v->collision) { 
-        if (EQUAL_GTID(v->gtid, *gtid)) { 
-            return v;
-        }
-    }
-	v = (MtmVertex*)palloc(sizeof(MtmVertex));
-    v->gtid = *gtid;
-	v->outgoingEdges = NULL;
-    v->collision = graph->hashtable[h];
-    graph->hashtable[h] = v;
-    return v;
+	MtmEdge const* a = (MtmEdge const*)p;
+	MtmEdge const* b = (MtmEdge const*)q;
+	int diff = compareGtid(&a->src, &b->src);
+	return diff != 0 ? diff : compareGtid(&a->dst, &b->dst);
 }
 
-void MtmGraphAdd(MtmGraph* graph, GlobalTransactionId* gtid, int size)
+/*
+ * Sort edges and remove duplicates. Returns number of distinct edges.
+ */
+int MtmGraphSort(MtmEdge* edges, int nEdges)
 {
-    GlobalTransactionId* last = gtid + size;
-    while (gtid != last) { 
-        MtmVertex* src = findVertex(graph, gtid++);
-        while (gtid->node != 0) { 
-            MtmVertex* dst = findVertex(graph, gtid++);
-            MtmEdge* e = (MtmEdge*)palloc(sizeof(MtmEdge));
-            e->dst = dst;
-            e->src = src;
-            e->next = src->outgoingEdges;
-            src->outgoingEdges = e;
-        }
-		gtid += 1;
-    }
+	int i, j;
+	if (nEdges <= 1) { 
+		return nEdges;
+	}
+	qsort(edges, nEdges, sizeof(MtmEdge), compareEdges);
+	for (i = 0, j = 1; j < nEdges; j++) { 
+		if (compareEdges(&edges[i], &edges[j]) != 0) { 
+			edges[++i] = edges[j];
+		}
+	}
+	return i + 1;
 }
 
-static bool recursiveTraverseGraph(MtmVertex* root, MtmVertex* v)
+/*
+ * Find difference between two sorted sets of edges.
+ */
+void MtmGraphDiff(MtmEdge* oldEdges, int nOld, MtmEdge* newEdges, int nNew, 
+				  MtmEdge* removed, int* nRemoved, MtmEdge* added, int* nAdded)
 {
-    MtmEdge* e;
-    v->gtid.node = VISITED_NODE_MARK;
-    for (e = v->outgoingEdges; e != NULL; e = e->next) {
-        if (e->dst == root) { 
-            return true;
-        } else if (e->dst->gtid.node != VISITED_NODE_MARK && recursiveTraverseGraph(root, e->dst)) { /* loop */
-            return true;
-        } 
-    }
-    return false;        
+	int i = 0, j = 0;
+	*nRemoved = *nAdded = 0;
+	while (i < nOld || j < nNew) { 
+		int diff = i == nOld ? 1 : j == nNew ? -1 : compareEdges(&oldEdges[i], &newEdges[j]);
+		if (diff < 0) { 
+			removed[(*nRemoved)++] = oldEdges[i++];
+		} else if (diff > 0) { 
+			added[(*nAdded)++] = newEdges[j++];
+		} else { 
+			i += 1;
+			j += 1;
+		}
+	}
 }
 
-bool MtmGraphFindLoop(MtmGraph* graph, GlobalTransactionId* root)
+/*
+ * Apply delta to the sorted set of edges. Result should have space for nEdges + nAdded edges.
+ * Returns number of edges in result.
+ */
+int MtmGraphMerge(MtmEdge* edges, int nEdges, MtmEdge* removed, int nRemoved, 
+				  MtmEdge* added, int nAdded, MtmEdge* result)
 {
-    MtmVertex* v;
-    for (v = graph->hashtable[root->xid % MAX_TRANSACTIONS]; v != NULL; v = v->collision) { 
-        if (EQUAL_GTID(v->gtid, *root)) { 
-            if (recursiveTraverseGraph(v, v)) { 
-                return true;
-            }
-            break;
-        }
-    }
-    return false;        
+	int i = 0, j = 0, k = 0, n = 0;
+	while (i < nEdges || k < nAdded) { 
+		int diff = i == nEdges ? 1 : k == nAdded ? -1 : compareEdges(&edges[i], &added[k]);
+		if (diff <= 0) { 
+			/* skip removed edges */
+			while (j < nRemoved && compareEdges(&removed[j], &edges[i]) < 0) { 
+				j += 1;
+			}
+			if (j == nRemoved || compareEdges(&removed[j], &edges[i]) != 0) { 
+				result[n++] = edges[i];
+			}
+			i += 1;
+			if (diff == 0) { 
+				k += 1;
+			}
+		} else { 
+			result[n++] = added[k++];
+		}
+	}
+	return n;
+}
+
+/*
+ * Position of the first edge outgoing from the vertex
+ */
+static int findOutgoingEdges(MtmGraph* graph, GlobalTransactionId* src)
+{
+	int l = 0, r = graph->nEdges;
+	while (l < r) { 
+		int m = (l + r) >> 1;
+		if (compareGtid(&graph->edges[m].src, src) < 0) { 
+			l = m + 1;
+		} else { 
+			r = m;
+		}
+	}
+	return l;
+}
+
+typedef struct MtmVisitedVertex
+{
+	GlobalTransactionId gtid; /* hash key */
+} MtmVisitedVertex;
+
+typedef struct MtmSearchFrame
+{
+	GlobalTransactionId vertex;
+	int graph; /* index of graph which outgoing edges are inspected */
+	int edge;  /* position of next edge in this graph */
+} MtmSearchFrame;
+
+/*
+ * Check if there is a loop in the union of graphs passing through the root vertex.
+ * Depth-first search is iterative and inspects at most MTM_DEADLOCK_SEARCH_LIMIT edges:
+ * if limit is reached, the answer is unknown and false is returned. Aborting transactions
+ * on a guess would hit innocent ones exactly when contention is heaviest; the caller
+ * re-arms the deadlock timeout instead, so the check is repeated later.
+ */
+bool MtmGraphFindLoop(MtmGraph** graphs, int nGraphs, GlobalTransactionId* root)
+{
+	HASHCTL ctl;
+	HTAB* visited;
+	MtmSearchFrame* stack;
+	int sp = 0, maxDepth = 64;
+	int nSteps = 0;
+	bool found = false;
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(GlobalTransactionId);
+	ctl.entrysize = sizeof(MtmVisitedVertex);
+	ctl.hcxt = CurrentMemoryContext;
+	visited = hash_create("MtmDeadlockVisited", 1024, &ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	stack = (MtmSearchFrame*)palloc(maxDepth*sizeof(MtmSearchFrame));
+	stack[0].vertex = *root;
+	stack[0].graph = -1;
+	stack[0].edge = 0;
+	hash_search(visited, root, HASH_ENTER, NULL);
+
+	while (sp >= 0 && !found) { 
+		MtmSearchFrame* top = &stack[sp];
+		MtmGraph* g;
+
+		if (top->graph < 0 || top->edge == graphs[top->graph]->nEdges 
+			|| compareGtid(&graphs[top->graph]->edges[top->edge].src, &top->vertex) != 0) 
+		{
+			/* switch to the next graph */
+			if (++top->graph == nGraphs) { 
+				sp -= 1;
+				continue;
+			}
+			top->edge = findOutgoingEdges(graphs[top->graph], &top->vertex);
+			continue;
+		}
+		if (++nSteps > MTM_DEADLOCK_SEARCH_LIMIT) { 
+			elog(WARNING, "Distributed deadlock search is interrupted after inspecting %d edges: it will be repeated after deadlock timeout", MTM_DEADLOCK_SEARCH_LIMIT);
+			break;
+		}
+		g = graphs[top->graph];
+		{
+			GlobalTransactionId dst = g->edges[top->edge++].dst;
+			bool isVisited;
+			if (EQUAL_GTID(dst, *root)) { 
+				found = true;
+				break;
+			}
+			hash_search(visited, &dst, HASH_ENTER, &isVisited);
+			if (!isVisited) { 
+				if (++sp == maxDepth) { 
+					maxDepth *= 2;
+					stack = (MtmSearchFrame*)repalloc(stack, maxDepth*sizeof(MtmSearchFrame));
+				}
+				stack[sp].vertex = dst;
+				stack[sp].graph = -1;
+				stack[sp].edge = 0;
+			}
+		}
+	}
+	pfree(stack);
+	hash_destroy(visited);
+	return found;
 }
@@ -3,29 +3,47 @@
 
 #include "multimaster.h"
 
-#define MAX_TRANSACTIONS  1024
-#define VISITED_NODE_MARK 0
+#define MTM_DEADLOCK_SEARCH_LIMIT 100000 /* maximal number of edges inspected by one cycle search */
+#define MTM_GRAPH_FULL_INTERVAL   16     /* full graph is published after this number of deltas */
 
+/*
+ * Edge of wait-for graph: transaction 'src' waits for lock held by transaction 'dst'
+ */
 typedef struct MtmEdge {
-	struct MtmEdge*   next; /* list of outgoing edges */
-    struct MtmVertex* dst;
-    struct MtmVertex* src;
+	GlobalTransactionId src;
+	GlobalTransactionId dst;
 } MtmEdge;
 
-typedef struct MtmVertex
-{    
-    struct MtmEdge* outgoingEdges;
-    struct MtmVertex* collision;
-	GlobalTransactionId gtid;
-} MtmVertex;
+/*
+ * Header of lock graph logical message ('L').
+ * Message contains either full graph (baseVersion == 0) or delta to the previously published version:
+ * header is followed by nRemoved removed edges and nAdded added edges.
+ */
+typedef struct MtmGraphMessage {
+	uint32 version;
+	uint32 baseVersion;
+	uint32 nRemoved;
+	uint32 nAdded;
+} MtmGraphMessage;
 
+/*
+ * Wait-for graph of cluster node maintained in shared memory: edges are sorted by (src,dst)
+ */
 typedef struct MtmGraph
 {
-    MtmVertex* hashtable[MAX_TRANSACTIONS];
+	uint32      version;     /* version of published graph, 0 if graph is not known */
+	int         nDeltas;     /* number of deltas published since last full graph */
+	TimestampTz updateTime;  /* time when graph was updated */
+	int         nEdges;
+	int         maxEdges;
+	MtmEdge*    edges;
 } MtmGraph;
 
-extern void MtmGraphInit(MtmGraph* graph);
-extern void MtmGraphAdd(MtmGraph* graph, GlobalTransactionId* subgraph, int size);
-extern bool MtmGraphFindLoop(MtmGraph* graph, GlobalTransactionId* root);
+extern int  MtmGraphSort(MtmEdge* edges, int nEdges);
+extern void MtmGraphDiff(MtmEdge* oldEdges, int nOld, MtmEdge* newEdges, int nNew, 
+						 MtmEdge* removed, int* nRemoved, MtmEdge* added, int* nAdded);
+extern int  MtmGraphMerge(MtmEdge* edges, int nEdges, MtmEdge* removed, int nRemoved, 
+						  MtmEdge* added, int nAdded, MtmEdge* result);
+extern bool MtmGraphFindLoop(MtmGraph** graphs, int nGraphs, GlobalTransactionId* root);
 
 #endif
@@ -42,6 +42,27 @@ CREATE FUNCTION mtm.get_nodes_state() RETURNS SETOF mtm.node_state
 AS 'MODULE_PATHNAME','mtm_get_nodes_state'
 LANGUAGE C;
 
+-- Latencies are in microseconds
+CREATE TYPE mtm.latency AS ("node" integer, "phase" text, "count" bigint, "avgLatency" bigint, "p50" bigint, "p90" bigint, "p99" bigint, "maxLatency" bigint);
+
+CREATE FUNCTION mtm.get_latency() RETURNS SETOF mtm.latency
+AS 'MODULE_PATHNAME','mtm_get_latency'
+LANGUAGE C;
+
+CREATE TYPE mtm.latency_bucket AS ("node" integer, "phase" text, "lowerBound" bigint, "upperBound" bigint, "count" bigint);
+
+CREATE FUNCTION mtm.get_latency_histogram() RETURNS SETOF mtm.latency_bucket
+AS 'MODULE_PATHNAME','mtm_get_latency_histogram'
+LANGUAGE C;
+
+CREATE FUNCTION mtm.reset_latency() RETURNS void
+AS 'MODULE_PATHNAME','mtm_reset_latency'
+LANGUAGE C;
+
+CREATE VIEW mtm.latency_stats AS SELECT * FROM mtm.get_latency();
+
+CREATE VIEW mtm.latency_histogram AS SELECT * FROM mtm.get_latency_histogram();
+
 CREATE TYPE mtm.cluster_state AS ("status" text, "disabledNodeMask" bigint, "disconnectedNodeMask" bigint, "catchUpNodeMask" bigint, "liveNodes" integer, "allNodes" integer, "nActiveQueries" integer, "nPendingQueries" integer, "queueSize" bigint, "transCount" bigint, "timeShift" bigint, "recoverySlot" integer,
 "xidHashSize" bigint, "gidHashSize" bigint, "oldestXid" bigint, "configChanges" integer, "stalledNodeMask" bigint, "stoppedNodeMask" bigint);
 
@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <time.h>
+#include <math.h>
 
 #include "postgres.h"
 #include "funcapi.h"
@@ -35,6 +36,7 @@
 #include "access/subtrans.h"
 #include "access/commit_ts.h"
 #include "access/xlog.h"
+#include "access/hash.h"
 #include "storage/proc.h"
 #include "executor/executor.h"
 #include "access/twophase.h"
@@ -45,6 +47,7 @@
 #include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/memutils.h"
+#include "utils/snapmgr.h"
 #include "commands/dbcommands.h"
 #include "postmaster/autovacuum.h"
 #include "storage/pmsignal.h"
@@ -83,6 +86,7 @@ typedef struct {
 	bool  isSuspended;    /* prepared transaction is suspended because coordinator node is switch to offline */
     bool  isTransactionBlock; /* is transaction block */
 	bool  containsDML;    /* transaction contains DML statements */
+	bool  isStaleSnapshot; /* read-only transaction uses snapshot preceding all in-doubt transactions */
 	XidStatus status;     /* transaction status */
     csn_t snapshot;       /* transaction snaphsot */
 	csn_t csn;            /* CSN */
@@ -100,6 +104,9 @@ typedef enum
 #define MIN_WAIT_TIMEOUT 1000
 #define MAX_WAIT_TIMEOUT 100000
 #define MAX_WAIT_LOOPS   10000 // 1000000 
+#define MTM_XID_MAP_SIZE       (256*1024) /* should be power of 2 and much larger than MTM_HASH_SIZE */
+#define MTM_XID_MAP_MAX_PROBES 32
+#define MTM_XID_MAP_DELETED    FrozenTransactionId /* can not be XID of distributed transaction */
 #define STATUS_POLL_DELAY USECS_PER_SEC
 
 void _PG_init(void);
@@ -119,6 +126,9 @@ PG_FUNCTION_INFO_V1(mtm_get_trans_by_gid);
 PG_FUNCTION_INFO_V1(mtm_get_trans_by_xid);
 PG_FUNCTION_INFO_V1(mtm_get_last_csn);
 PG_FUNCTION_INFO_V1(mtm_get_nodes_state);
+PG_FUNCTION_INFO_V1(mtm_get_latency);
+PG_FUNCTION_INFO_V1(mtm_get_latency_histogram);
+PG_FUNCTION_INFO_V1(mtm_reset_latency);
 PG_FUNCTION_INFO_V1(mtm_get_cluster_state);
 PG_FUNCTION_INFO_V1(mtm_get_cluster_info);
 PG_FUNCTION_INFO_V1(mtm_make_table_local);
@@ -130,6 +140,8 @@ static Snapshot MtmGetSnapshot(Snapshot snapshot);
 static void MtmInitialize(void);
 static void MtmXactCallback(XactEvent event, void *arg);
 static void MtmBeginTransaction(MtmCurrentTrans* x);
+static void MtmChooseSnapshot(MtmCurrentTrans* x);
+static void MtmUseStableSnapshot(MtmCurrentTrans* x);
 static void MtmPrePrepareTransaction(MtmCurrentTrans* x);
 static void MtmPostPrepareTransaction(MtmCurrentTrans* x);
 static void MtmAbortPreparedTransaction(MtmCurrentTrans* x);
@@ -148,6 +160,9 @@ static void MtmDeserializeTransactionState(void* ctx);
 static void MtmInitializeSequence(int64* start, int64* step);
 
 static void MtmCheckClusterLock(void);
+static timestamp_t MtmGetNodeFailureTimeout(int nodeId);
+static timestamp_t MtmGet2PCTimeout(nodemask_t participantsMask);
+static timestamp_t MtmGetClusterStabilizationDelay(void);
 static void MtmCheckSlots(void);
 static void MtmAddSubtransactions(MtmTransState* ts, TransactionId *subxids, int nSubxids);
 
@@ -224,13 +239,16 @@ int   MtmConnectTimeout;
 int   MtmReconnectTimeout;
 int   MtmNodeDisableDelay;
 int   MtmTransSpillThreshold;
+int   MtmTransStreamThreshold;
 int   MtmMaxNodes;
 int   MtmHeartbeatSendTimeout;
 int   MtmHeartbeatRecvTimeout;
+int   MtmVoteBatchDelay;
 int   MtmMin2PCTimeout;
 int   MtmMax2PCRatio;
 bool  MtmUseDtm;
 bool  MtmPreserveCommitOrder;
+bool  MtmTrackApplyDependencies;
 bool  MtmVolksWagenMode;
 
 TransactionId  MtmUtilityProcessedInXid;
@@ -243,6 +261,8 @@ static int   MtmVacuumDelay;
 static int   MtmMinRecoveryLag;
 static int   MtmMaxRecoveryLag;
 static int   MtmGcPeriod;
+static int   MtmMaxReadOnlyStaleness;
+static double MtmFailureDetectorPhi;
 static bool  MtmIgnoreTablesWithoutPk;
 static int   MtmLockCount;
 static bool  MtmMajorNode;
@@ -454,6 +474,150 @@ TransactionId MtmGetOldestXmin(Relation rel, bool ignoreVacuum)
 	return xmin;
 }
 
+/*
+ * -------------------------------------------
+ * Lock-free index of transaction states.
+ * It is used by visibility checks to avoid obtaining MtmLock for each tuple.
+ * Index is modified only together with MtmXid2State under exclusive MtmLock.
+ * Entries are placed within MTM_XID_MAP_MAX_PROBES slots from their home position, 
+ * so lookup never inspects more slots. Transactions which can not be placed are counted in Mtm->xidMapOverflow:
+ * until them are removed, readers have to fall back to MtmXid2State hash.
+ * -------------------------------------------
+ */
+
+static inline uint32 MtmXidMapHome(TransactionId xid)
+{
+	return DatumGetUInt32(hash_uint32(xid)) & (MTM_XID_MAP_SIZE-1);
+}
+
+static void MtmXidMapInsert(MtmTransState* ts)
+{
+	uint32 home = MtmXidMapHome(ts->xid);
+	int i;
+	for (i = 0; i < MTM_XID_MAP_MAX_PROBES; i++) {
+		MtmXidMapSlot* slot = &Mtm->xidMap[(home + i) & (MTM_XID_MAP_SIZE-1)];
+		TransactionId slotXid = pg_atomic_read_u32(&slot->xid);
+		if (slotXid == InvalidTransactionId || slotXid == MTM_XID_MAP_DELETED) {
+			slot->state = ts;
+			pg_write_barrier(); /* state of transaction should be visible before it is published */
+			pg_atomic_write_u32(&slot->xid, ts->xid);
+			return;
+		}
+		Assert(slotXid != ts->xid);
+	}
+	MTM_LOG1("Transaction %llu is not placed in xid map", (long64)ts->xid);
+	pg_atomic_fetch_add_u32(&Mtm->xidMapOverflow, 1);
+}
+
+static void MtmXidMapRemove(TransactionId xid)
+{
+	uint32 home = MtmXidMapHome(xid);
+	int i;
+	for (i = 0; i < MTM_XID_MAP_MAX_PROBES; i++) {
+		MtmXidMapSlot* slot = &Mtm->xidMap[(home + i) & (MTM_XID_MAP_SIZE-1)];
+		TransactionId slotXid = pg_atomic_read_u32(&slot->xid);
+		if (slotXid == xid) { 
+			pg_atomic_write_u32(&slot->xid, MTM_XID_MAP_DELETED);
+			return;
+		}
+		if (slotXid == InvalidTransactionId) { 
+			break;
+		}
+	}
+	/* Transaction was not placed in the index */
+	Assert(pg_atomic_read_u32(&Mtm->xidMapOverflow) != 0);
+	pg_atomic_fetch_sub_u32(&Mtm->xidMapOverflow, 1);
+}
+
+static MtmTransState* MtmXidMapLookup(TransactionId xid)
+{
+	uint32 home = MtmXidMapHome(xid);
+	int i;
+	for (i = 0; i < MTM_XID_MAP_MAX_PROBES; i++) {
+		MtmXidMapSlot* slot = &Mtm->xidMap[(home + i) & (MTM_XID_MAP_SIZE-1)];
+		TransactionId slotXid = pg_atomic_read_u32(&slot->xid);
+		if (slotXid == xid) { 
+			pg_read_barrier();
+			return slot->state;
+		}
+		if (slotXid == InvalidTransactionId) { 
+			break;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Get status and CSN of transaction without obtaining MtmLock. 
+ * Status is read before CSN: transaction is marked as committed only after its final CSN is assigned.
+ * Returns NULL if transaction is not found.
+ */
+static MtmTransState* MtmGetTransState(TransactionId xid, XidStatus* status, csn_t* csn)
+{
+	MtmTransState* ts;
+	if (pg_atomic_read_u32(&Mtm->xidMapOverflow) != 0) { 
+		MtmLock(LW_SHARED);
+		ts = (MtmTransState*)hash_search(MtmXid2State, &xid, HASH_FIND, NULL);
+		if (ts != NULL) { 
+			*status = ts->status;
+			*csn = ts->csn;
+		}
+		MtmUnlock();
+		return ts;
+	}
+	while ((ts = MtmXidMapLookup(xid)) != NULL) { 
+		*status = ts->status;
+		pg_read_barrier();
+		*csn = ts->csn;
+		pg_read_barrier();
+		if (ts->xid == xid) { 
+			break;
+		}
+		/* Entry was removed and reused by some other transaction: retry lookup */
+	}
+	return ts;
+}
+
+/*
+ * Wait until in-doubt transaction is resolved.
+ * Backend publishes XID it is waiting for and is woken up through its latch by MtmWakeUpInDoubtWaiters 
+ * when final status of transaction is set. Timeout only protects from lost wakeups.
+ */
+static void MtmWaitInDoubtTransaction(TransactionId xid, timestamp_t timeout)
+{
+	pg_atomic_uint32* slot;
+	XidStatus status;
+	csn_t csn;
+
+	if (MyProc == NULL) { 
+		MtmSleep(timeout);
+		return;
+	}
+	slot = &Mtm->inDoubtWaiters[MyProc->pgprocno];
+	pg_atomic_fetch_add_u32(&Mtm->nInDoubtWaiters, 1);
+	pg_atomic_write_u32(slot, xid);
+	pg_memory_barrier(); /* pairs with barrier in MtmAdjustSubtransactions */
+	if (MtmGetTransState(xid, &status, &csn) != NULL && status == TRANSACTION_STATUS_UNKNOWN) { 
+		int rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, 
+						   Max(USEC_TO_MSEC(timeout), 1));
+		if (rc & WL_LATCH_SET) { 
+			ResetLatch(MyLatch);
+		}
+	}
+	pg_atomic_write_u32(slot, InvalidTransactionId);
+	pg_atomic_fetch_sub_u32(&Mtm->nInDoubtWaiters, 1);
+}
+
+static void MtmWakeUpInDoubtWaiters(TransactionId xid)
+{
+	int i, n = ProcGlobal->allProcCount;
+	for (i = 0; i < n; i++) { 
+		if (pg_atomic_read_u32(&Mtm->inDoubtWaiters[i]) == xid) { 
+			SetLatch(&ProcGlobal->allProcs[i].procLatch);
+		}
+	}
+}
+
 bool MtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
 {	
 #if TRACE_SLEEP_TIME
@@ -470,8 +634,6 @@ bool MtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
 	if (!MtmUseDtm) { 
 		return PgXidInMVCCSnapshot(xid, snapshot);
 	}
-	MtmLock(LW_SHARED);
-
 #if TRACE_SLEEP_TIME
     if (firstReportTime == 0) {
         firstReportTime = MtmGetCurrentTime();
@@ -480,27 +642,27 @@ bool MtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
     
 	for (i = 0; i < MAX_WAIT_LOOPS; i++)
     {
-        MtmTransState* ts = (MtmTransState*)hash_search(MtmXid2State, &xid, HASH_FIND, NULL);
+        XidStatus status;
+        csn_t csn;
+        MtmTransState* ts = MtmGetTransState(xid, &status, &csn);
         if (ts != NULL /*&& ts->status != TRANSACTION_STATUS_IN_PROGRESS*/)
         {
-            if (ts->csn > MtmTx.snapshot) { 
+            if (csn > MtmTx.snapshot) { 
                 MTM_LOG4("%d: tuple with xid=%d(csn=%lld) is invisibile in snapshot %lld",
-						 MyProcPid, xid, ts->csn, MtmTx.snapshot);
+						 MyProcPid, xid, csn, MtmTx.snapshot);
 				if (MtmGetSystemTime() - start > USECS_PER_SEC) { 
 					elog(WARNING, "Backend %d waits for transaction %s (%llu) status %lld usecs", MyProcPid, ts->gid, (long64)xid, MtmGetSystemTime() - start);
 				}
-				MtmUnlock();
                 return true;
             }
-            if (ts->status == TRANSACTION_STATUS_UNKNOWN)
+            if (status == TRANSACTION_STATUS_UNKNOWN)
             {
                 MTM_LOG3("%d: wait for in-doubt transaction %u in snapshot %llu", MyProcPid, xid, MtmTx.snapshot);
-                MtmUnlock();
 #if TRACE_SLEEP_TIME
                 {
                 timestamp_t delta, now = MtmGetCurrentTime();
 #endif
-                MtmSleep(delay);
+                MtmWaitInDoubtTransaction(xid, delay);
 #if TRACE_SLEEP_TIME
                 delta = MtmGetCurrentTime() - now;
                 totalSleepTime += delta;
@@ -520,14 +682,12 @@ bool MtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
                 if (delay*2 <= MAX_WAIT_TIMEOUT) {
                     delay *= 2;
                 }
-				MtmLock(LW_SHARED);
             }
             else
             {
-                bool invisible = ts->status != TRANSACTION_STATUS_COMMITTED;
+                bool invisible = status != TRANSACTION_STATUS_COMMITTED;
                 MTM_LOG4("%d: tuple with xid=%d(csn= %lld) is %s in snapshot %lld",
-						 MyProcPid, xid, ts->csn, invisible ? "rollbacked" : "committed", MtmTx.snapshot);
-                MtmUnlock();
+						 MyProcPid, xid, csn, invisible ? "rollbacked" : "committed", MtmTx.snapshot);
 				if (MtmGetSystemTime() - start > USECS_PER_SEC) { 
 					elog(WARNING, "Backend %d waits for %s transaction %s (%llu) %lld usecs", MyProcPid, invisible ? "rollbacked" : "committed", 
 						 ts->gid, (long64)xid, MtmGetSystemTime() - start);
@@ -538,11 +698,9 @@ bool MtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
         else
         {
             MTM_LOG4("%d: visibility check is skept for transaction %u in snapshot %llu", MyProcPid, xid, MtmTx.snapshot);
-			MtmUnlock();
 			return PgXidInMVCCSnapshot(xid, snapshot);
         }
     }
-	MtmUnlock();
 	elog(ERROR, "Failed to get status of XID %llu in %lld usec", (long64)xid, MtmGetSystemTime() - start);
 	return true;
 }    
@@ -595,6 +753,7 @@ MtmAdjustOldestXid(TransactionId xid)
 		{ 
 			if (prev != NULL) { 
 				/* Remove information about too old transactions */
+				MtmXidMapRemove(prev->xid);
 				hash_search(MtmXid2State, &prev->xid, HASH_REMOVE, NULL);
 				hash_search(MtmGid2State, &prev->gid, HASH_REMOVE, NULL);
 			}
@@ -651,6 +810,61 @@ static void MtmTransactionListInsertAfter(MtmTransState* after, MtmTransState* t
     }
 }
 
+/*
+ * Exclude committed or aborted transaction from L2 list of in-doubt transactions.
+ * Should be called under exclusive MtmLock.
+ */
+void MtmInDoubtListRemove(MtmTransState* ts)
+{
+	if (!ts->isInDoubt) { 
+		return;
+	}
+	if (ts->prevInDoubt != NULL) { 
+		ts->prevInDoubt->nextInDoubt = ts->nextInDoubt;
+	} else { 
+		Mtm->inDoubtListHead = ts->nextInDoubt;
+	}
+	if (ts->nextInDoubt != NULL) { 
+		ts->nextInDoubt->prevInDoubt = ts->prevInDoubt;
+	} else { 
+		Mtm->inDoubtListTail = ts->prevInDoubt;
+	}
+	ts->isInDoubt = false;
+}
+
+/*
+ * Include transaction in L2 list of in-doubt transactions. Should be called under exclusive MtmLock
+ * after transaction status is set to TRANSACTION_STATUS_UNKNOWN and its CSN is assigned.
+ * Transactions usually become in-doubt in CSN order, so the list is scanned from the tail.
+ */
+void MtmInDoubtListInsert(MtmTransState* ts)
+{
+	MtmTransState* prev;
+
+	if (ts->isInDoubt) { 
+		MtmInDoubtListRemove(ts);
+	}
+	prev = Mtm->inDoubtListTail;
+	while (prev != NULL && prev->csn > ts->csn) { 
+		prev = prev->prevInDoubt;
+	}
+
+	ts->prevInDoubt = prev;
+	if (prev != NULL) { 
+		ts->nextInDoubt = prev->nextInDoubt;
+		prev->nextInDoubt = ts;
+	} else { 
+		ts->nextInDoubt = Mtm->inDoubtListHead;
+		Mtm->inDoubtListHead = ts;
+	}
+	if (ts->nextInDoubt != NULL) { 
+		ts->nextInDoubt->prevInDoubt = ts;
+	} else { 
+		Mtm->inDoubtListTail = ts;
+	}
+	ts->isInDoubt = true;
+}
+
 static void MtmAddSubtransactions(MtmTransState* ts, TransactionId* subxids, int nSubxids)
 {
     int i;
@@ -663,10 +877,12 @@ static void MtmAddSubtransactions(MtmTransState* ts, TransactionId* subxids, int
         Assert(!found);
 		sts->isActive = false;
 		sts->isPinned = false;
+		sts->isInDoubt = false;
         sts->status = ts->status;
         sts->csn = ts->csn;
 		sts->votingCompleted = true;
         MtmTransactionListInsertAfter(ts, sts);
+		MtmXidMapInsert(sts);
     }
 }
 
@@ -678,8 +894,20 @@ void MtmAdjustSubtransactions(MtmTransState* ts)
 
     for (i = 0; i < nSubxids; i++) {
 		sts = sts->next;
-		sts->status = ts->status;
 		sts->csn = ts->csn;
+		pg_write_barrier(); /* see MtmGetTransState */
+		sts->status = ts->status;
+	}
+	if (ts->status == TRANSACTION_STATUS_COMMITTED || ts->status == TRANSACTION_STATUS_ABORTED) { 
+		/* Wakeup backends waiting in MtmWaitInDoubtTransaction for resolution of this transaction */
+		pg_memory_barrier();
+		if (pg_atomic_read_u32(&Mtm->nInDoubtWaiters) != 0) { 
+			MtmWakeUpInDoubtWaiters(ts->xid);
+			for (i = 0, sts = ts; i < nSubxids; i++) {
+				sts = sts->next;
+				MtmWakeUpInDoubtWaiters(sts->xid);
+			}
+		}
 	}
 }
 
@@ -751,6 +979,7 @@ MtmResetTransaction()
 	x->isPrepared = false;
 	x->isSuspended = false;
 	x->isTwoPhase = false;
+	x->isStaleSnapshot = false;
 	x->csn = INVALID_CSN;
 	x->status = TRANSACTION_STATUS_UNKNOWN;
 	x->gid[0] = '\0';
@@ -792,7 +1021,7 @@ MtmBeginTransaction(MtmCurrentTrans* x)
 			elog(ERROR, "Multimaster node is not online: current status %s", MtmNodeStatusMnem[Mtm->status]);
 		}
 		x->containsDML = false;
-        x->snapshot = MtmAssignCSN();	
+		MtmChooseSnapshot(x);
 		x->gtid.xid = InvalidTransactionId;
 		x->gid[0] = '\0';
 		x->status = TRANSACTION_STATUS_IN_PROGRESS;
@@ -814,6 +1043,50 @@ MtmBeginTransaction(MtmCurrentTrans* x)
 }
 
 
+/*
+ * Get the newest CSN preceding all in-doubt transactions at this node.
+ * Snapshot with such CSN never waits in MtmXidInMVCCSnapshot: transactions which are in-doubt now have larger CSNs
+ * and transactions becoming in-doubt later get new CSN at precommit, which is larger than 'now'.
+ * In-doubt transactions are kept ordered by CSN, so it is enough to check the head of the list.
+ * Should be called under MtmLock, shared lock is enough.
+ */
+static csn_t MtmGetStableCSN(csn_t now)
+{
+	MtmTransState* ts = Mtm->inDoubtListHead;
+	return (ts != NULL && ts->csn <= now) ? ts->csn - 1 : now;
+}
+
+/*
+ * Assign CSN snapshot to the transaction.
+ * Read-only transactions may use slightly stale snapshot which precedes all in-doubt transactions,
+ * so that their visibility checks never wait for resolution of 2PC.
+ * Should be called under exclusive MtmLock before the transaction takes its first snapshot.
+ */
+static void
+MtmChooseSnapshot(MtmCurrentTrans* x)
+{
+	x->snapshot = MtmAssignCSN();
+	x->isStaleSnapshot = false;
+	MtmUseStableSnapshot(x);
+}
+
+/*
+ * Replace snapshot of read-only transaction with stable CSN if its staleness doesn't exceed
+ * multimaster.max_read_only_staleness, otherwise keep the current snapshot.
+ * Should be called under MtmLock, shared lock is enough.
+ */
+static void
+MtmUseStableSnapshot(MtmCurrentTrans* x)
+{
+	if (MtmMaxReadOnlyStaleness != 0 && MtmUseDtm && XactReadOnly && !x->isReplicated) { 
+		csn_t stable = MtmGetStableCSN(x->snapshot);
+		if (stable != x->snapshot && x->snapshot - stable <= MSEC_TO_USEC(MtmMaxReadOnlyStaleness)) { 
+			x->isStaleSnapshot = true;
+			x->snapshot = stable;
+		}
+	}
+}
+
 static MtmTransState* 
 MtmCreateTransState(MtmCurrentTrans* x)
 {
@@ -826,10 +1099,6 @@ MtmCreateTransState(MtmCurrentTrans* x)
 	ts->isTwoPhase = x->isTwoPhase;
 	ts->isPinned = false;
 	ts->votingCompleted = false;
-	if (!found) {
-		ts->isEnqueued = false;
-		ts->isActive = false;
-	}
 	if (TransactionIdIsValid(x->gtid.xid)) { 		
 		Assert(x->gtid.node != MtmNodeId);
 		ts->gtid = x->gtid;
@@ -839,6 +1108,14 @@ MtmCreateTransState(MtmCurrentTrans* x)
 		ts->gtid.node = MtmNodeId;
 	}
 	strcpy(ts->gid, x->gid);
+	if (!found) {
+		ts->isEnqueued = false;
+		ts->isActive = false;
+		ts->isInDoubt = false;
+		MtmXidMapInsert(ts);
+	} else { 
+		MtmInDoubtListRemove(ts);
+	}
 	return ts;
 }
 
@@ -885,6 +1162,7 @@ MtmPrePrepareTransaction(MtmCurrentTrans* x)
 	ts->isLocal = x->isReplicated || !x->containsDML;
 	ts->snapshot = x->snapshot;
 	ts->csn = MtmAssignCSN();	
+	ts->votingStart = MtmGetCurrentTime(); /* CSN may be adjusted, so it can't be used to measure latency */
 	ts->procno = MyProc->pgprocno;
 	ts->votingCompleted = false;
 	ts->participantsMask = (((nodemask_t)1 << Mtm->nAllNodes) - 1) & ~Mtm->disabledNodeMask & ~((nodemask_t)1 << (MtmNodeId-1));
@@ -925,7 +1203,7 @@ bool MtmWatchdog(timestamp_t now)
 	for (i = 0; i < n; i++) { 
 		if (i+1 != MtmNodeId && !BIT_CHECK(Mtm->disabledNodeMask, i)) {
 			if (Mtm->nodes[i].lastHeartbeat != 0
-				&& now > Mtm->nodes[i].lastHeartbeat + MSEC_TO_USEC(MtmHeartbeatRecvTimeout)) 
+				&& now > Mtm->nodes[i].lastHeartbeat + MtmGetNodeFailureTimeout(i+1)) 
 			{ 
 				elog(WARNING, "Heartbeat is not received from node %d during %d msec", 
 					 i+1, (int)USEC_TO_MSEC(now - Mtm->nodes[i].lastHeartbeat));
@@ -937,6 +1215,141 @@ bool MtmWatchdog(timestamp_t now)
 	return allAlive;
 }
 
+/*
+ * -------------------------------------------
+ * Phi-accrual failure detector.
+ * Arbiter learns distribution of heartbeat inter-arrival times for each link (exponentially weighted mean and variance).
+ * Node is suspected when probability to receive its next heartbeat so late drops below 10^-multimaster.failure_detector_phi.
+ * Node exclusion and 2PC voting timeouts are derived from this distribution.
+ * Fixed timeouts are used if failure detector is disabled or until enough heartbeats are received from the node.
+ * -------------------------------------------
+ */
+
+#define MTM_FD_MIN_SAMPLES      16         /* Number of samples needed to trust learned distribution */
+#define MTM_FD_SAMPLE_WEIGHT    (1.0/32)   /* Weight of new sample in moving average and variance */
+#define MTM_FD_MIN_STDDEV_RATIO 0.1        /* Minimal standard deviation relative to mean interval */
+
+/*
+ * Account arrival of heartbeat from the node. Called by arbiter receiver under exclusive MtmLock.
+ */
+void MtmUpdateHeartbeatStatistics(int nodeId, timestamp_t now)
+{
+	MtmNodeInfo* node = &Mtm->nodes[nodeId-1];
+	if (node->lastHeartbeatArrival != 0) { 
+		double interval = now - node->lastHeartbeatArrival;
+		/* Gaps caused by disconnection of the node should not affect distribution */
+		if (interval <= MSEC_TO_USEC(MtmHeartbeatRecvTimeout)) { 
+			if (node->nHeartbeatIntervals == 0) { 
+				node->heartbeatIntervalMean = interval;
+				node->heartbeatIntervalVar = 0;
+			} else { 
+				double diff = interval - node->heartbeatIntervalMean;
+				node->heartbeatIntervalMean += MTM_FD_SAMPLE_WEIGHT*diff;
+				node->heartbeatIntervalVar = (1 - MTM_FD_SAMPLE_WEIGHT)*(node->heartbeatIntervalVar + MTM_FD_SAMPLE_WEIGHT*diff*diff);
+			}
+			if (node->nHeartbeatIntervals < MTM_FD_MIN_SAMPLES) { 
+				node->nHeartbeatIntervals += 1;
+			}
+		}
+	}
+	node->lastHeartbeatArrival = now;
+}
+
+/*
+ * Deviation from the mean interval (in standard deviations) at which phi reaches multimaster.failure_detector_phi.
+ * Phi is calculated using logistic approximation of normal distribution: phi(y) = log10(1 + exp(y*(1.5976 + 0.070566*y^2))),
+ * so we have to find root of y*(1.5976 + 0.070566*y^2) = ln(10^phi - 1). It is done by Newton's method.
+ */
+static double MtmFailureDetectorDeviation(void)
+{
+	static double phi;
+	static double y;
+	if (phi != MtmFailureDetectorPhi) { 
+		double target = log(pow(10.0, MtmFailureDetectorPhi) - 1);
+		int i;
+		y = target/1.5976;
+		for (i = 0; i < 32; i++) { 
+			y -= (y*(1.5976 + 0.070566*y*y) - target)/(1.5976 + 3*0.070566*y*y);
+		}
+		phi = MtmFailureDetectorPhi;
+	}
+	return y;
+}
+
+/*
+ * Learned bound of heartbeat inter-arrival time for the node (usec), or 0 if it is not known
+ */
+static timestamp_t MtmGetHeartbeatIntervalBound(int nodeId)
+{
+	MtmNodeInfo* node = &Mtm->nodes[nodeId-1];
+	double mean, stddev;
+
+	if (MtmFailureDetectorPhi == 0 || node->nHeartbeatIntervals < MTM_FD_MIN_SAMPLES) { 
+		return 0;
+	}
+	mean = node->heartbeatIntervalMean;
+	stddev = Max(sqrt(node->heartbeatIntervalVar), mean*MTM_FD_MIN_STDDEV_RATIO);
+	return (timestamp_t)(mean + stddev*MtmFailureDetectorDeviation());
+}
+
+/*
+ * Time since the last message from the node after which it is considered to be dead.
+ * Learned timeout is not smaller than two heartbeat send periods and not larger than multimaster.heartbeat_recv_timeout.
+ */
+static timestamp_t MtmGetNodeFailureTimeout(int nodeId)
+{
+	timestamp_t timeout = MSEC_TO_USEC(MtmHeartbeatRecvTimeout);
+	timestamp_t bound = MtmGetHeartbeatIntervalBound(nodeId);
+	if (bound != 0) { 
+		timeout = Min(Max(bound, MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2), timeout);
+	}
+	return timeout;
+}
+
+/*
+ * Time to wait votes from participants of 2PC transaction in addition to time needed to prepare transaction
+ */
+static timestamp_t MtmGet2PCTimeout(nodemask_t participantsMask)
+{
+	timestamp_t timeout = 0;
+	int i;
+	for (i = 0; i < Mtm->nAllNodes; i++) { 
+		if (BIT_CHECK(participantsMask, i)) { 
+			timestamp_t bound = MtmGetHeartbeatIntervalBound(i+1);
+			timeout = Max(timeout, bound != 0 ? Max(bound, MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2) : MSEC_TO_USEC(MtmMin2PCTimeout));
+		}
+	}
+	return timeout != 0 ? timeout : MSEC_TO_USEC(MtmMin2PCTimeout);
+}
+
+/*
+ * Time in which all alive nodes are expected to send heartbeat and so replicate their connectivity masks
+ */
+static timestamp_t MtmGetClusterStabilizationDelay(void)
+{
+	timestamp_t delay = 0;
+	int i;
+	for (i = 0; i < Mtm->nAllNodes; i++) { 
+		if (i+1 != MtmNodeId && !BIT_CHECK(Mtm->disabledNodeMask, i)) { 
+			timestamp_t bound = MtmGetHeartbeatIntervalBound(i+1);
+			/* double timeout to condider worst case when heartbeat send interval is added with refresh cluster status interval */
+			if (bound == 0 || bound > MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2) { 
+				return MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2;
+			}
+			delay = Max(delay, bound);
+		}
+	}
+	return delay != 0 ? delay : MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2;
+}
+
+/*
+ * Period of checking heartbeats by arbiter receiver (milliseconds)
+ */
+int MtmGetWatchdogPeriod(void)
+{
+	return MtmFailureDetectorPhi != 0 ? Min(MtmHeartbeatSendTimeout, MtmHeartbeatRecvTimeout) : MtmHeartbeatRecvTimeout;
+}
+
 /* 
  * Mark transaction as precommitted
  */
@@ -954,6 +1367,7 @@ void MtmPrecommitTransaction(char const* gid)
 			if (ts->status == TRANSACTION_STATUS_IN_PROGRESS) {
 				ts->status = TRANSACTION_STATUS_UNKNOWN;
 				ts->csn = MtmAssignCSN();
+				MtmInDoubtListInsert(ts);
 				MtmAdjustSubtransactions(ts);
 				if (Mtm->status != MTM_RECOVERY) {
 					MtmSend2PCMessage(ts, MSG_PRECOMMITTED);
@@ -1007,6 +1421,7 @@ MtmVotingCompleted(MtmTransState* ts)
 			ts->csn = MtmAssignCSN();
 			ts->votingCompleted = true;
 			ts->status = TRANSACTION_STATUS_UNKNOWN;
+			MtmInDoubtListInsert(ts);
 			return true;
 		} else {
 			MTM_LOG1("Transaction %s is considered as prepared (status=%s participants=%llx disabled=%llx, voted=%llx)", 
@@ -1025,6 +1440,7 @@ MtmVotingCompleted(MtmTransState* ts)
 				return false;
 			} else {
 				ts->status = TRANSACTION_STATUS_UNKNOWN;
+				MtmInDoubtListInsert(ts);
 				ts->votingCompleted = true;
 				return true;
 			}
@@ -1039,7 +1455,7 @@ Mtm2PCVoting(MtmCurrentTrans* x, MtmTransState* ts)
 {
 	int result = 0;
 	timestamp_t prepareTime = ts->csn - ts->snapshot;
-	timestamp_t timeout = Max(prepareTime + MSEC_TO_USEC(MtmMin2PCTimeout), prepareTime*MtmMax2PCRatio/100);
+	timestamp_t timeout = Max(prepareTime + MtmGet2PCTimeout(ts->participantsMask), prepareTime*MtmMax2PCRatio/100);
 	timestamp_t start = MtmGetSystemTime();
 	timestamp_t deadline = start + timeout;
 	timestamp_t now;
@@ -1091,6 +1507,7 @@ Mtm2PCVoting(MtmCurrentTrans* x, MtmTransState* ts)
 		}
 	}
 	x->status = ts->status;
+	MtmLatencyAddSince(MtmNodeId, MTM_LATENCY_VOTE, ts->votingStart);
 	MTM_LOG3("%d: Result of vote: %d", MyProcPid, MtmTxnStatusMnem[ts->status]);
 }
 		
@@ -1123,10 +1540,12 @@ MtmPostPrepareTransaction(MtmCurrentTrans* x)
 			MtmSend2PCMessage(ts, MSG_PREPARED); /* send notification to coordinator */
 			if (!MtmUseDtm) { 
 				ts->status = TRANSACTION_STATUS_UNKNOWN;
+				MtmInDoubtListInsert(ts);
 			}
 		} else {
 			MTM_TXTRACE(x, "recovery? 3");
 			ts->status = TRANSACTION_STATUS_UNKNOWN;
+			MtmInDoubtListInsert(ts);
 		}
 		MTM_TXTRACE(x, "recovery? 4");
 		MtmUnlock();
@@ -1135,6 +1554,7 @@ MtmPostPrepareTransaction(MtmCurrentTrans* x)
 		MTM_TXTRACE(x, "recovery? 6");
 	} else if (!ts->isLocal)  { 
 		MTM_TXTRACE(x, "not recovery?");
+		MtmLatencyAddSince(MtmNodeId, MTM_LATENCY_PREPARE, ts->votingStart);
 		Mtm2PCVoting(x, ts);
 		MtmUnlock();
 		if (x->isTwoPhase) { 
@@ -1171,6 +1591,7 @@ MtmPreCommitPreparedTransaction(MtmCurrentTrans* x)
 
 		Assert(MtmIsCoordinator(ts));
 		if (!ts->isLocal) { 
+			timestamp_t start = MtmGetCurrentTime();
 			ts->votingCompleted = false;
 			ts->votedMask = 0;
 			ts->procno = MyProc->pgprocno;
@@ -1178,6 +1599,7 @@ MtmPreCommitPreparedTransaction(MtmCurrentTrans* x)
 			Assert(replorigin_session_origin == InvalidRepOriginId);
 			MtmUnlock();
 			SetPreparedTransactionState(ts->gid, MULTIMASTER_PRECOMMITTED);
+			MtmLatencyAddSince(MtmNodeId, MTM_LATENCY_PRECOMMIT, start);
 			//MtmSend2PCMessage(ts, MSG_PRECOMMIT);
 			MtmLock(LW_EXCLUSIVE);
 
@@ -1262,12 +1684,14 @@ MtmEndTransaction(MtmCurrentTrans* x, bool commit)
 					elog(ERROR, "Attempt to commit %s transaction %s (%llu)", 
 						 MtmTxnStatusMnem[ts->status], ts->gid, (long64)ts->xid);
 				}
+				MtmInDoubtListRemove(ts);
 				if (x->csn > ts->csn || Mtm->status == MTM_RECOVERY) {
 					Assert(x->csn != INVALID_CSN);
 					ts->csn = x->csn;
 					MtmSyncClock(ts->csn);
 				}
 				Mtm->lastCsn = ts->csn;
+				pg_write_barrier(); /* final CSN should be visible to MtmGetTransState before status */
 				ts->status = TRANSACTION_STATUS_COMMITTED;
 				Assert(ts->isActive);
 				ts->isActive = false;
@@ -1294,7 +1718,9 @@ MtmEndTransaction(MtmCurrentTrans* x, bool commit)
 				if (!found) { 
 					ts->isEnqueued = false;
 					ts->isActive = false;
+					ts->isInDoubt = false;
 				}
+				MtmInDoubtListRemove(ts);
 				ts->status = TRANSACTION_STATUS_ABORTED;
 				ts->isLocal = true;
 				ts->isPrepared = false;
@@ -1306,6 +1732,9 @@ MtmEndTransaction(MtmCurrentTrans* x, bool commit)
 				ts->nSubxids = 0;
 				ts->votingCompleted = true;
 				strcpy(ts->gid, x->gid);
+				if (!found) { 
+					MtmXidMapInsert(ts);
+				}
 				if (ts->isActive) { 
 					ts->isActive = false;
 					Assert(Mtm->nActiveTransactions != 0);
@@ -1320,7 +1749,10 @@ MtmEndTransaction(MtmCurrentTrans* x, bool commit)
 			}
 			MtmSend2PCMessage(ts, MSG_ABORTED); /* send notification to coordinator */
 		} else if (x->status == TRANSACTION_STATUS_ABORTED && x->isReplicated && !x->isPrepared) {
-			hash_search(MtmXid2State, &x->xid, HASH_REMOVE, NULL);
+			if (hash_search(MtmXid2State, &x->xid, HASH_FIND, NULL) != NULL) { 
+				MtmXidMapRemove(x->xid);
+				hash_search(MtmXid2State, &x->xid, HASH_REMOVE, NULL);
+			}
 		}
 		MtmUnlock();
 	}
@@ -1443,6 +1875,7 @@ static void	MtmLoadPreparedTransactions(void)
 			Mtm->nActiveTransactions += 1;
 			ts->isEnqueued = false;
 			ts->isActive = true;
+			ts->isInDoubt = false;
 			ts->status = strcmp(pxacts[i].state_3pc, MULTIMASTER_PRECOMMITTED) == 0 ? TRANSACTION_STATUS_UNKNOWN : TRANSACTION_STATUS_IN_PROGRESS;
 			ts->isLocal = true;
 			ts->isPrepared = true;
@@ -1450,6 +1883,9 @@ static void	MtmLoadPreparedTransactions(void)
 			ts->snapshot = INVALID_CSN;
 			ts->isTwoPhase = false;
 			ts->csn = 0; /* should be replaced with real CSN by poll result */
+			if (ts->status == TRANSACTION_STATUS_UNKNOWN) { 
+				MtmInDoubtListInsert(ts);
+			}
 			ts->gtid.node = MtmNodeId;
 			ts->gtid.xid = xid;
 			ts->nSubxids = 0;
@@ -1459,6 +1895,7 @@ static void	MtmLoadPreparedTransactions(void)
 			ts->votedMask = 0;
 			strcpy(ts->gid, gid);
 			MtmTransactionListAppend(ts);			
+			MtmXidMapInsert(ts);
 			tm->status = ts->status;
 			tm->state = ts;
 			MtmBroadcastPollMessage(ts);
@@ -1603,6 +2040,14 @@ csn_t MtmGetTransactionCSN(TransactionId xid)
 	return csn;
 }
 	
+/*
+ * Procnos of backends which wakeup is deferred until the end of wakeup batch.
+ * MtmWakeUpBatchUsed is -1 when wakeups are not deferred.
+ */
+static int* MtmWakeUpBatch;
+static int  MtmWakeUpBatchSize;
+static int  MtmWakeUpBatchUsed = -1;
+
 /* 
  * Wakeup coordinator's backend when voting is completed
  */
@@ -1612,8 +2057,37 @@ void MtmWakeUpBackend(MtmTransState* ts)
 		MTM_TXTRACE(ts, "MtmWakeUpBackend");
 		MTM_LOG3("Wakeup backed procno=%d, pid=%d", ts->procno, ProcGlobal->allProcs[ts->procno].pid);
 		ts->votingCompleted = true;
-		SetLatch(&ProcGlobal->allProcs[ts->procno].procLatch); 
+		if (MtmWakeUpBatchUsed >= 0) { 
+			if (MtmWakeUpBatchUsed == MtmWakeUpBatchSize) { 
+				MtmWakeUpBatchSize = MtmWakeUpBatchSize == 0 ? 64 : MtmWakeUpBatchSize*2;
+				MtmWakeUpBatch = (int*)(MtmWakeUpBatch == NULL 
+										? MemoryContextAlloc(TopMemoryContext, MtmWakeUpBatchSize*sizeof(int))
+										: repalloc(MtmWakeUpBatch, MtmWakeUpBatchSize*sizeof(int)));
+			}
+			MtmWakeUpBatch[MtmWakeUpBatchUsed++] = ts->procno;
+		} else { 
+			SetLatch(&ProcGlobal->allProcs[ts->procno].procLatch); 
+		}
+	}
+}
+
+/*
+ * Start deferring of backends wakeup. It is used by arbiter receiver while processing batch of votes:
+ * backends are woken up all together by MtmEndWakeUpBatch after release of MtmLock,
+ * so they do not immediately block on the lock still held by receiver.
+ */
+void MtmBeginWakeUpBatch(void)
+{
+	MtmWakeUpBatchUsed = 0;
+}
+
+void MtmEndWakeUpBatch(void)
+{
+	int i;
+	for (i = 0; i < MtmWakeUpBatchUsed; i++) { 
+		SetLatch(&ProcGlobal->allProcs[MtmWakeUpBatch[i]].procLatch); 
 	}
+	MtmWakeUpBatchUsed = -1;
 }
 
 
@@ -1628,6 +2102,7 @@ void MtmAbortTransaction(MtmTransState* ts)
 			elog(LOG, "Attempt to rollback already committed transaction %s (%llu)", ts->gid, (long64)ts->xid);
 		} else { 
 			MTM_LOG1("Rollback active transaction %s (%llu) %d:%llu status %s", ts->gid, (long64)ts->xid, ts->gtid.node, (long64)ts->gtid.xid, MtmTxnStatusMnem[ts->status]);
+			MtmInDoubtListRemove(ts);
 			ts->status = TRANSACTION_STATUS_ABORTED;
 			MtmAdjustSubtransactions(ts);
 			if (ts->isActive) {
@@ -2065,7 +2540,7 @@ void MtmRefreshClusterStatus()
 		 * connectivity graph is stabilized.
 		 */
 		oldClique = newClique;		
-		MtmSleep(MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2); /* double timeout to condider worst case when heartbeat send interval is added with refresh cluster status interval */
+		MtmSleep(MtmGetClusterStabilizationDelay());
 		MtmBuildConnectivityMatrix(matrix);
 		newClique = MtmFindMaxClique(matrix, Mtm->nAllNodes, &cliqueSize);
 	} while (newClique != oldClique);
@@ -2385,12 +2860,15 @@ static void MtmInitialize()
 		Mtm->walSenderLockerMask = 0;
 		Mtm->nodeLockerMask = 0;
 		Mtm->reconnectMask = 0;
+		Mtm->lockGraphResyncMask = 0;
 		Mtm->recoveredLSN = INVALID_LSN;
 		Mtm->nLockers = 0;
 		Mtm->nActiveTransactions = 0;
 		Mtm->votingTransactions = NULL;
         Mtm->transListHead = NULL;
         Mtm->transListTail = &Mtm->transListHead;		
+		Mtm->inDoubtListHead = NULL;
+		Mtm->inDoubtListTail = NULL;
         Mtm->nReceivers = 0;
         Mtm->nSenders = 0;
 		Mtm->timeShift = 0;		
@@ -2403,22 +2881,62 @@ static void MtmInitialize()
 		Mtm->inject2PCError = 0;
 		Mtm->sendQueue = NULL;
 		Mtm->freeQueue = NULL;
+		Mtm->xidMap = (MtmXidMapSlot*)ShmemAlloc(sizeof(MtmXidMapSlot)*MTM_XID_MAP_SIZE);
+		for (i = 0; i < MTM_XID_MAP_SIZE; i++) {
+			pg_atomic_init_u32(&Mtm->xidMap[i].xid, InvalidTransactionId);
+			Mtm->xidMap[i].state = NULL;
+		}
+		pg_atomic_init_u32(&Mtm->xidMapOverflow, 0);
+		Mtm->inDoubtWaiters = (pg_atomic_uint32*)ShmemAlloc(sizeof(pg_atomic_uint32)*ProcGlobal->allProcCount);
+		for (i = 0; i < ProcGlobal->allProcCount; i++) {
+			pg_atomic_init_u32(&Mtm->inDoubtWaiters[i], InvalidTransactionId);
+		}
+		pg_atomic_init_u32(&Mtm->nInDoubtWaiters, 0);
+		for (i = 0; i < MULTIMASTER_MAX_APPLY_STREAMS; i++) {
+			pg_atomic_init_u32(&Mtm->applyStreams[i].refCount, 0);
+			Mtm->applyStreams[i].queue = (shm_mq*)ShmemAlloc(MULTIMASTER_APPLY_STREAM_QUEUE_SIZE);
+		}
 		for (i = 0; i < MtmNodes; i++) {
 			Mtm->nodes[i].oldestSnapshot = 0;
 			Mtm->nodes[i].disabledNodeMask = 0;
 			Mtm->nodes[i].connectivityMask = 0;
-			Mtm->nodes[i].lockGraphUsed = 0;
-			Mtm->nodes[i].lockGraphAllocated = 0;
-			Mtm->nodes[i].lockGraphData = NULL;
 			Mtm->nodes[i].transDelay = 0;
 			Mtm->nodes[i].lastStatusChangeTime = MtmGetSystemTime();
 			Mtm->nodes[i].con = MtmConnections[i];
 			Mtm->nodes[i].flushPos = 0;
 			Mtm->nodes[i].lastHeartbeat = 0;
+			Mtm->nodes[i].lastHeartbeatArrival = 0;
+			Mtm->nodes[i].heartbeatIntervalMean = 0;
+			Mtm->nodes[i].heartbeatIntervalVar = 0;
+			Mtm->nodes[i].nHeartbeatIntervals = 0;
 			Mtm->nodes[i].restartLSN = INVALID_LSN;
 			Mtm->nodes[i].originId = InvalidRepOriginId;
 			Mtm->nodes[i].timeline = 0;
 		}
+		for (i = 0; i < MtmMaxNodes; i++) {
+			int j;
+			Mtm->nodes[i].applySeq = 0;
+			Mtm->nodes[i].applySlots = (MtmApplySlot*)ShmemAlloc(sizeof(MtmApplySlot)*MULTIMASTER_MAX_APPLY_INFLIGHT);
+			for (j = 0; j < MULTIMASTER_MAX_APPLY_INFLIGHT; j++) {
+				pg_atomic_init_u64(&Mtm->nodes[i].applySlots[j].done, 0);
+				Mtm->nodes[i].applySlots[j].nDeps = 0;
+				Mtm->nodes[i].applySlots[j].waitAll = false;
+			}
+			Mtm->nodes[i].lockGraph = (MtmGraph*)ShmemAlloc(sizeof(MtmGraph));
+			memset(Mtm->nodes[i].lockGraph, 0, sizeof(MtmGraph));
+			Mtm->nodes[i].lockGraph->maxEdges = MULTIMASTER_MAX_LOCK_GRAPH_EDGES;
+			Mtm->nodes[i].lockGraph->edges = (MtmEdge*)ShmemAlloc(MULTIMASTER_MAX_LOCK_GRAPH_EDGES*sizeof(MtmEdge));
+			Mtm->nodes[i].latency = (MtmLatencyHistogram*)ShmemAlloc(sizeof(MtmLatencyHistogram)*MTM_LATENCY_PHASES);
+			for (j = 0; j < MTM_LATENCY_PHASES; j++) {
+				int k;
+				pg_atomic_init_u64(&Mtm->nodes[i].latency[j].count, 0);
+				pg_atomic_init_u64(&Mtm->nodes[i].latency[j].sum, 0);
+				pg_atomic_init_u64(&Mtm->nodes[i].latency[j].max, 0);
+				for (k = 0; k < MTM_LATENCY_BUCKETS; k++) {
+					pg_atomic_init_u64(&Mtm->nodes[i].latency[j].buckets[k], 0);
+				}
+			}
+		}
 		Mtm->nodes[MtmNodeId-1].originId = DoNotReplicateId;
 		/* All transaction originated from the current node should be ignored during recovery */
 		Mtm->nodes[MtmNodeId-1].restartLSN = (lsn_t)PG_UINT64_MAX;
@@ -2742,6 +3260,21 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomIntVariable(
+		"multimaster.vote_batch_delay", 
+		"Group commit window in microseconds for 2PC votes",
+		"Arbiter sender waits this time before sending votes to coordinators, so that votes of concurrent transactions are packed in one message. 0 means that only already queued votes are packed together",
+		&MtmVoteBatchDelay,
+		0,
+		0,
+		INT_MAX,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomIntVariable(
 		"multimaster.gc_period",
 		"Number of distributed transactions after which garbage collection is started",
@@ -2785,6 +3318,20 @@ _PG_init(void)
 		NULL,
 		NULL
 	);
+	DefineCustomIntVariable(
+		"multimaster.trans_stream_threshold",
+		"Size (Mb) of transaction after which it is streamed to apply worker while it is received",
+		"Transaction is spilled to the disk only if there are no free apply workers. Streaming is not used if this threshold is larger than trans_spill_threshold",
+		&MtmTransStreamThreshold,
+		16,
+		0,
+		INT_MAX,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
 
 	DefineCustomIntVariable(
 		"multimaster.node_disable_delay",
@@ -2885,6 +3432,19 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomBoolVariable(
+		"multimaster.track_apply_dependencies",
+		"Apply transactions from one node in parallel only if they do not update the same keys",
+		"Transactions updating the same records are applied by workers in the same order as them were committed at origin node",
+		&MtmTrackApplyDependencies,
+		true,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomBoolVariable(
 		"multimaster.volkswagen_mode",
 		"Pretend to be normal postgres. This means skip some NOTICE's and use local sequences. Default false.",
@@ -2943,6 +3503,39 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomIntVariable(
+		"multimaster.max_read_only_staleness",
+		"Maximal staleness of snapshot used by read-only transactions to avoid waiting for in-doubt transactions (milliseconds)",
+		"Read-only transactions use the newest snapshot preceding all in-doubt transactions at this node if it is not older than this value. "
+			"Zero means that read-only transactions always use fresh snapshot.",
+		&MtmMaxReadOnlyStaleness,
+		0,
+		0,
+		INT_MAX,
+		PGC_USERSET,
+		GUC_UNIT_MS,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomRealVariable(
+		"multimaster.failure_detector_phi",
+		"Suspicion level at which node is considered to be dead by phi-accrual failure detector",
+		"Node exclusion and 2PC voting timeouts are derived from the learned distribution of heartbeat inter-arrival times: "
+			"node is suspected when probability to receive its next heartbeat so late drops below 10^-phi. "
+			"Zero disables failure detector, so that fixed timeouts are used.",
+		&MtmFailureDetectorPhi,
+		0.0,
+		0.0,
+		100.0,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomIntVariable(
 		"multimaster.min_2pc_timeout",
 		"Minimal timeout between receiving PREPARED message from nodes participated in transaction to coordinator (milliseconds)",
@@ -3089,7 +3682,7 @@ _PG_init(void)
 	 * the postmaster process.)  We'll allocate or attach to the shared
 	 * resources in mtm_shmem_startup().
 	 */
-	RequestAddinShmemSpace(MTM_SHMEM_SIZE + MtmQueueSize);
+	RequestAddinShmemSpace(MTM_SHMEM_SIZE + MtmQueueSize + MtmMaxNodes*MULTIMASTER_MAX_LOCK_GRAPH_EDGES*sizeof(MtmEdge));
 	RequestNamedLWLockTranche(MULTIMASTER_NAME, 1 + MtmMaxNodes*2);
 
     BgwPoolStart(MtmWorkers, MtmPoolConstructor);
@@ -3878,6 +4471,212 @@ mtm_get_nodes_state(PG_FUNCTION_ARGS)
 	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(usrfctx->desc, usrfctx->values, usrfctx->nulls)));
 }
 
+/*
+ * ********************************************************************************************************
+ * Latency histograms
+ * ********************************************************************************************************
+ */
+
+static char const* const MtmLatencyPhaseMnem[] =
+{
+	"prepare",
+	"vote",
+	"precommit",
+	"commit",
+	"queue"
+};
+
+static int
+MtmLatencyBucket(timestamp_t latency)
+{
+	int shift = 0;
+	int bucket;
+	if (latency < MTM_LATENCY_SUB_BUCKETS) {
+		return (int)latency;
+	}
+	while ((latency >> shift) >= 2*MTM_LATENCY_SUB_BUCKETS) {
+		shift += 1;
+	}
+	bucket = (shift + 1)*MTM_LATENCY_SUB_BUCKETS + (int)((latency >> shift) - MTM_LATENCY_SUB_BUCKETS);
+	return Min(bucket, MTM_LATENCY_BUCKETS-1);
+}
+
+/*
+ * Minimal latency belonging to the bucket
+ */
+static timestamp_t
+MtmLatencyBucketLowerBound(int bucket)
+{
+	if (bucket < MTM_LATENCY_SUB_BUCKETS) {
+		return bucket;
+	}
+	return (timestamp_t)(MTM_LATENCY_SUB_BUCKETS + bucket % MTM_LATENCY_SUB_BUCKETS) << (bucket/MTM_LATENCY_SUB_BUCKETS - 1);
+}
+
+void MtmLatencyAdd(int nodeId, MtmLatencyPhase phase, timestamp_t latency)
+{
+	MtmLatencyHistogram* h;
+	uint64 max;
+
+	if (nodeId <= 0 || nodeId > MtmMaxNodes) {
+		return;
+	}
+	h = &Mtm->nodes[nodeId-1].latency[phase];
+	pg_atomic_fetch_add_u64(&h->buckets[MtmLatencyBucket(latency)], 1);
+	pg_atomic_fetch_add_u64(&h->sum, latency);
+	pg_atomic_fetch_add_u64(&h->count, 1);
+	max = pg_atomic_read_u64(&h->max);
+	while (latency > max && !pg_atomic_compare_exchange_u64(&h->max, &max, latency));
+}
+
+/*
+ * Add latency of the phase started at the specified (adjusted) time
+ */
+void MtmLatencyAddSince(int nodeId, MtmLatencyPhase phase, timestamp_t start)
+{
+	timestamp_t now = MtmGetCurrentTime();
+	MtmLatencyAdd(nodeId, phase, now > start ? now - start : 0);
+}
+
+/*
+ * Find upper bound of latency of specified fraction of samples
+ */
+static timestamp_t
+MtmLatencyPercentile(uint64* buckets, uint64 total, timestamp_t max, double fraction)
+{
+	uint64 threshold = (uint64)(total*fraction);
+	uint64 sum = 0;
+	int i;
+	for (i = 0; i < MTM_LATENCY_BUCKETS-1; i++) {
+		sum += buckets[i];
+		if (sum > threshold) {
+			return Min(MtmLatencyBucketLowerBound(i+1), max);
+		}
+	}
+	return max;
+}
+
+typedef struct
+{
+	int       nodeId;
+	int       phase;
+	int       bucket;
+	TupleDesc desc;
+} MtmGetLatencyCtx;
+
+static MtmGetLatencyCtx*
+MtmGetLatencyInit(FunctionCallInfo fcinfo)
+{
+	FuncCallContext* funcctx;
+	MtmGetLatencyCtx* usrfctx;
+	MemoryContext oldcontext;
+
+	if (SRF_IS_FIRSTCALL()) {
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+		usrfctx = (MtmGetLatencyCtx*)palloc(sizeof(MtmGetLatencyCtx));
+		get_call_result_type(fcinfo, NULL, &usrfctx->desc);
+		usrfctx->nodeId = 1;
+		usrfctx->phase = 0;
+		usrfctx->bucket = 0;
+		funcctx->user_fctx = usrfctx;
+		MemoryContextSwitchTo(oldcontext);
+	}
+	funcctx = SRF_PERCALL_SETUP();
+	return (MtmGetLatencyCtx*)funcctx->user_fctx;
+}
+
+/*
+ * Summary of latency histograms: one row per node and phase
+ */
+Datum
+mtm_get_latency(PG_FUNCTION_ARGS)
+{
+	MtmGetLatencyCtx* usrfctx = MtmGetLatencyInit(fcinfo);
+	FuncCallContext* funcctx = SRF_PERCALL_SETUP();
+	Datum values[Natts_mtm_latency];
+	bool  nulls[Natts_mtm_latency] = {false};
+	uint64 buckets[MTM_LATENCY_BUCKETS];
+	uint64 total = 0;
+	timestamp_t max;
+	MtmLatencyHistogram* h;
+	int i;
+
+	if (usrfctx->phase == MTM_LATENCY_PHASES) {
+		usrfctx->phase = 0;
+		usrfctx->nodeId += 1;
+	}
+	if (usrfctx->nodeId > Mtm->nAllNodes) {
+		SRF_RETURN_DONE(funcctx);
+	}
+	h = &Mtm->nodes[usrfctx->nodeId-1].latency[usrfctx->phase];
+	for (i = 0; i < MTM_LATENCY_BUCKETS; i++) {
+		buckets[i] = pg_atomic_read_u64(&h->buckets[i]);
+		total += buckets[i];
+	}
+	max = pg_atomic_read_u64(&h->max);
+	values[0] = Int32GetDatum(usrfctx->nodeId);
+	values[1] = CStringGetTextDatum(MtmLatencyPhaseMnem[usrfctx->phase]);
+	values[2] = Int64GetDatum(total);
+	values[3] = Int64GetDatum(total ? pg_atomic_read_u64(&h->sum)/total : 0);
+	values[4] = Int64GetDatum(MtmLatencyPercentile(buckets, total, max, 0.5));
+	values[5] = Int64GetDatum(MtmLatencyPercentile(buckets, total, max, 0.9));
+	values[6] = Int64GetDatum(MtmLatencyPercentile(buckets, total, max, 0.99));
+	values[7] = Int64GetDatum(max);
+	usrfctx->phase += 1;
+
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(usrfctx->desc, values, nulls)));
+}
+
+/*
+ * Non-empty buckets of latency histograms
+ */
+Datum
+mtm_get_latency_histogram(PG_FUNCTION_ARGS)
+{
+	MtmGetLatencyCtx* usrfctx = MtmGetLatencyInit(fcinfo);
+	FuncCallContext* funcctx = SRF_PERCALL_SETUP();
+	Datum values[Natts_mtm_latency_bucket];
+	bool  nulls[Natts_mtm_latency_bucket] = {false};
+
+	for (; usrfctx->nodeId <= Mtm->nAllNodes; usrfctx->nodeId++, usrfctx->phase = 0) {
+		for (; usrfctx->phase < MTM_LATENCY_PHASES; usrfctx->phase++, usrfctx->bucket = 0) {
+			MtmLatencyHistogram* h = &Mtm->nodes[usrfctx->nodeId-1].latency[usrfctx->phase];
+			while (usrfctx->bucket < MTM_LATENCY_BUCKETS) {
+				int bucket = usrfctx->bucket++;
+				uint64 count = pg_atomic_read_u64(&h->buckets[bucket]);
+				if (count != 0) {
+					values[0] = Int32GetDatum(usrfctx->nodeId);
+					values[1] = CStringGetTextDatum(MtmLatencyPhaseMnem[usrfctx->phase]);
+					values[2] = Int64GetDatum(MtmLatencyBucketLowerBound(bucket));
+					values[3] = Int64GetDatum(MtmLatencyBucketLowerBound(bucket+1));
+					values[4] = Int64GetDatum(count);
+					SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(usrfctx->desc, values, nulls)));
+				}
+			}
+		}
+	}
+	SRF_RETURN_DONE(funcctx);
+}
+
+Datum
+mtm_reset_latency(PG_FUNCTION_ARGS)
+{
+	int i, j, k;
+	for (i = 0; i < Mtm->nAllNodes; i++) {
+		for (j = 0; j < MTM_LATENCY_PHASES; j++) {
+			MtmLatencyHistogram* h = &Mtm->nodes[i].latency[j];
+			for (k = 0; k < MTM_LATENCY_BUCKETS; k++) {
+				pg_atomic_write_u64(&h->buckets[k], 0);
+			}
+			pg_atomic_write_u64(&h->count, 0);
+			pg_atomic_write_u64(&h->sum, 0);
+			pg_atomic_write_u64(&h->max, 0);
+		}
+	}
+	PG_RETURN_VOID();
+}
+
 Datum
 mtm_get_trans_by_gid(PG_FUNCTION_ARGS)
 {
@@ -3976,8 +4775,8 @@ mtm_get_cluster_state(PG_FUNCTION_ARGS)
 	values[3] = Int64GetDatum(Mtm->nodeLockerMask);
 	values[4] = Int32GetDatum(Mtm->nLiveNodes);
 	values[5] = Int32GetDatum(Mtm->nAllNodes);
-	values[6] = Int32GetDatum((int)Mtm->pool.active);
-	values[7] = Int32GetDatum((int)Mtm->pool.pending);
+	values[6] = Int32GetDatum((int)pg_atomic_read_u32(&Mtm->pool.active));
+	values[7] = Int32GetDatum((int)pg_atomic_read_u32(&Mtm->pool.pending));
 	values[8] = Int64GetDatum(BgwPoolGetQueueSize(&Mtm->pool));
 	values[9] = Int64GetDatum(Mtm->transCount);
 	values[10] = Int64GetDatum(Mtm->timeShift);
@@ -4122,32 +4921,23 @@ Datum mtm_make_table_local(PG_FUNCTION_ARGS)
 Datum mtm_dump_lock_graph(PG_FUNCTION_ARGS)
 {
 	StringInfo s = makeStringInfo();
-	int i;
+	int i, j;
 	for (i = 0; i < Mtm->nAllNodes; i++)
 	{
-		size_t lockGraphSize;
-		char  *lockGraphData;
+		MtmGraph* graph = Mtm->nodes[i].lockGraph;
+		GlobalTransactionId src = {0, InvalidTransactionId};
 		MtmLockNode(i + 1 + MtmMaxNodes, LW_SHARED);
-		lockGraphSize = Mtm->nodes[i].lockGraphUsed;
-		lockGraphData = palloc(lockGraphSize);
-		memcpy(lockGraphData, Mtm->nodes[i].lockGraphData, lockGraphSize);
-		MtmUnlockNode(i + 1 + MtmMaxNodes);
-
-		if (lockGraphData) {
-			GlobalTransactionId *gtid = (GlobalTransactionId *) lockGraphData;
-			GlobalTransactionId *last = (GlobalTransactionId *) (lockGraphData + lockGraphSize);
-			appendStringInfo(s, "node-%d lock graph: ", i+1);
-			while (gtid != last) { 
-				GlobalTransactionId *src = gtid++;
-				appendStringInfo(s, "%d:%llu -> ", src->node, (long64)src->xid);
-				while (gtid->node != 0) {
-					GlobalTransactionId *dst = gtid++;
-					appendStringInfo(s, "%d:%llu, ", dst->node, (long64)dst->xid);
-				}
-				gtid += 1;
+		appendStringInfo(s, "node-%d lock graph: ", i+1);
+		for (j = 0; j < graph->nEdges; j++) { 
+			MtmEdge* e = &graph->edges[j];
+			if (!EQUAL_GTID(e->src, src)) { 
+				src = e->src;
+				appendStringInfo(s, "%s%d:%llu -> ", j == 0 ? "" : "; ", src.node, (long64)src.xid);
 			}
-			appendStringInfo(s, "\n");
+			appendStringInfo(s, "%d:%llu, ", e->dst.node, (long64)e->dst.xid);
 		}
+		MtmUnlockNode(i + 1 + MtmMaxNodes);
+		appendStringInfo(s, "\n");
 	}
 	return CStringGetTextDatum(s->data);
 }
@@ -4165,30 +4955,77 @@ Datum mtm_inject_2pc_error(PG_FUNCTION_ARGS)
  */
 
 /*
- * Execute statement with specified parameters and check its result
+ * Persistent connections to other nodes used to broadcast utility statements.
+ * Connections are established on demand and kept open for the whole life of the backend,
+ * so DDL fan-out doesn't pay connection setup for each statement.
  */
-static bool MtmRunUtilityStmt(PGconn* conn, char const* sql, char **errmsg)
-{
-	PGresult *result = PQexec(conn, sql);
-	int status = PQresultStatus(result);
+static PGconn* MtmBroadcastConns[MAX_NODES];
+static char*   MtmBroadcastConnStrs[MAX_NODES];
+static int     MtmBroadcastNodeIds[MAX_NODES];
+static bool    MtmBroadcastExitRegistered;
 
-	bool ret = status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK;
+/*
+ * Extract error message from result, stripping "ERROR:  " prefix and "\n" suffix
+ */
+static void MtmExtractUtilityError(PGresult* result, char **errmsg)
+{
+	char *errstr = PQresultErrorMessage(result);
+	int errlen = strlen(errstr);
+	if (errlen > 9) { 
+		*errmsg = palloc0(errlen);
+		strncpy(*errmsg, errstr + 8, errlen - 1 - 8);
+	} else { 
+		*errmsg = pstrdup(errstr);
+	}
+}
 
-	if (!ret) {
-		char *errstr = PQresultErrorMessage(result);
-		int errlen = strlen(errstr);
-		if (errlen > 9) { 
-			*errmsg = palloc0(errlen);
+/*
+ * Collect all results of query previously sent by PQsendQuery and check them.
+ * Error message is extracted from the first failed result.
+ */
+static bool MtmCollectUtilityResult(PGconn* conn, char **errmsg)
+{
+	PGresult *result;
+	bool ret = true;
 
-			/* Strip "ERROR:  " from beginning and "\n" from end of error string */
-			strncpy(*errmsg, errstr + 8, errlen - 1 - 8);
+	while ((result = PQgetResult(conn)) != NULL) { 
+		int status = PQresultStatus(result);
+		if (ret && status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK) { 
+			MtmExtractUtilityError(result, errmsg);
+			ret = false;
 		}
+		PQclear(result);
+	}
+	if (ret && PQstatus(conn) != CONNECTION_OK) { 
+		*errmsg = pstrdup(PQerrorMessage(conn));
+		ret = false;
 	}
-
-	PQclear(result);
 	return ret;
 }
 
+/*
+ * Execute statement with specified parameters and check its result
+ */
+static bool MtmRunUtilityStmt(PGconn* conn, char const* sql, char **errmsg)
+{
+	if (!PQsendQuery(conn, sql)) { 
+		*errmsg = pstrdup(PQerrorMessage(conn));
+		return false;
+	}
+	return MtmCollectUtilityResult(conn, errmsg);
+}
+
+static void MtmCloseBroadcastConnections(int code, Datum arg)
+{
+	int i;
+	for (i = 0; i < MAX_NODES; i++) { 
+		if (MtmBroadcastConns[i] != NULL) { 
+			PQfinish(MtmBroadcastConns[i]);
+			MtmBroadcastConns[i] = NULL;
+		}
+	}
+}
+
 static void 
 MtmNoticeReceiver(void *i, const PGresult *res)
 {
@@ -4224,6 +5061,97 @@ MtmNoticeReceiver(void *i, const PGresult *res)
 	pfree(stripped_notice);
 }
 
+/*
+ * Get connection to the specified node from the pool, establishing it if needed.
+ * Cached connection can be left in the middle of transaction if previous broadcast was interrupted by error,
+ * so rollback such transaction. Broken connections are reestablished.
+ */
+static PGconn* MtmGetBroadcastConnection(int nodeId)
+{
+	PGconn* conn = MtmBroadcastConns[nodeId];
+	char const* connStr = Mtm->nodes[nodeId].con.connStr;
+	char* errmsg;
+
+	if (conn != NULL && strcmp(MtmBroadcastConnStrs[nodeId], connStr) != 0) {
+		/* Node was reconfigured */
+		PQfinish(conn);
+		conn = NULL;
+	}
+	if (conn != NULL) { 
+		switch (PQtransactionStatus(conn)) { 
+		  case PQTRANS_IDLE:
+			break;
+		  case PQTRANS_ACTIVE:
+			MtmCollectUtilityResult(conn, &errmsg);
+			/* no break */
+		  case PQTRANS_INTRANS:
+		  case PQTRANS_INERROR:
+			if (MtmRunUtilityStmt(conn, "ROLLBACK TRANSACTION", &errmsg)) { 
+				break;
+			}
+			/* no break */
+		  default:
+			PQreset(conn);
+		}
+		if (PQstatus(conn) != CONNECTION_OK) { 
+			PQreset(conn);
+		}
+	} else { 
+		conn = PQconnectdb_safe(psprintf("%s application_name=%s", connStr, MULTIMASTER_BROADCAST_SERVICE));
+		if (MtmBroadcastConnStrs[nodeId] != NULL) { 
+			pfree(MtmBroadcastConnStrs[nodeId]);
+		}
+		MtmBroadcastConnStrs[nodeId] = MemoryContextStrdup(TopMemoryContext, connStr);
+		MtmBroadcastNodeIds[nodeId] = nodeId;
+		MtmBroadcastConns[nodeId] = conn;
+		if (!MtmBroadcastExitRegistered) { 
+			on_proc_exit(MtmCloseBroadcastConnections, 0);
+			MtmBroadcastExitRegistered = true;
+		}
+	}
+	PQsetNoticeReceiver(conn, MtmNoticeReceiver, &MtmBroadcastNodeIds[nodeId]);
+	return conn;
+}
+
+/*
+ * Reestablish broken connection and send statement through it
+ */
+static bool MtmReconnectAndSend(PGconn* conn, char const* sql)
+{
+	PQreset(conn);
+	return PQstatus(conn) == CONNECTION_OK && PQsendQuery(conn, sql);
+}
+
+/*
+ * Send statement to all nodes in parallel; results are collected by the caller.
+ * Cached connection may be broken by restart of the node since its last use. If statement starts new transaction,
+ * pass "reconnected" array: broken connection is then reestablished once and the node is marked in the array.
+ * Statements ending transaction (COMMIT, ROLLBACK) are never resent: executing them in a new session would silently
+ * lose the transaction (COMMIT just produces a warning there).
+ */
+static bool MtmSendUtilityStmt(PGconn** conns, int nNodes, char const* sql, bool* reconnected)
+{
+	int i;
+	bool ok = true;
+	for (i = 0; i < nNodes; i++) 
+	{ 
+		if (conns[i] && !PQsendQuery(conns[i], sql)) 
+		{
+			if (reconnected != NULL && !reconnected[i]) 
+			{
+				reconnected[i] = true;
+				if (MtmReconnectAndSend(conns[i], sql)) 
+				{
+					continue;
+				}
+			}
+			elog(WARNING, "Failed to send command to node %d: %s", i+1, PQerrorMessage(conns[i]));
+			ok = false;
+		}
+	}
+	return ok;
+}
+
 static void MtmBroadcastUtilityStmt(char const* sql, bool ignoreError)
 {
 	int i = 0;
@@ -4231,87 +5159,90 @@ static void MtmBroadcastUtilityStmt(char const* sql, bool ignoreError)
 	int failedNode = -1;
 	char const* errorMsg = NULL;
 	PGconn **conns = palloc0(sizeof(PGconn*)*Mtm->nAllNodes);
+	bool* reconnected = palloc0(sizeof(bool)*Mtm->nAllNodes);
 	char* utility_errmsg;
+	char* beginSql = psprintf("BEGIN TRANSACTION; %s", sql);
 	int nNodes = Mtm->nAllNodes;
 
 	for (i = 0; i < nNodes; i++) 
 	{ 
 		if (!BIT_CHECK(disabledNodeMask, i)) 
 		{
-			conns[i] = PQconnectdb_safe(psprintf("%s application_name=%s", Mtm->nodes[i].con.connStr, MULTIMASTER_BROADCAST_SERVICE));
+			conns[i] = MtmGetBroadcastConnection(i);
 			if (PQstatus(conns[i]) != CONNECTION_OK)
 			{
 				if (ignoreError) 
 				{ 
-					PQfinish(conns[i]);
 					conns[i] = NULL;
 				} else { 
-					failedNode = i;
-					do { 
-						PQfinish(conns[i]);
-					} while (--i >= 0);                             
-					elog(ERROR, "Failed to establish connection '%s' to node %d, error = %s", Mtm->nodes[failedNode].con.connStr, failedNode+1, PQerrorMessage(conns[i]));
+					elog(ERROR, "Failed to establish connection '%s' to node %d, error = %s", Mtm->nodes[i].con.connStr, i+1, PQerrorMessage(conns[i]));
 				}
 			}
-			PQsetNoticeReceiver(conns[i], MtmNoticeReceiver, &i);
 		}
 	}
 	Assert(i == nNodes);
-    
+
+	/* Start transaction and execute statement at all nodes with single round-trip */
+	if (!MtmSendUtilityStmt(conns, nNodes, beginSql, reconnected) && !ignoreError) 
+	{ 
+		errorMsg = "Failed to send command to the cluster nodes";
+		failedNode = nNodes;
+	}
 	for (i = 0; i < nNodes; i++) 
 	{ 
-		if (conns[i]) 
+		if (conns[i] && !MtmCollectUtilityResult(conns[i], &utility_errmsg))
 		{
-			if (!MtmRunUtilityStmt(conns[i], "BEGIN TRANSACTION", &utility_errmsg) && !ignoreError)
-			{
-				errorMsg = "Failed to start transaction at node %d";
-				failedNode = i;
-				break;
-			}
-			if (!MtmRunUtilityStmt(conns[i], sql, &utility_errmsg) && !ignoreError)
+			/* 
+			 * Connection was lost, most likely because the node was restarted: transaction could not start there,
+			 * so it is safe to retry once in a new session.
+			 */
+			if (PQstatus(conns[i]) == CONNECTION_BAD && !reconnected[i]) 
 			{
-				if (i + 1 == MtmNodeId)
-					errorMsg = utility_errmsg;
-				else
+				reconnected[i] = true;
+				if (MtmReconnectAndSend(conns[i], beginSql) && MtmCollectUtilityResult(conns[i], &utility_errmsg)) 
 				{
-					elog(ERROR, "%s", utility_errmsg);
-					errorMsg = "Failed to run command at node %d";
+					continue;
 				}
-
+			}
+			if (!ignoreError && failedNode < 0) 
+			{
+				errorMsg = utility_errmsg;
 				failedNode = i;
-				break;
 			}
 		}
 	}
-	if (failedNode >= 0 && !ignoreError)  
+	if (failedNode >= 0)  
 	{
+		/* Do not leave transactions holding locks at other nodes */
+		MtmSendUtilityStmt(conns, nNodes, "ROLLBACK TRANSACTION", NULL);
 		for (i = 0; i < nNodes; i++) 
 		{ 
 			if (conns[i])
 			{
-				MtmRunUtilityStmt(conns[i], "ROLLBACK TRANSACTION", &utility_errmsg);
-			}
-		}
-	} else { 
-		for (i = 0; i < nNodes; i++) 
-		{ 
-			if (conns[i] && !MtmRunUtilityStmt(conns[i], "COMMIT TRANSACTION", &utility_errmsg) && !ignoreError) 
-			{ 
-				errorMsg = "Commit failed at node %d";
-				failedNode = i;
+				MtmCollectUtilityResult(conns[i], &utility_errmsg);
 			}
 		}
-	}                       
+		pfree(conns);
+		pfree(reconnected);
+		elog(ERROR, "%s", errorMsg);
+	}
+
+	if (!MtmSendUtilityStmt(conns, nNodes, "COMMIT TRANSACTION", NULL) && !ignoreError) 
+	{ 
+		errorMsg = "Failed to send commit to the cluster nodes";
+	}
 	for (i = 0; i < nNodes; i++) 
 	{ 
-		if (conns[i])
-		{
-			PQfinish(conns[i]);
+		if (conns[i] && !MtmCollectUtilityResult(conns[i], &utility_errmsg) && !ignoreError) 
+		{ 
+			errorMsg = psprintf("Commit failed at node %d", i+1);
 		}
 	}
-	if (!ignoreError && failedNode >= 0) 
+	pfree(conns);
+	pfree(reconnected);
+	if (errorMsg != NULL) 
 	{ 
-		elog(ERROR, errorMsg, failedNode+1);
+		elog(ERROR, "%s", errorMsg);
 	}
 }
 
@@ -4562,20 +5493,79 @@ static void MtmFinishDDLCommand()
 	LogLogicalMessage("E", "", 1, true);
 }
 
+/*
+ * Replace edges of node's wait-for graph. Caller should hold exclusive lock of the node.
+ * Graph is kept in fixed-size buffer (shared memory can not be deallocated): if it doesn't fit, only part of it is kept.
+ * Loops found in this part still exist, but deltas can not be applied to it, so its version is forgotten.
+ */
+static void MtmSetLockGraph(MtmGraph* graph, MtmEdge* edges, int nEdges, uint32 version)
+{
+	if (nEdges > graph->maxEdges) { 
+		elog(WARNING, "Wait-for graph with %d edges doesn't fit in %d edges: only part of it is checked for distributed deadlocks",
+			 nEdges, graph->maxEdges);
+		nEdges = graph->maxEdges;
+		version = 0;
+	}
+	memcpy(graph->edges, edges, nEdges*sizeof(MtmEdge));
+	graph->nEdges = nEdges;
+	graph->version = version;
+	graph->updateTime = GetCurrentTimestamp();
+}
+
+/*
+ * Merge full graph or delta received from the node with its persistent wait-for graph
+ */
 void MtmUpdateLockGraph(int nodeId, void const* messageBody, int messageSize)
 {
-	int allocated;
+	MtmGraphMessage* msg = (MtmGraphMessage*)messageBody;
+	MtmEdge* removed;
+	MtmEdge* added;
+	MtmGraph* graph = Mtm->nodes[nodeId-1].lockGraph;
+
+	if (messageSize < (int)sizeof(MtmGraphMessage)
+		|| (size_t)messageSize != sizeof(MtmGraphMessage) + ((size_t)msg->nRemoved + msg->nAdded)*sizeof(MtmEdge))
+	{
+		/* Forget graph as if delta was lost */
+		elog(WARNING, "Ignore malformed lock graph message of size %d from node %d", messageSize, nodeId);
+		MtmLockNode(nodeId + MtmMaxNodes, LW_EXCLUSIVE);
+		graph->nEdges = 0;
+		graph->version = 0;
+		MtmUnlockNode(nodeId + MtmMaxNodes);
+		BIT_SET(Mtm->lockGraphResyncMask, nodeId-1);
+		return;
+	}
+	removed = (MtmEdge*)(msg + 1);
+	added = removed + msg->nRemoved;
+
 	MtmLockNode(nodeId + MtmMaxNodes, LW_EXCLUSIVE);
-	allocated = Mtm->nodes[nodeId-1].lockGraphAllocated;
-	if (messageSize > allocated) { 
-		allocated = Max(Max(MULTIMASTER_LOCK_BUF_INIT_SIZE, allocated*2), messageSize);
-		Mtm->nodes[nodeId-1].lockGraphData = ShmemAlloc(allocated);
-		Mtm->nodes[nodeId-1].lockGraphAllocated = allocated;
-	}
-	memcpy(Mtm->nodes[nodeId-1].lockGraphData, messageBody, messageSize);
-	Mtm->nodes[nodeId-1].lockGraphUsed = messageSize;
+	if (msg->baseVersion == 0) { 
+		MtmSetLockGraph(graph, added, msg->nAdded, msg->version);
+	} else if (msg->baseVersion == graph->version) { 
+		MtmEdge* result = (MtmEdge*)palloc((graph->nEdges + msg->nAdded)*sizeof(MtmEdge));
+		int nEdges = MtmGraphMerge(graph->edges, graph->nEdges, removed, msg->nRemoved, added, msg->nAdded, result);
+		MtmSetLockGraph(graph, result, nEdges, msg->version);
+		pfree(result);
+	} else { 
+		/* Some delta was lost: forget graph until full graph is received and ask node to send it */
+		MTM_LOG1("Lock graph delta %u of node %d doesn't match version %u", msg->baseVersion, nodeId, graph->version);
+		graph->nEdges = 0;
+		graph->version = 0;
+		BIT_SET(Mtm->lockGraphResyncMask, nodeId-1);
+	}
 	MtmUnlockNode(nodeId + MtmMaxNodes);
-	MTM_LOG1("Update deadlock graph for node %d size %d", nodeId, messageSize);
+	MTM_LOG3("Update deadlock graph for node %d: %u edges removed, %u edges added", nodeId, msg->nRemoved, msg->nAdded);
+}
+
+/*
+ * Some node lost a delta of our wait-for graph: publish full graph next time instead of waiting for MTM_GRAPH_FULL_INTERVAL deltas
+ */
+void MtmRequestFullLockGraph(void)
+{
+	MtmGraph* graph = Mtm->nodes[MtmNodeId-1].lockGraph;
+
+	MtmLockNode(MtmNodeId + MtmMaxNodes, LW_EXCLUSIVE);
+	graph->nDeltas = MTM_GRAPH_FULL_INTERVAL;
+	MtmUnlockNode(MtmNodeId + MtmMaxNodes);
 }
 
 static void MtmProcessUtility(Node *parsetree, const char *queryString,
@@ -4845,6 +5835,23 @@ static void MtmProcessUtility(Node *parsetree, const char *queryString,
 		elog(ERROR, "Isolation level %s is not supported by multimaster", isoLevelStr[XactIsoLevel]);
 	}
 
+	/* Access mode can be changed by BEGIN READ ONLY or SET TRANSACTION before the first query of transaction */
+	if (MtmMaxReadOnlyStaleness != 0 && (XactReadOnly || MtmTx.isStaleSnapshot)
+		&& MtmTx.snapshot != INVALID_CSN && !FirstSnapshotSet
+		&& (IsA(parsetree, TransactionStmt) || IsA(parsetree, VariableSetStmt)))
+	{
+		if (XactReadOnly) { 
+			MtmLock(LW_SHARED);
+			MtmUseStableSnapshot(&MtmTx);
+			MtmUnlock();
+		} else { 
+			/* Transaction is switched to read-write mode, so it needs fresh snapshot */
+			MtmLock(LW_EXCLUSIVE);
+			MtmChooseSnapshot(&MtmTx);
+			MtmUnlock();
+		}
+	}
+
 	if (MyXactAccessedTempRel)
 	{
 		MTM_LOG1("Xact accessed temp table, stopping replication");
@@ -4943,7 +5950,7 @@ void MtmExecute(void* work, int size)
 		/* During recovery apply changes sequentially to preserve commit order */
 		MtmExecutor(work, size);
 	} else { 
-		BgwPoolExecute(&Mtm->pool, work, size);
+		BgwPoolExecute(&Mtm->pool, work, size, MtmReplicationNodeId);
 	}
 }
     
@@ -4953,6 +5960,229 @@ MtmPoolConstructor(void)
     return &Mtm->pool;
 }
 
+/*
+ * -------------------------------------------
+ * Apply scheduler.
+ * Receiver numbers transactions from its node and for each transaction records
+ * preceding transactions updating the same keys (see pglogical_receiver.c).
+ * Worker waits completion of these transactions before applying its own,
+ * so transactions with disjoint write sets are applied in parallel,
+ * while conflicting ones are applied in commit order of origin node.
+ * -------------------------------------------
+ */
+
+#define MIN_APPLY_WAIT_TIMEOUT 10
+#define MAX_APPLY_WAIT_TIMEOUT 1000
+
+static int     MtmApplyNodeId;
+static ulong64 MtmApplySeq;
+
+static void MtmApplyOnExit(int code, Datum arg)
+{
+	if (MtmApplySeq != 0) {
+		MtmApplyDone(MtmApplyNodeId, MtmApplySeq);
+	}
+}
+
+bool MtmApplyIsDone(int nodeId, ulong64 seq)
+{
+	MtmApplySlot* slot = &Mtm->nodes[nodeId-1].applySlots[seq % MULTIMASTER_MAX_APPLY_INFLIGHT];
+	return pg_atomic_read_u64(&slot->done) >= seq;
+}
+
+void MtmApplyDone(int nodeId, ulong64 seq)
+{
+	MtmApplySlot* slot = &Mtm->nodes[nodeId-1].applySlots[seq % MULTIMASTER_MAX_APPLY_INFLIGHT];
+	Assert(pg_atomic_read_u64(&slot->done) < seq);
+	pg_atomic_write_u64(&slot->done, seq);
+	if (seq == MtmApplySeq) {
+		MtmApplySeq = 0;
+	}
+}
+
+void MtmApplyWait(int nodeId, ulong64 seq)
+{
+	timestamp_t delay = MIN_APPLY_WAIT_TIMEOUT;
+	while (!MtmApplyIsDone(nodeId, seq)) {
+		CHECK_FOR_INTERRUPTS();
+		MtmSleep(delay);
+		if (delay*2 <= MAX_APPLY_WAIT_TIMEOUT) {
+			delay *= 2;
+		}
+	}
+}
+
+/*
+ * Wait until all transactions on which transaction 'seq' depends are applied.
+ * Transaction is marked as completed by MtmApplyDone or at exit of worker.
+ */
+void MtmApplyWaitDependencies(int nodeId, ulong64 seq)
+{
+	static bool onExitRegistered;
+	MtmApplySlot* slot = &Mtm->nodes[nodeId-1].applySlots[seq % MULTIMASTER_MAX_APPLY_INFLIGHT];
+	int i;
+
+	if (!onExitRegistered) {
+		before_shmem_exit(MtmApplyOnExit, 0);
+		onExitRegistered = true;
+	}
+	MtmApplyNodeId = nodeId;
+	MtmApplySeq = seq;
+
+	if (slot->waitAll) {
+		ulong64 prev = seq > MULTIMASTER_MAX_APPLY_INFLIGHT ? seq - MULTIMASTER_MAX_APPLY_INFLIGHT + 1 : 1;
+		for (; prev < seq; prev++) {
+			MtmApplyWait(nodeId, prev);
+		}
+	} else {
+		for (i = 0; i < slot->nDeps; i++) {
+			MtmApplyWait(nodeId, slot->deps[i]);
+		}
+	}
+}
+
+/*
+ * -------------------------------------------
+ * Apply streams.
+ * Instead of spilling large transaction to the disk, receiver passes it to apply worker 
+ * as soon as transaction size exceeds spill threshold and then streams the rest of transaction
+ * to the worker through shared memory queue, so that transaction is applied while it is received.
+ * Each process can use only one stream at a time.
+ * -------------------------------------------
+ */
+
+static MtmApplyStream* MtmCurrentStream;
+static shm_mq_handle*  MtmCurrentStreamHandle;
+static MemoryContext   MtmCurrentStreamContext;
+static bool            MtmCurrentStreamDetached;
+
+static void MtmApplyStreamOnExit(int code, Datum arg)
+{
+	MtmCloseApplyStream();
+}
+
+static void MtmAttachApplyStreamQueue(MtmApplyStream* stream)
+{
+	static bool onExitRegistered;
+	MemoryContext oldContext;
+
+	if (!onExitRegistered) {
+		before_shmem_exit(MtmApplyStreamOnExit, 0);
+		onExitRegistered = true;
+	}
+	MtmCurrentStreamContext = AllocSetContextCreate(TopMemoryContext,
+													"ApplyStreamContext",
+													ALLOCSET_DEFAULT_MINSIZE,
+													ALLOCSET_DEFAULT_INITSIZE,
+													ALLOCSET_DEFAULT_MAXSIZE);
+	oldContext = MemoryContextSwitchTo(MtmCurrentStreamContext);
+	MtmCurrentStreamHandle = shm_mq_attach(stream->queue, NULL, NULL);
+	MemoryContextSwitchTo(oldContext);
+	MtmCurrentStream = stream;
+	MtmCurrentStreamDetached = false;
+}
+
+/*
+ * Called by receiver to allocate stream for the current transaction.
+ * Returns stream identifier or -1 if there are no free streams or apply workers:
+ * in this case transaction should be spilled to the disk.
+ */
+int MtmOpenApplyStream(void)
+{
+	int i;
+	Assert(MtmCurrentStream == NULL);
+	if (pg_atomic_read_u32(&Mtm->pool.active) + pg_atomic_read_u32(&Mtm->pool.pending) >= Mtm->pool.nWorkers) {
+		return -1;
+	}
+	for (i = 0; i < MULTIMASTER_MAX_APPLY_STREAMS; i++) {
+		MtmApplyStream* stream = &Mtm->applyStreams[i];
+		uint32 unused = 0;
+		if (pg_atomic_compare_exchange_u32(&stream->refCount, &unused, 2)) {
+			shm_mq_create(stream->queue, MULTIMASTER_APPLY_STREAM_QUEUE_SIZE);
+			shm_mq_set_sender(stream->queue, MyProc);
+			MtmAttachApplyStreamQueue(stream);
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Send chunk of transaction to apply worker.
+ * If the queue is full, wait on the latch until worker consumes some data, so that receiver remains interruptible.
+ * Returns false if worker has detached from the stream because of apply error:
+ * the rest of transaction is dropped by subsequent calls.
+ */
+bool MtmSendApplyStream(void const* data, int size)
+{
+	Assert(MtmCurrentStream != NULL);
+	while (!MtmCurrentStreamDetached) {
+		int rc;
+		shm_mq_result result = shm_mq_send(MtmCurrentStreamHandle, size, data, true);
+		if (result == SHM_MQ_SUCCESS) {
+			break;
+		}
+		if (result == SHM_MQ_DETACHED) {
+			MTM_LOG1("Apply worker stops receiving of streamed transaction");
+			MtmCurrentStreamDetached = true;
+			break;
+		}
+		Assert(result == SHM_MQ_WOULD_BLOCK);
+		rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, MULTIMASTER_APPLY_STREAM_WAIT_TIMEOUT);
+		if (rc & WL_POSTMASTER_DEATH) {
+			proc_exit(1);
+		}
+		if (rc & WL_LATCH_SET) {
+			ResetLatch(MyLatch);
+		}
+		CHECK_FOR_INTERRUPTS();
+	}
+	return !MtmCurrentStreamDetached;
+}
+
+/*
+ * Called by apply worker to start receiving of transaction from the stream
+ */
+void MtmAttachApplyStream(int streamId)
+{
+	MtmApplyStream* stream = &Mtm->applyStreams[streamId];
+	Assert(MtmCurrentStream == NULL);
+	shm_mq_set_receiver(stream->queue, MyProc);
+	MtmAttachApplyStreamQueue(stream);
+}
+
+/*
+ * Receive next chunk of transaction. Returned data is valid until next call.
+ * Returns NULL if receiver has detached from the stream without sending the whole transaction.
+ */
+char* MtmReceiveApplyStream(int* size)
+{
+	Size  len;
+	void* data;
+	Assert(MtmCurrentStream != NULL);
+	if (MtmCurrentStreamDetached || shm_mq_receive(MtmCurrentStreamHandle, &len, &data, false) != SHM_MQ_SUCCESS) {
+		MtmCurrentStreamDetached = true;
+		return NULL;
+	}
+	*size = (int)len;
+	return (char*)data;
+}
+
+/*
+ * Detach from the stream. Stream is released when both receiver and apply worker are detached.
+ */
+void MtmCloseApplyStream(void)
+{
+	if (MtmCurrentStream != NULL) {
+		shm_mq_detach(MtmCurrentStream->queue);
+		MemoryContextDelete(MtmCurrentStreamContext);
+		pg_atomic_fetch_sub_u32(&MtmCurrentStream->refCount, 1);
+		MtmCurrentStream = NULL;
+		MtmCurrentStreamHandle = NULL;
+		MtmCurrentStreamContext = NULL;
+	}
+}
+
 /*
  * -------------------------------------------
  * Deadlock detection
@@ -4964,38 +6194,53 @@ MtmGetGtid(TransactionId xid, GlobalTransactionId* gtid)
 {
 	MtmTransState* ts;
 
-	MtmLock(LW_SHARED);
-	ts = (MtmTransState*)hash_search(MtmXid2State, &xid, HASH_FIND, NULL);
-	if (ts != NULL) { 
-		*gtid = ts->gtid;
+	if (pg_atomic_read_u32(&Mtm->xidMapOverflow) != 0) { 
+		MtmLock(LW_SHARED);
+		ts = (MtmTransState*)hash_search(MtmXid2State, &xid, HASH_FIND, NULL);
+		if (ts != NULL) { 
+			*gtid = ts->gtid;
+		}
+		MtmUnlock();
 	} else { 
+		while ((ts = MtmXidMapLookup(xid)) != NULL) { 
+			*gtid = ts->gtid;
+			pg_read_barrier();
+			if (ts->xid == xid) { 
+				break;
+			}
+		}
+	}
+	if (ts == NULL) { 
 		gtid->node = MtmNodeId;
 		gtid->xid = xid;
 	}
-	MtmUnlock();
 }
 
+/*
+ * Collect edges of local wait-for graph. Only processes waiting for locks are inspected.
+ * Caller should hold all lock manager partition locks.
+ */
+static int
+MtmCollectLockGraph(MtmEdge** result)
+{
+	int i, nEdges = 0, maxEdges = 64;
+	MtmEdge* edges = (MtmEdge*)palloc(maxEdges*sizeof(MtmEdge));
 
-static void 
-MtmSerializeLock(PROCLOCK* proclock, void* arg)
-{
-    ByteBuffer* buf = (ByteBuffer*)arg;
-    LOCK* lock = proclock->tag.myLock;
-    PGPROC* proc = proclock->tag.myProc; 
-	GlobalTransactionId gtid;
-    if (lock != NULL) {
-        PGXACT* srcPgXact = &ProcGlobal->allPgXact[proc->pgprocno];
-        
-        if (TransactionIdIsValid(srcPgXact->xid) && proc->waitLock == lock) { 
-            LockMethod lockMethodTable = GetLocksMethodTable(lock);
-            int numLockModes = lockMethodTable->numLockModes;
-            int conflictMask = lockMethodTable->conflictTab[proc->waitLockMode];
-            SHM_QUEUE *procLocks = &(lock->procLocks);
-            int lm;
-
-			MtmGetGtid(srcPgXact->xid, &gtid);  /* waiting transaction */
-			
-            ByteBufferAppend(buf, &gtid, sizeof(gtid));
+	for (i = 0; i < ProcGlobal->allProcCount; i++) { 
+		PGPROC* proc = &ProcGlobal->allProcs[i];
+		LOCK* lock = proc->waitLock;
+		PGXACT* srcPgXact = &ProcGlobal->allPgXact[proc->pgprocno];
+
+		if (lock != NULL && TransactionIdIsValid(srcPgXact->xid)) { 
+			LockMethod lockMethodTable = GetLocksMethodTable(lock);
+			int numLockModes = lockMethodTable->numLockModes;
+			int conflictMask = lockMethodTable->conflictTab[proc->waitLockMode];
+			SHM_QUEUE *procLocks = &(lock->procLocks);
+			PROCLOCK* proclock;
+			GlobalTransactionId src;
+			int lm;
+
+			MtmGetGtid(srcPgXact->xid, &src);  /* waiting transaction */
 
             proclock = (PROCLOCK *) SHMQueueNext(procLocks, procLocks,
                                                  offsetof(PROCLOCK, lockLink));
@@ -5010,8 +6255,13 @@ MtmSerializeLock(PROCLOCK* proclock, void* arg)
                             if ((proclock->holdMask & LOCKBIT_ON(lm)) && (conflictMask & LOCKBIT_ON(lm)))
                             {
                                 MTM_LOG3("%d: %u(%u) waits for %u(%u)", MyProcPid, srcPgXact->xid, proc->pid, dstPgXact->xid, proclock->tag.myProc->pid);
-                                MtmGetGtid(dstPgXact->xid, &gtid); /* transaction holding lock */
-								ByteBufferAppend(buf, &gtid, sizeof(gtid)); 
+								if (nEdges == maxEdges) { 
+									maxEdges *= 2;
+									edges = (MtmEdge*)repalloc(edges, maxEdges*sizeof(MtmEdge));
+								}
+								edges[nEdges].src = src;
+                                MtmGetGtid(dstPgXact->xid, &edges[nEdges].dst); /* transaction holding lock */
+								nEdges += 1;
                                 break;
                             }
                         }
@@ -5020,51 +6270,108 @@ MtmSerializeLock(PROCLOCK* proclock, void* arg)
                 proclock = (PROCLOCK *) SHMQueueNext(procLocks, &proclock->lockLink,
                                                      offsetof(PROCLOCK, lockLink));
             }
-			gtid.node = 0;
-			gtid.xid = 0;
-            ByteBufferAppend(buf, &gtid, sizeof(gtid)); /* end of lock owners list */
-        }
-    }
+		}
+	}
+	*result = edges;
+	return MtmGraphSort(edges, nEdges);
+}
+
+/*
+ * Publish local wait-for graph unless it was already published by some other backend after the specified time.
+ * Only difference with previously published version is sent to other nodes (full graph is sent periodically).
+ */
+static void
+MtmPublishLockGraph(TimestampTz since)
+{
+	MtmGraph* graph = Mtm->nodes[MtmNodeId-1].lockGraph;
+	MtmEdge* edges;
+	int nEdges;
+	XLogRecPtr lsn = InvalidXLogRecPtr;
+
+	MtmLockNode(MtmNodeId + MtmMaxNodes, LW_SHARED);
+	if (graph->updateTime >= since) { 
+		MtmUnlockNode(MtmNodeId + MtmMaxNodes);
+		return;
+	}
+	MtmUnlockNode(MtmNodeId + MtmMaxNodes);
+
+	nEdges = MtmCollectLockGraph(&edges);
+
+	MtmLockNode(MtmNodeId + MtmMaxNodes, LW_EXCLUSIVE);
+	if (graph->updateTime < since) { 
+		MtmGraphMessage* msg = (MtmGraphMessage*)palloc(sizeof(MtmGraphMessage) + (graph->nEdges + nEdges)*sizeof(MtmEdge));
+		MtmEdge* delta = (MtmEdge*)(msg + 1);
+		int nRemoved, nAdded;
+
+		MtmGraphDiff(graph->edges, graph->nEdges, edges, nEdges, delta, &nRemoved, delta + graph->nEdges, &nAdded);
+		if (graph->version == 0 || graph->nDeltas >= MTM_GRAPH_FULL_INTERVAL || nRemoved + nAdded >= nEdges) { 
+			msg->baseVersion = 0;
+			msg->nRemoved = 0;
+			msg->nAdded = nEdges;
+			memcpy(delta, edges, nEdges*sizeof(MtmEdge));
+			graph->nDeltas = 0;
+		} else { 
+			msg->baseVersion = graph->version;
+			msg->nRemoved = nRemoved;
+			msg->nAdded = nAdded;
+			memmove(delta + nRemoved, delta + graph->nEdges, nAdded*sizeof(MtmEdge));
+			graph->nDeltas += 1;
+		}
+		if (msg->baseVersion == 0 || nRemoved + nAdded != 0) { 
+			/* Start from random version to distinguish graphs published before and after restart */
+			msg->version = graph->version == 0 ? (uint32)MtmGetSystemTime() | 1 : graph->version + 1;
+			Assert(replorigin_session_origin == InvalidRepOriginId);
+			lsn = LogLogicalMessage("L", (char*)msg, sizeof(MtmGraphMessage) + (msg->nRemoved + msg->nAdded)*sizeof(MtmEdge), false);
+			MtmSetLockGraph(graph, edges, nEdges, msg->version);
+		} else { 
+			graph->updateTime = GetCurrentTimestamp();
+		}
+		pfree(msg);
+	}
+	MtmUnlockNode(MtmNodeId + MtmMaxNodes);
+	pfree(edges);
+
+	if (lsn != InvalidXLogRecPtr) { 
+		XLogFlush(lsn);
+	}
+}
+
+/*
+ * Search for loop in union of wait-for graphs of all active nodes.
+ */
+static bool
+MtmFindDistributedLoop(GlobalTransactionId* root)
+{
+	MtmGraph* graphs[MAX_NODES];
+	int nodes[MAX_NODES];
+	int i, nGraphs = 0;
+	bool hasDeadlock;
+
+	for (i = 0; i < Mtm->nAllNodes; i++) { 
+		if (i+1 == MtmNodeId || !BIT_CHECK(Mtm->disabledNodeMask, i)) { 
+			MtmLockNode(i + 1 + MtmMaxNodes, LW_SHARED);
+			nodes[nGraphs] = i + 1;
+			graphs[nGraphs++] = Mtm->nodes[i].lockGraph;
+		}
+	}
+	hasDeadlock = MtmGraphFindLoop(graphs, nGraphs, root);
+	for (i = 0; i < nGraphs; i++) { 
+		MtmUnlockNode(nodes[i] + MtmMaxNodes);
+	}
+	return hasDeadlock;
 }
 
 static bool 
-MtmDetectGlobalDeadLockForXid(TransactionId xid)
+MtmDetectGlobalDeadLockForXid(TransactionId xid, TimestampTz since)
 {
 	bool hasDeadlock = false;
     if (TransactionIdIsValid(xid)) { 
-		ByteBuffer buf;
-		MtmGraph graph;
 		GlobalTransactionId gtid; 
-		int i;
-		
-        ByteBufferAlloc(&buf);
-        EnumerateLocks(MtmSerializeLock, &buf);
 
-		Assert(replorigin_session_origin == InvalidRepOriginId);
-		XLogFlush(LogLogicalMessage("L", buf.data, buf.used, false));
+		MtmPublishLockGraph(since);
 
-		MtmGraphInit(&graph);
-		MtmGraphAdd(&graph, (GlobalTransactionId*)buf.data, buf.used/sizeof(GlobalTransactionId));
-        ByteBufferFree(&buf);
-		for (i = 0; i < Mtm->nAllNodes; i++) { 
-			if (i+1 != MtmNodeId && !BIT_CHECK(Mtm->disabledNodeMask, i)) { 
-				size_t lockGraphSize;
-				void* lockGraphData;
-				MtmLockNode(i + 1 + MtmMaxNodes, LW_SHARED);
-				lockGraphSize = Mtm->nodes[i].lockGraphUsed;
-				lockGraphData = palloc(lockGraphSize);
-				memcpy(lockGraphData, Mtm->nodes[i].lockGraphData, lockGraphSize);
-				MtmUnlockNode(i + 1 + MtmMaxNodes);
-
-				if (lockGraphData == NULL) {
-					return true;
-				} else { 
-					MtmGraphAdd(&graph, (GlobalTransactionId*)lockGraphData, lockGraphSize/sizeof(GlobalTransactionId));
-				}
-			}
-		}
 		MtmGetGtid(xid, &gtid);
-		hasDeadlock = MtmGraphFindLoop(&graph, &gtid);
+		hasDeadlock = MtmFindDistributedLoop(&gtid);
 		elog(LOG, "Distributed deadlock check by backend %d for %u:%llu = %d", MyProcPid, gtid.node, (long64)gtid.xid, hasDeadlock);
 		if (!hasDeadlock) { 
 			/* There is no deadlock loop in graph, but deadlock can be caused by lack of apply workers: if all of them are busy, then some transactions
@@ -5092,11 +6399,22 @@ MtmDetectGlobalDeadLock(PGPROC* proc)
 
 	MTM_LOG1("Detect global deadlock for %llu by backend %d", (long64)pgxact->xid, MyProcPid);
 
-    return MtmDetectGlobalDeadLockForXid(pgxact->xid);
+	/* Graph published after this backend started to wait already contains its edges */
+    return MtmDetectGlobalDeadLockForXid(pgxact->xid, get_timeout_start_time(DEADLOCK_TIMEOUT));
 }
 
 Datum mtm_check_deadlock(PG_FUNCTION_ARGS)
 {
 	TransactionId xid = PG_GETARG_INT64(0);
-    PG_RETURN_BOOL(MtmDetectGlobalDeadLockForXid(xid));
+	bool hasDeadlock;
+	int i;
+
+	for (i = 0; i < NUM_LOCK_PARTITIONS; i++) { 
+		LWLockAcquire(LockHashPartitionLockByIndex(i), LW_SHARED);
+	}
+	hasDeadlock = MtmDetectGlobalDeadLockForXid(xid, GetCurrentTimestamp());
+	for (i = NUM_LOCK_PARTITIONS; --i >= 0;) { 
+		LWLockRelease(LockHashPartitionLockByIndex(i));
+	}
+    PG_RETURN_BOOL(hasDeadlock);
 }
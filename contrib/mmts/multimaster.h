@@ -8,6 +8,8 @@
 #include "access/clog.h"
 #include "pglogical_output/hooks.h"
 #include "commands/vacuum.h"
+#include "storage/pg_sema.h"
+#include "storage/shm_mq.h"
 #include "libpq-fe.h"
 
 #ifndef DEBUG_LEVEL
@@ -53,17 +55,27 @@
 #define MULTIMASTER_LOCAL_TABLES_TABLE  "local_tables"
 #define MULTIMASTER_SLOT_PATTERN        "mtm_slot_%d"
 #define MULTIMASTER_MIN_PROTO_VERSION   1
-#define MULTIMASTER_MAX_PROTO_VERSION   1
+#define MULTIMASTER_MAX_PROTO_VERSION   2     /* 2 - key hashes for apply scheduler in INSERT/UPDATE/DELETE records */
 #define MULTIMASTER_MAX_GID_SIZE        32
 #define MULTIMASTER_MAX_SLOT_NAME_SIZE  16
 #define MULTIMASTER_MAX_CONN_STR_SIZE   128
 #define MULTIMASTER_MAX_HOST_NAME_SIZE  64
 #define MULTIMASTER_MAX_LOCAL_TABLES    256
 #define MULTIMASTER_MAX_CTL_STR_SIZE    256
-#define MULTIMASTER_LOCK_BUF_INIT_SIZE  4096
+#define MULTIMASTER_MAX_LOCK_GRAPH_EDGES 16384 /* Capacity of wait-for graph of one node kept in shared memory */
 #define MULTIMASTER_BROADCAST_SERVICE   "mtm_broadcast"
 #define MULTIMASTER_ADMIN               "mtm_admin"
 #define MULTIMASTER_PRECOMMITTED        "precommitted"
+#define MULTIMASTER_MAX_APPLY_INFLIGHT  1024 /* Maximal number of transactions from one node tracked by apply scheduler */
+#define MULTIMASTER_MAX_APPLY_DEPS      16   /* Maximal number of transactions on which applied transaction can depend */
+#define MULTIMASTER_APPLY_KEY_MAP_SIZE  (64*1024) /* Number of entries in receiver's map of last writers of keys */
+#define MULTIMASTER_MAX_APPLY_STREAMS   4       /* Maximal number of large transactions concurrently streamed to apply workers */
+#define MULTIMASTER_APPLY_STREAM_QUEUE_SIZE (1024*1024) /* Size of shared memory queue used to stream transaction to apply worker */
+#define MULTIMASTER_APPLY_STREAM_CHUNK_SIZE (64*1024)   /* Size of chunks in which streamed transaction is sent to apply worker */
+#define MULTIMASTER_APPLY_STREAM_WAIT_TIMEOUT 1000      /* Timeout of waiting for apply worker to consume streamed data (milliseconds) */
+#define MULTIMASTER_ARBITER_PROTO_VERSION 2     /* Arbiter wire protocol: 1 - raw MtmArbiterMessage, 2 - compact variable length encoding */
+#define MULTIMASTER_ARBITER_PROTO_TAG   "arbiter_proto=" /* Prefix of gid in handshake message used to negotiate arbiter protocol version */
+#define MULTIMASTER_ARBITER_GID_DICT_SIZE 256   /* Size of per-connection dictionary of GIDs used by compact arbiter protocol */
 
 #define MULTIMASTER_DEFAULT_ARBITER_PORT 5433
 
@@ -83,6 +95,8 @@
 #define Natts_mtm_trans_state   15
 #define Natts_mtm_nodes_state   16
 #define Natts_mtm_cluster_state 18
+#define Natts_mtm_latency       8
+#define Natts_mtm_latency_bucket 5
 
 typedef ulong64 csn_t; /* commit serial number */
 #define INVALID_CSN  ((csn_t)-1)
@@ -123,7 +137,9 @@ typedef enum
 	MSG_STATUS,
 	MSG_HEARTBEAT,
 	MSG_POLL_REQUEST,
-	MSG_POLL_STATUS
+	MSG_POLL_STATUS,
+	MSG_VOTES,
+	MSG_GRAPH_RESYNC
 } MtmMessageCode;
 
 typedef enum
@@ -150,7 +166,7 @@ typedef struct
 {
 	MtmMessageCode code;   /* Message code: MSG_PREPARE, MSG_PRECOMMIT, MSG_COMMIT, MSG_ABORT,... */
     int            node;   /* Sender node ID */	
-	TransactionId  dxid;   /* Transaction ID at destination node */
+	TransactionId  dxid;   /* Transaction ID at destination node (number of votes for MSG_VOTES) */
 	TransactionId  sxid;   /* Transaction ID at sender node */  
     XidStatus      status; /* Transaction status */	
 	csn_t          csn;    /* Local CSN in case of sending data from replica to master, global CSN master->replica */
@@ -160,6 +176,19 @@ typedef struct
 	pgid_t         gid;    /* Global transaction identifier */
 } MtmArbiterMessage;
 
+/*
+ * Compact vote of replica for 2PC transaction. Votes sent by arbiter to the same coordinator within group commit window
+ * are packed in one MSG_VOTES frame: MtmArbiterMessage header (node, masks and oldest snapshot are common for all votes)
+ * followed by header.dxid MtmArbiterVote records.
+ */
+typedef struct
+{
+	csn_t          csn;    /* Local CSN of prepared/precommitted transaction */
+	TransactionId  dxid;   /* Transaction ID at destination node */
+	TransactionId  sxid;   /* Transaction ID at sender node */
+	MtmMessageCode code;   /* MSG_PREPARED, MSG_PRECOMMITTED or MSG_ABORTED */
+} MtmArbiterVote;
+
 /*
  * Abort logical message is send by replica when error is happen while applying prepared transaction.
  * In this case we do not have prepared transaction and can not do abort-prepared.
@@ -187,9 +216,9 @@ typedef struct
 
 typedef struct 
 {
-	int used;
-	int size;
-	MtmArbiterMessage* data;
+	int used;   /* used size in bytes */
+	int size;   /* allocated size in bytes */
+	char* data;
 } MtmBuffer;
 
 typedef struct
@@ -201,6 +230,49 @@ typedef struct
 } MtmConnectionInfo;
 
 
+/*
+ * State of remote transaction tracked by apply scheduler.
+ * Receiver assigns ascending sequence numbers to transactions received from the node and 
+ * records dependencies between transactions updating the same keys. Transaction is applied by worker only
+ * after completion of all transactions it depends on.
+ */
+typedef struct
+{
+	pg_atomic_uint64 done;             /* Sequence number of the last applied transaction which used this slot */
+	bool        waitAll;               /* Transaction has to wait completion of all preceding transactions */
+	int         nDeps;                 /* Number of transactions this transaction depends on */
+	ulong64     deps[MULTIMASTER_MAX_APPLY_DEPS]; /* Sequence numbers of these transactions */
+} MtmApplySlot;
+
+/*
+ * Phases of distributed transaction commit for which latency is tracked
+ */
+typedef enum
+{
+	MTM_LATENCY_PREPARE,   /* local PREPARE of transaction originated by the node */
+	MTM_LATENCY_VOTE,      /* round-trip of vote from the node (or whole voting for local node) */
+	MTM_LATENCY_PRECOMMIT, /* PRECOMMIT of transaction originated by the node */
+	MTM_LATENCY_COMMIT,    /* apply of COMMIT PREPARED received from the node */
+	MTM_LATENCY_QUEUE,     /* time spent in apply pool queue by work item received from the node */
+	MTM_LATENCY_PHASES
+} MtmLatencyPhase;
+
+/*
+ * Latency histogram (in microseconds) with logarithmic buckets: each power of two interval
+ * is split into MTM_LATENCY_SUB_BUCKETS linear buckets. It is updated using atomics without any locks.
+ */
+#define MTM_LATENCY_SUB_BUCKETS_LOG 2
+#define MTM_LATENCY_SUB_BUCKETS     (1 << MTM_LATENCY_SUB_BUCKETS_LOG)
+#define MTM_LATENCY_BUCKETS         (32*MTM_LATENCY_SUB_BUCKETS)
+
+typedef struct
+{
+	pg_atomic_uint64 count;
+	pg_atomic_uint64 sum;
+	pg_atomic_uint64 max;
+	pg_atomic_uint64 buckets[MTM_LATENCY_BUCKETS];
+} MtmLatencyHistogram;
+
 typedef struct
 {
 	MtmConnectionInfo con;
@@ -209,6 +281,10 @@ typedef struct
 	timestamp_t receiverStartTime;
 	timestamp_t senderStartTime;
 	timestamp_t lastHeartbeat;
+	timestamp_t lastHeartbeatArrival;  /* Time of receiving the last MSG_HEARTBEAT from this node */
+	double      heartbeatIntervalMean; /* Moving average of heartbeat inter-arrival time (usec), learned by failure detector */
+	double      heartbeatIntervalVar;  /* Moving variance of heartbeat inter-arrival time */
+	int         nHeartbeatIntervals;   /* Number of collected inter-arrival samples (saturated at MTM_FD_MIN_SAMPLES) */
 	nodemask_t  disabledNodeMask;      /* Bitmask of disabled nodes received from this node */
 	nodemask_t  connectivityMask;      /* Connectivity mask at this node */
 	int         senderPid;
@@ -218,11 +294,21 @@ typedef struct
 	lsn_t       restartLSN;
 	RepOriginId originId;
 	int         timeline;
-	void*       lockGraphData;
-	int         lockGraphAllocated;
-	int         lockGraphUsed;
+	struct MtmGraph* lockGraph;        /* wait-for graph of this node */
+	ulong64     applySeq;              /* Sequence number of last transaction received from this node and tracked by apply scheduler */
+	MtmApplySlot* applySlots;          /* [MULTIMASTER_MAX_APPLY_INFLIGHT]: apply scheduler state of transactions received from this node */
+	MtmLatencyHistogram* latency;      /* [MTM_LATENCY_PHASES]: latency of commit phases of transactions related with this node */
 } MtmNodeInfo;
 
+/*
+ * Shared memory queue through which receiver streams large transaction to apply worker
+ */
+typedef struct
+{
+	pg_atomic_uint32 refCount;         /* Number of processes (receiver and apply worker) using the stream, 0 if stream is free */
+	shm_mq*          queue;            /* [MULTIMASTER_APPLY_STREAM_QUEUE_SIZE] */
+} MtmApplyStream;
+
 typedef struct MtmTransState
 {
     TransactionId  xid;
@@ -231,10 +317,13 @@ typedef struct MtmTransState
 	GlobalTransactionId gtid;          /* Transaction id at coordinator */
     csn_t          csn;                /* commit serial number */
     csn_t          snapshot;           /* transaction snapshot, or INVALID_CSN for local transactions */
+	timestamp_t    votingStart;        /* (adjusted) time when transaction is sent to participants for voting: PREPARE is replicated as soon as it is written, so it is set before prepare */
 	int            procno;             /* pgprocno of transaction coordinator waiting for responses from replicas, 
 							              used to notify coordinator by arbiter */
 	int            nSubxids;           /* Number of subtransanctions */
     struct MtmTransState* next;        /* Next element in L1 list of all finished transaction present in xid2state hash */
+    struct MtmTransState* nextInDoubt; /* Next element in L2 list of in-doubt transactions ordered by CSN */
+    struct MtmTransState* prevInDoubt; /* Previous element in L2 list of in-doubt transactions */
 	bool           votingCompleted;    /* 2PC voting is completed */
 	bool           isLocal;            /* Transaction is either replicated, either doesn't contain DML statements, so it shoudl be ignored by pglogical replication */
 	bool           isEnqueued;         /* Transaction is inserted in queue */
@@ -242,6 +331,7 @@ typedef struct MtmTransState
 	bool           isActive;           /* Transaction is active */
 	bool           isTwoPhase;         /* User level 2PC */
 	bool           isPinned;           /* Transaction oid potected from GC */
+	bool           isInDoubt;          /* Transaction is included in L2 list of in-doubt transactions */
 	int            nConfigChanges;     /* Number of cluster configuration changes at moment of transaction start */
 	nodemask_t     participantsMask;   /* Mask of nodes involved in transaction */
 	nodemask_t     votedMask;          /* Mask of voted nodes */
@@ -255,6 +345,16 @@ typedef struct {
 	MtmTransState* state;
 } MtmTransMap;
 
+/*
+ * Slot of lock-free open addressing index xid->MtmTransState used by visibility checks.
+ * Index is updated only under exclusive MtmLock together with MtmXid2State hash, readers do not take any locks.
+ */
+typedef struct
+{
+	pg_atomic_uint32 xid;              /* InvalidTransactionId for empty slot, MTM_XID_MAP_DELETED for removed entry */
+	MtmTransState* volatile state;
+} MtmXidMapSlot;
+
 typedef struct
 {
 	MtmNodeStatus status;              /* Status of this node */
@@ -271,6 +371,7 @@ typedef struct
 	nodemask_t walSenderLockerMask;    /* Mask of WAL-senders IDs locking the cluster */
 	nodemask_t nodeLockerMask;         /* Mask of node IDs which WAL-senders are locking the cluster */
 	nodemask_t reconnectMask; 	       /* Mask of nodes connection to which has to be reestablished by sender */
+	nodemask_t lockGraphResyncMask;    /* Mask of nodes which lock graph delta was lost: they are asked by heartbeat to publish full graph */
 	int        lastLockHolder;         /* PID of process last obtaning the node lock */
 	bool   localTablesHashLoaded;      /* Whether data from local_tables table is loaded in shared memory hash table */
 	bool   preparedTransactionsLoaded; /* GIDs of prepared transactions are loaded at startup */
@@ -293,11 +394,19 @@ typedef struct
 									 	  It is cleanup by MtmGetOldestXmin */
     MtmTransState** transListTail;     /* Tail of L1 list of all finished transactionds, used to append new elements.
 								  		  This list is expected to be in CSN ascending order, by strict order may be violated */
+	MtmTransState* inDoubtListHead;    /* L2 list of in-doubt transactions ordered by CSN: its head determines stable CSN.
+										  It is maintained when transactions become in-doubt and when they are committed or aborted */
+	MtmTransState* inDoubtListTail;    /* Tail of L2 list of in-doubt transactions, used to append new elements */
 	ulong64 transCount;                /* Counter of transactions perfromed by this node */	
 	ulong64 gcCount;                   /* Number of global transactions performed since last GC */
 	MtmMessageQueue* sendQueue;        /* Messages to be sent by arbiter sender */
 	MtmMessageQueue* freeQueue;        /* Free messages */
+	MtmXidMapSlot* xidMap;             /* [MTM_XID_MAP_SIZE]: lock-free index of MtmXid2State hash */
+	pg_atomic_uint32 xidMapOverflow;   /* Number of transactions present in MtmXid2State but not in xidMap */
+	pg_atomic_uint32* inDoubtWaiters;  /* [ProcGlobal->allProcCount]: XID of in-doubt transaction which backend is waiting for */
+	pg_atomic_uint32 nInDoubtWaiters;  /* Number of backends waiting for in-doubt transactions */
 	lsn_t recoveredLSN;           /* LSN at the moment of recovery completion */
+	MtmApplyStream applyStreams[MULTIMASTER_MAX_APPLY_STREAMS]; /* Queues for streaming of large transactions to apply workers */
 	BgwPool pool;                      /* Pool of background workers for applying logical replication patches */
 	MtmNodeInfo nodes[1];              /* [Mtm->nAllNodes]: per-node data */ 
 } MtmState;
@@ -330,10 +439,13 @@ extern int   MtmConnectTimeout;
 extern int   MtmReconnectTimeout;
 extern int   MtmNodeDisableDelay;
 extern int   MtmTransSpillThreshold;
+extern int   MtmTransStreamThreshold;
 extern int   MtmHeartbeatSendTimeout;
 extern int   MtmHeartbeatRecvTimeout;
+extern int   MtmVoteBatchDelay;
 extern bool  MtmUseDtm;
 extern bool  MtmPreserveCommitOrder;
+extern bool  MtmTrackApplyDependencies;
 extern HTAB* MtmXid2State;
 extern HTAB* MtmGid2State;
 extern VacuumStmt* MtmVacuumStmt;
@@ -355,9 +467,20 @@ extern void  MtmReceiverStarted(int nodeId);
 extern MtmReplicationMode MtmGetReplicationMode(int nodeId, sig_atomic_t volatile* shutdown);
 extern void  MtmExecute(void* work, int size);
 extern void  MtmExecutor(void* work, size_t size);
+extern bool  MtmApplyIsDone(int nodeId, ulong64 seq);
+extern void  MtmApplyDone(int nodeId, ulong64 seq);
+extern void  MtmApplyWait(int nodeId, ulong64 seq);
+extern void  MtmApplyWaitDependencies(int nodeId, ulong64 seq);
+extern int   MtmOpenApplyStream(void);
+extern bool  MtmSendApplyStream(void const* data, int size);
+extern void  MtmAttachApplyStream(int streamId);
+extern char* MtmReceiveApplyStream(int* size);
+extern void  MtmCloseApplyStream(void);
 extern void  MtmSend2PCMessage(MtmTransState* ts, MtmMessageCode cmd);
 extern void  MtmSendMessage(MtmArbiterMessage* msg);
 extern void  MtmAdjustSubtransactions(MtmTransState* ts);
+extern void  MtmInDoubtListInsert(MtmTransState* ts);
+extern void  MtmInDoubtListRemove(MtmTransState* ts);
 extern void  MtmLock(LWLockMode mode);
 extern void  MtmUnlock(void);
 extern void  MtmLockNode(int nodeId, LWLockMode mode);
@@ -368,6 +491,8 @@ extern void  MtmRecoverNode(int nodeId);
 extern void  MtmOnNodeDisconnect(int nodeId);
 extern void  MtmOnNodeConnect(int nodeId);
 extern void  MtmWakeUpBackend(MtmTransState* ts);
+extern void  MtmBeginWakeUpBatch(void);
+extern void  MtmEndWakeUpBatch(void);
 extern void  MtmSleep(timestamp_t interval); 
 extern void  MtmAbortTransaction(MtmTransState* ts);
 extern void  MtmSetCurrentTransactionGID(char const* gid);
@@ -390,9 +515,12 @@ extern void  MtmHandleApplyError(void);
 extern void  MtmUpdateLsnMapping(int nodeId, lsn_t endLsn);
 extern lsn_t MtmGetFlushPosition(int nodeId);
 extern bool MtmWatchdog(timestamp_t now);
+extern void MtmUpdateHeartbeatStatistics(int nodeId, timestamp_t now);
+extern int  MtmGetWatchdogPeriod(void);
 extern void MtmCheckHeartbeat(void);
 extern void MtmResetTransaction(void);
 extern void MtmUpdateLockGraph(int nodeId, void const* messageBody, int messageSize);
+extern void MtmRequestFullLockGraph(void);
 extern void MtmReleaseRecoverySlot(int nodeId);
 extern PGconn *PQconnectdb_safe(const char *conninfo);
 extern void MtmBeginSession(int nodeId);
@@ -402,4 +530,6 @@ extern void MtmRollbackPreparedTransaction(int nodeId, char const* gid);
 extern bool MtmFilterTransaction(char* record, int size);
 extern void MtmPrecommitTransaction(char const* gid);
 extern char* MtmGucSerialize(void);
+extern void  MtmLatencyAdd(int nodeId, MtmLatencyPhase phase, timestamp_t latency);
+extern void  MtmLatencyAddSince(int nodeId, MtmLatencyPhase phase, timestamp_t start);
 #endif
@@ -24,6 +24,8 @@
 
 #include "libpq/pqformat.h"
 
+#include "nodes/makefuncs.h"
+
 #include "mb/pg_wchar.h"
 
 #include "parser/parse_type.h"
@@ -45,6 +47,7 @@
 #include "utils/tqual.h"
 #include "utils/builtins.h"
 #include "utils/datetime.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/snapmgr.h"
@@ -52,7 +55,6 @@
 #include "parser/parse_relation.h"
 
 #include "multimaster.h"
-#include "pglogical_relid_map.h"
 #include "spill.h"
 
 typedef struct TupleData
@@ -62,25 +64,71 @@ typedef struct TupleData
 	bool		changed[MaxTupleAttributeNumber];
 } TupleData;
 
-static Relation read_rel(StringInfo s, LOCKMODE mode);
+/*
+ * Apply worker cache of replicated relations, indexed by remote relation id.
+ * Information about replica identity index is kept until relcache invalidation,
+ * relation itself, its indexes and executor state are kept open till the end of transaction.
+ */
+typedef struct MtmApplyRelation
+{
+	Oid             remote_relid; /* hash key */
+	Oid             local_relid;
+	bool            valid;        /* cleared by relcache invalidation callback */
+	int             nkeys;        /* number of replica identity key attributes, -1 if not yet known */
+	Oid             idxoid;       /* replica identity index */
+	AttrNumber      keyattnos[INDEX_MAX_KEYS];
+	ScanKeyData     keys[INDEX_MAX_KEYS]; /* scan key templates with resolved comparison procedures */
+
+	/* Objects opened in current transaction */
+	Relation        rel;
+	Relation        idxrel;
+	EState*         estate;
+	TupleTableSlot* newslot;
+	TupleTableSlot* oldslot;
+} MtmApplyRelation;
+
+static MtmApplyRelation* read_rel(StringInfo s, LOCKMODE mode);
+static void close_apply_relation(MtmApplyRelation* arel);
+static void release_apply_relations(bool abort);
 static void read_tuple_parts(StringInfo s, Relation rel, TupleData *tup);
 static EState* create_rel_estate(Relation rel);
 static bool find_pkey_tuple(ScanKey skey, Relation rel, Relation idxrel,
                             TupleTableSlot *slot, bool lock, LockTupleMode mode);
 static void build_index_scan_keys(EState *estate, ScanKey *scan_keys, TupleData *tup);
 static bool build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, TupleData *tup);
+static int  build_index_scan_key_template(ScanKey skey, AttrNumber* attnos, Relation rel, Relation idxrel);
+static bool fill_index_scan_key(ScanKey skey, AttrNumber* attnos, int nkeys, TupleData *tup);
 static void UserTableUpdateOpenIndexes(EState *estate, TupleTableSlot *slot);
-static void UserTableUpdateIndexes(EState *estate, TupleTableSlot *slot);
 
 static bool process_remote_begin(StringInfo s);
 static bool process_remote_message(StringInfo s);
 static void process_remote_commit(StringInfo s);
-static void process_remote_insert(StringInfo s, Relation rel);
-static void process_remote_update(StringInfo s, Relation rel);
-static void process_remote_delete(StringInfo s, Relation rel);
+static void process_remote_insert(StringInfo s, MtmApplyRelation* arel);
+static void process_remote_update(StringInfo s, MtmApplyRelation* arel);
+static void process_remote_delete(StringInfo s, MtmApplyRelation* arel);
+static void flush_insert_batch(void);
 
 static MemoryContext TopContext;
 static bool          GucAltered; /* transaction is setting some GUC variables */
+static HTAB*         ApplyRelations;
+
+/*
+ * Consecutive inserts into the same relation are accumulated here and applied
+ * with heap_multi_insert, sharing executor state and open indexes of the relation.
+ * Limits are the same as used by COPY.
+ */
+#define MTM_MAX_BATCH_TUPLES 1000
+#define MTM_MAX_BATCH_SIZE   65535
+
+typedef struct
+{
+	MtmApplyRelation* arel;    /* NULL if batch is empty */
+	HeapTuple       tuples[MTM_MAX_BATCH_TUPLES];
+	int             nTuples;
+	Size            size;
+} MtmInsertBatch;
+
+static MtmInsertBatch InsertBatch;
 
 /*
  * Search the index 'idxrel' for a tuple identified by 'skey' in 'rel'.
@@ -216,14 +264,29 @@ build_index_scan_keys(EState *estate, ScanKey *scan_keys, TupleData *tup)
  */
 static bool
 build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, TupleData *tup)
+{
+	AttrNumber attnos[INDEX_MAX_KEYS];
+	int nkeys = build_index_scan_key_template(skey, attnos, rel, idxrel);
+	return fill_index_scan_key(skey, attnos, nkeys, tup);
+}
+
+/*
+ * Resolve comparison procedures for all key attributes of index 'idxrel' and
+ * save numbers of corresponding attributes of 'rel' in 'attnos'.
+ * Arguments of the scan keys are set later by fill_index_scan_key.
+ *
+ * Returns number of key attributes.
+ */
+static int
+build_index_scan_key_template(ScanKey skey, AttrNumber* attnos, Relation rel, Relation idxrel)
 {
 	int			attoff;
+	int			nkeys = IndexRelationGetNumberOfKeyAttributes(idxrel);
 	Datum		indclassDatum;
 	Datum		indkeyDatum;
 	bool		isnull;
 	oidvector  *opclass;
 	int2vector  *indkey;
-	bool		hasnulls = false;
 
 	indclassDatum = SysCacheGetAttr(INDEXRELID, idxrel->rd_indextuple,
 									Anum_pg_index_indclass, &isnull);
@@ -236,7 +299,7 @@ build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, TupleData *tup
 	indkey = (int2vector *) DatumGetPointer(indkeyDatum);
 
 
-	for (attoff = 0; attoff < IndexRelationGetNumberOfKeyAttributes(idxrel); attoff++)
+	for (attoff = 0; attoff < nkeys; attoff++)
 	{
 		Oid			operator;
 		Oid			opfamily;
@@ -264,7 +327,29 @@ build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, TupleData *tup
 					pkattno,
 					BTEqualStrategyNumber,
 					regop,
-					tup->values[mainattno - 1]);
+					(Datum)0);
+		attnos[attoff] = mainattno;
+	}
+	return nkeys;
+}
+
+/*
+ * Set arguments of scan keys built by build_index_scan_key_template to the values of tuple attributes.
+ *
+ * Returns whether any column contains NULLs.
+ */
+static bool
+fill_index_scan_key(ScanKey skey, AttrNumber* attnos, int nkeys, TupleData *tup)
+{
+	int			attoff;
+	bool		hasnulls = false;
+
+	for (attoff = 0; attoff < nkeys; attoff++)
+	{
+		int	mainattno = attnos[attoff];
+
+		skey[attoff].sk_argument = tup->values[mainattno - 1];
+		skey[attoff].sk_flags = 0;
 
 		if (tup->isnull[mainattno - 1])
 		{
@@ -275,18 +360,6 @@ build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, TupleData *tup
 	return hasnulls;
 }
 
-static void
-UserTableUpdateIndexes(EState *estate, TupleTableSlot *slot)
-{
-	/* HOT update does not require index inserts */
-	if (HeapTupleIsHeapOnly(slot->tts_tuple))
-		return;
-
-	ExecOpenIndices(estate->es_result_relation_info, false);
-	UserTableUpdateOpenIndexes(estate, slot);
-	ExecCloseIndices(estate->es_result_relation_info);
-}
-
 static void
 UserTableUpdateOpenIndexes(EState *estate, TupleTableSlot *slot)
 {
@@ -586,34 +659,187 @@ read_tuple_parts(StringInfo s, Relation rel, TupleData *tup)
 	}
 }
 
-static Relation 
+/*
+ * Relcache invalidation callback: force lookup of relation and its replica identity index at next access
+ */
+static void
+apply_relcache_callback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS status;
+	MtmApplyRelation* arel;
+
+	hash_seq_init(&status, ApplyRelations);
+	while ((arel = (MtmApplyRelation*)hash_seq_search(&status)) != NULL) {
+		if (relid == InvalidOid || arel->local_relid == relid) {
+			arel->valid = false;
+		}
+	}
+}
+
+static void
+init_apply_relations(void)
+{
+	HASHCTL	ctl;
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(MtmApplyRelation);
+	ctl.hcxt = CacheMemoryContext;
+
+	ApplyRelations = hash_create("MtmApplyRelations", 256, &ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	CacheRegisterRelcacheCallback(apply_relcache_callback, (Datum)0);
+}
+
+/*
+ * Open relation, its indexes and executor state for the rest of current transaction
+ */
+static void
+open_apply_relation(MtmApplyRelation* arel, LOCKMODE mode)
+{
+	EState* estate;
+
+	arel->rel = heap_open(arel->local_relid, mode);
+	arel->estate = estate = create_rel_estate(arel->rel);
+	arel->newslot = ExecInitExtraTupleSlot(estate);
+	arel->oldslot = ExecInitExtraTupleSlot(estate);
+	ExecSetSlotDescriptor(arel->newslot, RelationGetDescr(arel->rel));
+	ExecSetSlotDescriptor(arel->oldslot, RelationGetDescr(arel->rel));
+	ExecOpenIndices(estate->es_result_relation_info, false);
+	arel->idxrel = NULL;
+}
+
+static void
+close_apply_relation(MtmApplyRelation* arel)
+{
+	if (InsertBatch.arel == arel) {
+		flush_insert_batch();
+	}
+	/* release locks upon commit */
+	ExecCloseIndices(arel->estate->es_result_relation_info);
+	heap_close(arel->rel, NoLock);
+	ExecResetTupleTable(arel->estate->es_tupleTable, true);
+	FreeExecutorState(arel->estate);
+	arel->rel = NULL;
+	arel->idxrel = NULL;
+	arel->estate = NULL;
+}
+
+/*
+ * Close all relations opened by current transaction.
+ * In case of abort resources are released by resource owner and memory context reset.
+ */
+static void
+release_apply_relations(bool abort)
+{
+	HASH_SEQ_STATUS status;
+	MtmApplyRelation* arel;
+
+	if (abort) {
+		InsertBatch.arel = NULL;
+		InsertBatch.nTuples = 0;
+		InsertBatch.size = 0;
+	}
+	if (ApplyRelations == NULL) {
+		return;
+	}
+	hash_seq_init(&status, ApplyRelations);
+	while ((arel = (MtmApplyRelation*)hash_seq_search(&status)) != NULL) {
+		if (arel->rel != NULL) {
+			if (abort) {
+				arel->rel = NULL;
+				arel->idxrel = NULL;
+				arel->estate = NULL;
+			} else {
+				close_apply_relation(arel);
+			}
+		}
+	}
+}
+
+/*
+ * Get replica identity index of the relation, building scan key templates for it if needed.
+ */
+static Relation
+get_replica_identity_index(MtmApplyRelation* arel)
+{
+	if (arel->idxrel == NULL) {
+		Relation rel = arel->rel;
+		ResultRelInfo* relinfo = arel->estate->es_result_relation_info;
+		int i;
+
+		if (arel->nkeys < 0) {
+			/* lookup index to build scankey */
+			if (rel->rd_indexvalid == 0)
+				RelationGetIndexList(rel);
+			arel->idxoid = rel->rd_replidindex;
+			if (!OidIsValid(arel->idxoid))
+			{
+				elog(ERROR, "could not find primary key for table with oid %u",
+					 RelationGetRelid(rel));
+			}
+		}
+		/* index is already opened by ExecOpenIndices */
+		for (i = 0; i < relinfo->ri_NumIndices; i++) {
+			if (RelationGetRelid(relinfo->ri_IndexRelationDescs[i]) == arel->idxoid) {
+				arel->idxrel = relinfo->ri_IndexRelationDescs[i];
+				break;
+			}
+		}
+		if (arel->idxrel == NULL) {
+			elog(ERROR, "could not open primary key %u for table with oid %u",
+				 arel->idxoid, RelationGetRelid(rel));
+		}
+		Assert(arel->idxrel->rd_index->indisunique);
+
+		if (arel->nkeys < 0) {
+			/* comparison functions should survive end of transaction */
+			MemoryContext oldcontext = MemoryContextSwitchTo(CacheMemoryContext);
+			arel->nkeys = build_index_scan_key_template(arel->keys, arel->keyattnos, rel, arel->idxrel);
+			MemoryContextSwitchTo(oldcontext);
+		}
+	}
+	return arel->idxrel;
+}
+
+static MtmApplyRelation*
 read_rel(StringInfo s, LOCKMODE mode)
 {
 	int			relnamelen;
 	int			nspnamelen;
-	RangeVar*	rv;
+	char*       relname;
+	char*       nspname;
 	Oid			remote_relid = pq_getmsgint(s, 4);
-	Oid         local_relid;
-
-	local_relid = pglogical_relid_map_get(remote_relid);
-	if (local_relid == InvalidOid) { 
-		rv = makeNode(RangeVar);
-
-		nspnamelen = pq_getmsgbyte(s);
-		rv->schemaname = (char *) pq_getmsgbytes(s, nspnamelen);
-		
-		relnamelen = pq_getmsgbyte(s);
-		rv->relname = (char *) pq_getmsgbytes(s, relnamelen);
-		
-		local_relid = RangeVarGetRelidExtended(rv, mode, false, false, NULL, NULL);
-		pglogical_relid_map_put(remote_relid, local_relid);
-	} else { 
-		nspnamelen = pq_getmsgbyte(s);
-		s->cursor += nspnamelen;
-		relnamelen = pq_getmsgbyte(s);
-		s->cursor += relnamelen;
+	MtmApplyRelation* arel;
+	bool        found;
+
+	nspnamelen = pq_getmsgbyte(s);
+	nspname = (char *) pq_getmsgbytes(s, nspnamelen);
+	relnamelen = pq_getmsgbyte(s);
+	relname = (char *) pq_getmsgbytes(s, relnamelen);
+
+	if (ApplyRelations == NULL) {
+		init_apply_relations();
+	}
+	arel = (MtmApplyRelation*)hash_search(ApplyRelations, &remote_relid, HASH_ENTER, &found);
+	if (!found) {
+		arel->valid = false;
+		arel->rel = NULL;
+		arel->estate = NULL;
+		arel->idxrel = NULL;
+	}
+	if (!arel->valid) {
+		RangeVar* rv = makeRangeVar(nspname, relname, -1);
+		if (arel->rel != NULL) {
+			close_apply_relation(arel);
+		}
+		arel->valid = true;
+		arel->nkeys = -1;
+		arel->local_relid = RangeVarGetRelidExtended(rv, mode, false, false, NULL, NULL);
 	}
-	return heap_open(local_relid, NoLock);
+	if (arel->rel == NULL) {
+		open_apply_relation(arel, mode);
+	}
+	return arel;
 }
 
 static void
@@ -625,6 +851,7 @@ process_remote_commit(StringInfo in)
 	lsn_t       end_lsn;
 	lsn_t       origin_lsn;
 	int         origin_node;
+	timestamp_t start = MtmGetCurrentTime();
 	/* read event */
 	event = pq_getmsgbyte(in);
 	MtmReplicationNodeId = pq_getmsgbyte(in);
@@ -650,6 +877,7 @@ process_remote_commit(StringInfo in)
 			MtmBeginSession(origin_node);
 			MtmPrecommitTransaction(gid);
 			MtmEndSession(origin_node, true);
+			MtmLatencyAddSince(origin_node, MTM_LATENCY_PRECOMMIT, start);
 			return;
 		}
 		case PGLOGICAL_COMMIT:
@@ -682,6 +910,7 @@ process_remote_commit(StringInfo in)
 				MtmSetCurrentTransactionGID(gid);
 				PrepareTransactionBlock(gid);
 				CommitTransactionCommand();
+				MtmLatencyAddSince(origin_node, MTM_LATENCY_PREPARE, start);
 
 				if (MtmExchangeGlobalTransactionStatus(gid, TRANSACTION_STATUS_UNKNOWN) == TRANSACTION_STATUS_ABORTED) { 
 					MTM_LOG1("Perform delayed rollback of prepared global transaction %s", gid);	
@@ -708,6 +937,7 @@ process_remote_commit(StringInfo in)
 			FinishPreparedTransaction(gid, true);
 			CommitTransactionCommand();
 			MtmEndSession(origin_node, true);
+			MtmLatencyAddSince(origin_node, MTM_LATENCY_COMMIT, start);
 			break;
 		}
 		case PGLOGICAL_ABORT_PREPARED:
@@ -728,49 +958,82 @@ process_remote_commit(StringInfo in)
 	MtmUpdateLsnMapping(MtmReplicationNodeId, end_lsn);
 }
 
+/*
+ * Write accumulated tuples to the heap with single heap_multi_insert call and update indexes.
+ */
 static void
-process_remote_insert(StringInfo s, Relation rel)
+flush_insert_batch(void)
 {
-	EState *estate;
-	TupleData new_tuple;
-	TupleTableSlot *newslot;
-	TupleTableSlot *oldslot;
-	ResultRelInfo *relinfo;
-	ScanKey	*index_keys;
-	int	i;
+	MtmApplyRelation* arel = InsertBatch.arel;
+	EState* estate;
+	int i;
+
+	if (arel == NULL) { 
+		return;
+	}
+	estate = arel->estate;
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
-	estate = create_rel_estate(rel);
-	newslot = ExecInitExtraTupleSlot(estate);
-	oldslot = ExecInitExtraTupleSlot(estate);
-	ExecSetSlotDescriptor(newslot, RelationGetDescr(rel));
-	ExecSetSlotDescriptor(oldslot, RelationGetDescr(rel));
+	heap_multi_insert(arel->rel, InsertBatch.tuples, InsertBatch.nTuples,
+					  GetCurrentCommandId(true), 0, NULL);
 
-	read_tuple_parts(s, rel, &new_tuple);
+	for (i = 0; i < InsertBatch.nTuples; i++)
 	{
-		HeapTuple tup;
-		tup = heap_form_tuple(RelationGetDescr(rel),
-							  new_tuple.values, new_tuple.isnull);
-		ExecStoreTuple(tup, newslot, InvalidBuffer, true);
+		ExecStoreTuple(InsertBatch.tuples[i], arel->newslot, InvalidBuffer, false);
+		UserTableUpdateOpenIndexes(estate, arel->newslot);
+		ResetPerTupleExprContext(estate);
+		heap_freetuple(InsertBatch.tuples[i]);
+	}
+	ExecClearTuple(arel->newslot);
+
+	if (ActiveSnapshotSet())
+		PopActiveSnapshot();
+
+	InsertBatch.arel = NULL;
+	InsertBatch.nTuples = 0;
+	InsertBatch.size = 0;
+
+	CommandCounterIncrement();
+}
+
+static void
+process_remote_insert(StringInfo s, MtmApplyRelation* arel)
+{
+	Relation rel = arel->rel;
+	EState *estate = arel->estate;
+	ResultRelInfo *relinfo = estate->es_result_relation_info;
+	TupleData new_tuple;
+	HeapTuple tup;
+	ScanKey	*index_keys;
+	int	i;
+
+	if (InsertBatch.arel != arel) { 
+		flush_insert_batch();
+		InsertBatch.arel = arel;
 	}
 
+	read_tuple_parts(s, rel, &new_tuple);
+	tup = heap_form_tuple(RelationGetDescr(rel),
+						  new_tuple.values, new_tuple.isnull);
+
 	// if (rel->rd_rel->relkind != RELKIND_RELATION) // RELKIND_MATVIEW
 	// 	elog(ERROR, "unexpected relkind '%c' rel \"%s\"",
 	// 		 rel->rd_rel->relkind, RelationGetRelationName(rel));
 
 	/* debug output */
 #ifdef VERBOSE_INSERT
-	log_tuple("INSERT:%s", RelationGetDescr(rel), newslot->tts_tuple);
+	log_tuple("INSERT:%s", RelationGetDescr(rel), tup);
 #endif
 
 	/*
-	 * Search for conflicting tuples.
+	 * Search for conflicting tuples. Only unique indexes have to be checked:
+	 * tuples of the batch can not conflict with each other because
+	 * the same constraints were enforced at origin node.
 	 */
-	ExecOpenIndices(estate->es_result_relation_info, false);
-	relinfo = estate->es_result_relation_info;
-	index_keys = palloc0(relinfo->ri_NumIndices * sizeof(ScanKeyData*));
+	PushActiveSnapshot(GetTransactionSnapshot());
 
+	index_keys = palloc0(relinfo->ri_NumIndices * sizeof(ScanKeyData*));
 	build_index_scan_keys(estate, index_keys, &new_tuple);
 
 	/* do a SnapshotDirty search for conflicting tuples */
@@ -797,7 +1060,8 @@ process_remote_insert(StringInfo s, Relation rel)
 		/* if conflict: wait */
 		found = find_pkey_tuple(index_keys[i],
 								rel, relinfo->ri_IndexRelationDescs[i],
-								oldslot, true, LockTupleExclusive);
+								arel->oldslot, true, LockTupleExclusive);
+		pfree(index_keys[i]);
 
 		/* alert if there's more than one conflicting unique key */
 		if (found)
@@ -810,34 +1074,32 @@ process_remote_insert(StringInfo s, Relation rel)
 		}
 		CHECK_FOR_INTERRUPTS();
 	}
-
-	simple_heap_insert(rel, newslot->tts_tuple);
-    UserTableUpdateOpenIndexes(estate, newslot);
-
-	ExecCloseIndices(estate->es_result_relation_info);
+	pfree(index_keys);
+	ExecClearTuple(arel->oldslot);
 
 	if (ActiveSnapshotSet())
 		PopActiveSnapshot();
 
-    heap_close(rel, NoLock);
-    ExecResetTupleTable(estate->es_tupleTable, true);
-    FreeExecutorState(estate);
+	InsertBatch.tuples[InsertBatch.nTuples++] = tup;
+	InsertBatch.size += tup->t_len;
 
-	CommandCounterIncrement();
+	if (InsertBatch.nTuples == MTM_MAX_BATCH_TUPLES || InsertBatch.size >= MTM_MAX_BATCH_SIZE) { 
+		flush_insert_batch();
+	}
 }
 
 static void
-process_remote_update(StringInfo s, Relation rel)
+process_remote_update(StringInfo s, MtmApplyRelation* arel)
 {
 	char		action;
-	EState	   *estate;
-	TupleTableSlot *newslot;
-	TupleTableSlot *oldslot;
+	Relation	rel = arel->rel;
+	EState	   *estate = arel->estate;
+	TupleTableSlot *newslot = arel->newslot;
+	TupleTableSlot *oldslot = arel->oldslot;
 	bool		pkey_sent;
 	bool		found_tuple;
 	TupleData   old_tuple;
 	TupleData   new_tuple;
-	Oid			idxoid;
 	Relation	idxrel;
 	ScanKeyData skey[INDEX_MAX_KEYS];
 	HeapTuple	remote_tuple = NULL;
@@ -849,12 +1111,6 @@ process_remote_update(StringInfo s, Relation rel)
 		elog(ERROR, "expected action 'N' or 'K', got %c",
 			 action);
 
-	estate = create_rel_estate(rel);
-	oldslot = ExecInitExtraTupleSlot(estate);
-	ExecSetSlotDescriptor(oldslot, RelationGetDescr(rel));
-	newslot = ExecInitExtraTupleSlot(estate);
-	ExecSetSlotDescriptor(newslot, RelationGetDescr(rel));
-
 	if (action == 'K')
 	{
 		pkey_sent = true;
@@ -876,25 +1132,12 @@ process_remote_update(StringInfo s, Relation rel)
 	/* read new tuple */
 	read_tuple_parts(s, rel, &new_tuple);
 
-	/* lookup index to build scankey */
-	if (rel->rd_indexvalid == 0)
-		RelationGetIndexList(rel);
-	idxoid = rel->rd_replidindex;
-	if (!OidIsValid(idxoid))
-	{
-		elog(ERROR, "could not find primary key for table with oid %u",
-			 RelationGetRelid(rel));
-		return;
-	}
-
-	/* open index, so we can build scan key for row */
-	idxrel = index_open(idxoid, RowExclusiveLock);
-
-	Assert(idxrel->rd_index->indisunique);
+	idxrel = get_replica_identity_index(arel);
 
 	/* Use columns from the new tuple if the key didn't change. */
-	build_index_scan_key(skey, rel, idxrel,
-						 pkey_sent ? &old_tuple : &new_tuple);
+	memcpy(skey, arel->keys, arel->nkeys*sizeof(ScanKeyData));
+	fill_index_scan_key(skey, arel->keyattnos, arel->nkeys,
+						pkey_sent ? &old_tuple : &new_tuple);
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
@@ -925,7 +1168,7 @@ process_remote_update(StringInfo s, Relation rel)
 #endif
 
         simple_heap_update(rel, &oldslot->tts_tuple->t_self, newslot->tts_tuple);
-        UserTableUpdateIndexes(estate, newslot);
+        UserTableUpdateOpenIndexes(estate, newslot);
 	}
 	else
 	{
@@ -937,52 +1180,33 @@ process_remote_update(StringInfo s, Relation rel)
 	}
     
 	PopActiveSnapshot();
-    
-	/* release locks upon commit */
-	index_close(idxrel, NoLock);
-	heap_close(rel, NoLock);
-    
-	ExecResetTupleTable(estate->es_tupleTable, true);
-	FreeExecutorState(estate);
+
+	ExecClearTuple(oldslot);
+	ExecClearTuple(newslot);
+	ResetPerTupleExprContext(estate);
 
 	CommandCounterIncrement();
 }
 
 static void
-process_remote_delete(StringInfo s, Relation rel)
+process_remote_delete(StringInfo s, MtmApplyRelation* arel)
 {
-	EState	   *estate;
+	Relation	rel = arel->rel;
 	TupleData   oldtup;
-	TupleTableSlot *oldslot;
-	Oid			idxoid;
+	TupleTableSlot *oldslot = arel->oldslot;
 	Relation	idxrel;
 	ScanKeyData skey[INDEX_MAX_KEYS];
 	bool		found_old;
 
-	estate = create_rel_estate(rel);
-	oldslot = ExecInitExtraTupleSlot(estate);
-	ExecSetSlotDescriptor(oldslot, RelationGetDescr(rel));
-
 	read_tuple_parts(s, rel, &oldtup);
 
-	/* lookup index to build scankey */
-	if (rel->rd_indexvalid == 0)
-		RelationGetIndexList(rel);
-	idxoid = rel->rd_replidindex;
-	if (!OidIsValid(idxoid))
-	{
-		elog(ERROR, "could not find primary key for table with oid %u",
-			 RelationGetRelid(rel));
-		return;
-	}
-
-	/* Now open the primary key index */
-	idxrel = index_open(idxoid, RowExclusiveLock);
-
 	if (rel->rd_rel->relkind != RELKIND_RELATION)
 		elog(ERROR, "unexpected relkind '%c' rel \"%s\"",
 			 rel->rd_rel->relkind, RelationGetRelationName(rel));
 
+	/* Now get the primary key index */
+	idxrel = get_replica_identity_index(arel);
+
 #ifdef VERBOSE_DELETE
 	{
 		HeapTuple tup;
@@ -995,7 +1219,8 @@ process_remote_delete(StringInfo s, Relation rel)
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
-	build_index_scan_key(skey, rel, idxrel, &oldtup);
+	memcpy(skey, arel->keys, arel->nkeys*sizeof(ScanKeyData));
+	fill_index_scan_key(skey, arel->keyattnos, arel->nkeys, &oldtup);
 
 	/* try to find tuple via a (candidate|primary) key */
 	found_old = find_pkey_tuple(skey, rel, idxrel, oldslot, true, LockTupleExclusive);
@@ -1014,22 +1239,49 @@ process_remote_delete(StringInfo s, Relation rel)
 
 	PopActiveSnapshot();
 
-	index_close(idxrel, NoLock);
-	heap_close(rel, NoLock);
-
-	ExecResetTupleTable(estate->es_tupleTable, true);
-	FreeExecutorState(estate);
+	ExecClearTuple(oldslot);
 
 	CommandCounterIncrement();
 }
 
+/*
+ * Switch to the next chunk of transaction streamed by receiver.
+ * Returns false if receiver has closed the stream without sending the rest of transaction.
+ */
+static bool read_stream_chunk(StringInfo s)
+{
+	s->data = MtmReceiveApplyStream(&s->len);
+	s->cursor = 0;
+	return s->data != NULL;
+}
+
+/*
+ * Receiver closes the stream without sending commit record if streamed transaction is filtered
+ * (for example it was already applied at this node). It is not an error:
+ * just drop the part of transaction applied so far without notifying coordinator about abort.
+ */
+static void drop_streamed_transaction(void)
+{
+	MTM_LOG1("%d: Drop streamed transaction %llu filtered by receiver", MyProcPid, (long64)MtmGetCurrentTransactionId());
+	release_apply_relations(true);
+	if (IsTransactionState()) { 
+		MtmResetTransaction();
+		MtmEndSession(MtmReplicationNodeId, false);
+		AbortCurrentTransaction();
+	}
+}
+
 void MtmExecutor(void* work, size_t size)
 {
     StringInfoData s;
-    Relation rel = NULL;
+    MtmApplyRelation* rel = NULL;
 	int spill_file = -1;
 	int save_cursor = 0;
 	int save_len = 0;
+	/* set inside PG_TRY and used after an error */
+	volatile int apply_node = 0;
+	volatile ulong64 apply_seq = 0;
+	volatile bool streamed = false;
     s.data = work;
     s.len = size;
     s.maxlen = -1;
@@ -1044,11 +1296,22 @@ void MtmExecutor(void* work, size_t size)
     }
     TopContext = MemoryContextSwitchTo(MtmApplyContext);
 	replorigin_session_origin = InvalidRepOriginId;
+	if (BgwPoolItemProducerId != 0) { 
+		MtmLatencyAdd(BgwPoolItemProducerId, MTM_LATENCY_QUEUE, BgwPoolItemQueueTime);
+	}
     PG_TRY();
     {    
         while (true) { 
             char action = pq_getmsgbyte(&s);
             MTM_LOG2("%d: REMOTE process action %c", MyProcPid, action);
+			if (action != 'I' && action != 'R' && action != '(' && action != ')') { 
+				/* any other action has to see effect of preceding inserts */
+				flush_insert_batch();
+				if (action != 'U' && action != 'D') { 
+					/* relations can not be kept open across transaction boundary or DDL */
+					release_apply_relations(false);
+				}
+			}
 #if 0
 			if (Mtm->status == MTM_RECOVERY) { 
 				MTM_LOG1("Replay action %c[%x]",   action, s.data[s.cursor]);
@@ -1082,6 +1345,26 @@ void MtmExecutor(void* work, size_t size)
             case 'R':
                 rel = read_rel(&s, RowExclusiveLock);
                 continue;
+			case 'S':
+			{
+				/* sequence number assigned by apply scheduler */
+				apply_node = pq_getmsgbyte(&s);
+				apply_seq = pq_getmsgint64(&s);
+				MtmApplyWaitDependencies(apply_node, apply_seq);
+				continue;
+			}
+			case 'Q':
+			{
+				/* Large transaction is streamed by receiver through shared memory queue */
+				int stream_id = pq_getmsgint(&s, 4);
+				MtmAttachApplyStream(stream_id);
+				streamed = true;
+				if (!read_stream_chunk(&s)) { 
+					drop_streamed_transaction();
+					break;
+				}
+				continue;
+			}
 			case 'F':
 			{
 				int node_id = pq_getmsgint(&s, 4);
@@ -1103,6 +1386,13 @@ void MtmExecutor(void* work, size_t size)
 			}
   		    case ')':
 			{
+				if (streamed) { 
+					if (!read_stream_chunk(&s)) { 
+						drop_streamed_transaction();
+						break;
+					}
+					continue;
+				}
   			    pfree(s.data);
 				s.data = work;
   			    s.cursor = save_cursor;
@@ -1130,6 +1420,7 @@ void MtmExecutor(void* work, size_t size)
     PG_CATCH();
     {
 		MemoryContext oldcontext = MemoryContextSwitchTo(MtmApplyContext);
+		release_apply_relations(true);
 		MtmHandleApplyError();
 		MemoryContextSwitchTo(oldcontext);
 		EmitErrorReport();
@@ -1138,11 +1429,27 @@ void MtmExecutor(void* work, size_t size)
 		MtmEndSession(MtmReplicationNodeId, false);
         AbortCurrentTransaction();
 		MTM_LOG2("%d: REMOTE end abort transaction %llu", MyProcPid, (long64)MtmGetCurrentTransactionId());
+		if (streamed) {
+			/* detach, so that the receiver isn't blocked sending the rest */
+			MtmCloseApplyStream();
+			streamed = false;
+		}
+		if (apply_seq != 0) {
+			/* transactions depending on this one must not wait for it forever */
+			MtmApplyDone(apply_node, apply_seq);
+			apply_seq = 0;
+		}
     }
     PG_END_TRY();
 	if (spill_file >= 0) { 
 		MtmCloseSpillFile(spill_file);
 	}
+	if (streamed) { 
+		MtmCloseApplyStream();
+	}
+	if (apply_seq != 0) { 
+		MtmApplyDone(apply_node, apply_seq);
+	}
     MemoryContextResetAndDeleteChildren(MtmApplyContext);
 }
     
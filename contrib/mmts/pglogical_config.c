@@ -429,8 +429,9 @@ prepare_startup_message(PGLogicalOutputData *data)
 	ListCell *lc;
 	List *l = NIL;
 
-	l = add_startup_msg_s(l, "max_proto_version", "1");
-	l = add_startup_msg_s(l, "min_proto_version", "1");
+	l = add_startup_msg_i(l, "max_proto_version", PG_LOGICAL_PROTO_VERSION_NUM);
+	l = add_startup_msg_i(l, "min_proto_version", PG_LOGICAL_PROTO_MIN_VERSION_NUM);
+	l = add_startup_msg_i(l, "proto_version", data->proto_version);
 
 	/* We don't support understand column types yet */
 	l = add_startup_msg_b(l, "coltypes", false);
@@ -226,6 +226,8 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt,
 				 errmsg("client sent max_proto_version=%d but we only support protocol %d or higher",
 				 	data->client_max_proto_version, PG_LOGICAL_PROTO_MIN_VERSION_NUM)));
 
+		data->proto_version = Min(data->client_max_proto_version, PG_LOGICAL_PROTO_VERSION_NUM);
+
 		/*
 		 * Set correct protocol format.
 		 *
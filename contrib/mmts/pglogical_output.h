@@ -24,7 +24,7 @@
 
 #include "pglogical_proto.h"
 
-#define PG_LOGICAL_PROTO_VERSION_NUM 1
+#define PG_LOGICAL_PROTO_VERSION_NUM 2
 #define PG_LOGICAL_PROTO_MIN_VERSION_NUM 1
 
 /*
@@ -48,6 +48,7 @@ typedef struct PGLogicalOutputData
 	PGLogicalProtoAPI *api;
 
 	/* protocol */
+	uint32	proto_version;		/* negotiated with client */
 	bool	allow_internal_basetypes;
 	bool	allow_binary_basetypes;
 	bool	forward_changesets;
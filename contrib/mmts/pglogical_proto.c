@@ -5,6 +5,8 @@
 #include "pglogical_output.h"
 #include "replication/origin.h"
 
+#include "access/hash.h"
+#include "access/htup_details.h"
 #include "access/sysattr.h"
 #include "access/tuptoaster.h"
 #include "access/xact.h"
@@ -31,6 +33,7 @@
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/relcache.h"
 #include "utils/syscache.h"
 #include "utils/timestamp.h"
 #include "utils/typcache.h"
@@ -60,6 +63,7 @@ static void pglogical_write_delete(StringInfo out, PGLogicalOutputData *data,
 
 static void pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 								   Relation rel, HeapTuple tuple);
+static uint32 pglogical_key_hash(Relation rel, HeapTuple tuple);
 static char decide_datum_transfer(Form_pg_attribute att,
 								  Form_pg_type typclass,
 								  bool allow_internal_basetypes,
@@ -302,6 +306,8 @@ pglogical_write_insert(StringInfo out, PGLogicalOutputData *data,
 
 	MtmTransactionRecords += 1;
 	pq_sendbyte(out, 'I');		/* action INSERT */
+	if (data->proto_version >= 2)
+		pq_sendint(out, pglogical_key_hash(rel, newtuple), 4);
 	pglogical_write_tuple(out, data, rel, newtuple);
 
 }
@@ -328,6 +334,12 @@ pglogical_write_update(StringInfo out, PGLogicalOutputData *data,
 	MTM_LOG3("%d: pglogical_write_update confirmed_flush=%llx", MyProcPid, (long64)MyReplicationSlot->data.confirmed_flush);
 
 	pq_sendbyte(out, 'U');		/* action UPDATE */
+	if (data->proto_version >= 2)
+	{
+		uint32 newkey = pglogical_key_hash(rel, newtuple);
+		pq_sendint(out, newkey, 4);
+		pq_sendint(out, oldtuple != NULL ? pglogical_key_hash(rel, oldtuple) : newkey, 4);
+	}
 	/* FIXME support whole tuple (O tuple type) */
 	if (oldtuple != NULL)
 	{
@@ -358,9 +370,71 @@ pglogical_write_delete(StringInfo out, PGLogicalOutputData *data,
 
 	MtmTransactionRecords += 1;
 	pq_sendbyte(out, 'D');		/* action DELETE */
+	if (data->proto_version >= 2)
+		pq_sendint(out, pglogical_key_hash(rel, oldtuple), 4);
 	pglogical_write_tuple(out, data, rel, oldtuple);
 }
 
+/*
+ * Calculate hash of relation and replica identity key of the tuple.
+ * It is used by apply scheduler at receiver side to detect transactions updating the same records.
+ * Key values are hashed by their binary representation, so equal values with different representation
+ * may produce different hashes. Zero is returned if relation has no replica identity key.
+ * Hash is sent regardless of multimaster.track_apply_dependencies: only the receiver decides whether to use it.
+ */
+static uint32
+pglogical_key_hash(Relation rel, HeapTuple tuple)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	Bitmapset  *keyattrs;
+	int			attno = -1;
+	uint32		hash;
+	bool		hasKey = false;
+
+	keyattrs = RelationGetIndexAttrBitmap(rel, INDEX_ATTR_BITMAP_IDENTITY_KEY);
+	hash = hash_uint32(RelationGetRelid(rel));
+
+	while ((attno = bms_next_member(keyattrs, attno)) >= 0)
+	{
+		AttrNumber	attnum = attno + FirstLowInvalidHeapAttributeNumber;
+		Form_pg_attribute att;
+		Datum		value;
+		bool		isnull;
+		uint32		h;
+
+		if (attnum <= 0)
+			continue;
+
+		att = desc->attrs[attnum - 1];
+		value = heap_getattr(tuple, attnum, desc, &isnull);
+		if (isnull)
+			continue;
+
+		if (att->attbyval)
+			h = hash_any((unsigned char *) &value, sizeof(Datum));
+		else if (att->attlen == -1)
+		{
+			struct varlena *v;
+			if (VARATT_IS_EXTERNAL_ONDISK(value))
+				continue;
+			v = pg_detoast_datum_packed((struct varlena *) DatumGetPointer(value));
+			h = hash_any((unsigned char *) VARDATA_ANY(v), VARSIZE_ANY_EXHDR(v));
+		}
+		else if (att->attlen == -2)
+			h = hash_any((unsigned char *) DatumGetCString(value), strlen(DatumGetCString(value)));
+		else
+			h = hash_any((unsigned char *) DatumGetPointer(value), att->attlen);
+
+		hash = ((hash << 1) | (hash >> 31)) ^ h;
+		hasKey = true;
+	}
+	bms_free(keyattrs);
+
+	if (!hasKey)
+		return 0;
+	return hash != 0 ? hash : 1;
+}
+
 /*
  * Most of the brains for startup message creation lives in
  * pglogical_config.c, so this presently just sends the set of key/value pairs.
@@ -368,6 +442,26 @@ pglogical_write_delete(StringInfo out, PGLogicalOutputData *data,
 static void
 write_startup_message(StringInfo out, List *msg)
 {
+	ListCell   *lc;
+
+	/*
+	 * Receiver only needs to know negotiated protocol version to parse records.
+	 * It is not sent to the clients of version 1, which do not expect this message.
+	 */
+	foreach(lc, msg)
+	{
+		DefElem    *param = (DefElem *) lfirst(lc);
+		int			version;
+
+		if (strcmp(param->defname, "proto_version") != 0)
+			continue;
+		version = atoi(strVal(param->arg));
+		if (version >= 2)
+		{
+			pq_sendbyte(out, 'V');
+			pq_sendint(out, version, 4);
+		}
+	}
 }
 
 /*
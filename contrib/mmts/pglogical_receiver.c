@@ -62,6 +62,14 @@ lsn_t MtmSenderWalEnd;
 /* Stream functions */
 static void fe_sendint64(int64 i, char *buf);
 static int64 fe_recvint64(char *buf);
+static uint32 fe_recvint32(char *buf);
+
+/* Apply scheduler state */
+static ulong64* apply_key_map;      /* [MULTIMASTER_APPLY_KEY_MAP_SIZE]: last transactions which updated keys with such hash */
+static ulong64  apply_barrier;      /* last transaction which should be completed before any subsequent one is applied */
+static ulong64  apply_current_seq;  /* sequence number of currently received transaction */
+
+static int sender_proto_version;    /* protocol version negotiated with the sender: it sends 'V' record if version is 2 or higher */
 
 static void
 receiver_raw_sigterm(SIGNAL_ARGS)
@@ -160,6 +168,170 @@ fe_recvint64(char *buf)
 	return result;
 }
 
+/*
+ * Converts an uint32 from network byte order to native format.
+ */
+static uint32
+fe_recvint32(char *buf)
+{
+	uint32	  n32;
+	memcpy(&n32, buf, 4);
+	return ntohl(n32);
+}
+
+/*
+ * Record dependency of the current transaction on one of previously received transactions.
+ * If there are too many dependencies, then transaction just waits for all preceding transactions.
+ */
+static void
+MtmScheduleAddDependency(int nodeId, ulong64 seq)
+{
+	MtmApplySlot* slot = &Mtm->nodes[nodeId-1].applySlots[apply_current_seq % MULTIMASTER_MAX_APPLY_INFLIGHT];
+	int i;
+
+	if (seq == apply_current_seq || slot->waitAll || MtmApplyIsDone(nodeId, seq)) { 
+		return;
+	}
+	for (i = 0; i < slot->nDeps; i++) { 
+		if (slot->deps[i] == seq) { 
+			return;
+		}
+	}
+	if (slot->nDeps == MULTIMASTER_MAX_APPLY_DEPS) { 
+		slot->waitAll = true;
+	} else { 
+		slot->deps[slot->nDeps++] = seq;
+	}
+}
+
+/*
+ * Assign sequence number to the new transaction and prepend it with 'S' record,
+ * which makes apply worker wait for completion of transactions it depends on.
+ */
+static void
+MtmScheduleBegin(int nodeId, ByteBuffer* buf)
+{
+	MtmApplySlot* slot;
+	ulong64 seq;
+	char hdr[1 + 1 + 8];
+
+	if (apply_current_seq != 0) { 
+		/* previous transaction was not completed, so it will be never applied */
+		MtmApplyDone(nodeId, apply_current_seq);
+	}
+	seq = ++Mtm->nodes[nodeId-1].applySeq;
+	if (seq > MULTIMASTER_MAX_APPLY_INFLIGHT) { 
+		/* wait until slot is released by transaction which used it before */
+		MtmApplyWait(nodeId, seq - MULTIMASTER_MAX_APPLY_INFLIGHT);
+	}
+	slot = &Mtm->nodes[nodeId-1].applySlots[seq % MULTIMASTER_MAX_APPLY_INFLIGHT];
+	slot->nDeps = 0;
+	slot->waitAll = false;
+	apply_current_seq = seq;
+
+	if (apply_key_map == NULL) { 
+		/* 
+		 * Receiver is restarted, so we do not know write sets of transactions received before:
+		 * make this transaction barrier for all subsequent transactions.
+		 */
+		apply_key_map = (ulong64*)MemoryContextAllocZero(TopMemoryContext, MULTIMASTER_APPLY_KEY_MAP_SIZE*sizeof(ulong64));
+		slot->waitAll = true;
+		apply_barrier = seq;
+	} else if (apply_barrier != 0) { 
+		MtmScheduleAddDependency(nodeId, apply_barrier);
+	}
+	hdr[0] = 'S';
+	hdr[1] = (char)nodeId;
+	fe_sendint64(seq, &hdr[2]);
+	ByteBufferAppend(buf, hdr, sizeof hdr);
+}
+
+/*
+ * Number of key hashes following the action byte of the record.
+ * They are sent by protocol version 2 senders for the apply scheduler and are not passed to apply workers.
+ */
+static int
+MtmRecordKeys(char* record)
+{
+	if (sender_proto_version < 2) { 
+		return 0;
+	}
+	switch (record[0]) {
+	  case 'I':
+	  case 'D':
+		return 1;
+	  case 'U':
+		return 2; /* new and old keys */
+	  default:
+		return 0;
+	}
+}
+
+/*
+ * Update dependencies of the current transaction based on the record received from the node.
+ */
+static void
+MtmScheduleRecord(int nodeId, ByteBuffer* buf, char* record, int size)
+{
+	int nKeys = MtmRecordKeys(record);
+	int i;
+
+	switch (record[0]) {
+	  case 'B':
+		MtmScheduleBegin(nodeId, buf);
+		return;
+	  case 'M':
+		if (record[1] == 'D' && apply_current_seq != 0) { 
+			/* DDL inside transaction: serialize it with all other transactions */
+			Mtm->nodes[nodeId-1].applySlots[apply_current_seq % MULTIMASTER_MAX_APPLY_INFLIGHT].waitAll = true;
+			apply_barrier = apply_current_seq;
+		}
+		return;
+	  default:
+		break;
+	}
+	if (apply_current_seq == 0 || nKeys == 0 || size < 1 + nKeys*4) { 
+		return;
+	}
+	for (i = 0; i < nKeys; i++) { 
+		uint32 hash = fe_recvint32(&record[1 + i*4]);
+		if (hash != 0) { 
+			ulong64* writer = &apply_key_map[hash % MULTIMASTER_APPLY_KEY_MAP_SIZE];
+			if (*writer != 0) { 
+				MtmScheduleAddDependency(nodeId, *writer);
+			}
+			*writer = apply_current_seq;
+		}
+	}
+}
+
+/*
+ * Transaction is streamed to apply worker before all its records are received,
+ * so its dependencies are not known when worker starts to apply it:
+ * make it wait for completion of all preceding transactions.
+ */
+static void
+MtmScheduleStream(int nodeId)
+{
+	if (apply_current_seq != 0) { 
+		Mtm->nodes[nodeId-1].applySlots[apply_current_seq % MULTIMASTER_MAX_APPLY_INFLIGHT].waitAll = true;
+	}
+}
+
+/*
+ * Transaction is either passed to apply workers, either filtered.
+ */
+static void
+MtmScheduleEnd(int nodeId, bool applied)
+{
+	if (apply_current_seq != 0) { 
+		if (!applied) { 
+			MtmApplyDone(nodeId, apply_current_seq);
+		}
+		apply_current_seq = 0;
+	}
+}
+
 static int64
 feGetCurrentTimestamp(void)
 {
@@ -219,6 +391,7 @@ pglogical_receiver_main(Datum main_arg)
 	/* Buffer for COPY data */
 	char	*copybuf = NULL;
 	int spill_file = -1;
+	int stream_id = -1;
 	StringInfoData spill_info;
 	char *slotName;
 	char* connString = psprintf("replication=database %s", Mtm->nodes[nodeId-1].con.connStr);
@@ -366,6 +539,7 @@ pglogical_receiver_main(Datum main_arg)
 						  originStartPos,
 						  Mtm->recoveredLSN
 			);
+		sender_proto_version = 1; /* until 'V' record is received */
 		res = PQexec(conn, query->data);
 		if (PQresultStatus(res) != PGRES_COPY_BOTH)
 		{
@@ -521,6 +695,12 @@ pglogical_receiver_main(Datum main_arg)
 				if (rc > hdr_len)
 				{
 					stmt = copybuf + hdr_len;
+					if (stmt[0] == 'V') { 
+						/* startup message with negotiated protocol version */
+						sender_proto_version = fe_recvint32(&stmt[1]);
+						MTM_LOG1("Use protocol version %d for node %d", sender_proto_version, nodeId);
+						continue;
+					}
 					if (mode == REPLMODE_RECOVERED) {
 						if (stmt[0] != 'B') {
 							output_written_lsn = Max(walEnd, output_written_lsn);
@@ -529,7 +709,28 @@ pglogical_receiver_main(Datum main_arg)
 						mode = REPLMODE_OPEN_EXISTED;
 					}
 					MTM_LOG3("Receive message %c from node %d", stmt[0], nodeId);
-					if (buf.used >= MtmTransSpillThreshold*MB) { 
+					if (stream_id < 0 && spill_file < 0 && MtmTransStreamThreshold <= MtmTransSpillThreshold
+						&& buf.used >= MtmTransStreamThreshold*MB && Mtm->status == MTM_ONLINE) 
+					{
+						/* Try to stream large transaction to apply worker instead of spilling it to the disk */
+						stream_id = MtmOpenApplyStream();
+						if (stream_id >= 0) { 
+							if (MtmTrackApplyDependencies) { 
+								MtmScheduleStream(nodeId);
+							}
+							pq_sendbyte(&spill_info, 'Q');
+							pq_sendint(&spill_info, stream_id, 4);
+							MtmExecute(spill_info.data, spill_info.len);
+							resetStringInfo(&spill_info);
+						}
+					}
+					if (stream_id >= 0) { 
+						if (buf.used >= MULTIMASTER_APPLY_STREAM_CHUNK_SIZE) { 
+							ByteBufferAppend(&buf, ")", 1);
+							MtmSendApplyStream(buf.data, buf.used);
+							ByteBufferReset(&buf);
+						}
+					} else if (buf.used >= MtmTransSpillThreshold*MB) { 
 						if (spill_file < 0) {
 							int file_id;
 							spill_file = MtmCreateSpillFile(nodeId, &file_id);
@@ -551,10 +752,33 @@ pglogical_receiver_main(Datum main_arg)
 							MtmExecutor(stmt, rc - hdr_len); /* all other messages can be processed by receiver itself */
 						}
 					} else { 
-						ByteBufferAppend(&buf, stmt, rc - hdr_len);
+						int nKeys = MtmRecordKeys(stmt);
+						if (MtmTrackApplyDependencies) { 
+							MtmScheduleRecord(nodeId, &buf, stmt, rc - hdr_len);
+						}
+						if (nKeys != 0 && rc - hdr_len >= 1 + nKeys*4) { 
+							/* key hashes are needed only by apply scheduler */
+							ByteBufferAppend(&buf, stmt, 1);
+							ByteBufferAppend(&buf, stmt + 1 + nKeys*4, rc - hdr_len - 1 - nKeys*4);
+						} else { 
+							ByteBufferAppend(&buf, stmt, rc - hdr_len);
+						}
 						if (stmt[0] == 'C') /* commit */
 						{
-							if (!MtmFilterTransaction(stmt, rc - hdr_len)) 
+							bool filtered = MtmFilterTransaction(stmt, rc - hdr_len);
+							bool streamed = stream_id >= 0;
+							if (streamed) { 
+								/* 
+								 * Apply worker marks streamed transaction as completed by itself.
+								 * If transaction is filtered, worker drops it when stream is closed without commit record.
+								 */
+								if (!filtered) { 
+									MtmSendApplyStream(buf.data, buf.used);
+								}
+								MtmCloseApplyStream();
+								stream_id = -1;
+							} 
+							else if (!filtered) 
 							{ 
 								if (spill_file >= 0) { 
 									ByteBufferAppend(&buf, ")", 1);
@@ -583,6 +807,7 @@ pglogical_receiver_main(Datum main_arg)
 								MtmCloseSpillFile(spill_file);
 								spill_file = -1;
 							}
+							MtmScheduleEnd(nodeId, !filtered || streamed);
 							ByteBufferReset(&buf);
 						}
 					}
@@ -686,6 +911,10 @@ pglogical_receiver_main(Datum main_arg)
 		continue;
 
 	  OnError:
+		if (stream_id >= 0) { 
+			MtmCloseApplyStream();
+			stream_id = -1;
+		}
 		PQfinish(conn);
 		MtmReleaseRecoverySlot(nodeId);
 		MtmSleep(RECEIVER_SUSPEND_TIMEOUT);		
@@ -0,0 +1,63 @@
+use strict;
+use warnings;
+use Cluster;
+use TestLib;
+use Test::More tests => 5;
+
+my $cluster = new Cluster(3);
+$cluster->init();
+$cluster->configure();
+$cluster->start();
+
+my $psql_out;
+sleep(10);
+
+###############################################################################
+# Produce some voting traffic
+###############################################################################
+
+$cluster->psql(0, 'postgres', "
+	create extension multimaster;
+	create table if not exists t(k int primary key, v int);");
+$cluster->psql(0, 'postgres', "select mtm.reset_latency();");
+for my $i (1..20) {
+	$cluster->psql(0, 'postgres', "insert into t values($i, $i);");
+}
+
+###############################################################################
+# Latency histogram checks
+###############################################################################
+
+$cluster->psql(0, 'postgres', "
+	select count(*) from mtm.latency_histogram
+	where \"lowerBound\" < 0 or \"lowerBound\" >= \"upperBound\" or \"count\" <= 0;",
+	stdout => \$psql_out);
+is($psql_out, '0', "Histogram buckets are non-empty and have valid bounds.");
+
+$cluster->psql(0, 'postgres', "
+	select count(*) from (
+		select \"lowerBound\", lag(\"upperBound\") over (partition by node, phase order by \"lowerBound\") as prev
+		from mtm.latency_histogram) b
+	where \"lowerBound\" < prev;",
+	stdout => \$psql_out);
+is($psql_out, '0', "Histogram buckets do not overlap.");
+
+$cluster->psql(0, 'postgres', "
+	select count(*) from mtm.latency_stats
+	where \"count\" > 0 and (p50 > p90 or p90 > p99 or \"avgLatency\" > \"maxLatency\");",
+	stdout => \$psql_out);
+is($psql_out, '0', "Latency percentiles are ordered.");
+
+$cluster->psql(0, 'postgres', "
+	select count(*) from mtm.latency_stats
+	where phase = 'vote' and \"count\" > 0 and \"maxLatency\" > 60000000;",
+	stdout => \$psql_out);
+is($psql_out, '0', "Vote latency is measured from the start of voting.");
+
+$cluster->psql(0, 'postgres', "
+	select count(*) > 0 from mtm.latency_stats
+	where phase = 'vote' and \"count\" > 0;",
+	stdout => \$psql_out);
+is($psql_out, 't', "Votes are accounted.");
+
+$cluster->stop();
@@ -677,7 +677,8 @@ static void DtmSetTransactionStatus(TransactionId xid, int nsubxids, Transaction
 			if (status == TRANSACTION_STATUS_ABORTED || !MMIsDistributedTrans)
 			{
 				PgTransactionIdSetTreeStatus(xid, nsubxids, subxids, status, lsn);
-				ArbiterSetTransStatus(xid, TRANSACTION_STATUS_ABORTED, false);
+				/* nobody waits for the outcome of an abort vote */
+				ArbiterForgetReply(ArbiterSendSetTransStatus(xid, TRANSACTION_STATUS_ABORTED, false));
 				XTM_INFO("Abort transaction %d\n", xid);
 				return;
 			}
@@ -817,7 +818,7 @@ DtmXactCallback(XactEvent event, void *arg)
 		if (TransactionIdIsValid(DtmNextXid))
 		{
             if (!DtmVoted) {
-                ArbiterSetTransStatus(DtmNextXid, TRANSACTION_STATUS_ABORTED, false);
+                ArbiterForgetReply(ArbiterSendSetTransStatus(DtmNextXid, TRANSACTION_STATUS_ABORTED, false));
             }
 			if (event == XACT_EVENT_COMMIT)
 			{
@@ -670,12 +670,17 @@ static void DtmSetTransactionStatus(TransactionId xid, int nsubxids, Transaction
 			CurrentTransactionSnapshot = NULL;
 			if (status == TRANSACTION_STATUS_ABORTED)
 			{
+				int tag;
+
 				PgTransactionIdSetTreeStatus(xid, nsubxids, subxids, status, lsn);
-				if (ArbiterSetTransStatus(xid, status, false) == -1)
+				tag = ArbiterSendSetTransStatus(xid, status, false);
+				if (!tag)
 				{
 					elog(WARNING, "failed to set 'aborted' transaction status on arbiter");
 					return;
 				}
+				/* nobody waits for the outcome of an abort vote */
+				ArbiterForgetReply(tag);
 				XTM_INFO("Abort transaction %d\n", xid);
 				return;
 			}
@@ -799,7 +804,7 @@ DtmXactCallback(XactEvent event, void *arg)
 				 * so we have to send report to DTMD here
 				 */
 				if (!TransactionIdIsValid(GetCurrentTransactionIdIfAny()))
-					ArbiterSetTransStatus(DtmNextXid, TRANSACTION_STATUS_ABORTED, false);
+					ArbiterForgetReply(ArbiterSendSetTransStatus(DtmNextXid, TRANSACTION_STATUS_ABORTED, false));
 			}
 			DtmNextXid = InvalidTransactionId;
 			DtmLastSnapshot = NULL;
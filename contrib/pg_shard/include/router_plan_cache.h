@@ -0,0 +1,62 @@
+/*-------------------------------------------------------------------------
+ *
+ * include/router_plan_cache.h
+ *
+ * Declarations for public functions and types related to caching the plans of
+ * router queries, that is, queries which touch a single shard of a hash
+ * partitioned table.
+ *
+ * Copyright (c) 2014-2015, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PG_SHARD_ROUTER_PLAN_CACHE_H
+#define PG_SHARD_ROUTER_PLAN_CACHE_H
+
+#include "c.h"
+
+#include "lib/stringinfo.h"
+#include "nodes/nodes.h"
+#include "nodes/parsenodes.h"
+#include "nodes/primnodes.h"
+
+
+/* maximum number of query shapes kept before the cache is reset */
+#define MAX_ROUTER_PLAN_CACHE_ENTRIES 1024
+
+/*
+ * Number of the parameter standing in for the first constant in query shapes.
+ * The following constants get consecutive numbers, up to a maximum count.
+ */
+#define ROUTER_FIRST_CONSTANT_PARAM_ID 60000
+#define MAX_ROUTER_QUERY_CONSTANTS 1024
+
+
+/*
+ * RouterQueryKey identifies a router query by its shape: the query with the
+ * constants of its qualifiers and target values replaced by parameters, and
+ * serialized without token locations. Queries differing only in these values
+ * or in their formatting share a key, and thus a cache entry.
+ */
+typedef struct RouterQueryKey
+{
+	Oid distributedTableId;     /* hash partitioned table accessed by the query */
+	Query *parameterizedQuery;  /* query with its constants replaced */
+	int constantCount;          /* number of replaced constants */
+	Const **constantArray;      /* replaced constants of this particular query */
+	int partitionValueIndex;    /* index of the partition value in constantArray */
+	Const *partitionValue;      /* partition value of this particular query */
+	char *queryShape;           /* serialized parameterized query */
+	uint32 queryShapeHash;      /* hash of queryShape, used as cache key */
+} RouterQueryKey;
+
+
+/* function declarations for caching router query plans */
+extern RouterQueryKey * BuildRouterQueryKey(Query *query, Oid distributedTableId);
+extern StringInfo LookupRouterQuery(RouterQueryKey *routerQueryKey, int64 *shardId);
+extern void CacheRouterQuery(RouterQueryKey *routerQueryKey, int64 shardId,
+							 StringInfo queryString);
+
+
+#endif /* PG_SHARD_ROUTER_PLAN_CACHE_H */
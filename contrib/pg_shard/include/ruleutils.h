@@ -19,10 +19,12 @@
 
 #include "lib/stringinfo.h"
 #include "nodes/parsenodes.h"
+#include "nodes/primnodes.h"
 
 
 /* function declarations for extending and deparsing a query */
 extern void deparse_shard_query(Query *query, int64 shardid, StringInfo buffer);
+extern void deparse_shard_const(Const *constval, StringInfo buffer);
 
 
 #endif /* PG_SHARD_RULEUTILS_H */
@@ -115,6 +115,35 @@ GetConnection(char *nodeName, int32 nodePort, bool openNew)
 }
 
 
+/*
+ * OpenConnection establishes a new connection to the specified node without
+ * adding it to the connection hash, so that several queries can be run on the
+ * same node at once. The caller owns the returned connection and must close it
+ * using PQfinish. If the connection cannot be established, the function returns
+ * NULL.
+ *
+ * This function throws an error if a hostname over 255 characters is provided.
+ */
+PGconn *
+OpenConnection(char *nodeName, int32 nodePort)
+{
+	StringInfo nodePortString = NULL;
+
+	/* check input */
+	if (strnlen(nodeName, MAX_NODE_LENGTH + 1) > MAX_NODE_LENGTH)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("hostname exceeds the maximum length of %d",
+							   MAX_NODE_LENGTH)));
+	}
+
+	nodePortString = makeStringInfo();
+	appendStringInfo(nodePortString, "%d", nodePort);
+
+	return ConnectToNode(nodeName, nodePortString->data);
+}
+
+
 /*
  * PurgeConnection removes the given connection from the connection hash and
  * closes it using PQfinish. If our hash does not contain the given connection,
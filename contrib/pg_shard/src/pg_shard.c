@@ -23,8 +23,11 @@
 #include "create_shards.h"
 #include "distribution_metadata.h"
 #include "prune_shard_list.h"
+#include "router_plan_cache.h"
 #include "ruleutils.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <stddef.h>
 #include <string.h>
 #include <inttypes.h>
@@ -85,6 +88,44 @@
 
 typedef long long csn_t;
 
+/* number of remote rows buffered before inserting them into intermediate table */
+#define INTERMEDIATE_TABLE_BATCH_SIZE 1000
+
+/* timeout after which interrupts are checked while waiting for remote results */
+#define REMOTE_POLL_TIMEOUT_MS 1000
+
+/*
+ * ShardSelectTask tracks a single task of an asynchronously executed multiple
+ * shard SELECT: the placement it is running on and whether any of its rows have
+ * already been stored. Rows stored in the intermediate table can't be taken
+ * back, so a task may only fail over to another placement before that.
+ */
+typedef struct ShardSelectTask
+{
+	Task *task;
+	ListCell *placementCell;    /* current placement in taskPlacementList */
+	PGconn *connection;         /* connection the query is running on, if any */
+	bool ownsConnection;        /* was the connection opened just for this task? */
+	bool rowsStored;            /* were any rows of the task stored already? */
+} ShardSelectTask;
+
+/*
+ * IntermediateTableLoader converts rows received from the remote nodes into
+ * tuples of the intermediate table and inserts them in batches.
+ */
+typedef struct IntermediateTableLoader
+{
+	Relation table;
+	AttInMetadata *attributeInputMetadata;
+	AttrNumber *tableColumnIndex;   /* table column for each remote column, or -1 */
+	Datum *tableTupleValues;
+	bool *tableTupleNulls;
+	HeapTuple *tupleArray;
+	int tupleCount;
+	BulkInsertState bulkInsertState;
+	MemoryContext batchContext;
+} IntermediateTableLoader;
+
 /* controls use of locks to enforce safe commutativity */
 bool AllModificationsCommutative = false;
 
@@ -100,6 +141,12 @@ bool DtmTwoPhaseCommit = false;
 /* logs each statement used in a distributed plan */
 bool LogDistributedStatements = false;
 
+/* informs pg_shard to cache the plans of single-shard queries */
+bool UseRouterPlanCache = true;
+
+/* maximum number of shard queries a multiple shard SELECT runs on a node at once */
+int MaxSelectConnectionsPerNode = 8;
+
 
 /* planner functions forward declarations */
 static PlannedStmt * PgShardPlanner(Query *parse, int cursorOptions,
@@ -124,6 +171,9 @@ static List * QueryFromList(List *rangeTableList);
 static List * TargetEntryList(List *expressionList);
 static CreateStmt * CreateTemporaryTableLikeStmt(Oid sourceRelationId);
 static DistributedPlan * BuildDistributedPlan(Query *query, List *shardIntervalList);
+static DistributedPlan * BuildRouterPlan(Query *query, int64 shardId,
+										 StringInfo queryString);
+static Task * BuildTask(int64 shardId, StringInfo queryString);
 
 /* executor functions forward declarations */
 static void PgShardExecutorStart(QueryDesc *queryDesc, int eflags);
@@ -134,11 +184,28 @@ static void AcquireExecutorShardLocks(List *taskList, LOCKMODE lockMode);
 static int CompareTasksByShardId(const void *leftElement, const void *rightElement);
 static void ExecuteMultipleShardSelect(DistributedPlan *distributedPlan,
 									   RangeVar *intermediateTable);
+static void ExecuteShardSelectTasks(List *selectTaskList,
+									IntermediateTableLoader *loader);
+static void CancelShardSelectTasks(List *selectTaskList);
+static bool StartShardSelectTask(ShardSelectTask *selectTask, List *runningTaskList);
+static bool ConnectionIsBusy(PGconn *connection, List *runningTaskList);
+static int RunningTaskCountOnNode(char *nodeName, int32 nodePort,
+								  List *runningTaskList);
+static void ReleaseShardSelectConnection(ShardSelectTask *selectTask,
+										 bool connectionBroken);
+static void WaitForShardSelectResults(List *runningTaskList);
+static bool ConsumeShardSelectResults(ShardSelectTask *selectTask,
+									  IntermediateTableLoader *loader, bool *taskDone);
+static IntermediateTableLoader * BeginIntermediateTableLoad(RangeVar *tableRangeVar,
+															List *remoteTargetList,
+															TupleDesc remoteTupleDescriptor);
+static void LoadRemoteRow(IntermediateTableLoader *loader, PGresult *result,
+						  int rowIndex);
+static void FlushIntermediateTableBatch(IntermediateTableLoader *loader);
+static void EndIntermediateTableLoad(IntermediateTableLoader *loader);
 static bool SendQueryInSingleRowMode(PGconn *connection, StringInfo query);
 static bool StoreQueryResult(PGconn *connection, TupleDesc tupleDescriptor,
 							 Tuplestorestate *tupleStore);
-static void TupleStoreToTable(RangeVar *tableRangeVar, List *remoteTargetList,
-							  TupleDesc storeTupleDescriptor, Tuplestorestate *store);
 static void PgShardExecutorRun(QueryDesc *queryDesc, ScanDirection direction, long count);
 static int32 ExecuteDistributedModify(DistributedPlan *distributedPlan);
 static void PrepareDtmTransaction(Task *task);
@@ -237,6 +304,17 @@ _PG_init(void)
 							 &LogDistributedStatements, false, PGC_USERSET, 0, NULL,
 							 NULL, NULL);
 
+	DefineCustomBoolVariable("pg_shard.use_router_plan_cache",
+							 "Caches the plans of queries touching a single shard", NULL,
+							 &UseRouterPlanCache, true, PGC_USERSET, 0, NULL,
+							 NULL, NULL);
+
+	DefineCustomIntVariable("pg_shard.max_select_connections_per_node",
+							"Sets the maximum number of concurrent shard queries "
+							"a multiple shard SELECT runs on a single node", NULL,
+							&MaxSelectConnectionsPerNode, 8, 1, 1000, PGC_USERSET, 0,
+							NULL, NULL, NULL);
+
 	EmitWarningsOnPlaceholders("pg_shard");
 
 	/* install error transformation handler for PL/pgSQL invocations */
@@ -350,6 +428,7 @@ PgShardPlanner(Query *query, int cursorOptions, ParamListInfo boundParams)
 		List *queryShardList = NIL;
 		bool selectFromMultipleShards = false;
 		CreateStmt *createTemporaryTableStmt = NULL;
+		RouterQueryKey *routerQueryKey = NULL;
 
 		/* call standard planner first to have Query transformations performed */
 		plannedStatement = standard_planner(distributedQuery, cursorOptions,
@@ -358,53 +437,88 @@ PgShardPlanner(Query *query, int cursorOptions, ParamListInfo boundParams)
 		ErrorIfQueryNotSupported(distributedQuery);
 
 		/*
-		 * Compute the list of shards this query needs to access.
-		 * Error out if there are no existing shards for the table.
+		 * If we planned a query of the same shape before and it specifies the
+		 * partition value, route it using the cached query template. This skips
+		 * shard pruning and deparsing altogether.
 		 */
-		queryShardList = DistributedQueryShardList(distributedQuery);
+		if (UseRouterPlanCache)
+		{
+			Oid distributedTableId = ExtractFirstDistributedTableId(distributedQuery);
+			routerQueryKey = BuildRouterQueryKey(distributedQuery, distributedTableId);
+		}
 
-		/*
-		 * If a select query touches multiple shards, we don't push down the
-		 * query as-is, and instead only push down the filter clauses and select
-		 * needed columns. We then copy those results to a local temporary table
-		 * and then modify the original PostgreSQL plan to perform a sequential
-		 * scan on that temporary table.
-		 * XXX: This approach is limited as we cannot handle index or foreign
-		 * scans. We will revisit this by potentially using another type of scan
-		 * node instead of a sequential scan.
-		 */
-		selectFromMultipleShards = SelectFromMultipleShards(query, queryShardList);
-		if (selectFromMultipleShards)
+		if (routerQueryKey != NULL)
 		{
-			Oid distributedTableId = InvalidOid;
-			Query *localQuery = NULL;
-			List *queryRestrictList = QueryRestrictList(distributedQuery);
-			List *remoteRestrictList = NIL;
-			List *localRestrictList = NIL;
+			int64 shardId = 0;
+			StringInfo queryString = LookupRouterQuery(routerQueryKey, &shardId);
 
-			/* partition restrictions into remote and local lists */
-			ClassifyRestrictions(queryRestrictList, &remoteRestrictList,
-								 &localRestrictList);
+			if (queryString != NULL)
+			{
+				distributedPlan = BuildRouterPlan(distributedQuery, shardId, queryString);
+			}
+		}
 
-			/* build local and distributed query */
-			distributedQuery = RowAndColumnFilterQuery(distributedQuery,
-													   remoteRestrictList,
-													   localRestrictList);
-			localQuery = BuildLocalQuery(query, localRestrictList);
+		if (distributedPlan == NULL)
+		{
+			/*
+			 * Compute the list of shards this query needs to access.
+			 * Error out if there are no existing shards for the table.
+			 */
+			queryShardList = DistributedQueryShardList(distributedQuery);
 
 			/*
-			 * Force a sequential scan as we change the underlying table to
-			 * point to our intermediate temporary table which contains the
-			 * fetched data.
+			 * If a select query touches multiple shards, we don't push down the
+			 * query as-is, and instead only push down the filter clauses and select
+			 * needed columns. We then copy those results to a local temporary table
+			 * and then modify the original PostgreSQL plan to perform a sequential
+			 * scan on that temporary table.
+			 * XXX: This approach is limited as we cannot handle index or foreign
+			 * scans. We will revisit this by potentially using another type of scan
+			 * node instead of a sequential scan.
 			 */
-			plannedStatement = PlanSequentialScan(localQuery, cursorOptions, boundParams);
+			selectFromMultipleShards = SelectFromMultipleShards(query, queryShardList);
+			if (selectFromMultipleShards)
+			{
+				Oid distributedTableId = InvalidOid;
+				Query *localQuery = NULL;
+				List *queryRestrictList = QueryRestrictList(distributedQuery);
+				List *remoteRestrictList = NIL;
+				List *localRestrictList = NIL;
+
+				/* partition restrictions into remote and local lists */
+				ClassifyRestrictions(queryRestrictList, &remoteRestrictList,
+									 &localRestrictList);
+
+				/* build local and distributed query */
+				distributedQuery = RowAndColumnFilterQuery(distributedQuery,
+														   remoteRestrictList,
+														   localRestrictList);
+				localQuery = BuildLocalQuery(query, localRestrictList);
+
+				/*
+				 * Force a sequential scan as we change the underlying table to
+				 * point to our intermediate temporary table which contains the
+				 * fetched data.
+				 */
+				plannedStatement = PlanSequentialScan(localQuery, cursorOptions,
+													  boundParams);
+
+				/* construct a CreateStmt to clone the existing table */
+				distributedTableId = ExtractFirstDistributedTableId(distributedQuery);
+				createTemporaryTableStmt =
+					CreateTemporaryTableLikeStmt(distributedTableId);
+			}
 
-			/* construct a CreateStmt to clone the existing table */
-			distributedTableId = ExtractFirstDistributedTableId(distributedQuery);
-			createTemporaryTableStmt = CreateTemporaryTableLikeStmt(distributedTableId);
+			distributedPlan = BuildDistributedPlan(distributedQuery, queryShardList);
+
+			/* remember the query template if this turned out to be a router query */
+			if (routerQueryKey != NULL && list_length(distributedPlan->taskList) == 1)
+			{
+				Task *task = (Task *) linitial(distributedPlan->taskList);
+				CacheRouterQuery(routerQueryKey, task->shardId, task->queryString);
+			}
 		}
 
-		distributedPlan = BuildDistributedPlan(distributedQuery, queryShardList);
 		distributedPlan->originalPlan = plannedStatement->planTree;
 		distributedPlan->selectFromMultipleShards = selectFromMultipleShards;
 		distributedPlan->createTemporaryTableStmt = createTemporaryTableStmt;
@@ -1192,17 +1306,10 @@ BuildDistributedPlan(Query *query, List *shardIntervalList)
 	{
 		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
 		int64 shardId = shardInterval->id;
-		List *finalizedPlacementList = NIL;
 		FromExpr *joinTree = NULL;
 		Task *task = NULL;
 		StringInfo queryString = makeStringInfo();
 
-		/* grab shared metadata lock to stop concurrent placement additions */
-		LockShardDistributionMetadata(shardId, ShareLock);
-
-		/* now safe to populate placement list */
-		finalizedPlacementList = LoadFinalizedShardPlacementList(shardId);
-
 		/*
 		 * Convert the qualifiers to an explicitly and'd clause, which is needed
 		 * before we deparse the query. This applies to SELECT, UPDATE and
@@ -1220,16 +1327,7 @@ BuildDistributedPlan(Query *query, List *shardIntervalList)
 
 		deparse_shard_query(query, shardId, queryString);
 
-		if (LogDistributedStatements)
-		{
-			ereport(LOG, (errmsg("distributed statement: %s", queryString->data)));
-		}
-
-		task = (Task *) palloc0(sizeof(Task));
-		task->queryString = queryString;
-		task->taskPlacementList = finalizedPlacementList;
-		task->shardId = shardId;
-
+		task = BuildTask(shardId, queryString);
 		taskList = lappend(taskList, task);
 	}
 
@@ -1239,6 +1337,54 @@ BuildDistributedPlan(Query *query, List *shardIntervalList)
 }
 
 
+/*
+ * BuildRouterPlan creates the DistributedPlan instance for a query which was
+ * routed to a single shard using the router plan cache.
+ */
+static DistributedPlan *
+BuildRouterPlan(Query *query, int64 shardId, StringInfo queryString)
+{
+	DistributedPlan *distributedPlan = palloc0(sizeof(DistributedPlan));
+	Task *task = BuildTask(shardId, queryString);
+
+	distributedPlan->plan.type = (NodeTag) T_DistributedPlan;
+	distributedPlan->targetList = query->targetList;
+	distributedPlan->taskList = list_make1(task);
+
+	return distributedPlan;
+}
+
+
+/*
+ * BuildTask creates a task to run the given query string on the placements of
+ * the given shard.
+ */
+static Task *
+BuildTask(int64 shardId, StringInfo queryString)
+{
+	List *finalizedPlacementList = NIL;
+	Task *task = NULL;
+
+	/* grab shared metadata lock to stop concurrent placement additions */
+	LockShardDistributionMetadata(shardId, ShareLock);
+
+	/* now safe to populate placement list */
+	finalizedPlacementList = LoadFinalizedShardPlacementList(shardId);
+
+	if (LogDistributedStatements)
+	{
+		ereport(LOG, (errmsg("distributed statement: %s", queryString->data)));
+	}
+
+	task = (Task *) palloc0(sizeof(Task));
+	task->queryString = queryString;
+	task->taskPlacementList = finalizedPlacementList;
+	task->shardId = shardId;
+
+	return task;
+}
+
+
 /*
  * PgShardExecutorStart sets up the executor state and queryDesc for pgShard
  * executed statements. The function also handles multi-shard selects
@@ -1484,7 +1630,9 @@ CompareTasksByShardId(const void *leftElement, const void *rightElement)
 
 /*
  * ExecuteMultipleShardSelect executes the SELECT queries in the distributed
- * plan and inserts the returned rows into the given tableId.
+ * plan and inserts the returned rows into the given intermediate table. All
+ * shard queries are sent at once and their results are consumed as they stream
+ * in, so the whole fetch costs a single round-trip to every worker node.
  */
 static void
 ExecuteMultipleShardSelect(DistributedPlan *distributedPlan,
@@ -1494,8 +1642,9 @@ ExecuteMultipleShardSelect(DistributedPlan *distributedPlan,
 	List *targetList = distributedPlan->targetList;
 
 	/* ExecType instead of ExecCleanType so we don't ignore junk columns */
-	TupleDesc tupleStoreDescriptor = ExecTypeFromTL(targetList, false);
-
+	TupleDesc remoteTupleDescriptor = ExecTypeFromTL(targetList, false);
+	IntermediateTableLoader *loader = NULL;
+	List *selectTaskList = NIL;
 	ListCell *taskCell = NULL;
 
 	DtmTwoPhaseCommit = IsTransactionBlock();
@@ -1503,31 +1652,559 @@ ExecuteMultipleShardSelect(DistributedPlan *distributedPlan,
 	foreach(taskCell, taskList)
 	{
 		Task *task = (Task *) lfirst(taskCell);
-		Tuplestorestate *tupleStore = tuplestore_begin_heap(false, false, work_mem);
-		bool resultsOK = false;
+		ShardSelectTask *selectTask = (ShardSelectTask *) palloc0(sizeof(ShardSelectTask));
 
 		if (UseDtmTransactions)
 		{
 			PrepareDtmTransaction(task);
 		}
 
-		resultsOK = ExecuteTaskAndStoreResults(task, tupleStoreDescriptor, tupleStore);
-		if (!resultsOK)
+		selectTask->task = task;
+		selectTask->placementCell = list_head(task->taskPlacementList);
+		selectTaskList = lappend(selectTaskList, selectTask);
+	}
+
+	loader = BeginIntermediateTableLoad(intermediateTable, targetList,
+										remoteTupleDescriptor);
+
+	PG_TRY();
+	{
+		ExecuteShardSelectTasks(selectTaskList, loader);
+	}
+	PG_CATCH();
+	{
+		/* cancel running queries so no connection is left busy or open */
+		CancelShardSelectTasks(selectTaskList);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	EndIntermediateTableLoad(loader);
+}
+
+
+/*
+ * ExecuteShardSelectTasks runs the given shard select tasks concurrently and
+ * loads their results into the intermediate table. Tasks on the same node run
+ * on separate connections, up to pg_shard.max_select_connections_per_node at a
+ * time; the rest wait for one of them to finish. If a task fails on a placement
+ * before any of its rows were stored, it is retried on the next placement.
+ */
+static void
+ExecuteShardSelectTasks(List *selectTaskList, IntermediateTableLoader *loader)
+{
+	List *pendingTaskList = list_copy(selectTaskList);
+	List *runningTaskList = NIL;
+
+	while (pendingTaskList != NIL || runningTaskList != NIL)
+	{
+		List *waitingTaskList = NIL;
+		List *stillRunningTaskList = NIL;
+		ListCell *selectTaskCell = NULL;
+
+		/* start every pending task whose connection isn't busy */
+		foreach(selectTaskCell, pendingTaskList)
 		{
-			ereport(ERROR, (errmsg("could not receive query results")));
+			ShardSelectTask *selectTask = (ShardSelectTask *) lfirst(selectTaskCell);
+
+			bool taskStarted = StartShardSelectTask(selectTask, runningTaskList);
+			if (taskStarted)
+			{
+				runningTaskList = lappend(runningTaskList, selectTask);
+			}
+			else
+			{
+				waitingTaskList = lappend(waitingTaskList, selectTask);
+			}
 		}
+		list_free(pendingTaskList);
+		pendingTaskList = waitingTaskList;
 
-		/*
-		 * We successfully fetched data into local tuplestore. Now move results from
-		 * the tupleStore into the table.
-		 */
-		Assert(tupleStore != NULL);
-		TupleStoreToTable(intermediateTable, targetList, tupleStoreDescriptor,
-						  tupleStore);
+		/* a task only waits for a connection used by a running task */
+		Assert(runningTaskList != NIL);
+
+		WaitForShardSelectResults(runningTaskList);
+
+		foreach(selectTaskCell, runningTaskList)
+		{
+			ShardSelectTask *selectTask = (ShardSelectTask *) lfirst(selectTaskCell);
+			bool taskDone = false;
+
+			bool resultsOK = ConsumeShardSelectResults(selectTask, loader, &taskDone);
+			if (!resultsOK)
+			{
+				ReleaseShardSelectConnection(selectTask, true);
 
-		tuplestore_end(tupleStore);
+				if (selectTask->rowsStored)
+				{
+					ereport(ERROR, (errmsg("could not receive query results")));
+				}
+
+				/* fail over to the next placement */
+				selectTask->placementCell = lnext(selectTask->placementCell);
+				pendingTaskList = lappend(pendingTaskList, selectTask);
+			}
+			else if (taskDone)
+			{
+				ReleaseShardSelectConnection(selectTask, false);
+			}
+			else
+			{
+				stillRunningTaskList = lappend(stillRunningTaskList, selectTask);
+			}
+		}
+		list_free(runningTaskList);
+		runningTaskList = stillRunningTaskList;
+	}
+}
+
+
+/*
+ * CancelShardSelectTasks cancels the queries still running for the given tasks.
+ * Results on cached connections are discarded so the connections can be used
+ * again; connections opened just for a task are closed.
+ */
+static void
+CancelShardSelectTasks(List *selectTaskList)
+{
+	ListCell *selectTaskCell = NULL;
+
+	foreach(selectTaskCell, selectTaskList)
+	{
+		ShardSelectTask *selectTask = (ShardSelectTask *) lfirst(selectTaskCell);
+		PGconn *connection = selectTask->connection;
+		PGcancel *cancelObject = NULL;
+		PGresult *result = NULL;
+		char errorBuffer[256];
+
+		if (connection == NULL)
+		{
+			continue;
+		}
+
+		cancelObject = PQgetCancel(connection);
+		if (cancelObject != NULL)
+		{
+			PQcancel(cancelObject, errorBuffer, sizeof(errorBuffer));
+			PQfreeCancel(cancelObject);
+		}
+
+		if (!selectTask->ownsConnection)
+		{
+			while ((result = PQgetResult(connection)) != NULL)
+			{
+				PQclear(result);
+			}
+		}
+
+		ReleaseShardSelectConnection(selectTask, false);
 	}
-	
+}
+
+
+/*
+ * StartShardSelectTask sends the task's query in single-row mode to its current
+ * placement, moving on to the next placement if a connection can't be obtained
+ * or the query can't be sent. The first task on a node uses the node's cached
+ * connection, and further tasks on that node open connections of their own.
+ * Distributed transactions are bound to the cached connection however, so with
+ * pg_shard.use_dtm_transactions tasks on the same node still run one after the
+ * other. The function returns false if the task has to wait for a running task
+ * on its node to finish, and errors out if no placements are left to try.
+ */
+static bool
+StartShardSelectTask(ShardSelectTask *selectTask, List *runningTaskList)
+{
+	Task *task = selectTask->task;
+
+	while (selectTask->placementCell != NULL)
+	{
+		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(selectTask->placementCell);
+		char *nodeName = taskPlacement->nodeName;
+		int32 nodePort = taskPlacement->nodePort;
+		bool queryOK = false;
+
+		PGconn *connection = GetConnection(nodeName, nodePort, !UseDtmTransactions);
+		if (connection == NULL)
+		{
+			selectTask->placementCell = lnext(selectTask->placementCell);
+			continue;
+		}
+
+		if (ConnectionIsBusy(connection, runningTaskList))
+		{
+			int runningTaskCount = 0;
+
+			if (UseDtmTransactions)
+			{
+				return false;
+			}
+
+			runningTaskCount = RunningTaskCountOnNode(nodeName, nodePort,
+													  runningTaskList);
+			if (runningTaskCount >= MaxSelectConnectionsPerNode)
+			{
+				return false;
+			}
+
+			/* the node is reachable, so wait for a running task if this fails */
+			connection = OpenConnection(nodeName, nodePort);
+			if (connection == NULL)
+			{
+				return false;
+			}
+
+			selectTask->ownsConnection = true;
+		}
+
+		selectTask->connection = connection;
+
+		queryOK = SendQueryInSingleRowMode(connection, task->queryString);
+		if (!queryOK)
+		{
+			ReleaseShardSelectConnection(selectTask, true);
+			selectTask->placementCell = lnext(selectTask->placementCell);
+			continue;
+		}
+
+		return true;
+	}
+
+	ereport(ERROR, (errmsg("could not receive query results")));
+
+	return false;
+}
+
+
+/* ConnectionIsBusy checks whether any of the running tasks uses the connection. */
+static bool
+ConnectionIsBusy(PGconn *connection, List *runningTaskList)
+{
+	ListCell *selectTaskCell = NULL;
+
+	foreach(selectTaskCell, runningTaskList)
+	{
+		ShardSelectTask *selectTask = (ShardSelectTask *) lfirst(selectTaskCell);
+		if (selectTask->connection == connection)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * RunningTaskCountOnNode counts the running tasks whose current placement is on
+ * the given node.
+ */
+static int
+RunningTaskCountOnNode(char *nodeName, int32 nodePort, List *runningTaskList)
+{
+	ListCell *selectTaskCell = NULL;
+	int runningTaskCount = 0;
+
+	foreach(selectTaskCell, runningTaskList)
+	{
+		ShardSelectTask *selectTask = (ShardSelectTask *) lfirst(selectTaskCell);
+		ShardPlacement *placement = (ShardPlacement *) lfirst(selectTask->placementCell);
+
+		if (placement->nodePort == nodePort &&
+			strncmp(placement->nodeName, nodeName, MAX_NODE_LENGTH) == 0)
+		{
+			runningTaskCount++;
+		}
+	}
+
+	return runningTaskCount;
+}
+
+
+/*
+ * ReleaseShardSelectConnection detaches the task from its connection. The
+ * connection is closed if it was opened just for the task; a cached connection
+ * is kept for later use unless it is broken, in which case it is purged.
+ */
+static void
+ReleaseShardSelectConnection(ShardSelectTask *selectTask, bool connectionBroken)
+{
+	if (selectTask->ownsConnection)
+	{
+		PQfinish(selectTask->connection);
+	}
+	else if (connectionBroken)
+	{
+		PurgeConnection(selectTask->connection);
+	}
+
+	selectTask->connection = NULL;
+	selectTask->ownsConnection = false;
+}
+
+
+/*
+ * WaitForShardSelectResults blocks until at least one of the running tasks'
+ * connections has data to be consumed. The function returns immediately if
+ * libpq already buffered a complete result for any of them.
+ */
+static void
+WaitForShardSelectResults(List *runningTaskList)
+{
+	int connectionCount = list_length(runningTaskList);
+	struct pollfd *pollDescriptors = palloc0(connectionCount * sizeof(struct pollfd));
+	ListCell *selectTaskCell = NULL;
+	int pollIndex = 0;
+
+	foreach(selectTaskCell, runningTaskList)
+	{
+		ShardSelectTask *selectTask = (ShardSelectTask *) lfirst(selectTaskCell);
+		PGconn *connection = selectTask->connection;
+
+		if (!PQisBusy(connection))
+		{
+			pfree(pollDescriptors);
+			return;
+		}
+
+		pollDescriptors[pollIndex].fd = PQsocket(connection);
+		pollDescriptors[pollIndex].events = POLLIN;
+		pollIndex++;
+	}
+
+	for (;;)
+	{
+		int readyCount = 0;
+
+		CHECK_FOR_INTERRUPTS();
+
+		readyCount = poll(pollDescriptors, connectionCount, REMOTE_POLL_TIMEOUT_MS);
+		if (readyCount > 0)
+		{
+			break;
+		}
+		else if (readyCount < 0 && errno != EINTR)
+		{
+			ereport(ERROR, (errcode_for_socket_access(),
+							errmsg("could not wait for query results: %m")));
+		}
+	}
+
+	pfree(pollDescriptors);
+}
+
+
+/*
+ * ConsumeShardSelectResults reads whatever input arrived on the task's
+ * connection and loads all complete rows into the intermediate table without
+ * blocking. The function sets taskDone once the query has finished, and
+ * returns false if the query failed on the remote node.
+ */
+static bool
+ConsumeShardSelectResults(ShardSelectTask *selectTask, IntermediateTableLoader *loader,
+						  bool *taskDone)
+{
+	PGconn *connection = selectTask->connection;
+
+	if (PQconsumeInput(connection) == 0)
+	{
+		ReportRemoteError(connection, NULL);
+		return false;
+	}
+
+	while (PQisBusy(connection) == 0)
+	{
+		int rowIndex = 0;
+		int rowCount = 0;
+		ExecStatusType resultStatus = 0;
+
+		PGresult *result = PQgetResult(connection);
+		if (result == NULL)
+		{
+			*taskDone = true;
+			break;
+		}
+
+		resultStatus = PQresultStatus(result);
+		if ((resultStatus != PGRES_SINGLE_TUPLE) && (resultStatus != PGRES_TUPLES_OK))
+		{
+			ReportRemoteError(connection, result);
+			PQclear(result);
+
+			return false;
+		}
+
+		rowCount = PQntuples(result);
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			LoadRemoteRow(loader, result, rowIndex);
+			selectTask->rowsStored = true;
+		}
+
+		PQclear(result);
+	}
+
+	return true;
+}
+
+
+/*
+ * BeginIntermediateTableLoad opens the intermediate table and prepares to load
+ * rows of the remote query into it. For every column of the remote query's
+ * target list, the function determines the attribute location in the table
+ * based on the attribute number of the column.
+ */
+static IntermediateTableLoader *
+BeginIntermediateTableLoad(RangeVar *tableRangeVar, List *remoteTargetList,
+						   TupleDesc remoteTupleDescriptor)
+{
+	IntermediateTableLoader *loader = palloc0(sizeof(IntermediateTableLoader));
+	int remoteColumnCount = remoteTupleDescriptor->natts;
+	int tableColumnCount = 0;
+	int remoteColumnIndex = 0;
+	ListCell *targetEntryCell = NULL;
+
+	loader->table = heap_openrv(tableRangeVar, RowExclusiveLock);
+	tableColumnCount = RelationGetDescr(loader->table)->natts;
+
+	loader->attributeInputMetadata = TupleDescGetAttInMetadata(remoteTupleDescriptor);
+	loader->tableColumnIndex = palloc0(remoteColumnCount * sizeof(AttrNumber));
+	loader->tableTupleValues = palloc0(tableColumnCount * sizeof(Datum));
+	loader->tableTupleNulls = palloc0(tableColumnCount * sizeof(bool));
+	loader->tupleArray = palloc0(INTERMEDIATE_TABLE_BATCH_SIZE * sizeof(HeapTuple));
+	loader->tupleCount = 0;
+	loader->bulkInsertState = GetBulkInsertState();
+	loader->batchContext = AllocSetContextCreate(CurrentMemoryContext,
+												 "IntermediateTableLoad",
+												 ALLOCSET_DEFAULT_MINSIZE,
+												 ALLOCSET_DEFAULT_INITSIZE,
+												 ALLOCSET_DEFAULT_MAXSIZE);
+
+	foreach(targetEntryCell, remoteTargetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+		Expr *targetExpression = targetEntry->expr;
+
+		/* special case for count(*) as we expect a NULL const */
+		if (IsA(targetExpression, Const))
+		{
+			Const *constValue PG_USED_FOR_ASSERTS_ONLY = (Const *) targetExpression;
+			Assert(constValue->consttype == UNKNOWNOID);
+
+			/* skip over the null consts */
+			loader->tableColumnIndex[remoteColumnIndex] = -1;
+		}
+		else
+		{
+			Var *tableColumn = NULL;
+
+			Assert(IsA(targetExpression, Var));
+			tableColumn = (Var *) targetExpression;
+			loader->tableColumnIndex[remoteColumnIndex] = tableColumn->varattno - 1;
+		}
+
+		remoteColumnIndex++;
+	}
+
+	Assert(remoteColumnIndex == remoteColumnCount);
+
+	return loader;
+}
+
+
+/*
+ * LoadRemoteRow builds a tuple of the intermediate table directly from the
+ * textual values of the given remote row, and adds it to the current batch.
+ * The batch is inserted into the table once it is full.
+ */
+static void
+LoadRemoteRow(IntermediateTableLoader *loader, PGresult *result, int rowIndex)
+{
+	TupleDesc tableTupleDescriptor = RelationGetDescr(loader->table);
+	AttInMetadata *attributeInputMetadata = loader->attributeInputMetadata;
+	int columnCount = PQnfields(result);
+	int columnIndex = 0;
+	MemoryContext oldContext = NULL;
+
+	Assert(columnCount == attributeInputMetadata->tupdesc->natts);
+
+	/*
+	 * Tuples of the batch and any memory leaked by the I/O functions live in
+	 * the batch context, which we reset once the batch is inserted.
+	 */
+	oldContext = MemoryContextSwitchTo(loader->batchContext);
+
+	/* set all values to null for the table tuple */
+	memset(loader->tableTupleNulls, true, tableTupleDescriptor->natts * sizeof(bool));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		AttrNumber tableColumnIndex = loader->tableColumnIndex[columnIndex];
+		char *columnValue = NULL;
+
+		if (tableColumnIndex < 0)
+		{
+			continue;
+		}
+
+		if (!PQgetisnull(result, rowIndex, columnIndex))
+		{
+			columnValue = PQgetvalue(result, rowIndex, columnIndex);
+		}
+
+		loader->tableTupleValues[tableColumnIndex] =
+			InputFunctionCall(&attributeInputMetadata->attinfuncs[columnIndex],
+							  columnValue,
+							  attributeInputMetadata->attioparams[columnIndex],
+							  attributeInputMetadata->atttypmods[columnIndex]);
+		loader->tableTupleNulls[tableColumnIndex] = (columnValue == NULL);
+	}
+
+	loader->tupleArray[loader->tupleCount++] =
+		heap_form_tuple(tableTupleDescriptor, loader->tableTupleValues,
+						loader->tableTupleNulls);
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (loader->tupleCount == INTERMEDIATE_TABLE_BATCH_SIZE)
+	{
+		FlushIntermediateTableBatch(loader);
+	}
+}
+
+
+/*
+ * FlushIntermediateTableBatch inserts the buffered tuples into the intermediate
+ * table with a single heap_multi_insert call.
+ */
+static void
+FlushIntermediateTableBatch(IntermediateTableLoader *loader)
+{
+	if (loader->tupleCount > 0)
+	{
+		heap_multi_insert(loader->table, loader->tupleArray, loader->tupleCount,
+						  GetCurrentCommandId(true), 0, loader->bulkInsertState);
+		loader->tupleCount = 0;
+	}
+
+	MemoryContextReset(loader->batchContext);
+}
+
+
+/*
+ * EndIntermediateTableLoad inserts any remaining tuples, closes the
+ * intermediate table and makes the loaded rows visible to the local plan.
+ */
+static void
+EndIntermediateTableLoad(IntermediateTableLoader *loader)
+{
+	FlushIntermediateTableBatch(loader);
+
+	FreeBulkInsertState(loader->bulkInsertState);
+	heap_close(loader->table, RowExclusiveLock);
+	MemoryContextDelete(loader->batchContext);
+
+	CommandCounterIncrement();
 }
 
 
@@ -1706,95 +2383,6 @@ StoreQueryResult(PGconn *connection, TupleDesc tupleDescriptor,
 }
 
 
-/*
- * TupleStoreToTable inserts the tuples from the given tupleStore into the given
- * table. Before doing so, the function extracts the values from the tuple and
- * sets the right attributes for the given table based on the column attribute
- * numbers.
- */
-static void
-TupleStoreToTable(RangeVar *tableRangeVar, List *storeToTableColumnList,
-				  TupleDesc storeTupleDescriptor, Tuplestorestate *store)
-{
-	Relation table = heap_openrv(tableRangeVar, RowExclusiveLock);
-	TupleDesc tableTupleDescriptor = RelationGetDescr(table);
-
-	int tableColumnCount = tableTupleDescriptor->natts;
-	Datum *tableTupleValues = palloc0(tableColumnCount * sizeof(Datum));
-	bool *tableTupleNulls = palloc0(tableColumnCount * sizeof(bool));
-
-	int storeColumnCount = storeTupleDescriptor->natts;
-	Datum *storeTupleValues = palloc0(storeColumnCount * sizeof(Datum));
-	bool *storeTupleNulls = palloc0(storeColumnCount * sizeof(bool));
-	TupleTableSlot *storeTableSlot = MakeSingleTupleTableSlot(storeTupleDescriptor);
-
-	for (;;)
-	{
-		HeapTuple storeTuple = NULL;
-		HeapTuple tableTuple = NULL;
-		int storeColumnIndex = 0;
-
-		bool nextTuple = tuplestore_gettupleslot(store, true, false, storeTableSlot);
-		if (!nextTuple)
-		{
-			break;
-		}
-
-		storeTuple = ExecFetchSlotTuple(storeTableSlot);
-		heap_deform_tuple(storeTuple, storeTupleDescriptor,
-						  storeTupleValues, storeTupleNulls);
-
-		/* set all values to null for the table tuple */
-		memset(tableTupleNulls, true, tableColumnCount * sizeof(bool));
-
-		/*
-		 * Extract values from the returned tuple and set them in the right
-		 * attribute location for the new table. We determine this attribute
-		 * location based on the attribute number in the column from the remote
-		 * query's target list.
-		 */
-		for (storeColumnIndex = 0; storeColumnIndex < storeColumnCount;
-			 storeColumnIndex++)
-		{
-			TargetEntry *tableEntry = (TargetEntry *) list_nth(storeToTableColumnList,
-															   storeColumnIndex);
-			Expr *tableExpression = tableEntry->expr;
-			Var *tableColumn = NULL;
-			int tableColumnId = 0;
-
-			/* special case for count(*) as we expect a NULL const */
-			if (IsA(tableExpression, Const))
-			{
-				Const *constValue PG_USED_FOR_ASSERTS_ONLY = (Const *) tableExpression;
-				Assert(constValue->consttype == UNKNOWNOID);
-
-				/* skip over the null consts */
-				continue;
-			}
-
-			Assert(IsA(tableExpression, Var));
-			tableColumn = (Var *) tableExpression;
-			tableColumnId = tableColumn->varattno;
-
-			tableTupleValues[tableColumnId - 1] = storeTupleValues[storeColumnIndex];
-			tableTupleNulls[tableColumnId - 1] = storeTupleNulls[storeColumnIndex];
-		}
-
-		tableTuple = heap_form_tuple(tableTupleDescriptor,
-									 tableTupleValues, tableTupleNulls);
-
-		simple_heap_insert(table, tableTuple);
-		CommandCounterIncrement();
-
-		ExecClearTuple(storeTableSlot);
-		heap_freetuple(tableTuple);
-	}
-
-	ExecDropSingleTupleTableSlot(storeTableSlot);
-	heap_close(table, RowExclusiveLock);
-}
-
-
 /*
  * PgShardExecutorRun actually runs a distributed plan, if any.
  */
@@ -0,0 +1,1012 @@
+/*-------------------------------------------------------------------------
+ *
+ * src/router_plan_cache.c
+ *
+ * This file contains functions to cache the plans of router queries, that is,
+ * queries which touch a single shard of a hash partitioned table because they
+ * specify a value for the partition column. For every query shape we keep the
+ * deparsed shard query as a template with placeholders for the shard id and
+ * the query's constants. Each table additionally gets a sorted array of its
+ * shard intervals, so a router query resolves its shard with a binary search
+ * instead of constraint exclusion over all shards, and needs no deparsing.
+ *
+ * Copyright (c) 2014-2015, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "c.h"
+#include "fmgr.h"
+
+#include "ddl_commands.h"
+#include "distribution_metadata.h"
+#include "router_plan_cache.h"
+#include "ruleutils.h"
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "access/hash.h"
+#include "catalog/pg_type.h"
+#include "nodes/makefuncs.h"
+#include "nodes/memnodes.h" /* IWYU pragma: keep */
+#include "nodes/nodeFuncs.h"
+#include "nodes/nodes.h"
+#include "nodes/parsenodes.h"
+#include "nodes/pg_list.h"
+#include "nodes/primnodes.h"
+#include "parser/parsetree.h"
+#include "utils/elog.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/palloc.h"
+#include "utils/typcache.h"
+
+
+/* types of the placeholders in a query template */
+#define SHARD_ID_SLOT 's'
+#define CONSTANT_SLOT 'c'
+
+/* token preceding the location fields of serialized nodes */
+#define LOCATION_FIELD_TOKEN " :location "
+
+/* initial size of the cache hashes */
+#define ROUTER_TABLE_CACHE_SIZE 32
+#define ROUTER_PLAN_CACHE_SIZE 256
+
+
+/*
+ * RouterTableCacheEntry keeps what is needed to route queries on a hash
+ * partitioned table: the partition column, the operator and hash function used
+ * for its values, and the table's shard intervals sorted by their min values.
+ */
+typedef struct RouterTableCacheEntry
+{
+	Oid distributedTableId;     /* hash key */
+	Var *partitionColumn;
+	Oid equalityOperatorId;
+	FmgrInfo *hashFunction;
+	int shardIntervalCount;
+	ShardInterval **sortedShardIntervalArray;
+} RouterTableCacheEntry;
+
+
+/*
+ * RouterPlanCacheEntry holds the template of the shard query for one query
+ * shape. The template consists of fragmentCount pieces of query text, between
+ * which the shard id or one of the query's constants are to be placed as
+ * specified by slotTypeArray and constantIndexArray.
+ */
+typedef struct RouterPlanCacheEntry
+{
+	uint32 queryShapeHash;      /* hash key */
+	char *queryShape;           /* to tell apart shapes with colliding hashes */
+	Oid distributedTableId;
+	int fragmentCount;
+	char **fragmentArray;
+	char *slotTypeArray;
+	int *constantIndexArray;
+} RouterPlanCacheEntry;
+
+
+/*
+ * ParameterizeConstantsContext collects the constants replaced by parameters
+ * while building a query shape, and notes which of them is the partition value.
+ */
+typedef struct ParameterizeConstantsContext
+{
+	Const *partitionValue;
+	List *constantList;
+	int partitionValueIndex;
+} ParameterizeConstantsContext;
+
+
+/*
+ * Both caches live in their own memory context and are reset as a whole when
+ * one of the cached tables changes.
+ */
+static MemoryContext RouterPlanCacheContext = NULL;
+static HTAB *RouterTableCache = NULL;
+static HTAB *RouterPlanCache = NULL;
+
+
+/* local function forward declarations */
+static void InitializeRouterPlanCache(void);
+static void ResetRouterPlanCache(void);
+static void RouterPlanCacheRelcacheCallback(Datum argument, Oid relationId);
+static RouterTableCacheEntry * LookupRouterTableCacheEntry(Oid distributedTableId);
+static int CompareShardIntervalsByMinValue(const void *leftElement,
+										   const void *rightElement);
+static Node ** FindPartitionValueSlot(Query *query, RouterTableCacheEntry *tableEntry);
+static Node ** OpExpressionPartitionValueSlot(Node *clause,
+											  RouterTableCacheEntry *tableEntry);
+static bool IsPartitionValue(Node *node, RouterTableCacheEntry *tableEntry);
+static Node * ParameterizeConstantsMutator(Node *node,
+										   ParameterizeConstantsContext *context);
+static Param * MakeConstantParam(Const *constant, int constantIndex);
+static char * StripNodeLocations(char *nodeString);
+static ShardInterval * FindShardIntervalForValue(RouterTableCacheEntry *tableEntry,
+												 Const *partitionValue);
+static int64 TemplateShardId(int64 shardId);
+static RouterPlanCacheEntry * BuildQueryTemplate(char *templateString,
+												 int64 templateShardId,
+												 int constantCount,
+												 int partitionValueIndex);
+static StringInfo InstantiateQueryTemplate(RouterPlanCacheEntry *planEntry,
+										   int64 shardId, Const **constantArray);
+
+
+/*
+ * BuildRouterQueryKey checks whether the given query is a router query on a
+ * hash partitioned table and returns its key for the router plan cache. The
+ * query must provide a value for the partition column either as an INSERT's
+ * target or as an equality qualifier in its WHERE clause. Otherwise, the
+ * function returns NULL.
+ *
+ * The key's query shape replaces all non-null constants in the WHERE clause
+ * and, for INSERTs and UPDATEs, in the target values by parameters. Constants
+ * elsewhere, such as in a SELECT's target list where they might be taken for
+ * column numbers, remain part of the shape.
+ */
+RouterQueryKey *
+BuildRouterQueryKey(Query *query, Oid distributedTableId)
+{
+	RouterQueryKey *routerQueryKey = NULL;
+	RouterTableCacheEntry *tableEntry = NULL;
+	Query *parameterizedQuery = NULL;
+	Node **partitionValueSlot = NULL;
+	ParameterizeConstantsContext context;
+	ListCell *constantCell = NULL;
+	CmdType commandType = query->commandType;
+	int constantIndex = 0;
+	char *queryShape = NULL;
+
+	if (!OidIsValid(distributedTableId))
+	{
+		return NULL;
+	}
+
+	tableEntry = LookupRouterTableCacheEntry(distributedTableId);
+	if (tableEntry == NULL)
+	{
+		return NULL;
+	}
+
+	parameterizedQuery = copyObject(query);
+	partitionValueSlot = FindPartitionValueSlot(parameterizedQuery, tableEntry);
+	if (partitionValueSlot == NULL)
+	{
+		return NULL;
+	}
+
+	memset(&context, 0, sizeof(context));
+	context.partitionValue = (Const *) (*partitionValueSlot);
+	context.partitionValueIndex = -1;
+
+	if (parameterizedQuery->jointree != NULL)
+	{
+		FromExpr *joinTree = parameterizedQuery->jointree;
+		joinTree->quals = ParameterizeConstantsMutator(joinTree->quals, &context);
+	}
+
+	if (commandType == CMD_INSERT || commandType == CMD_UPDATE)
+	{
+		ListCell *targetEntryCell = NULL;
+
+		foreach(targetEntryCell, parameterizedQuery->targetList)
+		{
+			TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+			targetEntry->expr = (Expr *) ParameterizeConstantsMutator(
+				(Node *) targetEntry->expr, &context);
+		}
+	}
+
+	if (context.partitionValueIndex < 0 ||
+		list_length(context.constantList) > MAX_ROUTER_QUERY_CONSTANTS)
+	{
+		return NULL;
+	}
+
+	queryShape = StripNodeLocations(nodeToString(parameterizedQuery));
+
+	routerQueryKey = (RouterQueryKey *) palloc0(sizeof(RouterQueryKey));
+	routerQueryKey->distributedTableId = distributedTableId;
+	routerQueryKey->parameterizedQuery = parameterizedQuery;
+	routerQueryKey->constantCount = list_length(context.constantList);
+	routerQueryKey->constantArray =
+		palloc0(routerQueryKey->constantCount * sizeof(Const *));
+	routerQueryKey->partitionValueIndex = context.partitionValueIndex;
+	routerQueryKey->partitionValue = context.partitionValue;
+	routerQueryKey->queryShape = queryShape;
+	routerQueryKey->queryShapeHash =
+		DatumGetUInt32(hash_any((unsigned char *) queryShape, strlen(queryShape)));
+
+	foreach(constantCell, context.constantList)
+	{
+		routerQueryKey->constantArray[constantIndex++] = (Const *) lfirst(constantCell);
+	}
+
+	return routerQueryKey;
+}
+
+
+/*
+ * LookupRouterQuery searches the cache for the given query's shape. On a hit,
+ * the function determines the shard storing the query's partition value, sets
+ * shardId, and returns the query string to run on that shard. If the shape is
+ * not cached or no shard covers the partition value, the function returns NULL.
+ */
+StringInfo
+LookupRouterQuery(RouterQueryKey *routerQueryKey, int64 *shardId)
+{
+	RouterPlanCacheEntry *planEntry = NULL;
+	RouterTableCacheEntry *tableEntry = NULL;
+	ShardInterval *shardInterval = NULL;
+
+	if (RouterPlanCache == NULL)
+	{
+		return NULL;
+	}
+
+	planEntry = hash_search(RouterPlanCache, &(routerQueryKey->queryShapeHash),
+							HASH_FIND, NULL);
+	if (planEntry == NULL || strcmp(planEntry->queryShape, routerQueryKey->queryShape) != 0)
+	{
+		return NULL;
+	}
+
+	tableEntry = LookupRouterTableCacheEntry(routerQueryKey->distributedTableId);
+	if (tableEntry == NULL)
+	{
+		return NULL;
+	}
+
+	shardInterval = FindShardIntervalForValue(tableEntry, routerQueryKey->partitionValue);
+	if (shardInterval == NULL)
+	{
+		return NULL;
+	}
+
+	(*shardId) = shardInterval->id;
+
+	ereport(DEBUG1, (errmsg("using cached router query template")));
+
+	return InstantiateQueryTemplate(planEntry, shardInterval->id,
+									routerQueryKey->constantArray);
+}
+
+
+/*
+ * CacheRouterQuery adds the shape of the key's query to the cache. The caller
+ * passes the shard and query string it has planned the usual way, and the
+ * function only caches the shape if the template reproduces that query string
+ * exactly and the shard lookup array routes the partition value to that shard.
+ */
+void
+CacheRouterQuery(RouterQueryKey *routerQueryKey, int64 shardId, StringInfo queryString)
+{
+	RouterTableCacheEntry *tableEntry = NULL;
+	RouterPlanCacheEntry *templateEntry = NULL;
+	RouterPlanCacheEntry *planEntry = NULL;
+	ShardInterval *shardInterval = NULL;
+	StringInfo templateString = makeStringInfo();
+	StringInfo instantiatedString = NULL;
+	int64 templateShardId = TemplateShardId(shardId);
+	MemoryContext oldContext = NULL;
+	bool entryFound = false;
+	int fragmentIndex = 0;
+
+	if (RouterPlanCache != NULL &&
+		hash_get_num_entries(RouterPlanCache) >= MAX_ROUTER_PLAN_CACHE_ENTRIES)
+	{
+		ResetRouterPlanCache();
+	}
+
+	tableEntry = LookupRouterTableCacheEntry(routerQueryKey->distributedTableId);
+	if (tableEntry == NULL)
+	{
+		return;
+	}
+
+	shardInterval = FindShardIntervalForValue(tableEntry, routerQueryKey->partitionValue);
+	if (shardInterval == NULL || shardInterval->id != shardId)
+	{
+		return;
+	}
+
+	/* deparse the query with placeholders for the shard id and constants */
+	deparse_shard_query(routerQueryKey->parameterizedQuery, templateShardId,
+						templateString);
+
+	templateEntry = BuildQueryTemplate(templateString->data, templateShardId,
+									   routerQueryKey->constantCount,
+									   routerQueryKey->partitionValueIndex);
+	if (templateEntry == NULL)
+	{
+		return;
+	}
+
+	instantiatedString = InstantiateQueryTemplate(templateEntry, shardId,
+												  routerQueryKey->constantArray);
+	if (strcmp(instantiatedString->data, queryString->data) != 0)
+	{
+		ereport(DEBUG2, (errmsg("could not build router query template for: %s",
+								queryString->data)));
+		return;
+	}
+
+	/* tableEntry's lookup made sure the cache is initialized */
+	oldContext = MemoryContextSwitchTo(RouterPlanCacheContext);
+
+	planEntry = hash_search(RouterPlanCache, &(routerQueryKey->queryShapeHash),
+							HASH_ENTER, &entryFound);
+	planEntry->queryShape = pstrdup(routerQueryKey->queryShape);
+	planEntry->distributedTableId = routerQueryKey->distributedTableId;
+	planEntry->fragmentCount = templateEntry->fragmentCount;
+	planEntry->fragmentArray = palloc0(templateEntry->fragmentCount * sizeof(char *));
+	planEntry->slotTypeArray = palloc0(templateEntry->fragmentCount * sizeof(char));
+	planEntry->constantIndexArray = palloc0(templateEntry->fragmentCount * sizeof(int));
+
+	for (fragmentIndex = 0; fragmentIndex < templateEntry->fragmentCount; fragmentIndex++)
+	{
+		planEntry->fragmentArray[fragmentIndex] =
+			pstrdup(templateEntry->fragmentArray[fragmentIndex]);
+		planEntry->slotTypeArray[fragmentIndex] = templateEntry->slotTypeArray[fragmentIndex];
+		planEntry->constantIndexArray[fragmentIndex] =
+			templateEntry->constantIndexArray[fragmentIndex];
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	ereport(DEBUG1, (errmsg("caching router query template")));
+}
+
+
+/*
+ * InitializeRouterPlanCache creates the cache memory context and hashes if they
+ * don't exist yet. On first call, the function also registers the callback to
+ * reset the caches on relation changes.
+ */
+static void
+InitializeRouterPlanCache(void)
+{
+	HASHCTL info;
+	int hashFlags = (HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	if (RouterPlanCacheContext == NULL)
+	{
+		RouterPlanCacheContext = AllocSetContextCreate(CacheMemoryContext,
+													   "pg_shard router plan cache",
+													   ALLOCSET_DEFAULT_MINSIZE,
+													   ALLOCSET_DEFAULT_INITSIZE,
+													   ALLOCSET_DEFAULT_MAXSIZE);
+
+		CacheRegisterRelcacheCallback(RouterPlanCacheRelcacheCallback, (Datum) 0);
+	}
+
+	if (RouterTableCache == NULL)
+	{
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(Oid);
+		info.entrysize = sizeof(RouterTableCacheEntry);
+		info.hcxt = RouterPlanCacheContext;
+
+		RouterTableCache = hash_create("pg_shard router table cache",
+									   ROUTER_TABLE_CACHE_SIZE, &info, hashFlags);
+	}
+
+	if (RouterPlanCache == NULL)
+	{
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(uint32);
+		info.entrysize = sizeof(RouterPlanCacheEntry);
+		info.hcxt = RouterPlanCacheContext;
+
+		RouterPlanCache = hash_create("pg_shard router plan cache",
+									  ROUTER_PLAN_CACHE_SIZE, &info, hashFlags);
+	}
+}
+
+
+/* ResetRouterPlanCache drops all cached tables and query templates. */
+static void
+ResetRouterPlanCache(void)
+{
+	if (RouterTableCache != NULL)
+	{
+		hash_destroy(RouterTableCache);
+		RouterTableCache = NULL;
+	}
+
+	if (RouterPlanCache != NULL)
+	{
+		hash_destroy(RouterPlanCache);
+		RouterPlanCache = NULL;
+	}
+
+	if (RouterPlanCacheContext != NULL)
+	{
+		MemoryContextReset(RouterPlanCacheContext);
+	}
+}
+
+
+/*
+ * RouterPlanCacheRelcacheCallback resets the caches if one of the cached tables
+ * is changed, as that might change the query text deparsed for it.
+ */
+static void
+RouterPlanCacheRelcacheCallback(Datum argument, Oid relationId)
+{
+	bool entryFound = false;
+
+	if (RouterTableCache == NULL)
+	{
+		return;
+	}
+
+	if (OidIsValid(relationId))
+	{
+		hash_search(RouterTableCache, &relationId, HASH_FIND, &entryFound);
+	}
+
+	if (!OidIsValid(relationId) || entryFound)
+	{
+		ResetRouterPlanCache();
+	}
+}
+
+
+/*
+ * LookupRouterTableCacheEntry returns the routing information for the given
+ * table, building it on first access. If the table is not hash partitioned,
+ * has no shards yet, or its partition column type can't be hashed, the
+ * function returns NULL.
+ */
+static RouterTableCacheEntry *
+LookupRouterTableCacheEntry(Oid distributedTableId)
+{
+	RouterTableCacheEntry *tableEntry = NULL;
+	List *shardIntervalList = NIL;
+	ListCell *shardIntervalCell = NULL;
+	TypeCacheEntry *typeEntry = NULL;
+	Var *partitionColumn = NULL;
+	MemoryContext oldContext = NULL;
+	bool entryFound = false;
+	int shardIndex = 0;
+
+	InitializeRouterPlanCache();
+
+	tableEntry = hash_search(RouterTableCache, &distributedTableId, HASH_FIND,
+							 &entryFound);
+	if (entryFound)
+	{
+		return (tableEntry->partitionColumn != NULL) ? tableEntry : NULL;
+	}
+
+	if (PartitionType(distributedTableId) != HASH_PARTITION_TYPE)
+	{
+		tableEntry = hash_search(RouterTableCache, &distributedTableId, HASH_ENTER,
+								 &entryFound);
+		tableEntry->partitionColumn = NULL;
+		return NULL;
+	}
+
+	/* don't remember tables without shards, as shards might be created later */
+	shardIntervalList = LookupShardIntervalList(distributedTableId);
+	if (shardIntervalList == NIL)
+	{
+		return NULL;
+	}
+
+	partitionColumn = PartitionColumn(distributedTableId);
+	typeEntry = lookup_type_cache(partitionColumn->vartype,
+								  TYPECACHE_EQ_OPR | TYPECACHE_HASH_PROC_FINFO);
+
+	oldContext = MemoryContextSwitchTo(RouterPlanCacheContext);
+
+	tableEntry = hash_search(RouterTableCache, &distributedTableId, HASH_ENTER,
+							 &entryFound);
+	tableEntry->partitionColumn = NULL;
+	tableEntry->equalityOperatorId = typeEntry->eq_opr;
+	tableEntry->hashFunction = &(typeEntry->hash_proc_finfo);
+	tableEntry->shardIntervalCount = list_length(shardIntervalList);
+	tableEntry->sortedShardIntervalArray =
+		palloc0(tableEntry->shardIntervalCount * sizeof(ShardInterval *));
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		tableEntry->sortedShardIntervalArray[shardIndex++] = shardInterval;
+
+		/* hash partitioned tables are expected to have int4 token ranges */
+		if (shardInterval->valueTypeId != INT4OID)
+		{
+			MemoryContextSwitchTo(oldContext);
+			return NULL;
+		}
+	}
+
+	qsort(tableEntry->sortedShardIntervalArray, tableEntry->shardIntervalCount,
+		  sizeof(ShardInterval *), CompareShardIntervalsByMinValue);
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (!OidIsValid(tableEntry->equalityOperatorId) ||
+		!OidIsValid(tableEntry->hashFunction->fn_oid))
+	{
+		return NULL;
+	}
+
+	/* a valid partition column marks the entry as usable for routing */
+	oldContext = MemoryContextSwitchTo(RouterPlanCacheContext);
+	tableEntry->partitionColumn = copyObject(partitionColumn);
+	MemoryContextSwitchTo(oldContext);
+
+	return tableEntry;
+}
+
+
+/* Helper function to compare two hash partitioned shard intervals by min value. */
+static int
+CompareShardIntervalsByMinValue(const void *leftElement, const void *rightElement)
+{
+	const ShardInterval *leftInterval = *((const ShardInterval **) leftElement);
+	const ShardInterval *rightInterval = *((const ShardInterval **) rightElement);
+	int32 leftMinValue = DatumGetInt32(leftInterval->minValue);
+	int32 rightMinValue = DatumGetInt32(rightInterval->minValue);
+
+	if (leftMinValue > rightMinValue)
+	{
+		return 1;
+	}
+	else if (leftMinValue < rightMinValue)
+	{
+		return -1;
+	}
+	else
+	{
+		return 0;
+	}
+}
+
+
+/*
+ * FindPartitionValueSlot returns the location of the partition value in the
+ * given query, or NULL if the query doesn't specify one. For INSERTs, this is
+ * the partition column's target entry. For other commands, it's the constant
+ * side of a top-level equality qualifier on the partition column.
+ */
+static Node **
+FindPartitionValueSlot(Query *query, RouterTableCacheEntry *tableEntry)
+{
+	Node **partitionValueSlot = NULL;
+	CmdType commandType = query->commandType;
+
+	if (commandType == CMD_INSERT)
+	{
+		AttrNumber partitionColumnId = tableEntry->partitionColumn->varattno;
+		TargetEntry *targetEntry = get_tle_by_resno(query->targetList, partitionColumnId);
+
+		if (targetEntry != NULL && IsPartitionValue((Node *) targetEntry->expr, tableEntry))
+		{
+			partitionValueSlot = (Node **) &(targetEntry->expr);
+		}
+	}
+	else if (commandType == CMD_SELECT || commandType == CMD_UPDATE ||
+			 commandType == CMD_DELETE)
+	{
+		FromExpr *joinTree = query->jointree;
+		Node *whereClause = NULL;
+
+		if (joinTree == NULL || joinTree->quals == NULL)
+		{
+			return NULL;
+		}
+
+		whereClause = joinTree->quals;
+		if (IsA(whereClause, List))
+		{
+			ListCell *clauseCell = NULL;
+
+			foreach(clauseCell, (List *) whereClause)
+			{
+				Node *clause = (Node *) lfirst(clauseCell);
+
+				partitionValueSlot = OpExpressionPartitionValueSlot(clause, tableEntry);
+				if (partitionValueSlot != NULL)
+				{
+					break;
+				}
+			}
+		}
+		else
+		{
+			partitionValueSlot = OpExpressionPartitionValueSlot(whereClause, tableEntry);
+		}
+	}
+
+	return partitionValueSlot;
+}
+
+
+/*
+ * OpExpressionPartitionValueSlot returns the location of the constant in the
+ * given clause if it's an equality between the partition column and a
+ * constant, and NULL otherwise.
+ */
+static Node **
+OpExpressionPartitionValueSlot(Node *clause, RouterTableCacheEntry *tableEntry)
+{
+	OpExpr *operatorExpression = NULL;
+	ListCell *leftOperandCell = NULL;
+	ListCell *rightOperandCell = NULL;
+	Node *leftOperand = NULL;
+	Node *rightOperand = NULL;
+
+	if (!IsA(clause, OpExpr))
+	{
+		return NULL;
+	}
+
+	operatorExpression = (OpExpr *) clause;
+	if (operatorExpression->opno != tableEntry->equalityOperatorId ||
+		list_length(operatorExpression->args) != 2)
+	{
+		return NULL;
+	}
+
+	leftOperandCell = list_head(operatorExpression->args);
+	rightOperandCell = lnext(leftOperandCell);
+	leftOperand = (Node *) lfirst(leftOperandCell);
+	rightOperand = (Node *) lfirst(rightOperandCell);
+
+	if (equal(leftOperand, tableEntry->partitionColumn) &&
+		IsPartitionValue(rightOperand, tableEntry))
+	{
+		return (Node **) &lfirst(rightOperandCell);
+	}
+	else if (equal(rightOperand, tableEntry->partitionColumn) &&
+			 IsPartitionValue(leftOperand, tableEntry))
+	{
+		return (Node **) &lfirst(leftOperandCell);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * IsPartitionValue checks whether the node is a non-null constant of the
+ * partition column's type.
+ */
+static bool
+IsPartitionValue(Node *node, RouterTableCacheEntry *tableEntry)
+{
+	Const *constant = NULL;
+
+	if (node == NULL || !IsA(node, Const))
+	{
+		return false;
+	}
+
+	constant = (Const *) node;
+
+	return (!constant->constisnull &&
+			constant->consttype == tableEntry->partitionColumn->vartype);
+}
+
+
+/*
+ * ParameterizeConstantsMutator replaces the non-null constants in the given
+ * expression by parameters numbered in the order they are found, and appends
+ * the constants to the context's list. Null constants remain in place, as they
+ * are deparsed differently. The mutator doesn't descend into subqueries.
+ */
+static Node *
+ParameterizeConstantsMutator(Node *node, ParameterizeConstantsContext *context)
+{
+	if (node == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsA(node, Const))
+	{
+		Const *constant = (Const *) node;
+		int constantIndex = list_length(context->constantList);
+
+		if (constant->constisnull)
+		{
+			return node;
+		}
+
+		if (constant == context->partitionValue)
+		{
+			context->partitionValueIndex = constantIndex;
+		}
+
+		context->constantList = lappend(context->constantList, constant);
+
+		return (Node *) MakeConstantParam(constant, constantIndex);
+	}
+
+	if (IsA(node, Query))
+	{
+		return node;
+	}
+
+	return expression_tree_mutator(node, ParameterizeConstantsMutator, (void *) context);
+}
+
+
+/* MakeConstantParam creates the parameter standing in for the given constant. */
+static Param *
+MakeConstantParam(Const *constant, int constantIndex)
+{
+	Param *constantParam = makeNode(Param);
+	constantParam->paramkind = PARAM_EXTERN;
+	constantParam->paramid = ROUTER_FIRST_CONSTANT_PARAM_ID + constantIndex;
+	constantParam->paramtype = constant->consttype;
+	constantParam->paramtypmod = constant->consttypmod;
+	constantParam->paramcollid = constant->constcollid;
+	constantParam->location = -1;
+
+	return constantParam;
+}
+
+
+/*
+ * StripNodeLocations removes the values of all location fields from the given
+ * serialized node tree, so that queries which only differ in their formatting
+ * serialize the same way. As outToken() escapes spaces within strings, the
+ * location field token can't be matched inside a serialized name.
+ */
+static char *
+StripNodeLocations(char *nodeString)
+{
+	StringInfo strippedString = makeStringInfo();
+	int locationTokenLength = strlen(LOCATION_FIELD_TOKEN);
+	char *position = nodeString;
+	char *locationToken = NULL;
+
+	while ((locationToken = strstr(position, LOCATION_FIELD_TOKEN)) != NULL)
+	{
+		char *locationValue = locationToken + locationTokenLength;
+		appendBinaryStringInfo(strippedString, position, locationValue - position);
+
+		position = locationValue;
+		if (*position == '-')
+		{
+			position++;
+		}
+
+		while (isdigit((unsigned char) *position))
+		{
+			position++;
+		}
+	}
+
+	appendStringInfoString(strippedString, position);
+
+	return strippedString->data;
+}
+
+
+/*
+ * FindShardIntervalForValue hashes the partition value and finds the shard
+ * whose token range contains the hashed value using a binary search. If no
+ * shard covers the hashed value, the function returns NULL.
+ */
+static ShardInterval *
+FindShardIntervalForValue(RouterTableCacheEntry *tableEntry, Const *partitionValue)
+{
+	ShardInterval **sortedShardIntervalArray = tableEntry->sortedShardIntervalArray;
+	ShardInterval *shardInterval = NULL;
+	int lowerIndex = 0;
+	int upperIndex = tableEntry->shardIntervalCount;
+
+	/*
+	 * Note that any changes to PostgreSQL's hashing functions will change the
+	 * hashed value, just as they would for shard pruning.
+	 */
+	Datum hashedDatum = FunctionCall1(tableEntry->hashFunction,
+									  partitionValue->constvalue);
+	int32 hashedValue = DatumGetInt32(hashedDatum);
+
+	/* find the last shard interval whose min value is not above hashedValue */
+	while (lowerIndex < upperIndex)
+	{
+		int middleIndex = lowerIndex + (upperIndex - lowerIndex) / 2;
+		int32 minValue = DatumGetInt32(sortedShardIntervalArray[middleIndex]->minValue);
+
+		if (minValue <= hashedValue)
+		{
+			lowerIndex = middleIndex + 1;
+		}
+		else
+		{
+			upperIndex = middleIndex;
+		}
+	}
+
+	if (lowerIndex == 0)
+	{
+		return NULL;
+	}
+
+	shardInterval = sortedShardIntervalArray[lowerIndex - 1];
+	if (hashedValue > DatumGetInt32(shardInterval->maxValue))
+	{
+		return NULL;
+	}
+
+	return shardInterval;
+}
+
+
+/*
+ * TemplateShardId returns the shard id used as placeholder when deparsing a
+ * query template. It has as many digits as the given shard id, so the extended
+ * relation names have the same length, but differs from it.
+ */
+static int64
+TemplateShardId(int64 shardId)
+{
+	char *shardIdString = psprintf(INT64_FORMAT, shardId);
+	int digitCount = strlen(shardIdString);
+	int64 templateShardId = 0;
+	int digitIndex = 0;
+
+	for (digitIndex = 0; digitIndex < digitCount; digitIndex++)
+	{
+		templateShardId = templateShardId * 10 + 8;
+	}
+
+	if (templateShardId == shardId)
+	{
+		templateShardId -= templateShardId / 8;
+	}
+
+	return templateShardId;
+}
+
+
+/*
+ * BuildQueryTemplate splits the query string deparsed with the template shard
+ * id and constant parameters into fragments at these placeholders. The
+ * function returns NULL unless the partition value occurs exactly once.
+ */
+static RouterPlanCacheEntry *
+BuildQueryTemplate(char *templateString, int64 templateShardId, int constantCount,
+				   int partitionValueIndex)
+{
+	RouterPlanCacheEntry *templateEntry = palloc0(sizeof(RouterPlanCacheEntry));
+	char *shardIdPlaceholder = psprintf("%c" INT64_FORMAT, SHARD_NAME_SEPARATOR,
+										templateShardId);
+	int shardIdPlaceholderLength = strlen(shardIdPlaceholder);
+	List *fragmentList = NIL;
+	List *slotTypeList = NIL;
+	List *constantIndexList = NIL;
+	ListCell *fragmentCell = NULL;
+	ListCell *slotTypeCell = NULL;
+	ListCell *constantIndexCell = NULL;
+	int partitionValueCount = 0;
+	int fragmentIndex = 0;
+	char *fragmentStart = templateString;
+	char *position = templateString;
+
+	while (*position != '\0')
+	{
+		char slotType = '\0';
+		int constantIndex = -1;
+		int placeholderLength = 0;
+		int fragmentLength = 0;
+
+		if (strncmp(position, shardIdPlaceholder, shardIdPlaceholderLength) == 0 &&
+			!isdigit((unsigned char) position[shardIdPlaceholderLength]))
+		{
+			/* keep the separator in the fragment and replace the digits only */
+			slotType = SHARD_ID_SLOT;
+			position++;
+			placeholderLength = shardIdPlaceholderLength - 1;
+		}
+		else if (position[0] == '$' && isdigit((unsigned char) position[1]))
+		{
+			char *parameterEnd = NULL;
+			long parameterId = strtol(position + 1, &parameterEnd, 10);
+
+			if (parameterId < ROUTER_FIRST_CONSTANT_PARAM_ID ||
+				parameterId >= ROUTER_FIRST_CONSTANT_PARAM_ID + constantCount)
+			{
+				position = parameterEnd;
+				continue;
+			}
+
+			slotType = CONSTANT_SLOT;
+			constantIndex = (int) (parameterId - ROUTER_FIRST_CONSTANT_PARAM_ID);
+			placeholderLength = parameterEnd - position;
+
+			if (constantIndex == partitionValueIndex)
+			{
+				partitionValueCount++;
+			}
+		}
+		else
+		{
+			position++;
+			continue;
+		}
+
+		fragmentLength = position - fragmentStart;
+		fragmentList = lappend(fragmentList, pnstrdup(fragmentStart, fragmentLength));
+		slotTypeList = lappend_int(slotTypeList, slotType);
+		constantIndexList = lappend_int(constantIndexList, constantIndex);
+
+		position += placeholderLength;
+		fragmentStart = position;
+	}
+
+	fragmentList = lappend(fragmentList, pstrdup(fragmentStart));
+	slotTypeList = lappend_int(slotTypeList, '\0');
+	constantIndexList = lappend_int(constantIndexList, -1);
+
+	if (partitionValueCount != 1)
+	{
+		return NULL;
+	}
+
+	templateEntry->fragmentCount = list_length(fragmentList);
+	templateEntry->fragmentArray = palloc0(templateEntry->fragmentCount * sizeof(char *));
+	templateEntry->slotTypeArray = palloc0(templateEntry->fragmentCount * sizeof(char));
+	templateEntry->constantIndexArray =
+		palloc0(templateEntry->fragmentCount * sizeof(int));
+
+	constantIndexCell = list_head(constantIndexList);
+	forboth(fragmentCell, fragmentList, slotTypeCell, slotTypeList)
+	{
+		templateEntry->fragmentArray[fragmentIndex] = (char *) lfirst(fragmentCell);
+		templateEntry->slotTypeArray[fragmentIndex] = (char) lfirst_int(slotTypeCell);
+		templateEntry->constantIndexArray[fragmentIndex] = lfirst_int(constantIndexCell);
+		constantIndexCell = lnext(constantIndexCell);
+		fragmentIndex++;
+	}
+
+	return templateEntry;
+}
+
+
+/*
+ * InstantiateQueryTemplate builds the query string for the given shard and
+ * constants by filling the placeholders of the query template.
+ */
+static StringInfo
+InstantiateQueryTemplate(RouterPlanCacheEntry *planEntry, int64 shardId,
+						 Const **constantArray)
+{
+	StringInfo queryString = makeStringInfo();
+	int fragmentIndex = 0;
+
+	for (fragmentIndex = 0; fragmentIndex < planEntry->fragmentCount; fragmentIndex++)
+	{
+		char slotType = planEntry->slotTypeArray[fragmentIndex];
+
+		appendStringInfoString(queryString, planEntry->fragmentArray[fragmentIndex]);
+
+		if (slotType == SHARD_ID_SLOT)
+		{
+			appendStringInfo(queryString, INT64_FORMAT, shardId);
+		}
+		else if (slotType == CONSTANT_SLOT)
+		{
+			int constantIndex = planEntry->constantIndexArray[fragmentIndex];
+			deparse_shard_const(constantArray[constantIndex], queryString);
+		}
+	}
+
+	return queryString;
+}
@@ -1698,6 +1698,26 @@ deparse_shard_query(Query *query, int64 shardid, StringInfo buffer)
 }
 
 
+/* ----------
+ * deparse_shard_const		- Parse back a constant for use in a shard query
+ *
+ * Appends the constant to the provided buffer exactly as deparse_shard_query
+ * would print it within a query.
+ * ----------
+ */
+void
+deparse_shard_const(Const *constval, StringInfo buffer)
+{
+	deparse_context context;
+
+	memset(&context, 0, sizeof(context));
+	context.buf = buffer;
+	context.wrapColumn = WRAP_COLUMN_DEFAULT;
+
+	get_const_expr(constval, &context, 0);
+}
+
+
 /* ----------
  * get_query_def			- Parse back one query parsetree
  *
@@ -0,0 +1,64 @@
+-- ===================================================================
+-- test router plan cache hits, misses and invalidation
+-- ===================================================================
+
+CREATE TABLE cached_orders (
+	id integer NOT NULL,
+	symbol text NOT NULL,
+	quantity integer NOT NULL
+);
+
+SELECT master_create_distributed_table('cached_orders', 'id');
+
+\set VERBOSITY terse
+SELECT master_create_worker_shards('cached_orders', 2, 1);
+\set VERBOSITY default
+
+-- report when queries are added to or served from the cache
+SET client_min_messages TO DEBUG1;
+
+-- INSERTs of the same shape share a template, whatever their values
+INSERT INTO cached_orders VALUES (1, 'AAPL', 100);
+INSERT INTO cached_orders VALUES (2, 'MSFT', 2000);
+INSERT INTO cached_orders VALUES (3, 'IBM', -30);
+
+-- formatting doesn't change the shape
+INSERT   INTO cached_orders
+	VALUES (4,   'ORCL', 40);
+
+-- the partition value picks the shard, other constants are filled in as well
+SELECT symbol, quantity FROM cached_orders WHERE id = 1;
+SELECT symbol, quantity FROM cached_orders WHERE id = 2;
+SELECT symbol,quantity FROM cached_orders WHERE id=3;
+SELECT symbol, quantity FROM cached_orders WHERE id = 3 AND quantity < 0;
+SELECT symbol, quantity FROM cached_orders WHERE id = 2 AND quantity < 0;
+SELECT symbol, quantity FROM cached_orders WHERE id = 4 AND quantity < 50;
+
+-- a different query shape misses the cache
+SELECT symbol, quantity FROM cached_orders WHERE quantity < 50 AND id = 4;
+SELECT symbol, quantity FROM cached_orders WHERE id = 4 AND quantity > 50;
+
+-- UPDATEs and DELETEs are cached as well
+UPDATE cached_orders SET quantity = 110 WHERE id = 1;
+UPDATE cached_orders SET quantity = 2200 WHERE id = 2;
+DELETE FROM cached_orders WHERE id = 3;
+DELETE FROM cached_orders WHERE id = 4;
+
+SELECT symbol, quantity FROM cached_orders WHERE id = 1;
+SELECT symbol, quantity FROM cached_orders WHERE id = 2;
+SELECT symbol, quantity FROM cached_orders WHERE id = 3;
+SELECT symbol, quantity FROM cached_orders WHERE id = 4;
+
+-- changing the table invalidates the cached templates
+ALTER TABLE cached_orders ALTER COLUMN quantity SET DEFAULT 0;
+
+SELECT symbol, quantity FROM cached_orders WHERE id = 1;
+SELECT symbol, quantity FROM cached_orders WHERE id = 2;
+
+-- the cache can be turned off
+SET pg_shard.use_router_plan_cache TO off;
+
+SELECT symbol, quantity FROM cached_orders WHERE id = 1;
+
+RESET pg_shard.use_router_plan_cache;
+RESET client_min_messages;
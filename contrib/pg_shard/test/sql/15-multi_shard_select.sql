@@ -0,0 +1,92 @@
+-- ===================================================================
+-- test concurrent execution and failover of multiple shard SELECTs
+-- ===================================================================
+
+CREATE TABLE trades (
+	id integer NOT NULL,
+	symbol text NOT NULL,
+	quantity integer NOT NULL
+);
+
+SELECT master_create_distributed_table('trades', 'id');
+
+\set VERBOSITY terse
+SELECT master_create_worker_shards('trades', 4, 1);
+\set VERBOSITY default
+
+INSERT INTO trades VALUES (1, 'AAPL', 100);
+INSERT INTO trades VALUES (2, 'MSFT', 250);
+INSERT INTO trades VALUES (3, 'IBM', 75);
+INSERT INTO trades VALUES (4, 'ORCL', 500);
+INSERT INTO trades VALUES (5, 'INTC', 20);
+INSERT INTO trades VALUES (6, 'CSCO', 310);
+INSERT INTO trades VALUES (7, 'NVDA', 45);
+INSERT INTO trades VALUES (8, 'AMZN', 150);
+
+-- all shards are on the same node, so their queries run side by side
+SELECT count(*), sum(quantity) FROM trades;
+
+SELECT id, symbol FROM trades WHERE quantity > 100 ORDER BY id;
+
+-- the same queries with one shard query per node at a time
+SET pg_shard.max_select_connections_per_node TO 1;
+
+SELECT count(*), sum(quantity) FROM trades;
+
+SELECT id, symbol FROM trades WHERE quantity > 100 ORDER BY id;
+
+RESET pg_shard.max_select_connections_per_node;
+
+-- the node's cached connection is usable after a multiple shard SELECT
+SELECT symbol FROM trades WHERE id = 4;
+
+-- move all placements to an unreachable node
+UPDATE pgs_distribution_metadata.shard_placement
+SET    node_name = 'badhost',
+	   node_port = 54321
+WHERE  shard_id IN (SELECT id
+					FROM   pgs_distribution_metadata.shard
+					WHERE  relation_id = 'trades'::regclass);
+
+-- with no placement left to fail over to, the query errors out
+\set VERBOSITY terse
+SELECT count(*), sum(quantity) FROM trades;
+\set VERBOSITY default
+
+-- add healthy placements back next to the unreachable ones
+INSERT INTO pgs_distribution_metadata.shard_placement
+			(shard_id,
+			 shard_state,
+			 node_name,
+			 node_port)
+SELECT shard_id,
+	   shard_state,
+	   'localhost',
+	   :worker_port
+FROM   pgs_distribution_metadata.shard_placement
+WHERE  node_name = 'badhost'
+AND    shard_id IN (SELECT id
+					FROM   pgs_distribution_metadata.shard
+					WHERE  relation_id = 'trades'::regclass);
+
+-- tasks fail over to the healthy placements; hide the connection warnings,
+-- since the order in which placements are tried is not defined
+SET client_min_messages TO ERROR;
+
+SELECT count(*), sum(quantity) FROM trades;
+
+SELECT id, symbol FROM trades WHERE quantity > 100 ORDER BY id;
+
+SET pg_shard.max_select_connections_per_node TO 1;
+
+SELECT count(*), sum(quantity) FROM trades;
+
+RESET pg_shard.max_select_connections_per_node;
+RESET client_min_messages;
+
+-- clean up
+DELETE FROM pgs_distribution_metadata.shard_placement
+WHERE  node_name = 'badhost'
+AND    shard_id IN (SELECT id
+					FROM   pgs_distribution_metadata.shard
+					WHERE  relation_id = 'trades'::regclass);
@@ -49,6 +49,8 @@ static const struct config_enum_entry PGLogicalConflictResolvers[] = {
 
 bool	pglogical_synchronous_commit = false;
 char   *pglogical_temp_directory;
+int		pglogical_sync_copy_connections = 1;
+bool	pglogical_sync_binary_copy = false;
 
 void _PG_init(void);
 void pglogical_supervisor_main(Datum main_arg);
@@ -442,6 +444,24 @@ _PG_init(void)
 							   "/tmp", PGC_SIGHUP,
 							   0,
 							   NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pglogical.sync_copy_connections",
+							"Number of connection pairs used to copy table data during initial synchronization",
+							NULL,
+							&pglogical_sync_copy_connections,
+							1, 1, 64,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pglogical.sync_binary_copy",
+							 "Use binary COPY for initial synchronization of tables whose structure was synchronized too",
+							 NULL,
+							 &pglogical_sync_binary_copy,
+							 false, PGC_SIGHUP,
+							 0,
+							 NULL, NULL, NULL);
+
 	if (IsBinaryUpgrade)
 		return;
 
@@ -38,6 +38,8 @@
 
 extern bool pglogical_synchronous_commit;
 extern char *pglogical_temp_directory;
+extern int pglogical_sync_copy_connections;
+extern bool pglogical_sync_binary_copy;
 
 extern char *shorten_hash(const char *str, int maxlen);
 
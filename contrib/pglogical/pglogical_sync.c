@@ -13,6 +13,8 @@
 
 #include "postgres.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include "libpq-fe.h"
@@ -268,141 +270,376 @@ finish_copy_target_tx(PGconn *conn)
 
 
 /*
- * COPY single table over wire.
+ * State of one origin/target connection pair used for copying table data.
+ */
+typedef struct CopyConnection
+{
+	PGconn	   *origin_conn;
+	PGconn	   *target_conn;
+	RangeVar   *table;			/* table being copied, NULL when idle */
+} CopyConnection;
+
+/*
+ * Can the table be copied in binary format?
+ *
+ * The binary format is only guaranteed to be compatible within a major
+ * version.  Besides, the binary representation of arrays and composites
+ * embeds type OIDs, and those of user-defined types differ between the
+ * nodes, so tables with such columns are copied as text.  Domains are
+ * treated the same way, since they might be defined over such types.
+ */
+static bool
+table_binary_copy_safe(CopyConnection *conn, const char *nspname,
+					   const char *relname)
+{
+	PGresult   *res;
+	StringInfoData	query;
+	char	   *qualname;
+	char	   *relliteral;
+	bool		safe;
+
+	if (PQserverVersion(conn->origin_conn) / 100 !=
+		PQserverVersion(conn->target_conn) / 100)
+		return false;
+
+	qualname = psprintf("%s.%s", nspname, relname);
+	relliteral = PQescapeLiteral(conn->origin_conn, qualname,
+								 strlen(qualname));
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT 1 FROM pg_catalog.pg_attribute a"
+					 " JOIN pg_catalog.pg_type t ON t.oid = a.atttypid"
+					 " WHERE a.attrelid = %s::pg_catalog.regclass"
+					 " AND a.attnum > 0 AND NOT a.attisdropped"
+					 " AND (t.typtype IN ('c', 'd')"
+					 " OR (t.typelem >= %u AND t.typlen = -1)) LIMIT 1",
+					 relliteral, FirstNormalObjectId);
+
+	res = PQexec(conn->origin_conn, query.data);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		ereport(ERROR,
+				(errmsg("could not fetch column types of table %s.%s",
+						nspname, relname),
+				 errdetail("Query '%s': %s", query.data,
+					 PQerrorMessage(conn->origin_conn))));
+	safe = PQntuples(res) == 0;
+
+	PQclear(res);
+	PQfreemem(relliteral);
+	pfree(qualname);
+	pfree(query.data);
+
+	return safe;
+}
+
+/*
+ * Start COPY of single table over wire.
+ *
+ * Puts the origin connection into COPY OUT and the target connection into
+ * COPY IN mode, the data itself is moved by copy_table_data_step.
  */
 static void
-copy_table_data(PGconn *origin_conn, PGconn *target_conn,
-				const char *nspname, const char *relname)
+start_copy_table_data(CopyConnection *conn, RangeVar *table, bool binary)
 {
 	PGresult   *res;
-	int			bytes;
-	char	   *copybuf;
 	StringInfoData	query;
+	const char *format;
+	char	   *nspname = PQescapeIdentifier(conn->origin_conn,
+											 table->schemaname,
+											 strlen(table->schemaname));
+	char	   *relname = PQescapeIdentifier(conn->origin_conn,
+											 table->relname,
+											 strlen(table->relname));
+
+	if (binary && !table_binary_copy_safe(conn, nspname, relname))
+		binary = false;
+	format = binary ? " WITH (FORMAT binary)" : "";
 
 	/* Build COPY TO query. */
 	initStringInfo(&query);
-	appendStringInfo(&query, "COPY %s.%s TO stdout",
-					 PQescapeIdentifier(origin_conn, nspname,
-										strlen(nspname)),
-					 PQescapeIdentifier(origin_conn, relname,
-										strlen(relname)));
+	appendStringInfo(&query, "COPY %s.%s TO stdout%s",
+					 nspname, relname, format);
 
 	/* Execute COPY TO. */
-	res = PQexec(origin_conn, query.data);
+	res = PQexec(conn->origin_conn, query.data);
 	if (PQresultStatus(res) != PGRES_COPY_OUT)
 	{
 		ereport(ERROR,
 				(errmsg("table copy failed"),
 				 errdetail("Query '%s': %s", query.data,
-					 PQerrorMessage(origin_conn))));
+					 PQerrorMessage(conn->origin_conn))));
 	}
+	PQclear(res);
 
 	/* Build COPY FROM query. */
 	resetStringInfo(&query);
-	appendStringInfo(&query, "COPY %s.%s FROM stdin",
-					 PQescapeIdentifier(origin_conn, nspname,
-										strlen(nspname)),
-					 PQescapeIdentifier(origin_conn, relname,
-										strlen(relname)));
+	appendStringInfo(&query, "COPY %s.%s FROM stdin%s",
+					 nspname, relname, format);
 
 	/* Execute COPY FROM. */
-	res = PQexec(target_conn, query.data);
+	res = PQexec(conn->target_conn, query.data);
 	if (PQresultStatus(res) != PGRES_COPY_IN)
 	{
 		ereport(ERROR,
 				(errmsg("table copy failed"),
 				 errdetail("Query '%s': %s", query.data,
-					 PQerrorMessage(origin_conn))));
+					 PQerrorMessage(conn->target_conn))));
 	}
+	PQclear(res);
 
-	while ((bytes = PQgetCopyData(origin_conn, &copybuf, false)) > 0)
+	PQfreemem(nspname);
+	PQfreemem(relname);
+	pfree(query.data);
+
+	conn->table = table;
+}
+
+/*
+ * Move all the data already received from origin to target.
+ *
+ * Never waits for origin, returns true once the table has been copied
+ * completely, false if more data has to be read from the origin socket.
+ */
+static bool
+copy_table_data_step(CopyConnection *conn)
+{
+	PGresult   *res;
+	int			bytes;
+	char	   *copybuf;
+
+	while ((bytes = PQgetCopyData(conn->origin_conn, &copybuf, true)) > 0)
 	{
-		if (PQputCopyData(target_conn, copybuf, bytes) != 1)
+		if (PQputCopyData(conn->target_conn, copybuf, bytes) != 1)
 		{
 			ereport(ERROR,
 					(errmsg("writing to target table failed"),
 					 errdetail("destination connection reported: %s",
-						 PQerrorMessage(target_conn))));
+						 PQerrorMessage(conn->target_conn))));
 		}
 		PQfreemem(copybuf);
-
-		CHECK_FOR_INTERRUPTS();
 	}
 
+	/* Nothing buffered, need to wait for origin. */
+	if (bytes == 0)
+		return false;
+
 	if (bytes != -1)
 	{
 		ereport(ERROR,
 				(errmsg("reading from origin table failed"),
 				 errdetail("source connection returned %d: %s",
-					bytes, PQerrorMessage(origin_conn))));
+					bytes, PQerrorMessage(conn->origin_conn))));
 	}
 
+	res = PQgetResult(conn->origin_conn);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		ereport(ERROR,
+				(errmsg("reading from origin table failed"),
+				 errdetail("source connection reported: %s",
+					 PQresultErrorMessage(res))));
+	}
+	PQclear(res);
+	while ((res = PQgetResult(conn->origin_conn)) != NULL)
+		PQclear(res);
+
 	/* Send local finish */
-	if (PQputCopyEnd(target_conn, NULL) != 1)
+	if (PQputCopyEnd(conn->target_conn, NULL) != 1)
 	{
 		ereport(ERROR,
 				(errmsg("sending copy-completion to destination connection failed"),
 				 errdetail("destination connection reported: %s",
-					 PQerrorMessage(target_conn))));
+					 PQerrorMessage(conn->target_conn))));
 	}
 
+	res = PQgetResult(conn->target_conn);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		ereport(ERROR,
+				(errmsg("writing to target table failed"),
+				 errdetail("destination connection reported: %s",
+					 PQresultErrorMessage(res))));
+	}
 	PQclear(res);
+	while ((res = PQgetResult(conn->target_conn)) != NULL)
+		PQclear(res);
+
+	conn->table = NULL;
+
+	return true;
 }
 
 /*
- * Copy data from origin node to target node.
+ * Copy tables using up to pglogical.sync_copy_connections connection pairs.
  *
- * Creates new connection to origin and target.
+ * The origin_conn must already be in a transaction using origin_snapshot,
+ * additional origin connections import the same snapshot so every table is
+ * copied as of the same point in time. Each connection pair picks the next
+ * table from the list once it's done with its current one.
+ *
+ * Binary COPY is only safe when the tables on target were created from the
+ * origin's schema, so callers pass binary = true only when they synchronized
+ * the structure themselves and pglogical.sync_binary_copy is on.  Even then
+ * tables that table_binary_copy_safe rejects are copied as text.
+ *
+ * Note that every target connection commits separately.
  */
 static void
-copy_tables_data(const char *origin_dsn, const char *target_dsn,
-				 const char *origin_snapshot, List *tables)
+copy_tables_data_parallel(PGconn *origin_conn, const char *origin_dsn,
+						  const char *target_dsn, const char *origin_snapshot,
+						  List *tables, bool binary)
 {
-	PGconn	   *origin_conn;
-	PGconn	   *target_conn;
-	ListCell   *lc;
+	CopyConnection *conns;
+	struct pollfd  *pollfds;
+	int			   *pollconns;
+	int				nconns;
+	int				nactive = 0;
+	int				i;
+	ListCell	   *next = list_head(tables);
+
+	/* Without exported snapshot the connections would not agree on data. */
+	nconns = origin_snapshot ? pglogical_sync_copy_connections : 1;
+	nconns = Max(Min(nconns, list_length(tables)), 1);
+
+	conns = palloc0(sizeof(CopyConnection) * nconns);
+	pollfds = palloc(sizeof(struct pollfd) * nconns);
+	pollconns = palloc(sizeof(int) * nconns);
+
+	for (i = 0; i < nconns; i++)
+	{
+		/* Connect to origin node. */
+		if (i == 0)
+			conns[i].origin_conn = origin_conn;
+		else
+		{
+			conns[i].origin_conn = pglogical_connect(origin_dsn,
+													 EXTENSION_NAME "_copy");
+			start_copy_origin_tx(conns[i].origin_conn, origin_snapshot);
+		}
 
-	/* Connect to origin node. */
-	origin_conn = pglogical_connect(origin_dsn, EXTENSION_NAME "_copy");
-	start_copy_origin_tx(origin_conn, origin_snapshot);
+		/* Connect to target node. */
+		conns[i].target_conn = pglogical_connect(target_dsn,
+												 EXTENSION_NAME "_copy");
+		start_copy_target_tx(conns[i].target_conn);
+	}
 
-	/* Connect to target node. */
-	target_conn = pglogical_connect(target_dsn, EXTENSION_NAME "_copy");
-	start_copy_target_tx(target_conn);
+	/* Give every connection pair its first table. */
+	for (i = 0; i < nconns && next != NULL; i++)
+	{
+		start_copy_table_data(&conns[i], lfirst(next), binary);
+		next = lnext(next);
+		nactive++;
+	}
 
-	/* Copy every table. */
-	foreach (lc, tables)
+	while (nactive > 0)
 	{
-		RangeVar	*rv = lfirst(lc);
+		int		npoll = 0;
+		int		rc;
 
-		copy_table_data(origin_conn, target_conn,
-						rv->schemaname, rv->relname);
+		for (i = 0; i < nconns; i++)
+		{
+			CopyConnection *conn = &conns[i];
+
+			if (conn->table == NULL)
+				continue;
+
+			/* Table finished, move to next one if any. */
+			if (copy_table_data_step(conn))
+			{
+				if (next != NULL)
+				{
+					start_copy_table_data(conn, lfirst(next), binary);
+					next = lnext(next);
+				}
+				else
+				{
+					nactive--;
+					continue;
+				}
+			}
+
+			pollfds[npoll].fd = PQsocket(conn->origin_conn);
+			pollfds[npoll].events = POLLIN;
+			pollfds[npoll].revents = 0;
+			pollconns[npoll] = i;
+			npoll++;
+		}
 
 		CHECK_FOR_INTERRUPTS();
+
+		if (npoll == 0)
+			continue;
+
+		rc = poll(pollfds, npoll, 1000);
+		if (rc < 0 && errno != EINTR)
+			ereport(ERROR,
+					(errcode_for_socket_access(),
+					 errmsg("poll() failed while copying table data: %m")));
+
+		for (i = 0; i < npoll && rc > 0; i++)
+		{
+			CopyConnection *conn = &conns[pollconns[i]];
+
+			if (pollfds[i].revents == 0)
+				continue;
+
+			if (PQconsumeInput(conn->origin_conn) != 1)
+			{
+				ereport(ERROR,
+						(errmsg("reading from origin table failed"),
+						 errdetail("source connection reported: %s",
+							 PQerrorMessage(conn->origin_conn))));
+			}
+		}
 	}
 
 	/* Finish the transactions and disconnect. */
-	finish_copy_origin_tx(origin_conn);
-	finish_copy_target_tx(target_conn);
+	for (i = 0; i < nconns; i++)
+	{
+		finish_copy_origin_tx(conns[i].origin_conn);
+		finish_copy_target_tx(conns[i].target_conn);
+	}
+
+	pfree(conns);
+	pfree(pollfds);
+	pfree(pollconns);
 }
 
 /*
  * Copy data from origin node to target node.
  *
  * Creates new connection to origin and target.
+ */
+static void
+copy_tables_data(const char *origin_dsn, const char *target_dsn,
+				 const char *origin_snapshot, List *tables, bool binary)
+{
+	PGconn	   *origin_conn;
+
+	/* Connect to origin node. */
+	origin_conn = pglogical_connect(origin_dsn, EXTENSION_NAME "_copy");
+	start_copy_origin_tx(origin_conn, origin_snapshot);
+
+	copy_tables_data_parallel(origin_conn, origin_dsn, target_dsn,
+							  origin_snapshot, tables, binary);
+}
+
+/*
+ * Copy data from origin node to target node.
  *
- * This is basically same as the copy_tables_data, but it can't be easily
- * merged to single function because we need to get list of tables here after
- * the transaction is bound to a snapshot.
+ * Creates new connection to origin and target.
+ *
+ * This is basically same as the copy_tables_data, but we need to get list of
+ * tables here after the transaction is bound to a snapshot.
  */
 static List *
 copy_replication_sets_data(const char *origin_dsn, const char *target_dsn,
-						   const char *origin_snapshot, List *replication_sets)
+						   const char *origin_snapshot, List *replication_sets,
+						   bool binary)
 {
 	PGconn	   *origin_conn;
-	PGconn	   *target_conn;
 	List	   *tables;
-	ListCell   *lc;
 
 	/* Connect to origin node. */
 	origin_conn = pglogical_connect(origin_dsn, EXTENSION_NAME "_copy");
@@ -412,24 +649,8 @@ copy_replication_sets_data(const char *origin_dsn, const char *target_dsn,
 	tables = pg_logical_get_remote_repset_tables(origin_conn,
 												 replication_sets);
 
-	/* Connect to target node. */
-	target_conn = pglogical_connect(target_dsn, EXTENSION_NAME "_copy");
-	start_copy_target_tx(target_conn);
-
-	/* Copy every table. */
-	foreach (lc, tables)
-	{
-		RangeVar	*rv = lfirst(lc);
-
-		copy_table_data(origin_conn, target_conn,
-						rv->schemaname, rv->relname);
-
-		CHECK_FOR_INTERRUPTS();
-	}
-
-	/* Finish the transactions and disconnect. */
-	finish_copy_origin_tx(origin_conn);
-	finish_copy_target_tx(target_conn);
+	copy_tables_data_parallel(origin_conn, origin_dsn, target_dsn,
+							  origin_snapshot, tables, binary);
 
 	return tables;
 }
@@ -580,7 +801,9 @@ pglogical_sync_subscription(PGLogicalSubscription *sub)
 					tables = copy_replication_sets_data(sub->origin_if->dsn,
 														sub->target_if->dsn,
 														snapshot,
-														sub->replication_sets);
+														sub->replication_sets,
+														SyncKindStructure(sync->kind) &&
+														pglogical_sync_binary_copy);
 
 					/* Store info about all the synchronized tables. */
 					StartTransactionCommand();
@@ -708,7 +931,7 @@ pglogical_sync_table(PGLogicalSubscription *sub, RangeVar *table)
 
 		/* Copy data. */
 		copy_tables_data(sub->origin_if->dsn,sub->target_if->dsn, snapshot,
-						 list_make1(table));
+						 list_make1(table), false);
 	}
 	PG_END_ENSURE_ERROR_CLEANUP(pglogical_sync_worker_cleanup_cb,
 								PointerGetDatum(sub));
@@ -76,6 +76,17 @@
  * ----------------------------------------------------------------
  */
 
+/*
+ * Return the size of a varlena datum of any format.  This is
+ * VARSIZE_ANY() as a function, for the benefit of JIT compiled tuple
+ * deforming code, which can't expand macros.
+ */
+Size
+varsize_any(void *p)
+{
+	return VARSIZE_ANY(p);
+}
+
 
 /*
  * heap_compute_data_size
@@ -953,6 +964,91 @@ heap_deform_tuple(HeapTuple tuple, TupleDesc tupleDesc,
 	}
 }
 
+/*
+ * heap_deform_tuple_columns
+ *		Extract the first natts attributes of a tuple into row 'row' of
+ *		column-major values/isnull arrays, that is values[attnum][row].
+ *
+ *		This is heap_deform_tuple for callers deforming a set of tuples into
+ *		per-column arrays, which then can be processed a column at a time.
+ *		natts must not exceed tupleDesc->natts.
+ */
+void
+heap_deform_tuple_columns(HeapTuple tuple, TupleDesc tupleDesc, int natts,
+						  Datum **values, bool **isnull, int row)
+{
+	HeapTupleHeader tup = tuple->t_data;
+	bool		hasnulls = HeapTupleHasNulls(tuple);
+	Form_pg_attribute *att = tupleDesc->attrs;
+	int			tup_natts;		/* number of atts present in tuple */
+	int			attnum;
+	char	   *tp;				/* ptr to tuple data */
+	long		off;			/* offset in tuple data */
+	bits8	   *bp = tup->t_bits;		/* ptr to null bitmap in tuple */
+	bool		slow = false;	/* can we use/set attcacheoff? */
+
+	Assert(natts <= tupleDesc->natts);
+
+	tup_natts = Min(natts, HeapTupleHeaderGetNatts(tup));
+
+	tp = (char *) tup + tup->t_hoff;
+
+	off = 0;
+
+	for (attnum = 0; attnum < tup_natts; attnum++)
+	{
+		Form_pg_attribute thisatt = att[attnum];
+
+		if (hasnulls && att_isnull(attnum, bp))
+		{
+			values[attnum][row] = (Datum) 0;
+			isnull[attnum][row] = true;
+			slow = true;		/* can't use attcacheoff anymore */
+			continue;
+		}
+
+		isnull[attnum][row] = false;
+
+		if (!slow && thisatt->attcacheoff >= 0)
+			off = thisatt->attcacheoff;
+		else if (thisatt->attlen == -1)
+		{
+			/* see heap_deform_tuple */
+			if (!slow &&
+				off == att_align_nominal(off, thisatt->attalign))
+				thisatt->attcacheoff = off;
+			else
+			{
+				off = att_align_pointer(off, thisatt->attalign, -1,
+										tp + off);
+				slow = true;
+			}
+		}
+		else
+		{
+			/* not varlena, so safe to use att_align_nominal */
+			off = att_align_nominal(off, thisatt->attalign);
+
+			if (!slow)
+				thisatt->attcacheoff = off;
+		}
+
+		values[attnum][row] = fetchatt(thisatt, tp + off);
+
+		off = att_addlength_pointer(off, thisatt->attlen, tp + off);
+
+		if (thisatt->attlen <= 0)
+			slow = true;		/* can't use attcacheoff anymore */
+	}
+
+	/* attributes missing from the tuple read as null */
+	for (; attnum < natts; attnum++)
+	{
+		values[attnum][row] = (Datum) 0;
+		isnull[attnum][row] = true;
+	}
+}
+
 /*
  * slot_deform_tuple
  *		Given a TupleTableSlot, extract data from the slot's physical tuple
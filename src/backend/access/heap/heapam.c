@@ -22,6 +22,7 @@
  *		heap_rescan		- restart a relation scan
  *		heap_endscan	- end relation scan
  *		heap_getnext	- retrieve next tuple in scan
+ *		heap_getnextpage - retrieve next page's visible tuples in scan
  *		heap_fetch		- retrieve tuple with given tid
  *		heap_insert		- insert tuple into a relation
  *		heap_multi_insert - insert multiple tuples into a relation
@@ -1806,6 +1807,97 @@ heap_getnext(HeapScanDesc scan, ScanDirection direction)
 	return &(scan->rs_ctup);
 }
 
+/* ----------------
+ *		heap_getnextpage - advance a scan to its next page
+ *
+ *		Reads the next page of a forward, page-at-a-time scan and determines
+ *		the tuples on it that are visible, like heapgettup_pagemode() does
+ *		before returning them one at a time.  On return, scan->rs_cbuf holds
+ *		the page and scan->rs_vistuples[0 .. rs_ntuples - 1] the offsets of
+ *		the visible tuples, which stay valid while the buffer is pinned, that
+ *		is until the next call.  Some pages might have no visible tuples.
+ *
+ *		Returns false once all pages have been read.  Scan keys are not
+ *		supported, and the scan must not be mixed with heap_getnext().
+ * ----------------
+ */
+bool
+heap_getnextpage(HeapScanDesc scan)
+{
+	BlockNumber page;
+	bool		finished;
+
+	Assert(scan->rs_pageatatime);
+	Assert(scan->rs_nkeys == 0);
+
+	if (!scan->rs_inited)
+	{
+		/*
+		 * return false immediately if relation is empty
+		 */
+		if (scan->rs_nblocks == 0 || scan->rs_numblocks == 0)
+		{
+			Assert(!BufferIsValid(scan->rs_cbuf));
+			return false;
+		}
+		if (scan->rs_parallel != NULL)
+		{
+			page = heap_parallelscan_nextpage(scan);
+
+			/* Other processes might have already finished the scan. */
+			if (page == InvalidBlockNumber)
+			{
+				Assert(!BufferIsValid(scan->rs_cbuf));
+				return false;
+			}
+		}
+		else
+			page = scan->rs_startblock; /* first page */
+		scan->rs_inited = true;
+	}
+	else
+	{
+		/* move on from the current page, as heapgettup_pagemode() does */
+		page = scan->rs_cblock;
+		if (scan->rs_parallel != NULL)
+		{
+			page = heap_parallelscan_nextpage(scan);
+			finished = (page == InvalidBlockNumber);
+		}
+		else
+		{
+			page++;
+			if (page >= scan->rs_nblocks)
+				page = 0;
+			finished = (page == scan->rs_startblock) ||
+				(scan->rs_numblocks != InvalidBlockNumber ? --scan->rs_numblocks == 0 : false);
+
+			/* Report our new scan position for synchronization purposes. */
+			if (scan->rs_syncscan)
+				ss_report_location(scan->rs_rd, page);
+		}
+
+		if (finished)
+		{
+			if (BufferIsValid(scan->rs_cbuf))
+				ReleaseBuffer(scan->rs_cbuf);
+			scan->rs_cbuf = InvalidBuffer;
+			scan->rs_cblock = InvalidBlockNumber;
+			scan->rs_inited = false;
+			return false;
+		}
+	}
+
+	heapgetpage(scan, page);
+	TestForOldSnapshot(scan->rs_snapshot, scan->rs_rd,
+					   BufferGetPage(scan->rs_cbuf));
+
+	/* all of the page's visible tuples count as returned */
+	pgstat_count_heap_getnext_multi(scan->rs_rd, scan->rs_ntuples);
+
+	return true;
+}
+
 /*
  *	heap_fetch		- retrieve tuple with given tid
  *
@@ -21,6 +21,7 @@
 #include "commands/prepare.h"
 #include "executor/hashjoin.h"
 #include "foreign/fdwapi.h"
+#include "jit/jit.h"
 #include "nodes/extensible.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/clauses.h"
@@ -100,6 +101,7 @@ static void show_tablesample(TableSampleClause *tsc, PlanState *planstate,
 				 List *ancestors, ExplainState *es);
 static void show_sort_info(SortState *sortstate, ExplainState *es);
 static void show_hash_info(HashState *hashstate, ExplainState *es);
+static void show_hashagg_info(AggState *aggstate, ExplainState *es);
 static void show_tidbitmap_info(BitmapHeapScanState *planstate,
 					ExplainState *es);
 static void show_instrumentation_count(const char *qlabel, int which,
@@ -530,6 +532,10 @@ ExplainOnePlan(PlannedStmt *plannedstmt, IntoClause *into, ExplainState *es,
 	if (es->analyze)
 		ExplainPrintTriggers(es, queryDesc);
 
+	/* Print info about JIT compilation */
+	if (es->analyze)
+		ExplainPrintJIT(es, queryDesc);
+
 	/*
 	 * Close down the query and free resources.  Include time for this in the
 	 * total execution time (although it should be pretty minimal).
@@ -635,6 +641,81 @@ ExplainPrintTriggers(ExplainState *es, QueryDesc *queryDesc)
 	ExplainCloseGroup("Triggers", "Triggers", false, es);
 }
 
+/*
+ * ExplainPrintJIT -
+ *	  append information about JIT compilation of a query to es->str
+ *
+ * Nothing is printed if no code was compiled.  Code compiled in parallel
+ * workers isn't included.
+ */
+void
+ExplainPrintJIT(ExplainState *es, QueryDesc *queryDesc)
+{
+	JitContext *jc = queryDesc->estate->es_jit;
+	double		generation_time;
+	double		optimization_time;
+	double		emission_time;
+	double		total_time;
+
+	if (jc == NULL || jc->instr.created_functions == 0)
+		return;
+
+	generation_time = INSTR_TIME_GET_DOUBLE(jc->instr.generation_counter);
+	optimization_time = INSTR_TIME_GET_DOUBLE(jc->instr.optimization_counter);
+	emission_time = INSTR_TIME_GET_DOUBLE(jc->instr.emission_counter);
+	total_time = generation_time + optimization_time + emission_time;
+
+	ExplainOpenGroup("JIT", "JIT", true, es);
+
+	if (es->format == EXPLAIN_FORMAT_TEXT)
+	{
+		appendStringInfoString(es->str, "JIT:\n");
+		es->indent += 1;
+
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfo(es->str, "Functions: %ld\n",
+						 (long) jc->instr.created_functions);
+
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfo(es->str, "Options: Optimization %s\n",
+						 jc->flags & PGJIT_OPT3 ? "true" : "false");
+
+		if (es->timing)
+		{
+			appendStringInfoSpaces(es->str, es->indent * 2);
+			appendStringInfo(es->str,
+							 "Timing: Generation %.3f ms, Optimization %.3f ms, Emission %.3f ms, Total %.3f ms\n",
+							 1000.0 * generation_time,
+							 1000.0 * optimization_time,
+							 1000.0 * emission_time,
+							 1000.0 * total_time);
+		}
+
+		es->indent -= 1;
+	}
+	else
+	{
+		ExplainPropertyLong("Functions", (long) jc->instr.created_functions,
+							es);
+		ExplainPropertyBool("Optimization", (jc->flags & PGJIT_OPT3) != 0,
+							es);
+
+		if (es->timing)
+		{
+			ExplainOpenGroup("Timing", "Timing", true, es);
+			ExplainPropertyFloat("Generation", 1000.0 * generation_time,
+								 3, es);
+			ExplainPropertyFloat("Optimization", 1000.0 * optimization_time,
+								 3, es);
+			ExplainPropertyFloat("Emission", 1000.0 * emission_time, 3, es);
+			ExplainPropertyFloat("Total", 1000.0 * total_time, 3, es);
+			ExplainCloseGroup("Timing", "Timing", true, es);
+		}
+	}
+
+	ExplainCloseGroup("JIT", "JIT", true, es);
+}
+
 /*
  * ExplainQueryText -
  *	  add a "Query Text" node that contains the actual text of the query
@@ -1469,6 +1550,9 @@ ExplainNode(PlanState *planstate, List *ancestors,
 			if (plan->qual)
 				show_instrumentation_count("Rows Removed by Filter", 1,
 										   planstate, es);
+			show_hashagg_info((AggState *) planstate, es);
+			if (((AggState *) planstate)->batch_mode)
+				ExplainPropertyText("Batch Mode", "on", es);
 			break;
 		case T_Group:
 			show_group_keys((GroupState *) planstate, ancestors, es);
@@ -2228,6 +2312,39 @@ show_hash_info(HashState *hashstate, ExplainState *es)
 	}
 }
 
+/*
+ * If it's EXPLAIN ANALYZE, show memory and disk usage of a hash aggregation.
+ * In text format, this is only shown if the hash table had to spill.
+ */
+static void
+show_hashagg_info(AggState *aggstate, ExplainState *es)
+{
+	Agg		   *agg = (Agg *) aggstate->ss.ps.plan;
+	long		memPeakKb = (aggstate->hash_mem_peak + 1023) / 1024;
+	long		diskKb = aggstate->hash_disk_used * (BLCKSZ / 1024);
+
+	if (!es->analyze || agg->aggstrategy != AGG_HASHED ||
+		aggstate->hash_batches_used == 0)
+		return;
+
+	if (es->format != EXPLAIN_FORMAT_TEXT)
+	{
+		ExplainPropertyLong("HashAgg Batches", aggstate->hash_batches_used, es);
+		ExplainPropertyInteger("Partition Levels", aggstate->hash_spill_levels,
+							   es);
+		ExplainPropertyLong("Peak Memory Usage", memPeakKb, es);
+		ExplainPropertyLong("Disk Usage", diskKb, es);
+	}
+	else if (aggstate->hash_batches_used > 1)
+	{
+		appendStringInfoSpaces(es->str, es->indent * 2);
+		appendStringInfo(es->str,
+						 "Batches: %d  Partition Levels: %d  Memory Usage: %ldkB  Disk Usage: %ldkB\n",
+						 aggstate->hash_batches_used,
+						 aggstate->hash_spill_levels, memPeakKb, diskKb);
+	}
+}
+
 /*
  * If it's EXPLAIN ANALYZE, show exact/lossy pages for a BitmapHeapScan node
  */
@@ -0,0 +1,444 @@
+/*-------------------------------------------------------------------------
+ *
+ * execBatch.c
+ *	  Support for executing plan nodes a batch of tuples at a time.
+ *
+ * Normally every node returns one tuple per ExecProcNode call, which costs
+ * a chain of function calls, a slot store and a qual evaluation per row.
+ * When batch_execution is enabled, a parent node may instead ask a child
+ * that supports it for a TupleBatch at a time (see ExecInitNodeBatch and
+ * ExecProcNodeBatch): a set of tuples deformed into per-column arrays, plus
+ * a selection vector of the rows that passed the child's qual.  The parent
+ * then processes the batch a column at a time.  Currently sequential scans
+ * produce batches, one per heap page, and plain aggregation consumes them.
+ * All other nodes, and plans these nodes can't handle in batches, keep
+ * running a tuple at a time.
+ *
+ * Scan quals are evaluated over a batch one clause at a time, each clause
+ * narrowing the selection vector.  Only clauses of the form "Var op Const"
+ * with a strict operator, whose operands have exactly the operator's input
+ * types, are supported.  Comparisons of int4 and int8 columns are specialized
+ * into tight loops without function calls or data dependent branches, which
+ * the compiler can unroll and vectorize.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/executor/execBatch.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "catalog/objectaccess.h"
+#include "catalog/pg_type.h"
+#include "executor/execBatch.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "pgstat.h"
+#include "utils/acl.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+
+
+/* GUC */
+bool		batch_execution = false;
+
+/* comparisons evaluated without calling the operator's function */
+typedef enum BatchCompare
+{
+	BATCH_CMP_NONE,				/* call the function */
+	BATCH_CMP_EQ,
+	BATCH_CMP_NE,
+	BATCH_CMP_LT,
+	BATCH_CMP_LE,
+	BATCH_CMP_GT,
+	BATCH_CMP_GE
+} BatchCompare;
+
+typedef struct BatchCompareFunc
+{
+	Oid			funcid;
+	BatchCompare cmp;
+	bool		is_int8;		/* else int4 */
+} BatchCompareFunc;
+
+static const BatchCompareFunc batch_compare_funcs[] =
+{
+	{F_INT4EQ, BATCH_CMP_EQ, false},
+	{F_INT4NE, BATCH_CMP_NE, false},
+	{F_INT4LT, BATCH_CMP_LT, false},
+	{F_INT4LE, BATCH_CMP_LE, false},
+	{F_INT4GT, BATCH_CMP_GT, false},
+	{F_INT4GE, BATCH_CMP_GE, false},
+	{F_INT8EQ, BATCH_CMP_EQ, true},
+	{F_INT8NE, BATCH_CMP_NE, true},
+	{F_INT8LT, BATCH_CMP_LT, true},
+	{F_INT8LE, BATCH_CMP_LE, true},
+	{F_INT8GT, BATCH_CMP_GT, true},
+	{F_INT8GE, BATCH_CMP_GE, true}
+};
+
+/* one "Var op Const" clause of a BatchQual */
+typedef struct BatchQualClause
+{
+	int			attnum;			/* zero-based column of the Var */
+	BatchCompare cmp;			/* specialized comparison, if any */
+	bool		is_int8;		/* does cmp compare int8s? */
+	FmgrInfo	finfo;			/* the operator's function */
+	FunctionCallInfoData fcinfo;	/* with the Const as second argument */
+} BatchQualClause;
+
+struct BatchQual
+{
+	int			nclauses;
+	bool		checked;		/* have function permissions been checked? */
+	BatchQualClause clauses[FLEXIBLE_ARRAY_MEMBER];
+};
+
+static void batch_qual_check_permissions(BatchQual *bqual);
+static void batch_qual_compare(BatchQualClause *clause, TupleBatch *batch);
+static void batch_qual_call(BatchQualClause *clause, TupleBatch *batch);
+
+
+/*
+ * Create a batch holding up to maxrows tuples, of which the first natts
+ * columns are deformed.  The batch lives in the current memory context.
+ */
+TupleBatch *
+ExecCreateTupleBatch(TupleDesc tupdesc, int natts, int maxrows)
+{
+	TupleBatch *batch;
+	int			attnum;
+
+	Assert(natts <= tupdesc->natts);
+
+	batch = (TupleBatch *) palloc0(sizeof(TupleBatch));
+	batch->tupdesc = tupdesc;
+	batch->natts = natts;
+	batch->maxrows = maxrows;
+	batch->values = (Datum **) palloc(natts * sizeof(Datum *));
+	batch->isnull = (bool **) palloc(natts * sizeof(bool *));
+	for (attnum = 0; attnum < natts; attnum++)
+	{
+		batch->values[attnum] = (Datum *) palloc(maxrows * sizeof(Datum));
+		batch->isnull[attnum] = (bool *) palloc(maxrows * sizeof(bool));
+	}
+	batch->sel = (int *) palloc(maxrows * sizeof(int));
+
+	return batch;
+}
+
+/*
+ * Deform a tuple into the next row of a batch.  By-reference values point
+ * into the tuple, which the caller must keep around as long as the batch.
+ */
+void
+ExecBatchStoreTuple(TupleBatch *batch, HeapTuple tuple)
+{
+	Assert(batch->nrows < batch->maxrows);
+
+	if (batch->natts > 0)
+		heap_deform_tuple_columns(tuple, batch->tupdesc, batch->natts,
+								  batch->values, batch->isnull, batch->nrows);
+	batch->nrows++;
+}
+
+/*
+ * Select all rows of a batch.
+ */
+void
+ExecBatchSelectAll(TupleBatch *batch)
+{
+	int			i;
+
+	for (i = 0; i < batch->nrows; i++)
+		batch->sel[i] = i;
+	batch->nsel = batch->nrows;
+}
+
+/*
+ * Prepare a scan qual, in implicit-AND list form, for evaluation over
+ * batches of the tuples of relation scanrelid.  *natts is raised to cover
+ * the columns the qual references.
+ *
+ * Returns NULL if the qual contains anything not supported here, in which
+ * case the scan has to be run a tuple at a time.
+ */
+BatchQual *
+ExecInitBatchQual(List *qual, Index scanrelid, int *natts)
+{
+	BatchQual  *bqual;
+	int			maxatt = *natts;
+	int			clauseno;
+	ListCell   *lc;
+
+	bqual = (BatchQual *) palloc0(offsetof(BatchQual, clauses) +
+								  list_length(qual) * sizeof(BatchQualClause));
+	bqual->nclauses = list_length(qual);
+	bqual->checked = false;
+
+	clauseno = 0;
+	foreach(lc, qual)
+	{
+		BatchQualClause *clause = &bqual->clauses[clauseno++];
+		OpExpr	   *op = (OpExpr *) lfirst(lc);
+		Expr	   *arg1;
+		Expr	   *arg2;
+		Var		   *var;
+		Const	   *con;
+		Oid			lefttype;
+		Oid			righttype;
+		int			i;
+
+		if (!IsA(op, OpExpr) || list_length(op->args) != 2 || op->opretset)
+			return NULL;
+
+		arg1 = (Expr *) linitial(op->args);
+		arg2 = (Expr *) lsecond(op->args);
+		while (IsA(arg1, RelabelType))
+			arg1 = ((RelabelType *) arg1)->arg;
+		while (IsA(arg2, RelabelType))
+			arg2 = ((RelabelType *) arg2)->arg;
+		if (!IsA(arg1, Var) || !IsA(arg2, Const))
+			return NULL;
+		var = (Var *) arg1;
+		con = (Const *) arg2;
+		if (var->varno != scanrelid || var->varattno <= 0 ||
+			var->varlevelsup != 0)
+			return NULL;
+
+		/*
+		 * The values are passed to the function as they are, so insist on
+		 * the operator's own input types rather than trusting relabeling or
+		 * polymorphism to be representation-compatible.
+		 */
+		op_input_types(op->opno, &lefttype, &righttype);
+		if (var->vartype != lefttype || con->consttype != righttype)
+			return NULL;
+
+		set_opfuncid(op);
+		fmgr_info(op->opfuncid, &clause->finfo);
+		fmgr_info_set_expr((Node *) op, &clause->finfo);
+
+		/*
+		 * Rows whose Var is NULL are rejected without calling the function,
+		 * which is only right for strict ones.  Calls tracked by
+		 * track_functions are left to the tuple-at-a-time path.
+		 */
+		if (!clause->finfo.fn_strict ||
+			pgstat_track_functions > clause->finfo.fn_stats)
+			return NULL;
+
+		InitFunctionCallInfoData(clause->fcinfo, &clause->finfo, 2,
+								 op->inputcollid, NULL, NULL);
+		clause->fcinfo.arg[1] = con->constvalue;
+		clause->fcinfo.argnull[1] = con->constisnull;
+
+		clause->attnum = var->varattno - 1;
+		maxatt = Max(maxatt, var->varattno);
+
+		clause->cmp = BATCH_CMP_NONE;
+		for (i = 0; i < lengthof(batch_compare_funcs); i++)
+		{
+			Oid			typid = batch_compare_funcs[i].is_int8 ? INT8OID : INT4OID;
+
+			if (batch_compare_funcs[i].funcid == op->opfuncid &&
+				var->vartype == typid && con->consttype == typid)
+			{
+				clause->cmp = batch_compare_funcs[i].cmp;
+				clause->is_int8 = batch_compare_funcs[i].is_int8;
+				break;
+			}
+		}
+	}
+
+	*natts = maxatt;
+
+	return bqual;
+}
+
+/*
+ * Evaluate a BatchQual over the selected rows of a batch, removing those
+ * for which it isn't true from the selection vector.
+ *
+ * Functions are called in the current memory context, which the caller
+ * should reset for every batch.
+ */
+void
+ExecBatchQual(BatchQual *bqual, TupleBatch *batch)
+{
+	int			clauseno;
+
+	if (!bqual->checked)
+	{
+		batch_qual_check_permissions(bqual);
+		bqual->checked = true;
+	}
+
+	for (clauseno = 0; clauseno < bqual->nclauses; clauseno++)
+	{
+		BatchQualClause *clause = &bqual->clauses[clauseno];
+
+		if (batch->nsel == 0)
+			break;
+
+		/* a strict operator never returns true for a NULL constant */
+		if (clause->fcinfo.argnull[1])
+			batch->nsel = 0;
+		else if (clause->cmp != BATCH_CMP_NONE)
+			batch_qual_compare(clause, batch);
+		else
+			batch_qual_call(clause, batch);
+	}
+}
+
+/*
+ * Check permission to call the functions of a BatchQual, as the first
+ * evaluation of an expression would.
+ */
+static void
+batch_qual_check_permissions(BatchQual *bqual)
+{
+	int			clauseno;
+
+	for (clauseno = 0; clauseno < bqual->nclauses; clauseno++)
+	{
+		Oid			funcid = bqual->clauses[clauseno].finfo.fn_oid;
+		AclResult	aclresult;
+
+		aclresult = pg_proc_aclcheck(funcid, GetUserId(), ACL_EXECUTE);
+		if (aclresult != ACLCHECK_OK)
+			aclcheck_error(aclresult, ACL_KIND_PROC, get_func_name(funcid));
+		InvokeFunctionExecuteHook(funcid);
+	}
+}
+
+/*
+ * Narrow the selection vector to the rows whose value is not NULL and
+ * satisfies 'test'.  Every row is written to the next output position, which
+ * is only advanced if the row qualifies, so there's no branch depending on
+ * the data.
+ */
+#define BATCH_FILTER(test) \
+	do { \
+		for (i = 0; i < nsel; i++) \
+		{ \
+			int			row = sel[i]; \
+			\
+			sel[n] = row; \
+			n += (!isnull[row]) & (test); \
+		} \
+	} while (0)
+
+/*
+ * Evaluate a specialized comparison clause.
+ */
+static void
+batch_qual_compare(BatchQualClause *clause, TupleBatch *batch)
+{
+	Datum	   *values = batch->values[clause->attnum];
+	bool	   *isnull = batch->isnull[clause->attnum];
+	int		   *sel = batch->sel;
+	int			nsel = batch->nsel;
+	int			n = 0;
+	int			i;
+
+	if (clause->is_int8)
+	{
+		int64		c = DatumGetInt64(clause->fcinfo.arg[1]);
+
+		switch (clause->cmp)
+		{
+			case BATCH_CMP_EQ:
+				BATCH_FILTER(DatumGetInt64(values[row]) == c);
+				break;
+			case BATCH_CMP_NE:
+				BATCH_FILTER(DatumGetInt64(values[row]) != c);
+				break;
+			case BATCH_CMP_LT:
+				BATCH_FILTER(DatumGetInt64(values[row]) < c);
+				break;
+			case BATCH_CMP_LE:
+				BATCH_FILTER(DatumGetInt64(values[row]) <= c);
+				break;
+			case BATCH_CMP_GT:
+				BATCH_FILTER(DatumGetInt64(values[row]) > c);
+				break;
+			case BATCH_CMP_GE:
+				BATCH_FILTER(DatumGetInt64(values[row]) >= c);
+				break;
+			case BATCH_CMP_NONE:
+				elog(ERROR, "unexpected batch comparison");
+				break;
+		}
+	}
+	else
+	{
+		int32		c = DatumGetInt32(clause->fcinfo.arg[1]);
+
+		switch (clause->cmp)
+		{
+			case BATCH_CMP_EQ:
+				BATCH_FILTER(DatumGetInt32(values[row]) == c);
+				break;
+			case BATCH_CMP_NE:
+				BATCH_FILTER(DatumGetInt32(values[row]) != c);
+				break;
+			case BATCH_CMP_LT:
+				BATCH_FILTER(DatumGetInt32(values[row]) < c);
+				break;
+			case BATCH_CMP_LE:
+				BATCH_FILTER(DatumGetInt32(values[row]) <= c);
+				break;
+			case BATCH_CMP_GT:
+				BATCH_FILTER(DatumGetInt32(values[row]) > c);
+				break;
+			case BATCH_CMP_GE:
+				BATCH_FILTER(DatumGetInt32(values[row]) >= c);
+				break;
+			case BATCH_CMP_NONE:
+				elog(ERROR, "unexpected batch comparison");
+				break;
+		}
+	}
+
+	batch->nsel = n;
+}
+
+/*
+ * Evaluate a clause by calling its function for each selected row.
+ */
+static void
+batch_qual_call(BatchQualClause *clause, TupleBatch *batch)
+{
+	Datum	   *values = batch->values[clause->attnum];
+	bool	   *isnull = batch->isnull[clause->attnum];
+	FunctionCallInfo fcinfo = &clause->fcinfo;
+	int		   *sel = batch->sel;
+	int			nsel = batch->nsel;
+	int			n = 0;
+	int			i;
+
+	for (i = 0; i < nsel; i++)
+	{
+		int			row = sel[i];
+		Datum		result;
+
+		if (isnull[row])
+			continue;
+
+		fcinfo->arg[0] = values[row];
+		fcinfo->argnull[0] = false;
+		fcinfo->isnull = false;
+		result = FunctionCallInvoke(fcinfo);
+		if (!fcinfo->isnull && DatumGetBool(result))
+			sel[n++] = row;
+	}
+
+	batch->nsel = n;
+}
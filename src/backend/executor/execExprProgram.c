@@ -0,0 +1,1122 @@
+/*-------------------------------------------------------------------------
+ *
+ * execExprProgram.c
+ *	  Compile expressions into flat step programs, and evaluate them.
+ *
+ * ExecInitExpr normally turns an expression into a tree of ExprState
+ * nodes, each evaluated by a recursive call through its evalfunc, with
+ * set-returning-function bookkeeping at every level.  For the simple
+ * expressions that make up most scan and join quals and many projections,
+ * that overhead dominates the actual work.  So for expressions built only
+ * from the node types supported here, we instead emit a linear array of
+ * steps, which a single interpreter loop runs without recursion:
+ *
+ * - Each step stores its result directly where it is consumed, usually an
+ *	 argument slot of a later function call step, so no intermediate
+ *	 results are passed around.  Constant arguments are stored into the
+ *	 call's argument array once, when the program is built.
+ *
+ * - The input tuples are deformed by one step per slot at the start of the
+ *	 program, up to the highest attribute referenced, after which Vars are
+ *	 simple array fetches.
+ *
+ * - Common shapes get specialized steps, such as a strict operator applied
+ *	 to a scan Var and a Const, which is what most scan quals look like.
+ *
+ * - AND and OR short-circuit by jumping to the end of their arguments.
+ *
+ * - Where the compiler supports it, steps are direct-threaded: each step
+ *	 holds the address of the code implementing it, and dispatch is a
+ *	 computed goto rather than a switch.
+ *
+ * - If the planner decided the query is worth it, the program is handed to
+ *	 the JIT provider on first evaluation, to be compiled to native code;
+ *	 see jit/jit.c.  The steps are then just a description of the code.
+ *
+ * Expressions containing anything else keep using the ExprState tree, so
+ * nothing about the execution of unsupported constructs changes; their
+ * supported subexpressions are still compiled on their own, though.  None
+ * of the supported node types can return a set.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/executor/execExprProgram.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "catalog/objectaccess.h"
+#include "executor/execExprProgram.h"
+#include "executor/executor.h"
+#include "jit/jit.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "pgstat.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+
+
+/*
+ * Use computed goto for dispatch if the compiler supports it (GCC and
+ * compatibles do), otherwise fall back to a switch statement.
+ */
+#if defined(__GNUC__)
+#define EP_USE_COMPUTED_GOTO
+#endif
+
+#ifdef EP_USE_COMPUTED_GOTO
+#define EP_SWITCH()
+#define EP_CASE(name)		CASE_##name:
+#define EP_DISPATCH()		goto *((void *) op->opcode)
+#else
+#define EP_SWITCH()			starteval: switch ((ExprProgramOp) op->opcode)
+#define EP_CASE(name)		case name:
+#define EP_DISPATCH()		goto starteval
+#endif
+
+/* advance to the next step, or to step number stepno */
+#define EP_NEXT() \
+	do { \
+		op++; \
+		EP_DISPATCH(); \
+	} while (0)
+
+#define EP_JUMP(stepno) \
+	do { \
+		op = &state->steps[stepno]; \
+		EP_DISPATCH(); \
+	} while (0)
+
+/* working state while building a program */
+typedef struct ExprProgramBuild
+{
+	ExprProgramStep *steps;		/* steps emitted so far */
+	int			nsteps;			/* number of steps emitted */
+	int			steps_alloc;	/* allocated length of steps */
+	AttrNumber	last_scan;		/* highest attribute used of each slot */
+	AttrNumber	last_inner;
+	AttrNumber	last_outer;
+} ExprProgramBuild;
+
+static bool expr_program_supported(Node *node);
+static bool expr_program_last_attnums(Node *node, ExprProgramBuild *build);
+static ExprProgramStep *expr_program_new_step(ExprProgramBuild *build,
+					  ExprProgramOp opcode, Datum *resv, bool *resn);
+static void expr_program_compile(ExprProgramBuild *build, Expr *node,
+					 Datum *resv, bool *resn);
+static void expr_program_compile_func(ExprProgramBuild *build, Expr *node,
+						  Oid funcid, Oid inputcollid, List *args,
+						  Datum *resv, bool *resn);
+static void expr_program_compile_bool(ExprProgramBuild *build,
+						  BoolExpr *boolexpr, Datum *resv, bool *resn);
+static Datum ExecEvalProgramFirst(ExprProgramState *state,
+					 ExprContext *econtext,
+					 bool *isNull, ExprDoneCond *isDone);
+static Datum ExecEvalProgram(ExprProgramState *state, ExprContext *econtext,
+				bool *isNull, ExprDoneCond *isDone);
+static void CheckProgramVar(TupleTableSlot *slot, int attnum, Oid vartype);
+static Datum ExecInterpProgram(ExprProgramState *state, ExprContext *econtext,
+				  bool *isNull);
+
+
+/* ----------------------------------------------------------------
+ *		ExecCompileExpr
+ *
+ *		Compile an expression into an ExprProgramState, if all of it is
+ *		supported by the step interpreter.  Returns NULL if it isn't, in
+ *		which case the caller should build an ExprState tree as usual.
+ *
+ *		Lone Vars and Consts are left to ExecInitExpr, since their
+ *		evalfuncs are as cheap as a program would be.
+ * ----------------------------------------------------------------
+ */
+ExprState *
+ExecCompileExpr(Expr *node)
+{
+	ExprProgramState *state;
+	ExprProgramBuild build;
+
+	switch (nodeTag(node))
+	{
+		case T_FuncExpr:
+		case T_OpExpr:
+		case T_BoolExpr:
+		case T_NullTest:
+		case T_BooleanTest:
+			break;
+		default:
+			return NULL;
+	}
+
+	if (!expr_program_supported((Node *) node))
+		return NULL;
+
+	state = makeNode(ExprProgramState);
+	state->xprstate.expr = node;
+	state->xprstate.evalfunc = (ExprStateEvalFunc) ExecEvalProgramFirst;
+
+	build.steps_alloc = 16;
+	build.steps = (ExprProgramStep *)
+		palloc(build.steps_alloc * sizeof(ExprProgramStep));
+	build.nsteps = 0;
+	build.last_scan = 0;
+	build.last_inner = 0;
+	build.last_outer = 0;
+
+	/* deform each input tuple just once, as far as needed */
+	expr_program_last_attnums((Node *) node, &build);
+	if (build.last_scan > 0)
+		expr_program_new_step(&build, EPOP_SCAN_FETCHSOME, NULL, NULL)
+			->d.fetch.last = build.last_scan;
+	if (build.last_inner > 0)
+		expr_program_new_step(&build, EPOP_INNER_FETCHSOME, NULL, NULL)
+			->d.fetch.last = build.last_inner;
+	if (build.last_outer > 0)
+		expr_program_new_step(&build, EPOP_OUTER_FETCHSOME, NULL, NULL)
+			->d.fetch.last = build.last_outer;
+
+	expr_program_compile(&build, node, &state->resvalue, &state->resnull);
+	expr_program_new_step(&build, EPOP_DONE, NULL, NULL);
+
+	state->steps = build.steps;
+	state->nsteps = build.nsteps;
+
+	return (ExprState *) state;
+}
+
+/*
+ * Can the step interpreter evaluate this expression?
+ *
+ * Notably, Params and system columns aren't supported.  Among other things
+ * that keeps the testexprs of hashed SubPlans and the TID quals of TidScans,
+ * which nodeSubplan.c and nodeTidscan.c take apart, in the form of ExprState
+ * trees.
+ */
+static bool
+expr_program_supported(Node *node)
+{
+	ListCell   *lc;
+
+	if (node == NULL)
+		return false;
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+			/* only user attributes; not whole-row or system columns */
+			return ((Var *) node)->varattno > 0;
+
+		case T_Const:
+			return true;
+
+		case T_FuncExpr:
+			{
+				FuncExpr   *func = (FuncExpr *) node;
+
+				if (func->funcretset ||
+					list_length(func->args) > FUNC_MAX_ARGS)
+					return false;
+				foreach(lc, func->args)
+				{
+					if (!expr_program_supported(lfirst(lc)))
+						return false;
+				}
+				return true;
+			}
+
+		case T_OpExpr:
+			{
+				OpExpr	   *op = (OpExpr *) node;
+
+				if (op->opretset || !OidIsValid(op->opfuncid) ||
+					list_length(op->args) > FUNC_MAX_ARGS)
+					return false;
+				foreach(lc, op->args)
+				{
+					if (!expr_program_supported(lfirst(lc)))
+						return false;
+				}
+				return true;
+			}
+
+		case T_BoolExpr:
+			{
+				BoolExpr   *boolexpr = (BoolExpr *) node;
+
+				if (boolexpr->args == NIL)
+					return false;
+				foreach(lc, boolexpr->args)
+				{
+					if (!expr_program_supported(lfirst(lc)))
+						return false;
+				}
+				return true;
+			}
+
+		case T_NullTest:
+			/* field-by-field tests of rows aren't supported */
+			if (((NullTest *) node)->argisrow)
+				return false;
+			return expr_program_supported((Node *) ((NullTest *) node)->arg);
+
+		case T_BooleanTest:
+			return expr_program_supported((Node *) ((BooleanTest *) node)->arg);
+
+		case T_RelabelType:
+			return expr_program_supported((Node *) ((RelabelType *) node)->arg);
+
+		default:
+			return false;
+	}
+}
+
+/*
+ * Find the highest attribute number referenced in each input slot.
+ */
+static bool
+expr_program_last_attnums(Node *node, ExprProgramBuild *build)
+{
+	if (node == NULL)
+		return false;
+	if (IsA(node, Var))
+	{
+		Var		   *variable = (Var *) node;
+		AttrNumber	attnum = variable->varattno;
+
+		switch (variable->varno)
+		{
+			case INNER_VAR:
+				build->last_inner = Max(build->last_inner, attnum);
+				break;
+
+			case OUTER_VAR:
+				build->last_outer = Max(build->last_outer, attnum);
+				break;
+
+				/* INDEX_VAR is handled by default case */
+
+			default:
+				build->last_scan = Max(build->last_scan, attnum);
+				break;
+		}
+		return false;
+	}
+	return expression_tree_walker(node, expr_program_last_attnums,
+								  (void *) build);
+}
+
+/*
+ * Append a step to the program.  The returned pointer is only valid until
+ * the next step is added.
+ */
+static ExprProgramStep *
+expr_program_new_step(ExprProgramBuild *build, ExprProgramOp opcode,
+					  Datum *resv, bool *resn)
+{
+	ExprProgramStep *step;
+
+	if (build->nsteps >= build->steps_alloc)
+	{
+		build->steps_alloc *= 2;
+		build->steps = (ExprProgramStep *)
+			repalloc(build->steps,
+					 build->steps_alloc * sizeof(ExprProgramStep));
+	}
+
+	step = &build->steps[build->nsteps++];
+	memset(step, 0, sizeof(ExprProgramStep));
+	step->opcode = opcode;
+	step->resvalue = resv;
+	step->resnull = resn;
+
+	return step;
+}
+
+static Expr *
+strip_relabel(Expr *node)
+{
+	/* RelabelType is a no-op at runtime */
+	while (IsA(node, RelabelType))
+		node = ((RelabelType *) node)->arg;
+	return node;
+}
+
+/*
+ * Emit the steps computing an expression into *resv and *resn.
+ */
+static void
+expr_program_compile(ExprProgramBuild *build, Expr *node,
+					 Datum *resv, bool *resn)
+{
+	ExprProgramStep *step;
+
+	/* Guard against stack overflow due to overly complex expressions */
+	check_stack_depth();
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+			{
+				Var		   *variable = (Var *) node;
+				ExprProgramOp opcode;
+
+				switch (variable->varno)
+				{
+					case INNER_VAR:
+						opcode = EPOP_INNER_VAR;
+						break;
+					case OUTER_VAR:
+						opcode = EPOP_OUTER_VAR;
+						break;
+					default:
+						opcode = EPOP_SCAN_VAR;
+						break;
+				}
+				step = expr_program_new_step(build, opcode, resv, resn);
+				step->d.var.attnum = variable->varattno - 1;
+				step->d.var.vartype = variable->vartype;
+				break;
+			}
+
+		case T_Const:
+			{
+				Const	   *con = (Const *) node;
+
+				step = expr_program_new_step(build, EPOP_CONST, resv, resn);
+				step->d.constval.value = con->constvalue;
+				step->d.constval.isnull = con->constisnull;
+				break;
+			}
+
+		case T_FuncExpr:
+			{
+				FuncExpr   *func = (FuncExpr *) node;
+
+				expr_program_compile_func(build, node, func->funcid,
+										  func->inputcollid, func->args,
+										  resv, resn);
+				break;
+			}
+
+		case T_OpExpr:
+			{
+				OpExpr	   *op = (OpExpr *) node;
+
+				expr_program_compile_func(build, node, op->opfuncid,
+										  op->inputcollid, op->args,
+										  resv, resn);
+				break;
+			}
+
+		case T_BoolExpr:
+			{
+				BoolExpr   *boolexpr = (BoolExpr *) node;
+
+				if (boolexpr->boolop == NOT_EXPR)
+				{
+					Assert(list_length(boolexpr->args) == 1);
+					expr_program_compile(build, linitial(boolexpr->args),
+										 resv, resn);
+					expr_program_new_step(build, EPOP_BOOL_NOT, resv, resn);
+				}
+				else
+					expr_program_compile_bool(build, boolexpr, resv, resn);
+				break;
+			}
+
+		case T_NullTest:
+			{
+				NullTest   *ntest = (NullTest *) node;
+
+				expr_program_compile(build, ntest->arg, resv, resn);
+				if (ntest->nulltesttype == IS_NULL)
+					expr_program_new_step(build, EPOP_NULLTEST_ISNULL,
+										  resv, resn);
+				else
+					expr_program_new_step(build, EPOP_NULLTEST_ISNOTNULL,
+										  resv, resn);
+				break;
+			}
+
+		case T_BooleanTest:
+			{
+				BooleanTest *btest = (BooleanTest *) node;
+				ExprProgramOp opcode;
+
+				switch (btest->booltesttype)
+				{
+					case IS_TRUE:
+						opcode = EPOP_BOOLTEST_IS_TRUE;
+						break;
+					case IS_NOT_TRUE:
+						opcode = EPOP_BOOLTEST_IS_NOT_TRUE;
+						break;
+					case IS_FALSE:
+						opcode = EPOP_BOOLTEST_IS_FALSE;
+						break;
+					case IS_NOT_FALSE:
+						opcode = EPOP_BOOLTEST_IS_NOT_FALSE;
+						break;
+					case IS_UNKNOWN:
+						opcode = EPOP_NULLTEST_ISNULL;
+						break;
+					case IS_NOT_UNKNOWN:
+						opcode = EPOP_NULLTEST_ISNOTNULL;
+						break;
+					default:
+						elog(ERROR, "unrecognized booltesttype: %d",
+							 (int) btest->booltesttype);
+						opcode = EPOP_DONE;		/* keep compiler quiet */
+						break;
+				}
+				expr_program_compile(build, btest->arg, resv, resn);
+				expr_program_new_step(build, opcode, resv, resn);
+				break;
+			}
+
+		case T_RelabelType:
+			expr_program_compile(build, ((RelabelType *) node)->arg,
+								 resv, resn);
+			break;
+
+		default:
+			elog(ERROR, "unrecognized node type: %d",
+				 (int) nodeTag(node));
+			break;
+	}
+}
+
+/*
+ * Emit the steps for a function or operator call.
+ *
+ * Permission to call the function is checked when the program is first
+ * run, as the ExprState tree would, so merely initializing a plan (e.g.
+ * for EXPLAIN) doesn't require it.
+ */
+static void
+expr_program_compile_func(ExprProgramBuild *build, Expr *node,
+						  Oid funcid, Oid inputcollid, List *args,
+						  Datum *resv, bool *resn)
+{
+	int			nargs = list_length(args);
+	FmgrInfo   *finfo;
+	FunctionCallInfo fcinfo;
+	ExprProgramStep *step;
+	ExprProgramOp opcode;
+	Var		   *scanvar = NULL;
+	ListCell   *lc;
+	int			argno;
+
+	finfo = (FmgrInfo *) palloc0(sizeof(FmgrInfo));
+	fcinfo = (FunctionCallInfo) palloc0(sizeof(FunctionCallInfoData));
+	fmgr_info(funcid, finfo);
+	fmgr_info_set_expr((Node *) node, finfo);
+	InitFunctionCallInfoData(*fcinfo, finfo, nargs, inputcollid, NULL, NULL);
+
+	/*
+	 * A strict operator comparing a column of the scanned relation with a
+	 * constant gets a step of its own, which reads the column directly.
+	 */
+	if (nargs == 2 && finfo->fn_strict &&
+		pgstat_track_functions <= finfo->fn_stats)
+	{
+		Expr	   *arg1 = strip_relabel((Expr *) linitial(args));
+		Expr	   *arg2 = strip_relabel((Expr *) lsecond(args));
+
+		if (IsA(arg1, Var) && IsA(arg2, Const) &&
+			((Var *) arg1)->varno != INNER_VAR &&
+			((Var *) arg1)->varno != OUTER_VAR)
+			scanvar = (Var *) arg1;
+	}
+
+	/*
+	 * Store constant arguments once and for all; compute the others into
+	 * the argument array, ahead of the call.
+	 */
+	argno = 0;
+	foreach(lc, args)
+	{
+		Expr	   *arg = strip_relabel((Expr *) lfirst(lc));
+
+		if (IsA(arg, Const))
+		{
+			fcinfo->arg[argno] = ((Const *) arg)->constvalue;
+			fcinfo->argnull[argno] = ((Const *) arg)->constisnull;
+		}
+		else if (argno != 0 || scanvar == NULL)
+			expr_program_compile(build, arg,
+								 &fcinfo->arg[argno], &fcinfo->argnull[argno]);
+		argno++;
+	}
+
+	if (pgstat_track_functions > finfo->fn_stats)
+		opcode = EPOP_FUNC_FUSAGE;
+	else if (scanvar != NULL)
+		opcode = EPOP_FUNC_STRICT_VAR_CONST;
+	else if (finfo->fn_strict)
+		opcode = EPOP_FUNC_STRICT;
+	else
+		opcode = EPOP_FUNC;
+
+	step = expr_program_new_step(build, opcode, resv, resn);
+	step->d.func.finfo = finfo;
+	step->d.func.fcinfo = fcinfo;
+	step->d.func.nargs = nargs;
+	step->d.func.strict = finfo->fn_strict;
+	if (scanvar != NULL)
+	{
+		step->d.func.attnum = scanvar->varattno - 1;
+		step->d.func.vartype = scanvar->vartype;
+	}
+}
+
+/*
+ * Emit the steps for an AND or OR.  All the arguments are computed into the
+ * AND's own result; the step following each one jumps past the rest once
+ * the result is known.
+ */
+static void
+expr_program_compile_bool(ExprProgramBuild *build, BoolExpr *boolexpr,
+						  Datum *resv, bool *resn)
+{
+	int			nargs = list_length(boolexpr->args);
+	bool	   *anynull;
+	List	   *jumps = NIL;
+	ListCell   *lc;
+	int			argno;
+
+	Assert(boolexpr->boolop == AND_EXPR || boolexpr->boolop == OR_EXPR);
+
+	anynull = (bool *) palloc(sizeof(bool));
+	*anynull = false;
+
+	argno = 0;
+	foreach(lc, boolexpr->args)
+	{
+		ExprProgramStep *step;
+		ExprProgramOp opcode;
+
+		expr_program_compile(build, (Expr *) lfirst(lc), resv, resn);
+
+		if (boolexpr->boolop == AND_EXPR)
+		{
+			if (argno == nargs - 1)
+				opcode = EPOP_BOOL_AND_STEP_LAST;
+			else if (argno == 0)
+				opcode = EPOP_BOOL_AND_STEP_FIRST;
+			else
+				opcode = EPOP_BOOL_AND_STEP;
+		}
+		else
+		{
+			if (argno == nargs - 1)
+				opcode = EPOP_BOOL_OR_STEP_LAST;
+			else if (argno == 0)
+				opcode = EPOP_BOOL_OR_STEP_FIRST;
+			else
+				opcode = EPOP_BOOL_OR_STEP;
+		}
+
+		step = expr_program_new_step(build, opcode, resv, resn);
+		step->d.boolexpr.anynull = anynull;
+		jumps = lappend_int(jumps, build->nsteps - 1);
+		argno++;
+	}
+
+	/* now we know where the end is */
+	foreach(lc, jumps)
+		build->steps[lfirst_int(lc)].d.boolexpr.jumpdone = build->nsteps;
+	list_free(jumps);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecEvalProgramFirst
+ *
+ *		Evaluate a program for the first time.  Checks that couldn't be
+ *		made when it was built are made here, then the program is switched
+ *		over to ExecEvalProgram.
+ * ----------------------------------------------------------------
+ */
+static Datum
+ExecEvalProgramFirst(ExprProgramState *state, ExprContext *econtext,
+					 bool *isNull, ExprDoneCond *isDone)
+{
+	int			i;
+
+	for (i = 0; i < state->nsteps; i++)
+	{
+		ExprProgramStep *op = &state->steps[i];
+
+		switch ((ExprProgramOp) op->opcode)
+		{
+			case EPOP_SCAN_VAR:
+				CheckProgramVar(econtext->ecxt_scantuple,
+								op->d.var.attnum, op->d.var.vartype);
+				break;
+			case EPOP_INNER_VAR:
+				CheckProgramVar(econtext->ecxt_innertuple,
+								op->d.var.attnum, op->d.var.vartype);
+				break;
+			case EPOP_OUTER_VAR:
+				CheckProgramVar(econtext->ecxt_outertuple,
+								op->d.var.attnum, op->d.var.vartype);
+				break;
+			case EPOP_FUNC:
+			case EPOP_FUNC_STRICT:
+			case EPOP_FUNC_STRICT_VAR_CONST:
+			case EPOP_FUNC_FUSAGE:
+				{
+					Oid			funcid = op->d.func.finfo->fn_oid;
+					AclResult	aclresult;
+
+					if (op->opcode == EPOP_FUNC_STRICT_VAR_CONST)
+						CheckProgramVar(econtext->ecxt_scantuple,
+										op->d.func.attnum,
+										op->d.func.vartype);
+
+					/* Check permission to call function */
+					aclresult = pg_proc_aclcheck(funcid, GetUserId(),
+												 ACL_EXECUTE);
+					if (aclresult != ACLCHECK_OK)
+						aclcheck_error(aclresult, ACL_KIND_PROC,
+									   get_func_name(funcid));
+					InvokeFunctionExecuteHook(funcid);
+					break;
+				}
+			default:
+				break;
+		}
+	}
+
+	/*
+	 * If the query is expensive enough, have the program JIT compiled.  The
+	 * provider replaces the evalfunc if it succeeds.
+	 */
+	if (jit_compile_expr(state, econtext))
+		return ExecEvalExpr((ExprState *) state, econtext, isNull, isDone);
+
+#ifdef EP_USE_COMPUTED_GOTO
+	{
+		const void *const *dispatch_table;
+
+		/* replace each opcode with the address of its implementation */
+		dispatch_table = (const void *const *)
+			DatumGetPointer(ExecInterpProgram(NULL, NULL, NULL));
+		for (i = 0; i < state->nsteps; i++)
+			state->steps[i].opcode =
+				(intptr_t) dispatch_table[state->steps[i].opcode];
+	}
+#endif
+
+	/* Skip the checking on future executions */
+	state->xprstate.evalfunc = (ExprStateEvalFunc) ExecEvalProgram;
+	return ExecEvalProgram(state, econtext, isNull, isDone);
+}
+
+/*
+ * Check that a slot attribute has the type a Var of the program expects;
+ * see ExecEvalScalarVar.  The slot may be missing if the Var couldn't be
+ * reached in the tree form of the expression either, in which case we
+ * can't check anything.
+ */
+static void
+CheckProgramVar(TupleTableSlot *slot, int attnum, Oid vartype)
+{
+	TupleDesc	slot_tupdesc;
+	Form_pg_attribute attr;
+
+	if (slot == NULL)
+		return;
+
+	slot_tupdesc = slot->tts_tupleDescriptor;
+	if (attnum >= slot_tupdesc->natts)	/* should never happen */
+		elog(ERROR, "attribute number %d exceeds number of columns %d",
+			 attnum + 1, slot_tupdesc->natts);
+
+	attr = slot_tupdesc->attrs[attnum];
+
+	/* can't check type if dropped, since atttypid is probably 0 */
+	if (!attr->attisdropped && vartype != attr->atttypid)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("attribute %d has wrong type", attnum + 1),
+				 errdetail("Table has type %s, but query expects %s.",
+						   format_type_be(attr->atttypid),
+						   format_type_be(vartype))));
+}
+
+/* ----------------------------------------------------------------
+ *		ExecEvalProgram
+ *
+ *		Evaluate a program.  It never returns a set.
+ * ----------------------------------------------------------------
+ */
+static Datum
+ExecEvalProgram(ExprProgramState *state, ExprContext *econtext,
+				bool *isNull, ExprDoneCond *isDone)
+{
+	if (isDone)
+		*isDone = ExprSingleResult;
+
+	return ExecInterpProgram(state, econtext, isNull);
+}
+
+/*
+ * The interpreter proper.
+ *
+ * With computed goto, calling this with a NULL state returns the table of
+ * addresses the opcodes of a program are replaced with.
+ */
+static Datum
+ExecInterpProgram(ExprProgramState *state, ExprContext *econtext,
+				  bool *isNull)
+{
+	ExprProgramStep *op;
+	TupleTableSlot *scanslot;
+	TupleTableSlot *innerslot;
+	TupleTableSlot *outerslot;
+
+#ifdef EP_USE_COMPUTED_GOTO
+	/* must be in the order of ExprProgramOp */
+	static const void *const dispatch_table[] = {
+		&&CASE_EPOP_DONE,
+		&&CASE_EPOP_SCAN_FETCHSOME,
+		&&CASE_EPOP_INNER_FETCHSOME,
+		&&CASE_EPOP_OUTER_FETCHSOME,
+		&&CASE_EPOP_SCAN_VAR,
+		&&CASE_EPOP_INNER_VAR,
+		&&CASE_EPOP_OUTER_VAR,
+		&&CASE_EPOP_CONST,
+		&&CASE_EPOP_FUNC,
+		&&CASE_EPOP_FUNC_STRICT,
+		&&CASE_EPOP_FUNC_STRICT_VAR_CONST,
+		&&CASE_EPOP_FUNC_FUSAGE,
+		&&CASE_EPOP_BOOL_AND_STEP_FIRST,
+		&&CASE_EPOP_BOOL_AND_STEP,
+		&&CASE_EPOP_BOOL_AND_STEP_LAST,
+		&&CASE_EPOP_BOOL_OR_STEP_FIRST,
+		&&CASE_EPOP_BOOL_OR_STEP,
+		&&CASE_EPOP_BOOL_OR_STEP_LAST,
+		&&CASE_EPOP_BOOL_NOT,
+		&&CASE_EPOP_NULLTEST_ISNULL,
+		&&CASE_EPOP_NULLTEST_ISNOTNULL,
+		&&CASE_EPOP_BOOLTEST_IS_TRUE,
+		&&CASE_EPOP_BOOLTEST_IS_NOT_TRUE,
+		&&CASE_EPOP_BOOLTEST_IS_FALSE,
+		&&CASE_EPOP_BOOLTEST_IS_NOT_FALSE,
+		&&CASE_EPOP_LAST
+	};
+
+	StaticAssertStmt(lengthof(dispatch_table) == EPOP_LAST + 1,
+					 "dispatch_table out of sync with ExprProgramOp");
+
+	if (state == NULL)
+		return PointerGetDatum(dispatch_table);
+#endif
+
+	op = state->steps;
+	scanslot = econtext->ecxt_scantuple;
+	innerslot = econtext->ecxt_innertuple;
+	outerslot = econtext->ecxt_outertuple;
+
+	EP_DISPATCH();
+
+	EP_SWITCH()
+	{
+		EP_CASE(EPOP_DONE)
+		{
+			goto done;
+		}
+
+		EP_CASE(EPOP_SCAN_FETCHSOME)
+		{
+			slot_getsomeattrs(scanslot, op->d.fetch.last);
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_INNER_FETCHSOME)
+		{
+			slot_getsomeattrs(innerslot, op->d.fetch.last);
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_OUTER_FETCHSOME)
+		{
+			slot_getsomeattrs(outerslot, op->d.fetch.last);
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_SCAN_VAR)
+		{
+			int			attnum = op->d.var.attnum;
+
+			*op->resvalue = scanslot->tts_values[attnum];
+			*op->resnull = scanslot->tts_isnull[attnum];
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_INNER_VAR)
+		{
+			int			attnum = op->d.var.attnum;
+
+			*op->resvalue = innerslot->tts_values[attnum];
+			*op->resnull = innerslot->tts_isnull[attnum];
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_OUTER_VAR)
+		{
+			int			attnum = op->d.var.attnum;
+
+			*op->resvalue = outerslot->tts_values[attnum];
+			*op->resnull = outerslot->tts_isnull[attnum];
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_CONST)
+		{
+			*op->resvalue = op->d.constval.value;
+			*op->resnull = op->d.constval.isnull;
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_FUNC)
+		{
+			FunctionCallInfo fcinfo = op->d.func.fcinfo;
+
+			fcinfo->isnull = false;
+			*op->resvalue = FunctionCallInvoke(fcinfo);
+			*op->resnull = fcinfo->isnull;
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_FUNC_STRICT)
+		{
+			FunctionCallInfo fcinfo = op->d.func.fcinfo;
+			int			argno;
+
+			for (argno = 0; argno < op->d.func.nargs; argno++)
+			{
+				if (fcinfo->argnull[argno])
+				{
+					*op->resvalue = (Datum) 0;
+					*op->resnull = true;
+					EP_NEXT();
+				}
+			}
+			fcinfo->isnull = false;
+			*op->resvalue = FunctionCallInvoke(fcinfo);
+			*op->resnull = fcinfo->isnull;
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_FUNC_STRICT_VAR_CONST)
+		{
+			FunctionCallInfo fcinfo = op->d.func.fcinfo;
+			int			attnum = op->d.func.attnum;
+
+			if (scanslot->tts_isnull[attnum] || fcinfo->argnull[1])
+			{
+				*op->resvalue = (Datum) 0;
+				*op->resnull = true;
+				EP_NEXT();
+			}
+			fcinfo->arg[0] = scanslot->tts_values[attnum];
+			fcinfo->isnull = false;
+			*op->resvalue = FunctionCallInvoke(fcinfo);
+			*op->resnull = fcinfo->isnull;
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_FUNC_FUSAGE)
+		{
+			FunctionCallInfo fcinfo = op->d.func.fcinfo;
+			PgStat_FunctionCallUsage fcusage;
+			int			argno;
+
+			if (op->d.func.strict)
+			{
+				for (argno = 0; argno < op->d.func.nargs; argno++)
+				{
+					if (fcinfo->argnull[argno])
+					{
+						*op->resvalue = (Datum) 0;
+						*op->resnull = true;
+						EP_NEXT();
+					}
+				}
+			}
+
+			pgstat_init_function_usage(fcinfo, &fcusage);
+
+			fcinfo->isnull = false;
+			*op->resvalue = FunctionCallInvoke(fcinfo);
+			*op->resnull = fcinfo->isnull;
+
+			pgstat_end_function_usage(&fcusage, true);
+			EP_NEXT();
+		}
+
+		/*
+		 * AND: the result is false if any argument is false, else null if
+		 * any argument is null, else true.  The first step needs to reset
+		 * anynull, and then does the same as the middle ones.
+		 */
+		EP_CASE(EPOP_BOOL_AND_STEP_FIRST)
+		{
+			*op->d.boolexpr.anynull = false;
+			/* FALL THRU */
+		}
+
+		EP_CASE(EPOP_BOOL_AND_STEP)
+		{
+			if (*op->resnull)
+				*op->d.boolexpr.anynull = true;
+			else if (!DatumGetBool(*op->resvalue))
+			{
+				/* the result is false, and already stored */
+				EP_JUMP(op->d.boolexpr.jumpdone);
+			}
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_BOOL_AND_STEP_LAST)
+		{
+			if (*op->resnull)
+			{
+				/* the result is null, and already stored */
+			}
+			else if (!DatumGetBool(*op->resvalue))
+			{
+				/* the result is false, and already stored */
+			}
+			else if (*op->d.boolexpr.anynull)
+			{
+				*op->resvalue = (Datum) 0;
+				*op->resnull = true;
+			}
+			EP_NEXT();
+		}
+
+		/*
+		 * OR: the result is true if any argument is true, else null if any
+		 * argument is null, else false.
+		 */
+		EP_CASE(EPOP_BOOL_OR_STEP_FIRST)
+		{
+			*op->d.boolexpr.anynull = false;
+			/* FALL THRU */
+		}
+
+		EP_CASE(EPOP_BOOL_OR_STEP)
+		{
+			if (*op->resnull)
+				*op->d.boolexpr.anynull = true;
+			else if (DatumGetBool(*op->resvalue))
+			{
+				/* the result is true, and already stored */
+				EP_JUMP(op->d.boolexpr.jumpdone);
+			}
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_BOOL_OR_STEP_LAST)
+		{
+			if (*op->resnull)
+			{
+				/* the result is null, and already stored */
+			}
+			else if (DatumGetBool(*op->resvalue))
+			{
+				/* the result is true, and already stored */
+			}
+			else if (*op->d.boolexpr.anynull)
+			{
+				*op->resvalue = (Datum) 0;
+				*op->resnull = true;
+			}
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_BOOL_NOT)
+		{
+			/* NOT NULL is NULL */
+			if (!*op->resnull)
+				*op->resvalue = BoolGetDatum(!DatumGetBool(*op->resvalue));
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_NULLTEST_ISNULL)
+		{
+			*op->resvalue = BoolGetDatum(*op->resnull);
+			*op->resnull = false;
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_NULLTEST_ISNOTNULL)
+		{
+			*op->resvalue = BoolGetDatum(!*op->resnull);
+			*op->resnull = false;
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_BOOLTEST_IS_TRUE)
+		{
+			if (*op->resnull)
+			{
+				*op->resvalue = BoolGetDatum(false);
+				*op->resnull = false;
+			}
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_BOOLTEST_IS_NOT_TRUE)
+		{
+			if (*op->resnull)
+			{
+				*op->resvalue = BoolGetDatum(true);
+				*op->resnull = false;
+			}
+			else
+				*op->resvalue = BoolGetDatum(!DatumGetBool(*op->resvalue));
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_BOOLTEST_IS_FALSE)
+		{
+			if (*op->resnull)
+			{
+				*op->resvalue = BoolGetDatum(false);
+				*op->resnull = false;
+			}
+			else
+				*op->resvalue = BoolGetDatum(!DatumGetBool(*op->resvalue));
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_BOOLTEST_IS_NOT_FALSE)
+		{
+			if (*op->resnull)
+			{
+				*op->resvalue = BoolGetDatum(true);
+				*op->resnull = false;
+			}
+			EP_NEXT();
+		}
+
+		EP_CASE(EPOP_LAST)
+		{
+			elog(ERROR, "invalid expression program step");
+			goto done;
+		}
+	}
+
+done:
+	*isNull = state->resnull;
+	return state->resvalue;
+}
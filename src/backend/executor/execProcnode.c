@@ -20,6 +20,7 @@
  *	 INTERFACE ROUTINES
  *		ExecInitNode	-		initialize a plan node and its subplans
  *		ExecProcNode	-		get a tuple by executing the plan node
+ *		ExecProcNodeBatch -		get a batch of tuples from the plan node
  *		ExecEndNode		-		shut down a plan node and its subplans
  *
  *	 NOTES
@@ -77,6 +78,7 @@
  */
 #include "postgres.h"
 
+#include "executor/execBatch.h"
 #include "executor/executor.h"
 #include "executor/nodeAgg.h"
 #include "executor/nodeAppend.h"
@@ -599,6 +601,72 @@ MultiExecProcNode(PlanState *node)
 }
 
 
+/* ----------------------------------------------------------------
+ *		ExecInitNodeBatch
+ *
+ *		Prepare an initialized node to be executed through
+ *		ExecProcNodeBatch, with the first natts columns of its output
+ *		deformed.  Returns false if the node doesn't support that, in
+ *		which case the caller must use ExecProcNode.
+ * ----------------------------------------------------------------
+ */
+bool
+ExecInitNodeBatch(PlanState *node, int natts)
+{
+	switch (nodeTag(node))
+	{
+			/*
+			 * Only node types that actually support batches will be listed
+			 */
+
+		case T_SeqScanState:
+			return ExecSeqScanInitBatch((SeqScanState *) node, natts);
+
+		default:
+			return false;
+	}
+}
+
+
+/* ----------------------------------------------------------------
+ *		ExecProcNodeBatch
+ *
+ *		Execute a node prepared with ExecInitNodeBatch, returning its next
+ *		batch of tuples, or NULL when there are no more.  See execBatch.c.
+ * ----------------------------------------------------------------
+ */
+TupleBatch *
+ExecProcNodeBatch(PlanState *node)
+{
+	TupleBatch *result;
+
+	CHECK_FOR_INTERRUPTS();
+
+	if (node->chgParam != NULL) /* something changed */
+		ExecReScan(node);		/* let ReScan handle this */
+
+	if (node->instrument)
+		InstrStartNode(node->instrument);
+
+	switch (nodeTag(node))
+	{
+		case T_SeqScanState:
+			result = ExecSeqScanBatch((SeqScanState *) node);
+			break;
+
+		default:
+			elog(ERROR, "unrecognized node type: %d", (int) nodeTag(node));
+			result = NULL;
+			break;
+	}
+
+	if (node->instrument)
+		InstrStopNode(node->instrument, result ? result->nsel : 0.0);
+
+	return result;
+}
+
+
 /* ----------------------------------------------------------------
  *		ExecEndNode
  *
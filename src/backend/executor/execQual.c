@@ -41,6 +41,7 @@
 #include "access/tupconvert.h"
 #include "catalog/objectaccess.h"
 #include "catalog/pg_type.h"
+#include "executor/execExprProgram.h"
 #include "executor/execdebug.h"
 #include "executor/nodeSubplan.h"
 #include "funcapi.h"
@@ -4504,6 +4505,11 @@ ExecInitExpr(Expr *node, PlanState *parent)
 	/* Guard against stack overflow due to overly complex expressions */
 	check_stack_depth();
 
+	/* Use a flat step program instead of a tree, if the expression allows */
+	state = ExecCompileExpr(node);
+	if (state != NULL)
+		return state;
+
 	switch (nodeTag(node))
 	{
 		case T_Var:
@@ -139,6 +139,24 @@
  *	  sensitive to the grouping set for which the aggregate function is
  *	  currently being called.
  *
+ *	  In AGG_HASHED mode the hash table is limited to work_mem.  Memory is
+ *	  checked whenever a new group is added; once the table has outgrown
+ *	  the limit, input tuples of groups already in the table are still
+ *	  aggregated, but tuples belonging to any other group are written out
+ *	  to a set of logical tapes, partitioned by bits of their hash value.
+ *	  After the table's groups have all been returned, each partition is
+ *	  read back as a batch into an empty hash table.  A batch that again
+ *	  doesn't fit is partitioned further using the next bits of the hash
+ *	  value, so every group is eventually aggregated within one batch.
+ *
+ *	  With batch_execution enabled, plain aggregation over a node that can
+ *	  produce batches of tuples (see execBatch.c) consumes its input a
+ *	  TupleBatch at a time, if every aggregate's inputs are plain Vars and
+ *	  there is no DISTINCT, ORDER BY, FILTER or grouping set.  Each
+ *	  aggregate's transition function is then applied to the selected rows
+ *	  of a batch in one loop over its input columns, without evaluating
+ *	  any expressions.
+ *
  *	  TODO: AGG_HASHED doesn't support multiple grouping sets yet.
  *
  * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
@@ -157,8 +175,10 @@
 #include "catalog/pg_aggregate.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
+#include "executor/execBatch.h"
 #include "executor/executor.h"
 #include "executor/nodeAgg.h"
+#include "jit/jit.h"
 #include "miscadmin.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/clauses.h"
@@ -167,6 +187,8 @@
 #include "parser/parse_coerce.h"
 #include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/dynahash.h"
+#include "utils/logtape.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/syscache.h"
@@ -175,282 +197,58 @@
 
 
 /*
- * AggStatePerTransData - per aggregate state value information
- *
- * Working state for updating the aggregate's state value, by calling the
- * transition function with an input row. This struct does not store the
- * information needed to produce the final aggregate result from the transition
- * state, that's stored in AggStatePerAggData instead. This separation allows
- * multiple aggregate results to be produced from a single state value.
+ * To implement hashed aggregation, we need a hashtable that stores a
+ * representative tuple and an array of AggStatePerGroup structs for each
+ * distinct set of GROUP BY column values.  We compute the hash key from
+ * the GROUP BY columns.
  */
-typedef struct AggStatePerTransData
-{
-	/*
-	 * These values are set up during ExecInitAgg() and do not change
-	 * thereafter:
-	 */
-
-	/*
-	 * Link to an Aggref expr this state value is for.
-	 *
-	 * There can be multiple Aggref's sharing the same state value, as long as
-	 * the inputs and transition function are identical. This points to the
-	 * first one of them.
-	 */
-	Aggref	   *aggref;
-
-	/*
-	 * Nominal number of arguments for aggregate function.  For plain aggs,
-	 * this excludes any ORDER BY expressions.  For ordered-set aggs, this
-	 * counts both the direct and aggregated (ORDER BY) arguments.
-	 */
-	int			numArguments;
-
-	/*
-	 * Number of aggregated input columns.  This includes ORDER BY expressions
-	 * in both the plain-agg and ordered-set cases.  Ordered-set direct args
-	 * are not counted, though.
-	 */
-	int			numInputs;
-
-	/*
-	 * Number of aggregated input columns to pass to the transfn.  This
-	 * includes the ORDER BY columns for ordered-set aggs, but not for plain
-	 * aggs.  (This doesn't count the transition state value!)
-	 */
-	int			numTransInputs;
-
-	/* Oid of the state transition or combine function */
-	Oid			transfn_oid;
-
-	/* Oid of the serialization function or InvalidOid */
-	Oid			serialfn_oid;
-
-	/* Oid of the deserialization function or InvalidOid */
-	Oid			deserialfn_oid;
-
-	/* Oid of state value's datatype */
-	Oid			aggtranstype;
-
-	/* ExprStates of the FILTER and argument expressions. */
-	ExprState  *aggfilter;		/* state of FILTER expression, if any */
-	List	   *args;			/* states of aggregated-argument expressions */
-	List	   *aggdirectargs;	/* states of direct-argument expressions */
-
-	/*
-	 * fmgr lookup data for transition function or combine function.  Note in
-	 * particular that the fn_strict flag is kept here.
-	 */
-	FmgrInfo	transfn;
-
-	/* fmgr lookup data for serialization function */
-	FmgrInfo	serialfn;
-
-	/* fmgr lookup data for deserialization function */
-	FmgrInfo	deserialfn;
-
-	/* Input collation derived for aggregate */
-	Oid			aggCollation;
-
-	/* number of sorting columns */
-	int			numSortCols;
-
-	/* number of sorting columns to consider in DISTINCT comparisons */
-	/* (this is either zero or the same as numSortCols) */
-	int			numDistinctCols;
-
-	/* deconstructed sorting information (arrays of length numSortCols) */
-	AttrNumber *sortColIdx;
-	Oid		   *sortOperators;
-	Oid		   *sortCollations;
-	bool	   *sortNullsFirst;
-
-	/*
-	 * fmgr lookup data for input columns' equality operators --- only
-	 * set/used when aggregate has DISTINCT flag.  Note that these are in
-	 * order of sort column index, not parameter index.
-	 */
-	FmgrInfo   *equalfns;		/* array of length numDistinctCols */
-
-	/*
-	 * initial value from pg_aggregate entry
-	 */
-	Datum		initValue;
-	bool		initValueIsNull;
-
-	/*
-	 * We need the len and byval info for the agg's input and transition data
-	 * types in order to know how to copy/delete values.
-	 *
-	 * Note that the info for the input type is used only when handling
-	 * DISTINCT aggs with just one argument, so there is only one input type.
-	 */
-	int16		inputtypeLen,
-				transtypeLen;
-	bool		inputtypeByVal,
-				transtypeByVal;
-
-	/*
-	 * Stuff for evaluation of inputs.  We used to just use ExecEvalExpr, but
-	 * with the addition of ORDER BY we now need at least a slot for passing
-	 * data to the sort object, which requires a tupledesc, so we might as
-	 * well go whole hog and use ExecProject too.
-	 */
-	TupleDesc	evaldesc;		/* descriptor of input tuples */
-	ProjectionInfo *evalproj;	/* projection machinery */
-
-	/*
-	 * Slots for holding the evaluated input arguments.  These are set up
-	 * during ExecInitAgg() and then used for each input row.
-	 */
-	TupleTableSlot *evalslot;	/* current input tuple */
-	TupleTableSlot *uniqslot;	/* used for multi-column DISTINCT */
-
-	/*
-	 * These values are working state that is initialized at the start of an
-	 * input tuple group and updated for each input tuple.
-	 *
-	 * For a simple (non DISTINCT/ORDER BY) aggregate, we just feed the input
-	 * values straight to the transition function.  If it's DISTINCT or
-	 * requires ORDER BY, we pass the input values into a Tuplesort object;
-	 * then at completion of the input tuple group, we scan the sorted values,
-	 * eliminate duplicates if needed, and run the transition function on the
-	 * rest.
-	 *
-	 * We need a separate tuplesort for each grouping set.
-	 */
-
-	Tuplesortstate **sortstates;	/* sort objects, if DISTINCT or ORDER BY */
-
-	/*
-	 * This field is a pre-initialized FunctionCallInfo struct used for
-	 * calling this aggregate's transfn.  We save a few cycles per row by not
-	 * re-initializing the unchanging fields; which isn't much, but it seems
-	 * worth the extra space consumption.
-	 */
-	FunctionCallInfoData transfn_fcinfo;
-
-	/* Likewise for serialization and deserialization functions */
-	FunctionCallInfoData serialfn_fcinfo;
-
-	FunctionCallInfoData deserialfn_fcinfo;
-}	AggStatePerTransData;
+typedef struct AggHashEntryData *AggHashEntry;
 
-/*
- * AggStatePerAggData - per-aggregate information
- *
- * This contains the information needed to call the final function, to produce
- * a final aggregate result from the state value. If there are multiple
- * identical Aggrefs in the query, they can all share the same per-agg data.
- *
- * These values are set up during ExecInitAgg() and do not change thereafter.
- */
-typedef struct AggStatePerAggData
+typedef struct AggHashEntryData
 {
-	/*
-	 * Link to an Aggref expr this state value is for.
-	 *
-	 * There can be multiple identical Aggref's sharing the same per-agg. This
-	 * points to the first one of them.
-	 */
-	Aggref	   *aggref;
-
-	/* index to the state value which this agg should use */
-	int			transno;
-
-	/* Optional Oid of final function (may be InvalidOid) */
-	Oid			finalfn_oid;
-
-	/*
-	 * fmgr lookup data for final function --- only valid when finalfn_oid oid
-	 * is not InvalidOid.
-	 */
-	FmgrInfo	finalfn;
-
-	/*
-	 * Number of arguments to pass to the finalfn.  This is always at least 1
-	 * (the transition state value) plus any ordered-set direct args. If the
-	 * finalfn wants extra args then we pass nulls corresponding to the
-	 * aggregated input columns.
-	 */
-	int			numFinalArgs;
-
-	/*
-	 * We need the len and byval info for the agg's result data type in order
-	 * to know how to copy/delete values.
-	 */
-	int16		resulttypeLen;
-	bool		resulttypeByVal;
-
-}	AggStatePerAggData;
+	TupleHashEntryData shared;	/* common header for hash table entries */
+	/* per-aggregate transition status array */
+	AggStatePerGroupData pergroup[FLEXIBLE_ARRAY_MEMBER];
+}	AggHashEntryData;
 
 /*
- * AggStatePerGroupData - per-aggregate-per-group working state
- *
- * These values are working state that is initialized at the start of
- * an input tuple group and updated for each input tuple.
- *
- * In AGG_PLAIN and AGG_SORTED modes, we have a single array of these
- * structs (pointed to by aggstate->pergroup); we re-use the array for
- * each input group, if it's AGG_SORTED mode.  In AGG_HASHED mode, the
- * hash table contains an array of these structs for each tuple group.
- *
- * Logically, the sortstate field belongs in this struct, but we do not
- * keep it here for space reasons: we don't support DISTINCT aggregates
- * in AGG_HASHED mode, so there's no reason to use up a pointer field
- * in every entry of the hashtable.
+ * Bounds on the number of partitions a spilling hash table's input is
+ * divided into.  Every partition costs a tape buffer, so we don't let them
+ * take more than a quarter of work_mem either.
  */
-typedef struct AggStatePerGroupData
-{
-	Datum		transValue;		/* current transition value */
-	bool		transValueIsNull;
-
-	bool		noTransValue;	/* true if transValue not set yet */
+#define HASHAGG_MIN_PARTITIONS 4
+#define HASHAGG_MAX_PARTITIONS 256
 
-	/*
-	 * Note: noTransValue initially has the same value as transValueIsNull,
-	 * and if true both are cleared to false at the same time.  They are not
-	 * the same though: if transfn later returns a NULL, we want to keep that
-	 * NULL and not auto-replace it with a later input value. Only the first
-	 * non-NULL input will be auto-substituted.
-	 */
-} AggStatePerGroupData;
+/* plan for this much more memory than the groups seen so far need */
+#define HASHAGG_PARTITION_FACTOR 1.5
 
 /*
- * AggStatePerPhaseData - per-grouping-set-phase state
- *
- * Grouping sets are divided into "phases", where a single phase can be
- * processed in one pass over the input. If there is more than one phase, then
- * at the end of input from the current phase, state is reset and another pass
- * taken over the data which has been re-sorted in the mean time.
- *
- * Accordingly, each phase specifies a list of grouping sets and group clause
- * information, plus each phase after the first also has a sort order.
+ * State of one spilling pass over the input (or over a spilled batch): the
+ * tapes that the tuples of groups not in the hash table are written to.
  */
-typedef struct AggStatePerPhaseData
+typedef struct HashAggSpillData
 {
-	int			numsets;		/* number of grouping sets (or 0) */
-	int		   *gset_lengths;	/* lengths of grouping sets */
-	Bitmapset **grouped_cols;	/* column groupings for rollup */
-	FmgrInfo   *eqfunctions;	/* per-grouping-field equality fns */
-	Agg		   *aggnode;		/* Agg node for phase data */
-	Sort	   *sortnode;		/* Sort node for input ordering for phase */
-}	AggStatePerPhaseData;
+	LogicalTapeSet *tapeset;	/* one tape per partition */
+	int			npartitions;	/* number of partitions, a power of 2 */
+	int			nbits;			/* log2(npartitions) */
+	int			shift;			/* shift to apply to the hash value */
+	int64	   *ntuples;		/* number of tuples in each partition */
+	int			nbatches;		/* batches still to be read from tapeset */
+} HashAggSpillData;
 
 /*
- * To implement hashed aggregation, we need a hashtable that stores a
- * representative tuple and an array of AggStatePerGroup structs for each
- * distinct set of GROUP BY column values.  We compute the hash key from
- * the GROUP BY columns.
+ * A spilled partition waiting to be aggregated.
  */
-typedef struct AggHashEntryData *AggHashEntry;
+typedef struct HashAggBatchData *HashAggBatch;
 
-typedef struct AggHashEntryData
+typedef struct HashAggBatchData
 {
-	TupleHashEntryData shared;	/* common header for hash table entries */
-	/* per-aggregate transition status array */
-	AggStatePerGroupData pergroup[FLEXIBLE_ARRAY_MEMBER];
-}	AggHashEntryData;
+	HashAggSpill spill;			/* spill whose tapeset holds the tuples */
+	int			tapenum;		/* tape holding the tuples */
+	int			used_bits;		/* hash bits that selected this partition */
+	int			level;			/* # partitioning passes that produced it */
+	int64		ntuples;		/* number of tuples in the batch */
+} HashAggBatchData;
 
 static void initialize_phase(AggState *aggstate, int newphase);
 static TupleTableSlot *fetch_input_tuple(AggState *aggstate);
@@ -461,6 +259,8 @@ static void advance_transition_function(AggState *aggstate,
 							AggStatePerTrans pertrans,
 							AggStatePerGroup pergroupstate);
 static void advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup);
+static void advance_aggregates_batch(AggState *aggstate,
+						 AggStatePerGroup pergroup, TupleBatch *batch);
 static void advance_combine_function(AggState *aggstate,
 						 AggStatePerTrans pertrans,
 						 AggStatePerGroup pergroupstate);
@@ -493,7 +293,22 @@ static void build_hash_table(AggState *aggstate);
 static AggHashEntry lookup_hash_entry(AggState *aggstate,
 				  TupleTableSlot *inputslot);
 static TupleTableSlot *agg_retrieve_direct(AggState *aggstate);
+static TupleTableSlot *agg_retrieve_batch(AggState *aggstate);
+static bool agg_init_batch(AggState *aggstate);
+static Var *batch_agg_arg(TargetEntry *tle);
+static void agg_hash_advance(AggState *aggstate, TupleTableSlot *slot);
 static void agg_fill_hash_table(AggState *aggstate);
+static bool agg_refill_hash_table(AggState *aggstate);
+static void hash_agg_check_limits(AggState *aggstate);
+static void hash_agg_enter_spill_mode(AggState *aggstate, Size mem);
+static uint32 hash_agg_hash_value(AggState *aggstate, TupleTableSlot *slot);
+static void hash_agg_spill_tuple(AggState *aggstate, TupleTableSlot *slot);
+static void hash_agg_finish_spill(AggState *aggstate);
+static TupleTableSlot *hash_agg_read_spilled(AggState *aggstate,
+					  HashAggBatch batch);
+static void hash_agg_release_batch(HashAggBatch batch);
+static void hash_agg_free_spill(HashAggSpill spill);
+static void hash_agg_reset_spill(AggState *aggstate);
 static TupleTableSlot *agg_retrieve_hash_table(AggState *aggstate);
 static Datum GetAggInitVal(Datum textInitVal, Oid transtype);
 static void build_pertrans_for_aggref(AggStatePerTrans pertrans,
@@ -862,6 +677,22 @@ advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup)
 	int			numGroupingSets = Max(aggstate->phase->numsets, 1);
 	int			numTrans = aggstate->numtrans;
 
+	/*
+	 * If the query is expensive enough, try to JIT compile this function for
+	 * the node's aggregates on first use.  The provider sets jit_advance if
+	 * it succeeds.
+	 */
+	if (!aggstate->jit_advance_tried)
+	{
+		aggstate->jit_advance_tried = true;
+		jit_compile_agg_advance(aggstate);
+	}
+	if (aggstate->jit_advance)
+	{
+		aggstate->jit_advance(aggstate, pergroup);
+		return;
+	}
+
 	for (transno = 0; transno < numTrans; transno++)
 	{
 		AggStatePerTrans pertrans = &aggstate->pertrans[transno];
@@ -945,6 +776,50 @@ advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup)
 	}
 }
 
+/*
+ * advance_aggregates_batch replaces advance_aggregates in batch mode,
+ * advancing the transition states for all selected rows of a batch.  The
+ * aggregates are processed one at a time, each over all of the rows, so that
+ * each loop touches only that aggregate's input columns.  We know there's
+ * just one grouping set, and no FILTER, DISTINCT or ORDER BY to handle; see
+ * agg_init_batch.
+ */
+static void
+advance_aggregates_batch(AggState *aggstate, AggStatePerGroup pergroup,
+						 TupleBatch *batch)
+{
+	int			transno;
+	int			numTrans = aggstate->numtrans;
+
+	aggstate->current_set = 0;
+
+	for (transno = 0; transno < numTrans; transno++)
+	{
+		AggStatePerTrans pertrans = &aggstate->pertrans[transno];
+		AggStatePerGroup pergroupstate = &pergroup[transno];
+		FunctionCallInfo fcinfo = &pertrans->transfn_fcinfo;
+		int			numTransInputs = pertrans->numTransInputs;
+		int			s;
+		int			i;
+
+		for (s = 0; s < batch->nsel; s++)
+		{
+			int			row = batch->sel[s];
+
+			/* Load values into fcinfo, starting from 1 */
+			for (i = 0; i < numTransInputs; i++)
+			{
+				int			attnum = pertrans->batchAttnums[i];
+
+				fcinfo->arg[i + 1] = batch->values[attnum][row];
+				fcinfo->argnull[i + 1] = batch->isnull[attnum][row];
+			}
+
+			advance_transition_function(aggstate, pertrans, pergroupstate);
+		}
+	}
+}
+
 /*
  * combine_aggregates replaces advance_aggregates in DO_AGGSPLIT_COMBINE
  * mode.  The principal difference is that here we may need to apply the
@@ -1797,6 +1672,9 @@ hash_agg_entry_size(int numAggs)
  * Find or create a hashtable entry for the tuple group containing the
  * given tuple.
  *
+ * Once the hash table has entered spill mode, no more groups are created;
+ * NULL is returned if the tuple's group is not in the table already.
+ *
  * When called, CurrentMemoryContext should be the per-query context.
  */
 static AggHashEntry
@@ -1826,19 +1704,290 @@ lookup_hash_entry(AggState *aggstate, TupleTableSlot *inputslot)
 	}
 
 	/* find or create the hashtable entry using the filtered tuple */
+	isnew = false;
 	entry = (AggHashEntry) LookupTupleHashEntry(aggstate->hashtable,
 												hashslot,
-												&isnew);
+								aggstate->hash_spill_mode ? NULL : &isnew);
 
 	if (isnew)
 	{
 		/* initialize aggregates for new tuple group */
 		initialize_aggregates(aggstate, entry->pergroup, 0);
+
+		/* and see whether the table has grown too large */
+		hash_agg_check_limits(aggstate);
 	}
 
 	return entry;
 }
 
+/*
+ * Check the memory used by the hash table after a new group has been added
+ * to it, and enter spill mode if it exceeds work_mem.
+ *
+ * The transition values of the groups live in the same context as the
+ * table, so this covers them too.
+ */
+static void
+hash_agg_check_limits(AggState *aggstate)
+{
+	MemoryContext hashcxt = aggstate->aggcontexts[0]->ecxt_per_tuple_memory;
+	Size		mem;
+
+	mem = MemoryContextMemAllocated(hashcxt, true);
+	if (mem > aggstate->hash_mem_peak)
+		aggstate->hash_mem_peak = mem;
+
+	/*
+	 * If all the bits of the hash value have been used up partitioning the
+	 * input already, further partitioning can't separate the remaining
+	 * groups, so just let the table grow.
+	 */
+	if (mem > aggstate->hash_mem_limit && aggstate->hash_used_bits < 32)
+		hash_agg_enter_spill_mode(aggstate, mem);
+}
+
+/*
+ * Stop adding groups to the hash table and prepare to spill the tuples of
+ * the groups that aren't in it.
+ *
+ * The number of partitions is chosen so that each of them is expected to
+ * fit in memory, judging by the memory used per group so far and the
+ * expected number of groups in the input.
+ */
+static void
+hash_agg_enter_spill_mode(AggState *aggstate, Size mem)
+{
+	long		ngroups = hash_get_num_entries(aggstate->hashtable->hashtab);
+	double		mem_per_group;
+	double		mem_wanted;
+	int			npartitions;
+	int			nbits;
+	HashAggSpill spill;
+	MemoryContext oldcontext;
+
+	mem_per_group = (double) mem / Max(ngroups, 1);
+	mem_wanted = HASHAGG_PARTITION_FACTOR * aggstate->hash_input_groups *
+		mem_per_group;
+	npartitions = 1 + (int) Min(mem_wanted / aggstate->hash_mem_limit,
+								(double) HASHAGG_MAX_PARTITIONS);
+	npartitions = Min(npartitions, aggstate->hash_mem_limit / 4 / BLCKSZ);
+	npartitions = Max(npartitions, HASHAGG_MIN_PARTITIONS);
+
+	/* round up to a power of 2, within the hash bits that are left */
+	nbits = my_log2(npartitions);
+	nbits = Min(nbits, 32 - aggstate->hash_used_bits);
+	npartitions = 1 << nbits;
+
+	oldcontext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+
+	spill = (HashAggSpill) palloc(sizeof(HashAggSpillData));
+	spill->tapeset = LogicalTapeSetCreate(npartitions);
+	spill->npartitions = npartitions;
+	spill->nbits = nbits;
+	spill->shift = 32 - aggstate->hash_used_bits - nbits;
+	spill->ntuples = (int64 *) palloc0(sizeof(int64) * npartitions);
+	spill->nbatches = 0;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	aggstate->hash_spill = spill;
+	aggstate->hash_spill_mode = true;
+	aggstate->hash_spill_levels = Max(aggstate->hash_spill_levels,
+									  aggstate->hash_spill_level + 1);
+}
+
+/*
+ * Compute the hash value of the grouping columns of an input tuple.  This
+ * must match the hash value computed by the TupleHashTable, so that tuples
+ * are partitioned consistently with the table's own bucketing.
+ *
+ * Any memory used is released with the per-input-tuple context.
+ */
+static uint32
+hash_agg_hash_value(AggState *aggstate, TupleTableSlot *slot)
+{
+	Agg		   *node = (Agg *) aggstate->ss.ps.plan;
+	MemoryContext oldcontext;
+	uint32		hashkey = 0;
+	int			i;
+
+	oldcontext = MemoryContextSwitchTo(aggstate->tmpcontext->ecxt_per_tuple_memory);
+
+	for (i = 0; i < node->numCols; i++)
+	{
+		Datum		attr;
+		bool		isNull;
+
+		/* rotate hashkey left 1 bit at each step */
+		hashkey = (hashkey << 1) | ((hashkey & 0x80000000) ? 1 : 0);
+
+		attr = slot_getattr(slot, node->grpColIdx[i], &isNull);
+
+		if (!isNull)			/* treat nulls as having hash key 0 */
+		{
+			uint32		hkey;
+
+			hkey = DatumGetUInt32(FunctionCall1(&aggstate->hashfunctions[i],
+												attr));
+			hashkey ^= hkey;
+		}
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return hashkey;
+}
+
+/*
+ * Write an input tuple whose group isn't in the hash table to the partition
+ * selected by the next unused bits of its hash value.
+ *
+ * The hash value itself isn't stored; it's cheap enough to recompute when
+ * the tuple is read back.
+ */
+static void
+hash_agg_spill_tuple(AggState *aggstate, TupleTableSlot *slot)
+{
+	HashAggSpill spill = aggstate->hash_spill;
+	MemoryContext oldcontext;
+	MinimalTuple tuple;
+	uint32		hashvalue;
+	int			partition;
+
+	hashvalue = hash_agg_hash_value(aggstate, slot);
+	partition = (hashvalue >> spill->shift) & (spill->npartitions - 1);
+
+	/* the tape's buffer is allocated on its first write, so use query memory */
+	oldcontext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+	tuple = ExecFetchSlotMinimalTuple(slot);
+	LogicalTapeWrite(spill->tapeset, partition, (void *) tuple, tuple->t_len);
+	MemoryContextSwitchTo(oldcontext);
+
+	spill->ntuples[partition]++;
+}
+
+/*
+ * At the end of a pass over the input or a batch, turn the partitions that
+ * were written during it into batches to be aggregated later.
+ */
+static void
+hash_agg_finish_spill(AggState *aggstate)
+{
+	HashAggSpill spill = aggstate->hash_spill;
+	MemoryContext oldcontext;
+	int			i;
+
+	aggstate->hash_spill_mode = false;
+	if (spill == NULL)
+		return;
+	aggstate->hash_spill = NULL;
+
+	oldcontext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+
+	for (i = 0; i < spill->npartitions; i++)
+	{
+		HashAggBatch batch;
+
+		if (spill->ntuples[i] == 0)
+			continue;
+
+		LogicalTapeRewind(spill->tapeset, i, false);
+
+		batch = (HashAggBatch) palloc(sizeof(HashAggBatchData));
+		batch->spill = spill;
+		batch->tapenum = i;
+		batch->used_bits = aggstate->hash_used_bits + spill->nbits;
+		batch->level = aggstate->hash_spill_level + 1;
+		batch->ntuples = spill->ntuples[i];
+		spill->nbatches++;
+
+		/*
+		 * Process the most recently spilled batches first, so that a tapeset
+		 * is released before the batches of earlier passes are started.
+		 */
+		aggstate->hash_batches = lcons(batch, aggstate->hash_batches);
+	}
+
+	aggstate->hash_disk_used += LogicalTapeSetBlocks(spill->tapeset);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (spill->nbatches == 0)
+		hash_agg_free_spill(spill);
+}
+
+/*
+ * Read the next tuple of a spilled batch into hash_spill_slot.  Returns
+ * NULL at the end of the batch.
+ */
+static TupleTableSlot *
+hash_agg_read_spilled(AggState *aggstate, HashAggBatch batch)
+{
+	LogicalTapeSet *tapeset = batch->spill->tapeset;
+	MinimalTuple tuple;
+	uint32		t_len;
+	size_t		nread;
+
+	nread = LogicalTapeRead(tapeset, batch->tapenum, &t_len, sizeof(t_len));
+	if (nread == 0)
+		return NULL;
+	if (nread != sizeof(t_len))
+		elog(ERROR, "unexpected end of data");
+
+	tuple = (MinimalTuple) palloc(t_len);
+	tuple->t_len = t_len;
+	nread = LogicalTapeRead(tapeset, batch->tapenum,
+							(char *) tuple + sizeof(uint32),
+							t_len - sizeof(uint32));
+	if (nread != t_len - sizeof(uint32))
+		elog(ERROR, "unexpected end of data");
+
+	return ExecStoreMinimalTuple(tuple, aggstate->hash_spill_slot, true);
+}
+
+/*
+ * Release a batch, closing its tapeset once no batches are left in it.
+ */
+static void
+hash_agg_release_batch(HashAggBatch batch)
+{
+	HashAggSpill spill = batch->spill;
+
+	if (--spill->nbatches == 0)
+		hash_agg_free_spill(spill);
+	pfree(batch);
+}
+
+static void
+hash_agg_free_spill(HashAggSpill spill)
+{
+	LogicalTapeSetClose(spill->tapeset);
+	pfree(spill->ntuples);
+	pfree(spill);
+}
+
+/*
+ * Throw away any spilled data, at rescan or shutdown.
+ */
+static void
+hash_agg_reset_spill(AggState *aggstate)
+{
+	ListCell   *lc;
+
+	foreach(lc, aggstate->hash_batches)
+		hash_agg_release_batch((HashAggBatch) lfirst(lc));
+	list_free(aggstate->hash_batches);
+	aggstate->hash_batches = NIL;
+
+	if (aggstate->hash_spill != NULL)
+	{
+		hash_agg_free_spill(aggstate->hash_spill);
+		aggstate->hash_spill = NULL;
+	}
+	aggstate->hash_spill_mode = false;
+}
+
 /*
  * ExecAgg -
  *
@@ -1889,7 +2038,10 @@ ExecAgg(AggState *node)
 				result = agg_retrieve_hash_table(node);
 				break;
 			default:
-				result = agg_retrieve_direct(node);
+				if (node->batch_mode)
+					result = agg_retrieve_batch(node);
+				else
+					result = agg_retrieve_direct(node);
 				break;
 		}
 
@@ -2224,22 +2376,183 @@ agg_retrieve_direct(AggState *aggstate)
 	return NULL;
 }
 
+/*
+ * ExecAgg for plain aggregation in batch mode: aggregate all of the input,
+ * and return the single result row unless it fails the node's qual.
+ */
+static TupleTableSlot *
+agg_retrieve_batch(AggState *aggstate)
+{
+	ExprContext *econtext = aggstate->ss.ps.ps_ExprContext;
+	ExprContext *tmpcontext = aggstate->tmpcontext;
+	AggStatePerGroup pergroup = aggstate->pergroup;
+	PlanState  *outerNode = outerPlanState(aggstate);
+	TupleBatch *batch;
+
+	Assert(!aggstate->agg_done);
+
+	/* as in agg_retrieve_direct, clear previous results */
+	ReScanExprContext(econtext);
+	ReScanExprContext(aggstate->aggcontexts[0]);
+	aggstate->projected_set = 0;
+
+	initialize_aggregates(aggstate, pergroup, 1);
+
+	while ((batch = ExecProcNodeBatch(outerNode)) != NULL)
+	{
+		advance_aggregates_batch(aggstate, pergroup, batch);
+
+		/*
+		 * Reset per-input-tuple context after each batch rather than each
+		 * tuple; by-ref transition values live in the aggregate context.
+		 */
+		ResetExprContext(tmpcontext);
+	}
+
+	aggstate->agg_done = true;
+
+	/*
+	 * There's no grouping, so there's no representative input tuple to
+	 * project with; use the empty scan slot, like agg_retrieve_direct does
+	 * for an empty input.
+	 */
+	econtext->ecxt_outertuple = aggstate->ss.ss_ScanTupleSlot;
+
+	prepare_projection_slot(aggstate, econtext->ecxt_outertuple, 0);
+
+	finalize_aggregates(aggstate, aggstate->peragg, pergroup, 0);
+
+	return project_aggregates(aggstate);
+}
+
+/*
+ * Decide whether the node can consume its input in batch mode, and prepare
+ * for it if so.  That requires plain aggregation without grouping sets or
+ * combining, aggregates whose arguments are all plain Vars of the outer plan
+ * and that have no FILTER, DISTINCT or ORDER BY, and an outer plan that can
+ * produce batches.
+ */
+static bool
+agg_init_batch(AggState *aggstate)
+{
+	Agg		   *node = (Agg *) aggstate->ss.ps.plan;
+	int			natts = 0;
+	int			transno;
+
+	if (node->aggstrategy != AGG_PLAIN || aggstate->numphases != 1 ||
+		aggstate->maxsets > 1 || DO_AGGSPLIT_COMBINE(aggstate->aggsplit))
+		return false;
+
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		AggStatePerTrans pertrans = &aggstate->pertrans[transno];
+		List	   *args = pertrans->aggref->args;
+		ListCell   *lc;
+
+		if (pertrans->numSortCols > 0 || pertrans->aggfilter != NULL ||
+			list_length(args) != pertrans->numTransInputs)
+			return false;
+
+		foreach(lc, args)
+		{
+			Var		   *var = batch_agg_arg(lfirst(lc));
+
+			if (var == NULL)
+				return false;
+			natts = Max(natts, var->varattno);
+		}
+	}
+
+	if (!ExecInitNodeBatch(outerPlanState(aggstate), natts))
+		return false;
+
+	/* batch mode is on; remember where each aggregate finds its inputs */
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		AggStatePerTrans pertrans = &aggstate->pertrans[transno];
+		ListCell   *lc;
+		int			i;
+
+		pertrans->batchAttnums = (int *)
+			palloc(Max(pertrans->numTransInputs, 1) * sizeof(int));
+
+		i = 0;
+		foreach(lc, pertrans->aggref->args)
+		{
+			Var		   *var = batch_agg_arg(lfirst(lc));
+
+			pertrans->batchAttnums[i++] = var->varattno - 1;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Return the input column Var of an aggregate argument, or NULL if the
+ * argument is anything but a plain column of the outer plan.
+ */
+static Var *
+batch_agg_arg(TargetEntry *tle)
+{
+	Var		   *var = (Var *) tle->expr;
+
+	while (var && IsA(var, RelabelType))
+		var = (Var *) ((RelabelType *) var)->arg;
+
+	if (var == NULL || !IsA(var, Var) || var->varno != OUTER_VAR ||
+		var->varattno <= 0)
+		return NULL;
+	return var;
+}
+
+/*
+ * ExecAgg for hashed case: advance the aggregates of the group an input
+ * tuple belongs to, or spill the tuple if its group isn't in the hash table
+ * and the table is full.
+ */
+static void
+agg_hash_advance(AggState *aggstate, TupleTableSlot *slot)
+{
+	/* tmpcontext is the per-input-tuple expression context */
+	ExprContext *tmpcontext = aggstate->tmpcontext;
+	AggHashEntry entry;
+
+	/* set up for advance_aggregates call */
+	tmpcontext->ecxt_outertuple = slot;
+
+	/* Find or build hashtable entry for this tuple's group */
+	entry = lookup_hash_entry(aggstate, slot);
+
+	if (entry != NULL)
+	{
+		/* Advance the aggregates */
+		if (DO_AGGSPLIT_COMBINE(aggstate->aggsplit))
+			combine_aggregates(aggstate, entry->pergroup);
+		else
+			advance_aggregates(aggstate, entry->pergroup);
+	}
+	else
+		hash_agg_spill_tuple(aggstate, slot);
+
+	/* Reset per-input-tuple context after each tuple */
+	ResetExprContext(tmpcontext);
+}
+
 /*
  * ExecAgg for hashed case: phase 1, read input and build hash table
  */
 static void
 agg_fill_hash_table(AggState *aggstate)
 {
-	ExprContext *tmpcontext;
-	AggHashEntry entry;
 	TupleTableSlot *outerslot;
 
-	/*
-	 * get state info from node
-	 *
-	 * tmpcontext is the per-input-tuple expression context
-	 */
-	tmpcontext = aggstate->tmpcontext;
+	/* the whole input goes into the first batch, unpartitioned */
+	aggstate->hash_used_bits = 0;
+	aggstate->hash_spill_level = 0;
+	aggstate->hash_input_groups = ((Agg *) aggstate->ss.ps.plan)->numGroups;
+	aggstate->hash_batches_used = 1;
+	aggstate->hash_spill_levels = 0;
 
 	/*
 	 * Process each outer-plan tuple, and then fetch the next one, until we
@@ -2250,25 +2563,64 @@ agg_fill_hash_table(AggState *aggstate)
 		outerslot = fetch_input_tuple(aggstate);
 		if (TupIsNull(outerslot))
 			break;
-		/* set up for advance_aggregates call */
-		tmpcontext->ecxt_outertuple = outerslot;
+		agg_hash_advance(aggstate, outerslot);
+	}
 
-		/* Find or build hashtable entry for this tuple's group */
-		entry = lookup_hash_entry(aggstate, outerslot);
+	hash_agg_finish_spill(aggstate);
 
-		/* Advance the aggregates */
-		if (DO_AGGSPLIT_COMBINE(aggstate->aggsplit))
-			combine_aggregates(aggstate, entry->pergroup);
-		else
-			advance_aggregates(aggstate, entry->pergroup);
+	aggstate->table_filled = true;
+	/* Initialize to walk the hash table */
+	ResetTupleHashIterator(aggstate->hashtable, &aggstate->hashiter);
+}
 
-		/* Reset per-input-tuple context after each tuple */
-		ResetExprContext(tmpcontext);
+/*
+ * ExecAgg for hashed case: once all groups of the hash table have been
+ * returned, aggregate the next spilled batch into an empty table.  Returns
+ * false if there are no batches left.
+ */
+static bool
+agg_refill_hash_table(AggState *aggstate)
+{
+	HashAggBatch batch;
+	TupleTableSlot *slot;
+
+	if (aggstate->hash_batches == NIL)
+		return false;
+
+	batch = (HashAggBatch) linitial(aggstate->hash_batches);
+	aggstate->hash_batches = list_delete_first(aggstate->hash_batches);
+
+	/*
+	 * Discard the groups of the previous batch.  The representative tuple
+	 * of the last group returned is among them, so forget it first.  (We
+	 * use rescan rather than reset so that any callbacks registered by the
+	 * transition functions get run.)
+	 */
+	ExecClearTuple(aggstate->ss.ss_ScanTupleSlot);
+	ReScanExprContext(aggstate->aggcontexts[0]);
+	build_hash_table(aggstate);
+
+	aggstate->hash_used_bits = batch->used_bits;
+	aggstate->hash_spill_level = batch->level;
+	aggstate->hash_input_groups = batch->ntuples;
+	aggstate->hash_batches_used++;
+
+	for (;;)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		slot = hash_agg_read_spilled(aggstate, batch);
+		if (TupIsNull(slot))
+			break;
+		agg_hash_advance(aggstate, slot);
 	}
 
-	aggstate->table_filled = true;
+	hash_agg_release_batch(batch);
+	hash_agg_finish_spill(aggstate);
+
 	/* Initialize to walk the hash table */
 	ResetTupleHashIterator(aggstate->hashtable, &aggstate->hashiter);
+	return true;
 }
 
 /*
@@ -2304,6 +2656,10 @@ agg_retrieve_hash_table(AggState *aggstate)
 		entry = (AggHashEntry) ScanTupleHashTable(&aggstate->hashiter);
 		if (entry == NULL)
 		{
+			/* Move on to the next spilled batch, if there is one */
+			if (agg_refill_hash_table(aggstate))
+				continue;
+
 			/* No more entries in hashtable, so done */
 			aggstate->agg_done = TRUE;
 			return NULL;
@@ -2399,6 +2755,9 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 	aggstate->hashtable = NULL;
 	aggstate->sort_in = NULL;
 	aggstate->sort_out = NULL;
+	aggstate->jit_advance = NULL;
+	aggstate->jit_advance_tried = false;
+	aggstate->batch_mode = false;
 
 	/*
 	 * Calculate the maximum number of grouping sets in any phase; this
@@ -2636,6 +2995,12 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 		aggstate->table_filled = false;
 		/* Compute the columns we actually need to hash on */
 		aggstate->hash_needed = find_hash_columns(aggstate);
+
+		/* Set up for spilling input tuples if the table exceeds work_mem */
+		aggstate->hash_mem_limit = work_mem * 1024L;
+		aggstate->hash_spill_slot = ExecInitExtraTupleSlot(estate);
+		ExecSetSlotDescriptor(aggstate->hash_spill_slot,
+							  aggstate->ss.ss_ScanTupleSlot->tts_tupleDescriptor);
 	}
 	else
 	{
@@ -2949,6 +3314,11 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 	aggstate->numaggs = aggno + 1;
 	aggstate->numtrans = transno + 1;
 
+	/*
+	 * If enabled, see whether the input can be consumed a batch at a time.
+	 */
+	aggstate->batch_mode = batch_execution && agg_init_batch(aggstate);
+
 	return aggstate;
 }
 
@@ -3440,6 +3810,9 @@ ExecEndAgg(AggState *node)
 	for (setno = 0; setno < numGroupingSets; setno++)
 		ReScanExprContext(node->aggcontexts[setno]);
 
+	/* Close the tapes of any spilled hash aggregation batches */
+	hash_agg_reset_spill(node);
+
 	/*
 	 * We don't actually free any ExprContexts here (see comment in
 	 * ExecFreeExprContext), just unlinking the output one from the plan node
@@ -3483,14 +3856,19 @@ ExecReScanAgg(AggState *node)
 		 * If we do have the hash table, and the subplan does not have any
 		 * parameter changes, and none of our own parameter changes affect
 		 * input expressions of the aggregated functions, then we can just
-		 * rescan the existing hash table; no need to build it again.
+		 * rescan the existing hash table; no need to build it again.  That
+		 * doesn't work if the input was spilled, though, since then the
+		 * table only holds the groups of the last batch.
 		 */
 		if (outerPlan->chgParam == NULL &&
-			!bms_overlap(node->ss.ps.chgParam, aggnode->aggParams))
+			!bms_overlap(node->ss.ps.chgParam, aggnode->aggParams) &&
+			node->hash_batches_used == 1)
 		{
 			ResetTupleHashIterator(node->hashtable, &node->hashiter);
 			return;
 		}
+
+		hash_agg_reset_spill(node);
 	}
 
 	/* Make sure we have closed any open tuplesorts */
@@ -25,6 +25,7 @@
 #include <limits.h>
 
 #include "access/htup_details.h"
+#include "access/parallel.h"
 #include "catalog/pg_statistic.h"
 #include "commands/tablespace.h"
 #include "executor/execdebug.h"
@@ -32,6 +33,8 @@
 #include "executor/nodeHash.h"
 #include "executor/nodeHashjoin.h"
 #include "miscadmin.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
 #include "utils/dynahash.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
@@ -50,6 +53,50 @@ static void ExecHashRemoveNextSkewBucket(HashJoinTable hashtable);
 
 static void *dense_alloc(HashJoinTable hashtable, Size size);
 
+static bool ExecHashBuildShared(HashState *node, double *ntuples);
+static void ExecHashLoadShared(HashState *node, int firstslice, int endslice,
+				   double *ntuples, Size *chunk);
+static uint32 ExecHashAllocShared(ParallelHashJoinState *pstate, Size size,
+					Size *chunk);
+static bool ExecHashFinishShared(ParallelHashJoinState *pstate);
+
+/*
+ * Convert an offset in a shared hash table to a tuple pointer that is valid
+ * in this process.  Offset 0 is the table header, so it means "no tuple".
+ */
+static inline HashJoinTuple
+ExecHashSharedTuple(ParallelHashJoinState *pstate, Size offset)
+{
+	if (offset == 0)
+		return NULL;
+	return (HashJoinTuple) ((char *) pstate + offset);
+}
+
+/* first tuple in the given bucket of the main hash table */
+static inline HashJoinTuple
+ExecHashFirstTuple(HashJoinTable hashtable, int bucketno)
+{
+	ParallelHashJoinState *pstate = hashtable->parallel_state;
+
+	if (pstate != NULL)
+	{
+		pg_atomic_uint32 *buckets;
+
+		buckets = (pg_atomic_uint32 *) ((char *) pstate + pstate->buckets);
+		return ExecHashSharedTuple(pstate, pg_atomic_read_u32(&buckets[bucketno]));
+	}
+	return hashtable->buckets[bucketno];
+}
+
+/* next tuple in the same bucket of the main hash table */
+static inline HashJoinTuple
+ExecHashNextTuple(HashJoinTable hashtable, HashJoinTuple tuple)
+{
+	if (hashtable->parallel_state != NULL)
+		return ExecHashSharedTuple(hashtable->parallel_state, tuple->next.shared);
+	return tuple->next.unshared;
+}
+
 /* ----------------------------------------------------------------
  *		ExecHash
  *
@@ -79,6 +126,7 @@ MultiExecHash(HashState *node)
 	TupleTableSlot *slot;
 	ExprContext *econtext;
 	uint32		hashvalue;
+	double		ntuples;
 
 	/* must provide our own instrumentation support */
 	if (node->ps.instrument)
@@ -90,6 +138,21 @@ MultiExecHash(HashState *node)
 	outerNode = outerPlanState(node);
 	hashtable = node->hashtable;
 
+	/*
+	 * In a parallel query, try to use the table shared by all participants.
+	 * It doesn't track match flags per participant, so it can't be used for
+	 * right and full joins, which are the ones keeping NULL inner tuples.
+	 */
+	if (node->parallel_state != NULL && !hashtable->keepNulls &&
+		hashtable->nbatch == 1 && !hashtable->skewEnabled &&
+		ExecHashBuildShared(node, &ntuples))
+	{
+		/* must provide our own instrumentation support */
+		if (node->ps.instrument)
+			InstrStopNode(node->ps.instrument, ntuples);
+		return NULL;
+	}
+
 	/*
 	 * set expression context
 	 */
@@ -174,6 +237,8 @@ ExecInitHash(Hash *node, EState *estate, int eflags)
 	hashstate->ps.state = estate;
 	hashstate->hashtable = NULL;
 	hashstate->hashkeys = NIL;	/* will be set by parent HashJoin */
+	hashstate->parallel_state = NULL;
+	hashstate->pstate_len = 0;
 
 	/*
 	 * Miscellaneous initialization
@@ -306,6 +371,7 @@ ExecHashTableCreate(Hash *node, List *hashOperators, bool keepNulls)
 	hashtable->spaceAllowedSkew =
 		hashtable->spaceAllowed * SKEW_WORK_MEM_PERCENT / 100;
 	hashtable->chunks = NULL;
+	hashtable->parallel_state = NULL;
 
 #ifdef HJDEBUG
 	printf("Hashjoin %p: initial nbatch = %d, nbuckets = %d\n",
@@ -703,7 +769,7 @@ ExecHashIncreaseNumBatches(HashJoinTable hashtable)
 				memcpy(copyTuple, hashTuple, hashTupleSize);
 
 				/* and add it back to the appropriate bucket */
-				copyTuple->next = hashtable->buckets[bucketno];
+				copyTuple->next.unshared = hashtable->buckets[bucketno];
 				hashtable->buckets[bucketno] = copyTuple;
 			}
 			else
@@ -807,7 +873,7 @@ ExecHashIncreaseNumBuckets(HashJoinTable hashtable)
 									  &bucketno, &batchno);
 
 			/* add the tuple to the proper bucket */
-			hashTuple->next = hashtable->buckets[bucketno];
+			hashTuple->next.unshared = hashtable->buckets[bucketno];
 			hashtable->buckets[bucketno] = hashTuple;
 
 			/* advance index past the tuple */
@@ -869,7 +935,7 @@ ExecHashTableInsert(HashJoinTable hashtable,
 		HeapTupleHeaderClearMatch(HJTUPLE_MINTUPLE(hashTuple));
 
 		/* Push it onto the front of the bucket's list */
-		hashTuple->next = hashtable->buckets[bucketno];
+		hashTuple->next.unshared = hashtable->buckets[bucketno];
 		hashtable->buckets[bucketno] = hashTuple;
 
 		/*
@@ -1076,11 +1142,11 @@ ExecScanHashBucket(HashJoinState *hjstate,
 	 * otherwise scan the standard hashtable bucket.
 	 */
 	if (hashTuple != NULL)
-		hashTuple = hashTuple->next;
+		hashTuple = ExecHashNextTuple(hashtable, hashTuple);
 	else if (hjstate->hj_CurSkewBucketNo != INVALID_SKEW_BUCKET_NO)
 		hashTuple = hashtable->skewBucket[hjstate->hj_CurSkewBucketNo]->tuples;
 	else
-		hashTuple = hashtable->buckets[hjstate->hj_CurBucketNo];
+		hashTuple = ExecHashFirstTuple(hashtable, hjstate->hj_CurBucketNo);
 
 	while (hashTuple != NULL)
 	{
@@ -1104,7 +1170,7 @@ ExecScanHashBucket(HashJoinState *hjstate,
 			}
 		}
 
-		hashTuple = hashTuple->next;
+		hashTuple = ExecHashNextTuple(hashtable, hashTuple);
 	}
 
 	/*
@@ -1155,7 +1221,7 @@ ExecScanHashTableForUnmatched(HashJoinState *hjstate, ExprContext *econtext)
 		 * bucket.
 		 */
 		if (hashTuple != NULL)
-			hashTuple = hashTuple->next;
+			hashTuple = hashTuple->next.unshared;
 		else if (hjstate->hj_CurBucketNo < hashtable->nbuckets)
 		{
 			hashTuple = hashtable->buckets[hjstate->hj_CurBucketNo];
@@ -1194,7 +1260,7 @@ ExecScanHashTableForUnmatched(HashJoinState *hjstate, ExprContext *econtext)
 				return true;
 			}
 
-			hashTuple = hashTuple->next;
+			hashTuple = hashTuple->next.unshared;
 		}
 	}
 
@@ -1247,7 +1313,8 @@ ExecHashTableResetMatchFlags(HashJoinTable hashtable)
 	/* Reset all flags in the main table ... */
 	for (i = 0; i < hashtable->nbuckets; i++)
 	{
-		for (tuple = hashtable->buckets[i]; tuple != NULL; tuple = tuple->next)
+		for (tuple = hashtable->buckets[i]; tuple != NULL;
+			 tuple = tuple->next.unshared)
 			HeapTupleHeaderClearMatch(HJTUPLE_MINTUPLE(tuple));
 	}
 
@@ -1257,7 +1324,8 @@ ExecHashTableResetMatchFlags(HashJoinTable hashtable)
 		int			j = hashtable->skewBucketNums[i];
 		HashSkewBucket *skewBucket = hashtable->skewBucket[j];
 
-		for (tuple = skewBucket->tuples; tuple != NULL; tuple = tuple->next)
+		for (tuple = skewBucket->tuples; tuple != NULL;
+			 tuple = tuple->next.unshared)
 			HeapTupleHeaderClearMatch(HJTUPLE_MINTUPLE(tuple));
 	}
 }
@@ -1509,7 +1577,7 @@ ExecHashSkewTableInsert(HashJoinTable hashtable,
 	HeapTupleHeaderClearMatch(HJTUPLE_MINTUPLE(hashTuple));
 
 	/* Push it onto the front of the skew bucket's list */
-	hashTuple->next = hashtable->skewBucket[bucketNumber]->tuples;
+	hashTuple->next.unshared = hashtable->skewBucket[bucketNumber]->tuples;
 	hashtable->skewBucket[bucketNumber]->tuples = hashTuple;
 
 	/* Account for space used, and back off if we've used too much */
@@ -1558,7 +1626,7 @@ ExecHashRemoveNextSkewBucket(HashJoinTable hashtable)
 	hashTuple = bucket->tuples;
 	while (hashTuple != NULL)
 	{
-		HashJoinTuple nextHashTuple = hashTuple->next;
+		HashJoinTuple nextHashTuple = hashTuple->next.unshared;
 		MinimalTuple tuple;
 		Size		tupleSize;
 
@@ -1584,7 +1652,7 @@ ExecHashRemoveNextSkewBucket(HashJoinTable hashtable)
 			memcpy(copyTuple, hashTuple, tupleSize);
 			pfree(hashTuple);
 
-			copyTuple->next = hashtable->buckets[bucketno];
+			copyTuple->next.unshared = hashtable->buckets[bucketno];
 			hashtable->buckets[bucketno] = copyTuple;
 
 			/* We have reduced skew space, but overall space doesn't change */
@@ -1716,3 +1784,467 @@ dense_alloc(HashJoinTable hashtable, Size size)
 	/* return pointer to the start of the tuple memory */
 	return ptr;
 }
+
+/* ----------------------------------------------------------------
+ *						Parallel Hash Support
+ * ----------------------------------------------------------------
+ */
+
+/*
+ * ExecHashBuildShared
+ *		load, together with the other participants, the shared hash table
+ *
+ * Returns false if the shared table can't be used, in which case the caller
+ * must build a private one as usual.  *ntuples is set to the number of inner
+ * tuples this participant loaded itself, for instrumentation.
+ */
+static bool
+ExecHashBuildShared(HashState *node, double *ntuples)
+{
+	ParallelHashJoinState *pstate = node->parallel_state;
+	HashJoinTable hashtable = node->hashtable;
+	int		   *waiters = (int *) ((char *) pstate + pstate->waiters);
+	ParallelHashJoinStatus status;
+	Size		chunk = 0;
+	bool		attached = false;
+	bool		scanned = false;
+	bool		last = false;
+
+	*ntuples = 0;
+
+	SpinLockAcquire(&pstate->mutex);
+	if (pstate->status == PHJ_BUILD_LOADING)
+	{
+		pstate->nattached++;
+		attached = true;
+	}
+	SpinLockRelease(&pstate->mutex);
+
+	while (attached)
+	{
+		int			firstslice;
+		int			endslice;
+
+		/*
+		 * Claim a slice of the hash space to load.  Once we've made a pass,
+		 * take all remaining slices if nobody else is loading, as the workers
+		 * they were meant for may never arrive.  Stop claiming once the space
+		 * has run out, and detach when there's nothing left to load.
+		 */
+		SpinLockAcquire(&pstate->mutex);
+		if (pg_atomic_read_u32(&pstate->outOfSpace) != 0)
+			pstate->nextslice = pstate->nslices;
+		firstslice = pstate->nextslice;
+		if (scanned && pstate->nattached == 1)
+			endslice = pstate->nslices;
+		else
+			endslice = Min(firstslice + 1, pstate->nslices);
+		pstate->nextslice = endslice;
+		if (firstslice == endslice)
+		{
+			pstate->totalTuples += *ntuples;
+			attached = false;
+			if (--pstate->nattached == 0)
+			{
+				pstate->status = PHJ_BUILD_FINISHING;
+				last = true;
+			}
+		}
+		SpinLockRelease(&pstate->mutex);
+
+		if (firstslice == endslice)
+			break;
+
+		/* every pass needs the whole inner relation */
+		if (scanned)
+			ExecReScan(outerPlanState(node));
+		scanned = true;
+
+		ExecHashLoadShared(node, firstslice, endslice, ntuples, &chunk);
+	}
+
+	if (last)
+	{
+		/* the others are done loading, so it's up to us to finish the table */
+		int			nwaiters;
+		int			i;
+
+		status = ExecHashFinishShared(pstate) ? PHJ_BUILD_DONE : PHJ_BUILD_FAILED;
+
+		SpinLockAcquire(&pstate->mutex);
+		pstate->status = status;
+		nwaiters = pstate->nwaiters;
+		pstate->nwaiters = 0;
+		SpinLockRelease(&pstate->mutex);
+
+		/* nobody registers any more, so the array is stable now */
+		for (i = 0; i < nwaiters; i++)
+			SetLatch(&ProcGlobal->allProcs[waiters[i]].procLatch);
+	}
+	else
+	{
+		bool		waiting = false;
+
+		/* wait for the last participant to finish the table */
+		for (;;)
+		{
+			SpinLockAcquire(&pstate->mutex);
+			status = pstate->status;
+			if ((status == PHJ_BUILD_LOADING || status == PHJ_BUILD_FINISHING) &&
+				!waiting)
+			{
+				/* ask the last participant to set our latch once it's done */
+				Assert(pstate->nwaiters < pstate->maxwaiters);
+				waiters[pstate->nwaiters++] = MyProc->pgprocno;
+				waiting = true;
+			}
+			SpinLockRelease(&pstate->mutex);
+
+			if (status == PHJ_BUILD_DONE || status == PHJ_BUILD_FAILED)
+				break;
+
+			WaitLatch(MyLatch, WL_LATCH_SET, 0);
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+
+	if (status == PHJ_BUILD_FAILED)
+	{
+		/*
+		 * The table would need more batches, so every participant builds a
+		 * private one instead.  If we've consumed part of the inner relation,
+		 * start it over.  The shared space is at most work_mem, so this
+		 * repeats only a small part of the scan.
+		 */
+		if (scanned)
+			ExecReScan(outerPlanState(node));
+		*ntuples = 0;
+		return false;
+	}
+
+	/* from now on, probe the shared table instead of our own buckets */
+	hashtable->parallel_state = pstate;
+	hashtable->nbuckets = pstate->nbuckets;
+	hashtable->nbuckets_optimal = pstate->nbuckets;
+	hashtable->log2_nbuckets = pstate->log2_nbuckets;
+	hashtable->log2_nbuckets_optimal = pstate->log2_nbuckets;
+	hashtable->totalTuples = pstate->totalTuples;
+	hashtable->spaceUsed = pstate->spaceUsed;
+	hashtable->spacePeak = pstate->spaceUsed;
+	hashtable->growEnabled = false;
+
+	return true;
+}
+
+/*
+ * ExecHashLoadShared
+ *		run the inner plan and insert the tuples of the given slices into the
+ *		shared table
+ *
+ * Other participants insert the tuples of their slices at the same time, so
+ * tuples are pushed onto the bucket chains atomically.  *chunk is the offset
+ * of the chunk this participant is filling, or 0.  Stops early once the shared
+ * space has run out, whether for us or for someone else.
+ */
+static void
+ExecHashLoadShared(HashState *node, int firstslice, int endslice,
+				   double *ntuples, Size *chunk)
+{
+	ParallelHashJoinState *pstate = node->parallel_state;
+	HashJoinTable hashtable = node->hashtable;
+	PlanState  *outerNode = outerPlanState(node);
+	List	   *hashkeys = node->hashkeys;
+	ExprContext *econtext = node->ps.ps_ExprContext;
+	pg_atomic_uint32 *buckets;
+	TupleTableSlot *slot;
+	uint32		hashvalue;
+
+	buckets = (pg_atomic_uint32 *) ((char *) pstate + pstate->buckets);
+
+	for (;;)
+	{
+		slot = ExecProcNode(outerNode);
+		if (TupIsNull(slot))
+			break;
+		/* We have to compute the hash value */
+		econtext->ecxt_innertuple = slot;
+		if (ExecHashGetHashValue(hashtable, econtext, hashkeys,
+								 false, hashtable->keepNulls,
+								 &hashvalue))
+		{
+			int			slice = hashvalue % pstate->nslices;
+			int			bucketno = hashvalue & (pstate->nbuckets - 1);
+			MinimalTuple tuple;
+			HashJoinTuple hashTuple;
+			uint32		offset;
+			uint32		head;
+
+			/* other participants take care of the other slices */
+			if (slice < firstslice || slice >= endslice)
+				continue;
+
+			if (pg_atomic_read_u32(&pstate->outOfSpace) != 0)
+				return;
+
+			tuple = ExecFetchSlotMinimalTuple(slot);
+			offset = ExecHashAllocShared(pstate,
+										 MAXALIGN(HJTUPLE_OVERHEAD + tuple->t_len),
+										 chunk);
+			if (offset == 0)
+			{
+				pg_atomic_write_u32(&pstate->outOfSpace, 1);
+				return;
+			}
+
+			hashTuple = (HashJoinTuple) ((char *) pstate + offset);
+			hashTuple->hashvalue = hashvalue;
+			memcpy(HJTUPLE_MINTUPLE(hashTuple), tuple, tuple->t_len);
+			HeapTupleHeaderClearMatch(HJTUPLE_MINTUPLE(hashTuple));
+
+			/* the exchange is a full barrier, so the tuple is complete first */
+			head = pg_atomic_read_u32(&buckets[bucketno]);
+			do
+			{
+				hashTuple->next.shared = head;
+			} while (!pg_atomic_compare_exchange_u32(&buckets[bucketno],
+													 &head, offset));
+
+			*ntuples += 1;
+		}
+	}
+}
+
+/*
+ * ExecHashAllocShared
+ *		allocate space for a tuple in the shared table
+ *
+ * Tuples are packed into this participant's current chunk, whose offset is
+ * *chunk, until it's full.  A new chunk is then carved out of the free space,
+ * which all participants take from concurrently.  Returns the offset of the
+ * allocated space, or 0 if there's none left.
+ */
+static uint32
+ExecHashAllocShared(ParallelHashJoinState *pstate, Size size, Size *chunk)
+{
+	ParallelHashChunkData *chunkData;
+	Size		chunkSize;
+	uint32		used;
+
+	if (*chunk != 0)
+	{
+		chunkData = (ParallelHashChunkData *) ((char *) pstate + *chunk);
+		if (chunkData->used + size <= chunkData->size)
+		{
+			uint32		offset = *chunk + chunkData->used;
+
+			chunkData->used += size;
+			return offset;
+		}
+	}
+
+	/* oversized tuples get a chunk of their own, as in dense_alloc */
+	used = pg_atomic_read_u32(&pstate->used);
+	do
+	{
+		if (used + PHJ_CHUNK_HEADER_SIZE + size > pstate->size)
+			return 0;
+		chunkSize = Max(HASH_CHUNK_SIZE, PHJ_CHUNK_HEADER_SIZE + size);
+		chunkSize = Min(chunkSize, pstate->size - used);
+	} while (!pg_atomic_compare_exchange_u32(&pstate->used, &used,
+											 used + chunkSize));
+
+	*chunk = used;
+	chunkData = (ParallelHashChunkData *) ((char *) pstate + used);
+	chunkData->size = chunkSize;
+	chunkData->used = PHJ_CHUNK_HEADER_SIZE + size;
+
+	return used + PHJ_CHUNK_HEADER_SIZE;
+}
+
+/*
+ * ExecHashFinishShared
+ *		complete the shared table once all participants have loaded it
+ *
+ * Run by the last participant to finish loading, while the others wait.  If
+ * the table ended up overfull, it gets a bigger bucket array, as a private one
+ * would in ExecHashIncreaseNumBuckets, provided the array fits in the space
+ * left.  Returns false if the table ran out of space while loading.
+ */
+static bool
+ExecHashFinishShared(ParallelHashJoinState *pstate)
+{
+	uint32		used = pg_atomic_read_u32(&pstate->used);
+	int			nbuckets = pstate->nbuckets;
+	pg_atomic_uint32 *buckets = NULL;
+	Size		tupleSpace = 0;
+	Size		offset;
+	int			i;
+
+	if (pg_atomic_read_u32(&pstate->outOfSpace) != 0)
+		return false;
+
+	while (pstate->totalTuples > nbuckets * NTUP_PER_BUCKET &&
+		   nbuckets <= INT_MAX / 2 &&
+		   nbuckets * 2 <= MaxAllocSize / sizeof(pg_atomic_uint32))
+		nbuckets *= 2;
+
+	if (nbuckets != pstate->nbuckets &&
+		used + nbuckets * sizeof(pg_atomic_uint32) <= pstate->size)
+	{
+		buckets = (pg_atomic_uint32 *) ((char *) pstate + used);
+		for (i = 0; i < nbuckets; i++)
+			pg_atomic_init_u32(&buckets[i], 0);
+	}
+
+	/* walk the chunks, relinking their tuples if the buckets have grown */
+	offset = pstate->chunks;
+	while (offset < used)
+	{
+		ParallelHashChunkData *chunkData;
+		Size		tupleOffset;
+
+		chunkData = (ParallelHashChunkData *) ((char *) pstate + offset);
+		tupleOffset = offset + PHJ_CHUNK_HEADER_SIZE;
+		tupleSpace += chunkData->used;
+
+		while (buckets != NULL && tupleOffset < offset + chunkData->used)
+		{
+			HashJoinTuple hashTuple = ExecHashSharedTuple(pstate, tupleOffset);
+			int			bucketno = hashTuple->hashvalue & (nbuckets - 1);
+
+			hashTuple->next.shared = pg_atomic_read_u32(&buckets[bucketno]);
+			pg_atomic_write_u32(&buckets[bucketno], tupleOffset);
+
+			tupleOffset += MAXALIGN(HJTUPLE_OVERHEAD +
+									HJTUPLE_MINTUPLE(hashTuple)->t_len);
+		}
+
+		offset += chunkData->size;
+	}
+
+	if (buckets != NULL)
+	{
+		pstate->buckets = used;
+		pstate->nbuckets = nbuckets;
+		pstate->log2_nbuckets = my_log2(nbuckets);
+		pg_atomic_write_u32(&pstate->used,
+							used + nbuckets * sizeof(pg_atomic_uint32));
+	}
+	pstate->spaceUsed = tupleSpace + pstate->nbuckets * sizeof(pg_atomic_uint32);
+
+	return true;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecHashEstimate
+ *
+ *		estimates the space required for the shared hash table.
+ * ----------------------------------------------------------------
+ */
+void
+ExecHashEstimate(HashState *node, ParallelContext *pcxt)
+{
+	Hash	   *plan = (Hash *) node->ps.plan;
+	Plan	   *outerNode = outerPlan(plan);
+	int			nbuckets;
+	int			nbatch;
+	int			num_skew_mcvs;
+	double		space;
+
+	/*
+	 * create_hashjoin_plan only marks the node parallel-aware if the join is
+	 * expected to fit in a single batch, since batch files are private to
+	 * each participant, and if the inner plan is unparameterized, so that
+	 * every participant sees the same inner relation.
+	 */
+	ExecChooseHashTableSize(outerNode->plan_rows, outerNode->plan_width,
+							OidIsValid(plan->skewTable),
+							&nbuckets, &nbatch, &num_skew_mcvs);
+
+	/*
+	 * The shared table can't grow once the segment has been created, so
+	 * reserve twice the planner's estimate to absorb misestimation, plus a
+	 * partly filled chunk per participant, but no more than a private table
+	 * would be allowed to use.
+	 */
+	space = outerNode->plan_rows * (HJTUPLE_OVERHEAD +
+									MAXALIGN(SizeofMinimalTupleHeader) +
+									MAXALIGN(outerNode->plan_width));
+	space = 2.0 * space + nbuckets * sizeof(pg_atomic_uint32) +
+		(pcxt->nworkers + 1) * (double) HASH_CHUNK_SIZE;
+	space = Min(space, work_mem * 1024.0);
+
+	/* every participant but the last one to load may wait for it */
+	node->pstate_len = MAXALIGN(sizeof(ParallelHashJoinState)) +
+		MAXALIGN((pcxt->nworkers + 1) * sizeof(int)) +
+		MAXALIGN((Size) space);
+	shm_toc_estimate_chunk(&pcxt->estimator, node->pstate_len);
+	shm_toc_estimate_keys(&pcxt->estimator, 1);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecHashInitializeDSM
+ *
+ *		Set up an empty shared hash table.
+ * ----------------------------------------------------------------
+ */
+void
+ExecHashInitializeDSM(HashState *node, ParallelContext *pcxt)
+{
+	Hash	   *plan = (Hash *) node->ps.plan;
+	Plan	   *outerNode = outerPlan(plan);
+	ParallelHashJoinState *pstate;
+	pg_atomic_uint32 *buckets;
+	int			nbuckets;
+	int			nbatch;
+	int			num_skew_mcvs;
+	int			i;
+
+	/* size the buckets for the planner's estimate, as a private table would */
+	ExecChooseHashTableSize(outerNode->plan_rows, outerNode->plan_width,
+							OidIsValid(plan->skewTable),
+							&nbuckets, &nbatch, &num_skew_mcvs);
+
+	pstate = shm_toc_allocate(pcxt->toc, node->pstate_len);
+	SpinLockInit(&pstate->mutex);
+	pstate->status = PHJ_BUILD_LOADING;
+	pstate->nattached = 0;
+	pstate->nextslice = 0;
+	pstate->totalTuples = 0;
+	pstate->nwaiters = 0;
+	pstate->maxwaiters = pcxt->nworkers + 1;
+	pstate->waiters = MAXALIGN(sizeof(ParallelHashJoinState));
+	pstate->nslices = pcxt->nworkers + 1;
+	pstate->nbuckets = nbuckets;
+	pstate->log2_nbuckets = my_log2(nbuckets);
+	pstate->buckets = pstate->waiters +
+		MAXALIGN(pstate->maxwaiters * sizeof(int));
+	pstate->chunks = pstate->buckets +
+		MAXALIGN(nbuckets * sizeof(pg_atomic_uint32));
+	pstate->spaceUsed = 0;
+	pstate->size = node->pstate_len;
+	pg_atomic_init_u32(&pstate->used, pstate->chunks);
+	pg_atomic_init_u32(&pstate->outOfSpace, 0);
+
+	/* ExecHashEstimate reserved room for the buckets */
+	Assert(pstate->chunks <= pstate->size);
+	buckets = (pg_atomic_uint32 *) ((char *) pstate + pstate->buckets);
+	for (i = 0; i < nbuckets; i++)
+		pg_atomic_init_u32(&buckets[i], 0);
+
+	shm_toc_insert(pcxt->toc, node->ps.plan->plan_node_id, pstate);
+	node->parallel_state = pstate;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecHashInitializeWorker
+ *
+ *		Copy relevant information from TOC into planstate.
+ * ----------------------------------------------------------------
+ */
+void
+ExecHashInitializeWorker(HashState *node, shm_toc *toc)
+{
+	node->parallel_state = shm_toc_lookup(toc, node->ps.plan->plan_node_id);
+}
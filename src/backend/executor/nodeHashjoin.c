@@ -296,7 +296,14 @@ ExecHashJoin(HashJoinState *node)
 				if (joinqual == NIL || ExecQual(joinqual, econtext, false))
 				{
 					node->hj_MatchedOuter = true;
-					HeapTupleHeaderSetMatch(HJTUPLE_MINTUPLE(node->hj_CurTuple));
+
+					/*
+					 * Only right and full joins look at the inner tuple's
+					 * match flag.  Don't set it otherwise, since the tuple
+					 * may be in a table shared with other processes.
+					 */
+					if (HJ_FILL_INNER(node))
+						HeapTupleHeaderSetMatch(HJTUPLE_MINTUPLE(node->hj_CurTuple));
 
 					/* In an antijoin, we never return a matched tuple */
 					if (node->js.jointype == JOIN_ANTI)
@@ -564,20 +571,25 @@ ExecInitHashJoin(HashJoin *node, EState *estate, int eflags)
 	 * that we can evaluate those subexpressions separately.  Also make a list
 	 * of the hash operator OIDs, in preparation for looking up the hash
 	 * functions to use.
+	 *
+	 * The arguments are initialized on their own, rather than taken from the
+	 * hash clauses' ExprStates, since ExecInitExpr may have compiled each
+	 * clause into a single program.
 	 */
 	lclauses = NIL;
 	rclauses = NIL;
 	hoperators = NIL;
-	foreach(l, hjstate->hashclauses)
+	foreach(l, node->hashclauses)
 	{
-		FuncExprState *fstate = (FuncExprState *) lfirst(l);
-		OpExpr	   *hclause;
+		OpExpr	   *hclause = (OpExpr *) lfirst(l);
 
-		Assert(IsA(fstate, FuncExprState));
-		hclause = (OpExpr *) fstate->xprstate.expr;
 		Assert(IsA(hclause, OpExpr));
-		lclauses = lappend(lclauses, linitial(fstate->args));
-		rclauses = lappend(rclauses, lsecond(fstate->args));
+		lclauses = lappend(lclauses,
+						   ExecInitExpr((Expr *) linitial(hclause->args),
+										(PlanState *) hjstate));
+		rclauses = lappend(rclauses,
+						   ExecInitExpr((Expr *) lsecond(hclause->args),
+										(PlanState *) hjstate));
 		hoperators = lappend_oid(hoperators, hclause->opno);
 	}
 	hjstate->hj_OuterHashKeys = lclauses;
@@ -20,6 +20,9 @@
  *		ExecEndSeqScan			releases any storage allocated.
  *		ExecReScanSeqScan		rescans the relation
  *
+ *		ExecSeqScanInitBatch	prepares to return tuples a page at a time
+ *		ExecSeqScanBatch		returns the next page's qualifying tuples
+ *
  *		ExecSeqScanEstimate		estimates DSM space needed for parallel scan
  *		ExecSeqScanInitializeDSM initialize DSM for parallel scan
  *		ExecSeqScanInitializeWorker attach to DSM info in parallel worker
@@ -27,9 +30,13 @@
 #include "postgres.h"
 
 #include "access/relscan.h"
+#include "executor/execBatch.h"
 #include "executor/execdebug.h"
 #include "executor/nodeSeqscan.h"
+#include "storage/bufmgr.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/tqual.h"
 
 static void InitScanRelation(SeqScanState *node, EState *estate, int eflags);
 static TupleTableSlot *SeqNext(SeqScanState *node);
@@ -283,6 +290,119 @@ ExecReScanSeqScan(SeqScanState *node)
 	ExecScanReScan((ScanState *) node);
 }
 
+/* ----------------------------------------------------------------
+ *						Batch Mode Support
+ * ----------------------------------------------------------------
+ */
+
+/* ----------------------------------------------------------------
+ *		ExecSeqScanInitBatch
+ *
+ *		Prepares the scan to be run through ExecSeqScanBatch, returning
+ *		batches with the first natts columns deformed.  Returns false if
+ *		that's not possible, in which case the scan has to be run a tuple
+ *		at a time.
+ * ----------------------------------------------------------------
+ */
+bool
+ExecSeqScanInitBatch(SeqScanState *node, int natts)
+{
+	EState	   *estate = node->ss.ps.state;
+	SeqScan    *plan = (SeqScan *) node->ss.ps.plan;
+	Relation	relation = node->ss.ss_currentRelation;
+
+	/* batches hold scan tuples, so there must be nothing to project */
+	if (node->ss.ps.ps_ProjInfo != NULL)
+		return false;
+
+	/* the scan is only run page-at-a-time with an MVCC snapshot */
+	if (!IsMVCCSnapshot(estate->es_snapshot))
+		return false;
+
+	/* EvalPlanQual rechecks substitute a test tuple for the scan */
+	if (estate->es_epqTuple != NULL)
+		return false;
+
+	node->batchqual = ExecInitBatchQual(plan->plan.qual, plan->scanrelid,
+										&natts);
+	if (node->batchqual == NULL)
+		return false;
+
+	node->batch = ExecCreateTupleBatch(RelationGetDescr(relation), natts,
+									   MaxHeapTuplesPerPage);
+
+	return true;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecSeqScanBatch
+ *
+ *		Returns the tuples of the next page of the relation that satisfy
+ *		the scan's qual, or NULL at the end of the scan.  Pages with no
+ *		qualifying tuples are skipped.
+ *
+ *		The batch's by-reference values point into the page, which stays
+ *		pinned by the scan until the next call.
+ * ----------------------------------------------------------------
+ */
+TupleBatch *
+ExecSeqScanBatch(SeqScanState *node)
+{
+	EState	   *estate = node->ss.ps.state;
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	Relation	relation = node->ss.ss_currentRelation;
+	HeapScanDesc scandesc = node->ss.ss_currentScanDesc;
+	TupleBatch *batch = node->batch;
+
+	Assert(batch != NULL);
+	Assert(ScanDirectionIsForward(estate->es_direction));
+
+	if (scandesc == NULL)
+	{
+		/* not parallel, or a parallel scan being executed serially */
+		scandesc = heap_beginscan(relation, estate->es_snapshot, 0, NULL);
+		node->ss.ss_currentScanDesc = scandesc;
+	}
+
+	while (heap_getnextpage(scandesc))
+	{
+		Page		dp = BufferGetPage(scandesc->rs_cbuf);
+		HeapTupleData tuple;
+		MemoryContext oldcontext;
+		int			i;
+
+		/* deform the page's visible tuples */
+		batch->nrows = 0;
+		tuple.t_tableOid = RelationGetRelid(relation);
+		for (i = 0; i < scandesc->rs_ntuples; i++)
+		{
+			OffsetNumber lineoff = scandesc->rs_vistuples[i];
+			ItemId		lpp = PageGetItemId(dp, lineoff);
+
+			Assert(ItemIdIsNormal(lpp));
+			tuple.t_data = (HeapTupleHeader) PageGetItem(dp, lpp);
+			tuple.t_len = ItemIdGetLength(lpp);
+			ItemPointerSet(&tuple.t_self, scandesc->rs_cblock, lineoff);
+
+			ExecBatchStoreTuple(batch, &tuple);
+		}
+
+		/* and filter them, in the per-tuple context, reset for each page */
+		ExecBatchSelectAll(batch);
+		ResetExprContext(econtext);
+		oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+		ExecBatchQual(node->batchqual, batch);
+		MemoryContextSwitchTo(oldcontext);
+
+		InstrCountFiltered1(node, batch->nrows - batch->nsel);
+
+		if (batch->nsel > 0)
+			return batch;
+	}
+
+	return NULL;
+}
+
 /* ----------------------------------------------------------------
  *						Parallel Scan Support
  * ----------------------------------------------------------------
@@ -0,0 +1,199 @@
+/*-------------------------------------------------------------------------
+ *
+ * jit.c
+ *	  Provider independent JIT infrastructure.
+ *
+ * Code related to loading JIT providers, redirecting calls into them, and
+ * the GUCs controlling when JIT compilation is performed.  The provider,
+ * which does the actual code generation, is a shared library loaded on
+ * first use, so that the server doesn't depend on a compiler library
+ * unless JIT compilation is used.
+ *
+ * JIT compilation is triggered by the planner, which sets flags in the
+ * PlannedStmt when the plan's cost exceeds jit_above_cost.  The executor
+ * then asks the provider to compile an expression program when it's first
+ * evaluated, and the transition calls of an Agg node when its first input
+ * tuple is aggregated.  Either way the interpreted form remains, to be used
+ * whenever the provider declines or isn't available.
+ *
+ *
+ * Copyright (c) 2016, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *	  src/backend/jit/jit.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fmgr.h"
+#include "jit/jit.h"
+#include "miscadmin.h"
+#include "nodes/execnodes.h"
+#include "utils/resowner_private.h"
+
+
+/* GUCs */
+bool		jit_enabled = false;
+char	   *jit_provider = NULL;
+bool		jit_expressions = true;
+bool		jit_tuple_deforming = true;
+double		jit_above_cost = 100000;
+double		jit_optimize_above_cost = 500000;
+
+static JitProviderCallbacks provider;
+static bool provider_successfully_loaded = false;
+static bool provider_failed_loading = false;
+
+
+static bool provider_init(void);
+static bool file_exists(const char *name);
+
+
+/*
+ * Return whether a JIT provider has successfully been loaded, caching the
+ * result.
+ */
+static bool
+provider_init(void)
+{
+	char		path[MAXPGPATH];
+	JitProviderInit init;
+
+	/* don't even try to load if not enabled */
+	if (!jit_enabled)
+		return false;
+
+	/*
+	 * Don't retry loading after failing - attempting to load JIT provider
+	 * isn't cheap.
+	 */
+	if (provider_failed_loading)
+		return false;
+	if (provider_successfully_loaded)
+		return true;
+
+	/*
+	 * Check whether shared library exists.  We do that check before actually
+	 * attempting to load the shared library (via load_external_function()),
+	 * because that'd error out in case the shlib isn't available.
+	 */
+	snprintf(path, MAXPGPATH, "%s/%s%s", pkglib_path, jit_provider, DLSUFFIX);
+	elog(DEBUG1, "probing availability of JIT provider at %s", path);
+	if (!file_exists(path))
+	{
+		elog(DEBUG1,
+			 "provider not available, disabling JIT for current session");
+		provider_failed_loading = true;
+		return false;
+	}
+
+	/*
+	 * If loading functions fails, signal failure.  We do so because
+	 * load_external_function() might error out despite the above check if
+	 * e.g. the library's dependencies aren't installed.  We want to signal
+	 * ERROR in that case, so the user is notified, but we don't want to
+	 * continually retry.
+	 */
+	provider_failed_loading = true;
+
+	/* and initialize */
+	init = (JitProviderInit)
+		load_external_function(path, "_PG_jit_provider_init", true, NULL);
+	init(&provider);
+
+	provider_successfully_loaded = true;
+	provider_failed_loading = false;
+
+	elog(DEBUG1, "successfully loaded JIT provider in current session");
+
+	return true;
+}
+
+/*
+ * Release resources required by one JIT context.
+ */
+void
+jit_release_context(JitContext *context)
+{
+	if (provider_successfully_loaded)
+		provider.release_context(context);
+
+	ResourceOwnerForgetJIT(context->resowner, context);
+	pfree(context);
+}
+
+/*
+ * Ask provider to JIT compile an expression program.
+ *
+ * Returns true if successful, in which case the provider has replaced the
+ * program's evalfunc; false if the program should be interpreted.
+ */
+bool
+jit_compile_expr(struct ExprProgramState *state, struct ExprContext *econtext)
+{
+	EState	   *estate = econtext->ecxt_estate;
+
+	/*
+	 * We can easily create a one-off context for functions without an
+	 * associated EState, but there's no point: they're not run long enough
+	 * to make compilation worthwhile.
+	 */
+	if (estate == NULL)
+		return false;
+
+	/* if no jitting should be performed at all */
+	if (!(estate->es_jit_flags & PGJIT_PERFORM))
+		return false;
+
+	/* or if expressions aren't JITed */
+	if (!(estate->es_jit_flags & PGJIT_EXPR))
+		return false;
+
+	/* this also takes !jit_enabled into account */
+	if (provider_init())
+		return provider.compile_expr(state, econtext);
+
+	return false;
+}
+
+/*
+ * Ask provider to JIT compile the transition calls of an Agg node, which
+ * replace advance_aggregates() if successful.
+ */
+bool
+jit_compile_agg_advance(struct AggState *aggstate)
+{
+	EState	   *estate = aggstate->ss.ps.state;
+
+	if (!(estate->es_jit_flags & PGJIT_PERFORM))
+		return false;
+	if (!(estate->es_jit_flags & PGJIT_EXPR))
+		return false;
+
+	if (provider_init())
+		return provider.compile_agg_advance(aggstate);
+
+	return false;
+}
+
+static bool
+file_exists(const char *name)
+{
+	struct stat st;
+
+	AssertArg(name != NULL);
+
+	if (stat(name, &st) == 0)
+		return S_ISDIR(st.st_mode) ? false : true;
+	else if (!(errno == ENOENT || errno == ENOTDIR))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not access file \"%s\": %m", name)));
+
+	return false;
+}
@@ -0,0 +1,1799 @@
+/*-------------------------------------------------------------------------
+ *
+ * llvmjit.c
+ *	  JIT provider compiling expression programs, tuple deforming and
+ *	  aggregate transition calls to native code using LLVM.
+ *
+ * Code is generated with LLVM's C API directly from the steps of an
+ * ExprProgramState (see executor/execExprProgram.c) and from the tuple
+ * descriptor and per-transition state of the node it serves, so there is
+ * no C source to keep in sync with the interpreter beyond the semantics of
+ * each step.  Structs are accessed through byte offsets computed by the C
+ * compiler, and pointers that are fixed for the lifetime of the plan, like
+ * the FunctionCallInfo of a function call step, are embedded as constants.
+ * That means the code is specific to one plan node, and is released along
+ * with the EState.
+ *
+ * Each compiled function goes into a module of its own, which is optimized
+ * and handed to one of two ORC LLJIT instances, one emitting code with and
+ * one without codegen optimizations.  The code of one JitContext is tracked
+ * by an ORC resource tracker, so it can be released in one go.
+ *
+ *
+ * Copyright (c) 2016, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *	  src/backend/jit/llvm/llvmjit.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <llvm-c/Analysis.h>
+#include <llvm-c/Core.h>
+#include <llvm-c/Error.h>
+#include <llvm-c/ErrorHandling.h>
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Orc.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+
+#include "access/htup_details.h"
+#include "executor/execExprProgram.h"
+#include "executor/executor.h"
+#include "executor/nodeAgg.h"
+#include "jit/jit.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "utils/memutils.h"
+#include "utils/resowner_private.h"
+
+PG_MODULE_MAGIC;
+
+
+typedef struct LLVMJitContext
+{
+	JitContext	base;
+
+	/* LLJIT instance the code is emitted with, chosen by PGJIT_OPT3 */
+	LLVMOrcLLJITRef lljit;
+
+	/* tracks the code emitted for this context, NULL if none yet */
+	LLVMOrcResourceTrackerRef tracker;
+} LLVMJitContext;
+
+/* state of the function being generated */
+typedef struct LLVMJitBuild
+{
+	LLVMJitContext *context;
+	LLVMModuleRef module;
+	LLVMBuilderRef b;
+} LLVMJitBuild;
+
+
+extern void _PG_jit_provider_init(JitProviderCallbacks *cb);
+
+static void llvm_release_context(JitContext *context);
+static bool llvm_compile_expr(ExprProgramState *state, ExprContext *econtext);
+static bool llvm_compile_agg_advance(AggState *aggstate);
+
+static void llvm_session_initialize(void);
+static LLVMOrcLLJITRef llvm_create_jit_instance(LLVMCodeGenOptLevel opt_level);
+static void llvm_fatal_error_handler(const char *reason);
+static void llvm_error_report(int elevel, LLVMErrorRef error,
+				  const char *what);
+static LLVMJitContext *llvm_get_context(EState *estate);
+static char *llvm_expand_funcname(const char *basename);
+static void llvm_start_build(LLVMJitBuild *build, LLVMJitContext *context);
+static void *llvm_finish_build(LLVMJitBuild *build, const char *funcname,
+				  instr_time starttime);
+static LLVMValueRef llvm_compile_deform(LLVMJitBuild *build,
+					TupleDesc desc, int natts);
+static void llvm_compile_fetch(LLVMJitBuild *build, LLVMJitContext *context,
+				   LLVMValueRef v_slot, TupleTableSlot *slot, int last,
+				   LLVMBasicBlockRef next);
+static void llvm_compile_funccall(LLVMJitBuild *build, ExprProgramStep *op,
+					  LLVMValueRef v_resvaluep, LLVMValueRef v_resnullp);
+
+
+/* session state */
+static bool llvm_initialized = false;
+static LLVMOrcThreadSafeContextRef llvm_ts_context;
+static LLVMContextRef llvm_context;
+static LLVMOrcLLJITRef llvm_opt0_orc;
+static LLVMOrcLLJITRef llvm_opt3_orc;
+static char *llvm_triple;
+static char *llvm_cpu;
+static char *llvm_cpu_features;
+static size_t llvm_generation = 0;
+
+/* frequently used types */
+static LLVMTypeRef TypeSizeT;
+static LLVMTypeRef TypeStorageBool;
+static LLVMTypeRef TypeInt16;
+static LLVMTypeRef TypeInt32;
+static LLVMTypeRef TypeInt8;
+static LLVMTypeRef TypeVoid;
+static LLVMTypeRef TypePtr;
+
+
+/*
+ * Helpers to generate code.  All pointers are handled as i8 *, and fields
+ * of structs as byte offsets, cast to a pointer to the field's type.
+ */
+static inline LLVMValueRef
+l_sizet_const(size_t i)
+{
+	return LLVMConstInt(TypeSizeT, i, false);
+}
+
+static inline LLVMValueRef
+l_int32_const(int32 i)
+{
+	return LLVMConstInt(TypeInt32, i, false);
+}
+
+static inline LLVMValueRef
+l_sbool_const(bool i)
+{
+	return LLVMConstInt(TypeStorageBool, (int) i, false);
+}
+
+/* a pointer known when the code is generated */
+static inline LLVMValueRef
+l_ptr_const(const void *ptr, LLVMTypeRef type)
+{
+	return LLVMConstIntToPtr(l_sizet_const((uintptr_t) ptr), type);
+}
+
+/* pointer to a field at offset 'off' within the struct at 'base' */
+static inline LLVMValueRef
+l_field_ptr(LLVMBuilderRef b, LLVMValueRef base, size_t off,
+			LLVMTypeRef fieldtype)
+{
+	LLVMValueRef v_off = l_sizet_const(off);
+	LLVMValueRef v_ptr;
+
+	v_ptr = LLVMBuildBitCast(b, base, TypePtr, "");
+	v_ptr = LLVMBuildGEP2(b, TypeInt8, v_ptr, &v_off, 1, "");
+	return LLVMBuildBitCast(b, v_ptr, LLVMPointerType(fieldtype, 0), "");
+}
+
+static inline LLVMValueRef
+l_load_field(LLVMBuilderRef b, LLVMValueRef base, size_t off,
+			 LLVMTypeRef fieldtype, const char *name)
+{
+	return LLVMBuildLoad2(b, fieldtype,
+						  l_field_ptr(b, base, off, fieldtype), name);
+}
+
+static inline void
+l_store_field(LLVMBuilderRef b, LLVMValueRef value, LLVMValueRef base,
+			  size_t off)
+{
+	LLVMBuildStore(b, value,
+				   l_field_ptr(b, base, off, LLVMTypeOf(value)));
+}
+
+/* element 'idx' of an array of 'elemtype' */
+static inline LLVMValueRef
+l_array_elem_ptr(LLVMBuilderRef b, LLVMTypeRef elemtype, LLVMValueRef array,
+				 LLVMValueRef idx)
+{
+	return LLVMBuildGEP2(b, elemtype, array, &idx, 1, "");
+}
+
+/* is a bool stored in memory true? */
+static inline LLVMValueRef
+l_sbool_is_true(LLVMBuilderRef b, LLVMValueRef v)
+{
+	return LLVMBuildICmp(b, LLVMIntNE, v, l_sbool_const(false), "");
+}
+
+/* DatumGetBool(), as a condition */
+static inline LLVMValueRef
+l_datum_is_true(LLVMBuilderRef b, LLVMValueRef v)
+{
+	return LLVMBuildICmp(b, LLVMIntNE,
+						 LLVMBuildTrunc(b, v, TypeStorageBool, ""),
+						 l_sbool_const(false), "");
+}
+
+/* BoolGetDatum() of a condition */
+static inline LLVMValueRef
+l_bool_datum(LLVMBuilderRef b, LLVMValueRef cond)
+{
+	return LLVMBuildZExt(b, cond, TypeSizeT, "");
+}
+
+/* call a C function by address */
+static LLVMValueRef
+l_call(LLVMBuilderRef b, LLVMTypeRef rettype, const void *fn,
+	   LLVMValueRef *args, int nargs, const char *name)
+{
+	LLVMTypeRef paramtypes[4];
+	LLVMTypeRef fntype;
+	int			i;
+
+	Assert(nargs <= lengthof(paramtypes));
+	for (i = 0; i < nargs; i++)
+		paramtypes[i] = LLVMTypeOf(args[i]);
+	fntype = LLVMFunctionType(rettype, paramtypes, nargs, false);
+
+	return LLVMBuildCall2(b, fntype,
+						  l_ptr_const(fn, LLVMPointerType(fntype, 0)),
+						  args, nargs, name);
+}
+
+static inline LLVMBasicBlockRef
+l_bb_append(LLVMValueRef fn, const char *fmt, int i)
+{
+	char		name[64];
+
+	snprintf(name, sizeof(name), fmt, i);
+	return LLVMAppendBasicBlockInContext(llvm_context, fn, name);
+}
+
+
+/*
+ * Initialize the provider's callbacks.
+ */
+void
+_PG_jit_provider_init(JitProviderCallbacks *cb)
+{
+	cb->release_context = llvm_release_context;
+	cb->compile_expr = llvm_compile_expr;
+	cb->compile_agg_advance = llvm_compile_agg_advance;
+}
+
+/*
+ * Release the code of a JIT context.  The context itself is freed by the
+ * caller.
+ */
+static void
+llvm_release_context(JitContext *context)
+{
+	LLVMJitContext *llvm_jit_context = (LLVMJitContext *) context;
+
+	if (llvm_jit_context->tracker)
+	{
+		LLVMErrorRef error;
+
+		error = LLVMOrcResourceTrackerRemove(llvm_jit_context->tracker);
+		if (error)
+			llvm_error_report(WARNING, error, "could not remove module");
+		LLVMOrcReleaseResourceTracker(llvm_jit_context->tracker);
+		llvm_jit_context->tracker = NULL;
+	}
+}
+
+/*
+ * Per session initialization.
+ */
+static void
+llvm_session_initialize(void)
+{
+	LLVMTargetRef target;
+	char	   *error = NULL;
+
+	if (llvm_initialized)
+		return;
+
+	LLVMInstallFatalErrorHandler(llvm_fatal_error_handler);
+
+	LLVMInitializeNativeTarget();
+	LLVMInitializeNativeAsmPrinter();
+	LLVMInitializeNativeAsmParser();
+
+	llvm_triple = LLVMGetDefaultTargetTriple();
+	if (LLVMGetTargetFromTriple(llvm_triple, &target, &error) != 0)
+		elog(FATAL, "could not look up target \"%s\": %s",
+			 llvm_triple, error);
+
+	/* generate code for the CPU we're running on */
+	llvm_cpu = LLVMGetHostCPUName();
+	llvm_cpu_features = LLVMGetHostCPUFeatures();
+	elog(DEBUG2, "LLVMJIT detected CPU \"%s\", with features \"%s\"",
+		 llvm_cpu, llvm_cpu_features);
+
+	llvm_ts_context = LLVMOrcCreateNewThreadSafeContext();
+	llvm_context = LLVMOrcThreadSafeContextGetContext(llvm_ts_context);
+
+	TypeSizeT = LLVMIntTypeInContext(llvm_context, sizeof(Datum) * 8);
+	TypeStorageBool = LLVMIntTypeInContext(llvm_context, sizeof(bool) * 8);
+	TypeInt8 = LLVMInt8TypeInContext(llvm_context);
+	TypeInt16 = LLVMInt16TypeInContext(llvm_context);
+	TypeInt32 = LLVMInt32TypeInContext(llvm_context);
+	TypeVoid = LLVMVoidTypeInContext(llvm_context);
+	TypePtr = LLVMPointerType(TypeInt8, 0);
+
+	llvm_opt0_orc = llvm_create_jit_instance(LLVMCodeGenLevelNone);
+	llvm_opt3_orc = llvm_create_jit_instance(LLVMCodeGenLevelAggressive);
+
+	llvm_initialized = true;
+}
+
+static LLVMOrcLLJITRef
+llvm_create_jit_instance(LLVMCodeGenOptLevel opt_level)
+{
+	LLVMTargetRef target;
+	LLVMTargetMachineRef tm;
+	LLVMOrcJITTargetMachineBuilderRef tm_builder;
+	LLVMOrcLLJITBuilderRef lljit_builder;
+	LLVMOrcLLJITRef lljit;
+	LLVMOrcDefinitionGeneratorRef process_gen;
+	LLVMErrorRef error;
+	char	   *msg = NULL;
+
+	if (LLVMGetTargetFromTriple(llvm_triple, &target, &msg) != 0)
+		elog(FATAL, "could not look up target \"%s\": %s",
+			 llvm_triple, msg);
+
+	tm = LLVMCreateTargetMachine(target, llvm_triple, llvm_cpu,
+								 llvm_cpu_features, opt_level,
+								 LLVMRelocDefault, LLVMCodeModelJITDefault);
+
+	/* the builders take ownership of what's passed to them */
+	tm_builder = LLVMOrcJITTargetMachineBuilderCreateFromTargetMachine(tm);
+	lljit_builder = LLVMOrcCreateLLJITBuilder();
+	LLVMOrcLLJITBuilderSetJITTargetMachineBuilder(lljit_builder, tm_builder);
+
+	error = LLVMOrcCreateLLJIT(&lljit, lljit_builder);
+	if (error)
+		llvm_error_report(FATAL, error, "could not create LLJIT instance");
+
+	/*
+	 * Generated code calls functions by address, but the optimizer may still
+	 * introduce calls to library functions like memset, so let those be
+	 * resolved from the symbols of the process.
+	 */
+	error = LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(&process_gen,
+											 LLVMOrcLLJITGetGlobalPrefix(lljit),
+																 NULL, NULL);
+	if (error)
+		llvm_error_report(FATAL, error,
+						  "could not create generator for process symbols");
+	LLVMOrcJITDylibAddGenerator(LLVMOrcLLJITGetMainJITDylib(lljit),
+								process_gen);
+
+	return lljit;
+}
+
+static void
+llvm_fatal_error_handler(const char *reason)
+{
+	ereport(FATAL,
+			(errcode(ERRCODE_OUT_OF_MEMORY),
+			 errmsg("fatal llvm error: %s", reason)));
+}
+
+/*
+ * Report an error returned by LLVM, consuming it.
+ */
+static void
+llvm_error_report(int elevel, LLVMErrorRef error, const char *what)
+{
+	char	   *llvm_msg = LLVMGetErrorMessage(error);
+	char	   *msg = pstrdup(llvm_msg);
+
+	LLVMDisposeErrorMessage(llvm_msg);
+	elog(elevel, "%s: %s", what, msg);
+}
+
+/*
+ * Return the JIT context of an EState, creating it if necessary.
+ */
+static LLVMJitContext *
+llvm_get_context(EState *estate)
+{
+	LLVMJitContext *context;
+
+	if (estate->es_jit != NULL)
+		return (LLVMJitContext *) estate->es_jit;
+
+	llvm_session_initialize();
+
+	ResourceOwnerEnlargeJIT(CurrentResourceOwner);
+
+	context = (LLVMJitContext *)
+		MemoryContextAllocZero(TopMemoryContext, sizeof(LLVMJitContext));
+	context->base.flags = estate->es_jit_flags;
+	context->base.resowner = CurrentResourceOwner;
+	context->lljit = (estate->es_jit_flags & PGJIT_OPT3) ?
+		llvm_opt3_orc : llvm_opt0_orc;
+
+	/* ensure the context is released even if the query errors out */
+	ResourceOwnerRememberJIT(CurrentResourceOwner, &context->base);
+
+	estate->es_jit = &context->base;
+
+	return context;
+}
+
+/*
+ * Return a name for a function, unique within the session.
+ */
+static char *
+llvm_expand_funcname(const char *basename)
+{
+	return psprintf("%s_%d_%zu", basename, MyProcPid, llvm_generation++);
+}
+
+/*
+ * Set up a module to generate a function into.
+ */
+static void
+llvm_start_build(LLVMJitBuild *build, LLVMJitContext *context)
+{
+	build->context = context;
+	build->module = LLVMModuleCreateWithNameInContext("pg", llvm_context);
+	LLVMSetTarget(build->module, llvm_triple);
+	LLVMSetDataLayout(build->module,
+					  LLVMOrcLLJITGetDataLayoutStr(context->lljit));
+	build->b = LLVMCreateBuilderInContext(llvm_context);
+}
+
+/*
+ * Optimize and emit the module generated, and return the address of
+ * function 'funcname' within it.  Code generation started at 'starttime'.
+ */
+static void *
+llvm_finish_build(LLVMJitBuild *build, const char *funcname,
+				  instr_time starttime)
+{
+	LLVMJitContext *context = build->context;
+	LLVMPassBuilderOptionsRef options;
+	LLVMOrcThreadSafeModuleRef ts_module;
+	LLVMErrorRef error;
+	instr_time	endtime;
+	uint64_t	addr;
+
+	LLVMDisposeBuilder(build->b);
+
+#ifdef USE_ASSERT_CHECKING
+	{
+		char	   *msg = NULL;
+
+		if (LLVMVerifyModule(build->module, LLVMReturnStatusAction, &msg))
+			elog(ERROR, "generated code for \"%s\" is invalid: %s",
+				 funcname, msg);
+		LLVMDisposeMessage(msg);
+	}
+#endif
+
+	INSTR_TIME_SET_CURRENT(endtime);
+	INSTR_TIME_ACCUM_DIFF(context->base.instr.generation_counter,
+						  endtime, starttime);
+
+	/*
+	 * Optimize.  Even without PGJIT_OPT3, turning the allocas used for local
+	 * state into registers is cheap and makes the code a lot better.
+	 */
+	INSTR_TIME_SET_CURRENT(starttime);
+	options = LLVMCreatePassBuilderOptions();
+	error = LLVMRunPasses(build->module,
+						  (context->base.flags & PGJIT_OPT3) ?
+						  "default<O3>" : "mem2reg",
+						  NULL, options);
+	LLVMDisposePassBuilderOptions(options);
+	if (error)
+		llvm_error_report(ERROR, error, "could not optimize module");
+	INSTR_TIME_SET_CURRENT(endtime);
+	INSTR_TIME_ACCUM_DIFF(context->base.instr.optimization_counter,
+						  endtime, starttime);
+
+	/* and emit the code */
+	INSTR_TIME_SET_CURRENT(starttime);
+	if (context->tracker == NULL)
+		context->tracker = LLVMOrcJITDylibCreateResourceTracker(
+							LLVMOrcLLJITGetMainJITDylib(context->lljit));
+
+	/* the JIT takes ownership of the module */
+	ts_module = LLVMOrcCreateNewThreadSafeModule(build->module,
+												 llvm_ts_context);
+	build->module = NULL;
+	error = LLVMOrcLLJITAddLLVMIRModuleWithRT(context->lljit,
+											  context->tracker, ts_module);
+	if (error)
+		llvm_error_report(ERROR, error, "could not add module");
+
+	error = LLVMOrcLLJITLookup(context->lljit, &addr, funcname);
+	if (error)
+		llvm_error_report(ERROR, error, "could not look up function");
+	INSTR_TIME_SET_CURRENT(endtime);
+	INSTR_TIME_ACCUM_DIFF(context->base.instr.emission_counter,
+						  endtime, starttime);
+
+	context->base.instr.created_functions++;
+
+	return (void *) (uintptr_t) addr;
+}
+
+
+/*
+ * Generate a function deforming the first 'natts' attributes of a heap
+ * tuple stored in a slot whose descriptor is 'desc', starting from the
+ * first attribute; see slot_deform_tuple() and slot_getsomeattrs().
+ *
+ * Knowing the descriptor lets the loop over the attributes be unrolled,
+ * with their lengths, alignments and by-value-ness turned into constants.
+ * The function takes the slot as its only argument.
+ */
+static LLVMValueRef
+llvm_compile_deform(LLVMJitBuild *build, TupleDesc desc, int natts)
+{
+	LLVMBuilderRef b = build->b;
+	LLVMTypeRef param_types[1];
+	LLVMValueRef v_deform_fn;
+	LLVMBasicBlockRef b_entry;
+	LLVMBasicBlockRef b_out;
+	LLVMBasicBlockRef *attcheckblocks;
+	LLVMBasicBlockRef *missingblocks;
+	LLVMValueRef v_slot;
+	LLVMValueRef v_values;
+	LLVMValueRef v_nulls;
+	LLVMValueRef v_tuplep;
+	LLVMValueRef v_tupdata;
+	LLVMValueRef v_infomask;
+	LLVMValueRef v_infomask2;
+	LLVMValueRef v_hasnulls;
+	LLVMValueRef v_maxatt;
+	LLVMValueRef v_hoff;
+	LLVMValueRef v_tupdata_base;
+	LLVMValueRef v_bits;
+	LLVMValueRef v_offp;
+	char	   *funcname;
+	int			attnum;
+
+	funcname = llvm_expand_funcname("deform");
+	param_types[0] = TypePtr;
+	v_deform_fn = LLVMAddFunction(build->module, funcname,
+							LLVMFunctionType(TypeVoid, param_types, 1, false));
+	LLVMSetLinkage(v_deform_fn, LLVMInternalLinkage);
+
+	b_entry = LLVMAppendBasicBlockInContext(llvm_context, v_deform_fn,
+											"entry");
+	attcheckblocks = palloc((natts + 1) * sizeof(LLVMBasicBlockRef));
+	missingblocks = palloc(natts * sizeof(LLVMBasicBlockRef));
+	for (attnum = 0; attnum < natts; attnum++)
+	{
+		attcheckblocks[attnum] = l_bb_append(v_deform_fn,
+											 "block.attr.%d.attcheck", attnum);
+		missingblocks[attnum] = l_bb_append(v_deform_fn,
+											"block.attr.%d.missing", attnum);
+	}
+	b_out = LLVMAppendBasicBlockInContext(llvm_context, v_deform_fn, "out");
+	attcheckblocks[natts] = b_out;
+
+	LLVMPositionBuilderAtEnd(b, b_entry);
+
+	v_offp = LLVMBuildAlloca(b, TypeSizeT, "v_offp");
+	LLVMBuildStore(b, l_sizet_const(0), v_offp);
+
+	v_slot = LLVMGetParam(v_deform_fn, 0);
+	v_values = l_load_field(b, v_slot, offsetof(TupleTableSlot, tts_values),
+							LLVMPointerType(TypeSizeT, 0), "tts_values");
+	v_nulls = l_load_field(b, v_slot, offsetof(TupleTableSlot, tts_isnull),
+						   LLVMPointerType(TypeStorageBool, 0), "tts_isnull");
+	v_tuplep = l_load_field(b, v_slot, offsetof(TupleTableSlot, tts_tuple),
+							TypePtr, "tts_tuple");
+	v_tupdata = l_load_field(b, v_tuplep, offsetof(HeapTupleData, t_data),
+							 TypePtr, "t_data");
+
+	v_infomask = l_load_field(b, v_tupdata,
+							  offsetof(HeapTupleHeaderData, t_infomask),
+							  TypeInt16, "infomask");
+	v_infomask2 = l_load_field(b, v_tupdata,
+							   offsetof(HeapTupleHeaderData, t_infomask2),
+							   TypeInt16, "infomask2");
+
+	/* t_infomask & HEAP_HASNULL */
+	v_hasnulls = LLVMBuildICmp(b, LLVMIntNE,
+							   LLVMBuildAnd(b, v_infomask,
+								  LLVMConstInt(TypeInt16, HEAP_HASNULL, false),
+											""),
+							   LLVMConstInt(TypeInt16, 0, false),
+							   "hasnulls");
+
+	/* HeapTupleHeaderGetNatts() */
+	v_maxatt = LLVMBuildAnd(b, v_infomask2,
+							LLVMConstInt(TypeInt16, HEAP_NATTS_MASK, false),
+							"");
+	v_maxatt = LLVMBuildZExt(b, v_maxatt, TypeInt32, "maxatt");
+
+	v_hoff = l_load_field(b, v_tupdata,
+						  offsetof(HeapTupleHeaderData, t_hoff),
+						  TypeInt8, "t_hoff");
+	v_hoff = LLVMBuildZExt(b, v_hoff, TypeSizeT, "");
+	v_tupdata_base = LLVMBuildGEP2(b, TypeInt8, v_tupdata, &v_hoff, 1,
+								   "tupdata_base");
+	v_bits = l_field_ptr(b, v_tupdata,
+						 offsetof(HeapTupleHeaderData, t_bits),
+						 TypeInt8);
+
+	LLVMBuildBr(b, attcheckblocks[0]);
+
+	for (attnum = 0; attnum < natts; attnum++)
+	{
+		Form_pg_attribute att = desc->attrs[attnum];
+		LLVMValueRef v_attnum = l_int32_const(attnum);
+		LLVMBasicBlockRef b_nullcheck;
+		LLVMBasicBlockRef b_isnull;
+		LLVMBasicBlockRef b_notnull;
+		LLVMValueRef v_off;
+		LLVMValueRef v_attdatap;
+		LLVMValueRef v_value;
+		LLVMValueRef v_incby;
+		int			alignto;
+
+		b_nullcheck = l_bb_append(v_deform_fn, "block.attr.%d.nullcheck",
+								  attnum);
+		b_isnull = l_bb_append(v_deform_fn, "block.attr.%d.isnull", attnum);
+		b_notnull = l_bb_append(v_deform_fn, "block.attr.%d.notnull", attnum);
+
+		/*
+		 * Attributes beyond the end of the tuple, which can happen after ALTER
+		 * TABLE ADD COLUMN, are NULL; this one and all the following ones.
+		 */
+		LLVMPositionBuilderAtEnd(b, attcheckblocks[attnum]);
+		LLVMBuildCondBr(b,
+						LLVMBuildICmp(b, LLVMIntULT, v_attnum, v_maxatt, ""),
+						b_nullcheck, missingblocks[attnum]);
+
+		LLVMPositionBuilderAtEnd(b, missingblocks[attnum]);
+		LLVMBuildStore(b, l_sizet_const(0),
+					   l_array_elem_ptr(b, TypeSizeT, v_values, v_attnum));
+		LLVMBuildStore(b, l_sbool_const(true),
+				   l_array_elem_ptr(b, TypeStorageBool, v_nulls, v_attnum));
+		if (attnum + 1 < natts)
+			LLVMBuildBr(b, missingblocks[attnum + 1]);
+		else
+			LLVMBuildBr(b, b_out);
+
+		/* att_isnull() */
+		LLVMPositionBuilderAtEnd(b, b_nullcheck);
+		{
+			LLVMValueRef v_byte;
+			LLVMValueRef v_isnull;
+			LLVMValueRef v_byteno = l_sizet_const(attnum >> 3);
+
+			v_byte = LLVMBuildLoad2(b, TypeInt8,
+									LLVMBuildGEP2(b, TypeInt8, v_bits,
+												  &v_byteno, 1, ""),
+									"");
+			v_isnull = LLVMBuildICmp(b, LLVMIntEQ,
+									 LLVMBuildAnd(b, v_byte,
+								  LLVMConstInt(TypeInt8, 1 << (attnum & 0x07),
+											   false), ""),
+									 LLVMConstInt(TypeInt8, 0, false), "");
+			LLVMBuildCondBr(b, LLVMBuildAnd(b, v_hasnulls, v_isnull, ""),
+							b_isnull, b_notnull);
+		}
+
+		LLVMPositionBuilderAtEnd(b, b_isnull);
+		LLVMBuildStore(b, l_sizet_const(0),
+					   l_array_elem_ptr(b, TypeSizeT, v_values, v_attnum));
+		LLVMBuildStore(b, l_sbool_const(true),
+				   l_array_elem_ptr(b, TypeStorageBool, v_nulls, v_attnum));
+		LLVMBuildBr(b, attcheckblocks[attnum + 1]);
+
+		LLVMPositionBuilderAtEnd(b, b_notnull);
+
+		/* align the offset; see att_align_nominal() */
+		switch (att->attalign)
+		{
+			case 'i':
+				alignto = ALIGNOF_INT;
+				break;
+			case 'c':
+				alignto = 1;
+				break;
+			case 'd':
+				alignto = ALIGNOF_DOUBLE;
+				break;
+			case 's':
+				alignto = ALIGNOF_SHORT;
+				break;
+			default:
+				elog(ERROR, "unknown alignment %c", att->attalign);
+				alignto = 0;	/* keep compiler quiet */
+				break;
+		}
+
+		if (alignto > 1)
+		{
+			LLVMBasicBlockRef b_align = NULL;
+			LLVMBasicBlockRef b_aligned = NULL;
+			LLVMValueRef v_aligned;
+
+			/*
+			 * A varlena might be a short one, which isn't aligned.  Only a
+			 * zero byte is padding; see att_align_pointer().
+			 */
+			if (att->attlen == -1)
+			{
+				LLVMValueRef v_byte;
+
+				b_align = l_bb_append(v_deform_fn, "block.attr.%d.align",
+									  attnum);
+				b_aligned = l_bb_append(v_deform_fn, "block.attr.%d.aligned",
+										attnum);
+
+				v_off = LLVMBuildLoad2(b, TypeSizeT, v_offp, "");
+				v_byte = LLVMBuildLoad2(b, TypeInt8,
+										LLVMBuildGEP2(b, TypeInt8,
+													  v_tupdata_base,
+													  &v_off, 1, ""),
+										"");
+				LLVMBuildCondBr(b,
+								LLVMBuildICmp(b, LLVMIntEQ, v_byte,
+											  LLVMConstInt(TypeInt8, 0, false),
+											  ""),
+								b_align, b_aligned);
+				LLVMPositionBuilderAtEnd(b, b_align);
+			}
+
+			/* TYPEALIGN() */
+			v_off = LLVMBuildLoad2(b, TypeSizeT, v_offp, "");
+			v_aligned = LLVMBuildAnd(b,
+									 LLVMBuildAdd(b, v_off,
+												  l_sizet_const(alignto - 1),
+												  ""),
+									 l_sizet_const(~((size_t) alignto - 1)),
+									 "aligned_off");
+			LLVMBuildStore(b, v_aligned, v_offp);
+
+			if (att->attlen == -1)
+			{
+				LLVMBuildBr(b, b_aligned);
+				LLVMPositionBuilderAtEnd(b, b_aligned);
+			}
+		}
+
+		/* fetch_att() */
+		v_off = LLVMBuildLoad2(b, TypeSizeT, v_offp, "");
+		v_attdatap = LLVMBuildGEP2(b, TypeInt8, v_tupdata_base, &v_off, 1,
+								   "attdatap");
+
+		if (att->attbyval)
+		{
+			LLVMTypeRef vartype = LLVMIntTypeInContext(llvm_context,
+													   att->attlen * 8);
+
+			Assert(att->attlen == 1 || att->attlen == 2 ||
+				   att->attlen == 4 || att->attlen == 8);
+			v_value = LLVMBuildLoad2(b, vartype,
+									 LLVMBuildBitCast(b, v_attdatap,
+												 LLVMPointerType(vartype, 0),
+													  ""),
+									 "");
+			if (att->attlen < sizeof(Datum))
+				v_value = LLVMBuildSExt(b, v_value, TypeSizeT, "");
+		}
+		else
+			v_value = LLVMBuildPtrToInt(b, v_attdatap, TypeSizeT, "");
+
+		LLVMBuildStore(b, v_value,
+					   l_array_elem_ptr(b, TypeSizeT, v_values, v_attnum));
+		LLVMBuildStore(b, l_sbool_const(false),
+				   l_array_elem_ptr(b, TypeStorageBool, v_nulls, v_attnum));
+
+		/* att_addlength_pointer() */
+		if (att->attlen > 0)
+			v_incby = l_sizet_const(att->attlen);
+		else if (att->attlen == -1)
+			v_incby = l_call(b, TypeSizeT, varsize_any, &v_attdatap, 1, "");
+		else
+		{
+			Assert(att->attlen == -2);
+			v_incby = LLVMBuildAdd(b,
+								   l_call(b, TypeSizeT, strlen,
+										  &v_attdatap, 1, ""),
+								   l_sizet_const(1), "");
+		}
+		LLVMBuildStore(b, LLVMBuildAdd(b, v_off, v_incby, ""), v_offp);
+
+		LLVMBuildBr(b, attcheckblocks[attnum + 1]);
+	}
+
+	/*
+	 * Save the state slot_deform_tuple() needs to continue where we left
+	 * off.  We don't maintain attcacheoff, so it has to take the slow path.
+	 */
+	LLVMPositionBuilderAtEnd(b, b_out);
+	l_store_field(b, l_int32_const(natts), v_slot,
+				  offsetof(TupleTableSlot, tts_nvalid));
+	l_store_field(b,
+				  LLVMBuildTrunc(b, LLVMBuildLoad2(b, TypeSizeT, v_offp, ""),
+								 LLVMIntTypeInContext(llvm_context,
+													  sizeof(long) * 8),
+								 ""),
+				  v_slot, offsetof(TupleTableSlot, tts_off));
+	l_store_field(b, l_sbool_const(true), v_slot,
+				  offsetof(TupleTableSlot, tts_slow));
+	LLVMBuildRetVoid(b);
+
+	pfree(attcheckblocks);
+	pfree(missingblocks);
+	pfree(funcname);
+
+	return v_deform_fn;
+}
+
+/*
+ * Emit the code for an EPOP_*_FETCHSOME step: make sure the first 'last'
+ * attributes of the slot in v_slot are deformed, then continue at 'next'.
+ * 'slot' is the slot the expression is evaluated with the first time, if
+ * known.
+ */
+static void
+llvm_compile_fetch(LLVMJitBuild *build, LLVMJitContext *context,
+				   LLVMValueRef v_slot, TupleTableSlot *slot, int last,
+				   LLVMBasicBlockRef next)
+{
+	LLVMBuilderRef b = build->b;
+	LLVMValueRef fn = LLVMGetBasicBlockParent(LLVMGetInsertBlock(b));
+	LLVMBasicBlockRef b_fetch;
+	LLVMBasicBlockRef b_generic;
+	LLVMValueRef v_nvalid;
+	LLVMValueRef args[2];
+
+	b_fetch = LLVMAppendBasicBlockInContext(llvm_context, fn, "fetch");
+	b_generic = LLVMAppendBasicBlockInContext(llvm_context, fn,
+											  "fetch.generic");
+
+	/* nothing to do if enough attributes are valid already */
+	v_nvalid = l_load_field(b, v_slot, offsetof(TupleTableSlot, tts_nvalid),
+							TypeInt32, "tts_nvalid");
+	LLVMBuildCondBr(b,
+					LLVMBuildICmp(b, LLVMIntSGE, v_nvalid,
+								  l_int32_const(last), ""),
+					next, b_fetch);
+
+	LLVMPositionBuilderAtEnd(b, b_fetch);
+
+	/*
+	 * Deform with code specific to the slot's descriptor if it's still the
+	 * one we saw, none of the tuple has been deformed yet, and it's stored as
+	 * a physical tuple.  Otherwise leave it to slot_getsomeattrs().
+	 */
+	if ((context->base.flags & PGJIT_DEFORM) && slot != NULL &&
+		slot->tts_tupleDescriptor != NULL &&
+		last <= slot->tts_tupleDescriptor->natts)
+	{
+		TupleDesc	desc = slot->tts_tupleDescriptor;
+		LLVMBasicBlockRef b_deform;
+		LLVMValueRef v_deform_fn;
+		LLVMValueRef v_cond;
+		LLVMValueRef v_desc;
+		LLVMValueRef v_tuple;
+
+		b_deform = LLVMAppendBasicBlockInContext(llvm_context, fn,
+												 "fetch.deform");
+		v_deform_fn = llvm_compile_deform(build, desc, last);
+		LLVMPositionBuilderAtEnd(b, b_fetch);
+
+		v_desc = l_load_field(b, v_slot,
+							  offsetof(TupleTableSlot, tts_tupleDescriptor),
+							  TypePtr, "tts_tupleDescriptor");
+		v_tuple = l_load_field(b, v_slot, offsetof(TupleTableSlot, tts_tuple),
+							   TypePtr, "tts_tuple");
+		v_cond = LLVMBuildICmp(b, LLVMIntEQ, v_nvalid, l_int32_const(0), "");
+		v_cond = LLVMBuildAnd(b, v_cond,
+							  LLVMBuildICmp(b, LLVMIntEQ, v_desc,
+											l_ptr_const(desc, TypePtr), ""),
+							  "");
+		v_cond = LLVMBuildAnd(b, v_cond,
+							  LLVMBuildIsNotNull(b, v_tuple, ""), "");
+		LLVMBuildCondBr(b, v_cond, b_deform, b_generic);
+
+		LLVMPositionBuilderAtEnd(b, b_deform);
+		args[0] = LLVMBuildBitCast(b, v_slot, TypePtr, "");
+		LLVMBuildCall2(b, LLVMGlobalGetValueType(v_deform_fn), v_deform_fn,
+					   args, 1, "");
+		LLVMBuildBr(b, next);
+	}
+	else
+		LLVMBuildBr(b, b_generic);
+
+	LLVMPositionBuilderAtEnd(b, b_generic);
+	args[0] = v_slot;
+	args[1] = l_int32_const(last);
+	l_call(b, TypeVoid, slot_getsomeattrs, args, 2, "");
+	LLVMBuildBr(b, next);
+}
+
+/*
+ * Emit a call of the function of an EPOP_FUNC* step, whose arguments are
+ * in place, storing the result.
+ */
+static void
+llvm_compile_funccall(LLVMJitBuild *build, ExprProgramStep *op,
+					  LLVMValueRef v_resvaluep, LLVMValueRef v_resnullp)
+{
+	LLVMBuilderRef b = build->b;
+	LLVMValueRef v_fcinfo = l_ptr_const(op->d.func.fcinfo, TypePtr);
+	LLVMValueRef v_retval;
+
+	l_store_field(b, l_sbool_const(false), v_fcinfo,
+				  offsetof(FunctionCallInfoData, isnull));
+	v_retval = l_call(b, TypeSizeT, op->d.func.finfo->fn_addr,
+					  &v_fcinfo, 1, "funccall");
+	LLVMBuildStore(b, v_retval, v_resvaluep);
+	LLVMBuildStore(b,
+				   l_load_field(b, v_fcinfo,
+								offsetof(FunctionCallInfoData, isnull),
+								TypeStorageBool, ""),
+				   v_resnullp);
+}
+
+/*
+ * Emit a check of the argument null flags of a strict function call step,
+ * branching to 'b_null' if any is set, else continuing with the builder
+ * positioned in a new block.
+ */
+static void
+llvm_compile_strict_check(LLVMJitBuild *build, ExprProgramStep *op,
+						  LLVMBasicBlockRef b_null)
+{
+	LLVMBuilderRef b = build->b;
+	LLVMValueRef fn = LLVMGetBasicBlockParent(LLVMGetInsertBlock(b));
+	LLVMValueRef v_fcinfo = l_ptr_const(op->d.func.fcinfo, TypePtr);
+	int			argno;
+
+	for (argno = 0; argno < op->d.func.nargs; argno++)
+	{
+		LLVMBasicBlockRef b_next;
+		LLVMValueRef v_argnull;
+
+		b_next = l_bb_append(fn, "strict.arg.%d.notnull", argno);
+		v_argnull = l_load_field(b, v_fcinfo,
+								 offsetof(FunctionCallInfoData, argnull) +
+								 argno * sizeof(bool),
+								 TypeStorageBool, "");
+		LLVMBuildCondBr(b, l_sbool_is_true(b, v_argnull), b_null, b_next);
+		LLVMPositionBuilderAtEnd(b, b_next);
+	}
+}
+
+/*
+ * Compile an expression program into a function with the signature of an
+ * ExprState's evalfunc, and install it as the program's evalfunc.
+ */
+static bool
+llvm_compile_expr(ExprProgramState *state, ExprContext *econtext)
+{
+	LLVMJitContext *context;
+	LLVMJitBuild build;
+	LLVMBuilderRef b;
+	LLVMTypeRef param_types[4];
+	LLVMValueRef eval_fn;
+	LLVMBasicBlockRef b_entry;
+	LLVMBasicBlockRef b_setdone;
+	LLVMBasicBlockRef b_start;
+	LLVMBasicBlockRef *opblocks;
+	LLVMValueRef v_isnullp;
+	LLVMValueRef v_isdonep;
+	LLVMValueRef v_econtext;
+	LLVMValueRef v_scanslot = NULL;
+	LLVMValueRef v_scanvalues = NULL;
+	LLVMValueRef v_scannulls = NULL;
+	LLVMValueRef v_innerslot = NULL;
+	LLVMValueRef v_innervalues = NULL;
+	LLVMValueRef v_innernulls = NULL;
+	LLVMValueRef v_outerslot = NULL;
+	LLVMValueRef v_outervalues = NULL;
+	LLVMValueRef v_outernulls = NULL;
+	LLVMValueRef v_fcusage = NULL;
+	instr_time	starttime;
+	char	   *funcname;
+	void	   *code;
+	int			i;
+
+	context = llvm_get_context(econtext->ecxt_estate);
+
+	INSTR_TIME_SET_CURRENT(starttime);
+
+	llvm_start_build(&build, context);
+	b = build.b;
+
+	/* Datum evalfunc(ExprState *, ExprContext *, bool *, ExprDoneCond *) */
+	funcname = llvm_expand_funcname("evalexpr");
+	param_types[0] = TypePtr;
+	param_types[1] = TypePtr;
+	param_types[2] = LLVMPointerType(TypeStorageBool, 0);
+	param_types[3] = LLVMPointerType(TypeInt32, 0);
+	eval_fn = LLVMAddFunction(build.module, funcname,
+							  LLVMFunctionType(TypeSizeT, param_types, 4,
+											   false));
+	LLVMSetLinkage(eval_fn, LLVMExternalLinkage);
+	LLVMSetVisibility(eval_fn, LLVMDefaultVisibility);
+
+	b_entry = LLVMAppendBasicBlockInContext(llvm_context, eval_fn, "entry");
+	b_setdone = LLVMAppendBasicBlockInContext(llvm_context, eval_fn,
+											  "setdone");
+	b_start = LLVMAppendBasicBlockInContext(llvm_context, eval_fn, "start");
+
+	opblocks = palloc(state->nsteps * sizeof(LLVMBasicBlockRef));
+	for (i = 0; i < state->nsteps; i++)
+		opblocks[i] = l_bb_append(eval_fn, "b.op.%d.start", i);
+
+	LLVMPositionBuilderAtEnd(b, b_entry);
+
+	v_econtext = LLVMGetParam(eval_fn, 1);
+	v_isnullp = LLVMGetParam(eval_fn, 2);
+	v_isdonep = LLVMGetParam(eval_fn, 3);
+
+	/* local state for pgstat_init_function_usage(), if needed */
+	for (i = 0; i < state->nsteps; i++)
+	{
+		if (state->steps[i].opcode == EPOP_FUNC_FUSAGE)
+		{
+			v_fcusage = LLVMBuildAlloca(b,
+										LLVMArrayType(TypeInt8,
+										  sizeof(PgStat_FunctionCallUsage)),
+										"fcusage");
+			LLVMSetAlignment(v_fcusage, MAXIMUM_ALIGNOF);
+			v_fcusage = LLVMBuildBitCast(b, v_fcusage, TypePtr, "");
+			break;
+		}
+	}
+
+	/*
+	 * Load the slots the program uses, and their value and null arrays,
+	 * which stay the same while tuples come and go.  The FETCHSOME steps at
+	 * the start of the program guarantee they're present.
+	 */
+	for (i = 0; i < state->nsteps; i++)
+	{
+		switch ((ExprProgramOp) state->steps[i].opcode)
+		{
+			case EPOP_SCAN_FETCHSOME:
+				v_scanslot = l_load_field(b, v_econtext,
+										  offsetof(ExprContext,
+												   ecxt_scantuple),
+										  TypePtr, "scanslot");
+				v_scanvalues = l_load_field(b, v_scanslot,
+										offsetof(TupleTableSlot, tts_values),
+											LLVMPointerType(TypeSizeT, 0),
+											"scanvalues");
+				v_scannulls = l_load_field(b, v_scanslot,
+										offsetof(TupleTableSlot, tts_isnull),
+									   LLVMPointerType(TypeStorageBool, 0),
+										   "scannulls");
+				break;
+			case EPOP_INNER_FETCHSOME:
+				v_innerslot = l_load_field(b, v_econtext,
+										   offsetof(ExprContext,
+													ecxt_innertuple),
+										   TypePtr, "innerslot");
+				v_innervalues = l_load_field(b, v_innerslot,
+										offsetof(TupleTableSlot, tts_values),
+											 LLVMPointerType(TypeSizeT, 0),
+											 "innervalues");
+				v_innernulls = l_load_field(b, v_innerslot,
+										offsetof(TupleTableSlot, tts_isnull),
+									   LLVMPointerType(TypeStorageBool, 0),
+											"innernulls");
+				break;
+			case EPOP_OUTER_FETCHSOME:
+				v_outerslot = l_load_field(b, v_econtext,
+										   offsetof(ExprContext,
+													ecxt_outertuple),
+										   TypePtr, "outerslot");
+				v_outervalues = l_load_field(b, v_outerslot,
+										offsetof(TupleTableSlot, tts_values),
+											 LLVMPointerType(TypeSizeT, 0),
+											 "outervalues");
+				v_outernulls = l_load_field(b, v_outerslot,
+										offsetof(TupleTableSlot, tts_isnull),
+									   LLVMPointerType(TypeStorageBool, 0),
+											"outernulls");
+				break;
+			default:
+				break;
+		}
+	}
+
+	/* if (isDone) *isDone = ExprSingleResult; */
+	LLVMBuildCondBr(b, LLVMBuildIsNotNull(b, v_isdonep, ""),
+					b_setdone, b_start);
+	LLVMPositionBuilderAtEnd(b, b_setdone);
+	LLVMBuildStore(b, l_int32_const(ExprSingleResult), v_isdonep);
+	LLVMBuildBr(b, b_start);
+	LLVMPositionBuilderAtEnd(b, b_start);
+	LLVMBuildBr(b, opblocks[0]);
+
+	for (i = 0; i < state->nsteps; i++)
+	{
+		ExprProgramStep *op = &state->steps[i];
+		LLVMValueRef v_resvaluep;
+		LLVMValueRef v_resnullp;
+		LLVMBasicBlockRef b_next;
+
+		LLVMPositionBuilderAtEnd(b, opblocks[i]);
+
+		v_resvaluep = l_ptr_const(op->resvalue,
+								  LLVMPointerType(TypeSizeT, 0));
+		v_resnullp = l_ptr_const(op->resnull,
+								 LLVMPointerType(TypeStorageBool, 0));
+		b_next = (i + 1 < state->nsteps) ? opblocks[i + 1] : NULL;
+
+		switch ((ExprProgramOp) op->opcode)
+		{
+			case EPOP_DONE:
+				{
+					LLVMValueRef v_tmpvalue;
+					LLVMValueRef v_tmpisnull;
+
+					v_tmpvalue = LLVMBuildLoad2(b, TypeSizeT,
+												l_ptr_const(&state->resvalue,
+											  LLVMPointerType(TypeSizeT, 0)),
+												"");
+					v_tmpisnull = LLVMBuildLoad2(b, TypeStorageBool,
+												 l_ptr_const(&state->resnull,
+										LLVMPointerType(TypeStorageBool, 0)),
+												 "");
+					LLVMBuildStore(b, v_tmpisnull, v_isnullp);
+					LLVMBuildRet(b, v_tmpvalue);
+					break;
+				}
+
+			case EPOP_SCAN_FETCHSOME:
+				llvm_compile_fetch(&build, context, v_scanslot,
+								   econtext->ecxt_scantuple,
+								   op->d.fetch.last, b_next);
+				break;
+
+			case EPOP_INNER_FETCHSOME:
+				llvm_compile_fetch(&build, context, v_innerslot,
+								   econtext->ecxt_innertuple,
+								   op->d.fetch.last, b_next);
+				break;
+
+			case EPOP_OUTER_FETCHSOME:
+				llvm_compile_fetch(&build, context, v_outerslot,
+								   econtext->ecxt_outertuple,
+								   op->d.fetch.last, b_next);
+				break;
+
+			case EPOP_SCAN_VAR:
+			case EPOP_INNER_VAR:
+			case EPOP_OUTER_VAR:
+				{
+					LLVMValueRef v_values;
+					LLVMValueRef v_nulls;
+					LLVMValueRef v_attnum;
+
+					if (op->opcode == EPOP_SCAN_VAR)
+					{
+						v_values = v_scanvalues;
+						v_nulls = v_scannulls;
+					}
+					else if (op->opcode == EPOP_INNER_VAR)
+					{
+						v_values = v_innervalues;
+						v_nulls = v_innernulls;
+					}
+					else
+					{
+						v_values = v_outervalues;
+						v_nulls = v_outernulls;
+					}
+
+					v_attnum = l_int32_const(op->d.var.attnum);
+					LLVMBuildStore(b,
+								   LLVMBuildLoad2(b, TypeSizeT,
+									l_array_elem_ptr(b, TypeSizeT, v_values,
+													 v_attnum),
+												  ""),
+								   v_resvaluep);
+					LLVMBuildStore(b,
+								   LLVMBuildLoad2(b, TypeStorageBool,
+							  l_array_elem_ptr(b, TypeStorageBool, v_nulls,
+											   v_attnum),
+												  ""),
+								   v_resnullp);
+					LLVMBuildBr(b, b_next);
+					break;
+				}
+
+			case EPOP_CONST:
+				LLVMBuildStore(b, l_sizet_const(op->d.constval.value),
+							   v_resvaluep);
+				LLVMBuildStore(b, l_sbool_const(op->d.constval.isnull),
+							   v_resnullp);
+				LLVMBuildBr(b, b_next);
+				break;
+
+			case EPOP_FUNC:
+				llvm_compile_funccall(&build, op, v_resvaluep, v_resnullp);
+				LLVMBuildBr(b, b_next);
+				break;
+
+			case EPOP_FUNC_STRICT:
+				{
+					LLVMBasicBlockRef b_null;
+
+					b_null = l_bb_append(eval_fn, "b.op.%d.null", i);
+					llvm_compile_strict_check(&build, op, b_null);
+					llvm_compile_funccall(&build, op, v_resvaluep, v_resnullp);
+					LLVMBuildBr(b, b_next);
+
+					LLVMPositionBuilderAtEnd(b, b_null);
+					LLVMBuildStore(b, l_sizet_const(0), v_resvaluep);
+					LLVMBuildStore(b, l_sbool_const(true), v_resnullp);
+					LLVMBuildBr(b, b_next);
+					break;
+				}
+
+			case EPOP_FUNC_STRICT_VAR_CONST:
+				{
+					LLVMBasicBlockRef b_null;
+					LLVMBasicBlockRef b_call;
+					LLVMValueRef v_fcinfo;
+					LLVMValueRef v_attnum;
+					LLVMValueRef v_varnull;
+					LLVMValueRef v_constnull;
+
+					b_null = l_bb_append(eval_fn, "b.op.%d.null", i);
+					b_call = l_bb_append(eval_fn, "b.op.%d.call", i);
+
+					v_fcinfo = l_ptr_const(op->d.func.fcinfo, TypePtr);
+					v_attnum = l_int32_const(op->d.func.attnum);
+					v_varnull = LLVMBuildLoad2(b, TypeStorageBool,
+							l_array_elem_ptr(b, TypeStorageBool, v_scannulls,
+											 v_attnum),
+											   "");
+					v_constnull = l_load_field(b, v_fcinfo,
+									  offsetof(FunctionCallInfoData, argnull) +
+											   sizeof(bool),
+											   TypeStorageBool, "");
+					LLVMBuildCondBr(b,
+									LLVMBuildOr(b,
+												l_sbool_is_true(b, v_varnull),
+											  l_sbool_is_true(b, v_constnull),
+												""),
+									b_null, b_call);
+
+					LLVMPositionBuilderAtEnd(b, b_call);
+					l_store_field(b,
+								  LLVMBuildLoad2(b, TypeSizeT,
+									l_array_elem_ptr(b, TypeSizeT,
+													 v_scanvalues, v_attnum),
+												 ""),
+								  v_fcinfo,
+								  offsetof(FunctionCallInfoData, arg));
+					llvm_compile_funccall(&build, op, v_resvaluep, v_resnullp);
+					LLVMBuildBr(b, b_next);
+
+					LLVMPositionBuilderAtEnd(b, b_null);
+					LLVMBuildStore(b, l_sizet_const(0), v_resvaluep);
+					LLVMBuildStore(b, l_sbool_const(true), v_resnullp);
+					LLVMBuildBr(b, b_next);
+					break;
+				}
+
+			case EPOP_FUNC_FUSAGE:
+				{
+					LLVMBasicBlockRef b_null;
+					LLVMValueRef args[2];
+
+					b_null = l_bb_append(eval_fn, "b.op.%d.null", i);
+					if (op->d.func.strict)
+						llvm_compile_strict_check(&build, op, b_null);
+
+					args[0] = l_ptr_const(op->d.func.fcinfo, TypePtr);
+					args[1] = v_fcusage;
+					l_call(b, TypeVoid, pgstat_init_function_usage,
+						   args, 2, "");
+
+					llvm_compile_funccall(&build, op, v_resvaluep, v_resnullp);
+
+					/*
+					 * The bool argument is passed as an int, which is how the
+					 * calling conventions we support pass it anyway.
+					 */
+					args[0] = v_fcusage;
+					args[1] = l_int32_const(true);
+					l_call(b, TypeVoid, pgstat_end_function_usage,
+						   args, 2, "");
+					LLVMBuildBr(b, b_next);
+
+					LLVMPositionBuilderAtEnd(b, b_null);
+					LLVMBuildStore(b, l_sizet_const(0), v_resvaluep);
+					LLVMBuildStore(b, l_sbool_const(true), v_resnullp);
+					LLVMBuildBr(b, b_next);
+					break;
+				}
+
+			case EPOP_BOOL_AND_STEP_FIRST:
+			case EPOP_BOOL_AND_STEP:
+			case EPOP_BOOL_OR_STEP_FIRST:
+			case EPOP_BOOL_OR_STEP:
+				{
+					bool		is_and = (op->opcode == EPOP_BOOL_AND_STEP_FIRST ||
+										  op->opcode == EPOP_BOOL_AND_STEP);
+					LLVMValueRef v_anynullp;
+					LLVMValueRef v_resnull;
+					LLVMValueRef v_isdecided;
+					LLVMBasicBlockRef b_setanynull;
+					LLVMBasicBlockRef b_checkvalue;
+
+					b_setanynull = l_bb_append(eval_fn, "b.op.%d.anynull", i);
+					b_checkvalue = l_bb_append(eval_fn, "b.op.%d.check", i);
+
+					v_anynullp = l_ptr_const(op->d.boolexpr.anynull,
+									   LLVMPointerType(TypeStorageBool, 0));
+					if (op->opcode == EPOP_BOOL_AND_STEP_FIRST ||
+						op->opcode == EPOP_BOOL_OR_STEP_FIRST)
+						LLVMBuildStore(b, l_sbool_const(false), v_anynullp);
+
+					v_resnull = LLVMBuildLoad2(b, TypeStorageBool,
+											   v_resnullp, "");
+					LLVMBuildCondBr(b, l_sbool_is_true(b, v_resnull),
+									b_setanynull, b_checkvalue);
+
+					LLVMPositionBuilderAtEnd(b, b_setanynull);
+					LLVMBuildStore(b, l_sbool_const(true), v_anynullp);
+					LLVMBuildBr(b, b_next);
+
+					/*
+					 * A false argument decides an AND, a true one an OR; the
+					 * result is already stored.
+					 */
+					LLVMPositionBuilderAtEnd(b, b_checkvalue);
+					v_isdecided = l_datum_is_true(b,
+												  LLVMBuildLoad2(b, TypeSizeT,
+															  v_resvaluep,
+																 ""));
+					if (is_and)
+						v_isdecided = LLVMBuildNot(b, v_isdecided, "");
+					LLVMBuildCondBr(b, v_isdecided,
+									opblocks[op->d.boolexpr.jumpdone],
+									b_next);
+					break;
+				}
+
+			case EPOP_BOOL_AND_STEP_LAST:
+			case EPOP_BOOL_OR_STEP_LAST:
+				{
+					bool		is_and = (op->opcode == EPOP_BOOL_AND_STEP_LAST);
+					LLVMValueRef v_isdecided;
+					LLVMBasicBlockRef b_checkvalue;
+					LLVMBasicBlockRef b_checkanynull;
+					LLVMBasicBlockRef b_setnull;
+
+					b_checkvalue = l_bb_append(eval_fn, "b.op.%d.check", i);
+					b_checkanynull = l_bb_append(eval_fn, "b.op.%d.anynull",
+												 i);
+					b_setnull = l_bb_append(eval_fn, "b.op.%d.setnull", i);
+
+					/* a null last argument makes the result null anyway */
+					LLVMBuildCondBr(b,
+									l_sbool_is_true(b,
+									  LLVMBuildLoad2(b, TypeStorageBool,
+													 v_resnullp, "")),
+									b_next, b_checkvalue);
+
+					LLVMPositionBuilderAtEnd(b, b_checkvalue);
+					v_isdecided = l_datum_is_true(b,
+												  LLVMBuildLoad2(b, TypeSizeT,
+															  v_resvaluep,
+																 ""));
+					if (is_and)
+						v_isdecided = LLVMBuildNot(b, v_isdecided, "");
+					LLVMBuildCondBr(b, v_isdecided, b_next, b_checkanynull);
+
+					LLVMPositionBuilderAtEnd(b, b_checkanynull);
+					LLVMBuildCondBr(b,
+									l_sbool_is_true(b,
+									  LLVMBuildLoad2(b, TypeStorageBool,
+										 l_ptr_const(op->d.boolexpr.anynull,
+										LLVMPointerType(TypeStorageBool, 0)),
+													 "")),
+									b_setnull, b_next);
+
+					LLVMPositionBuilderAtEnd(b, b_setnull);
+					LLVMBuildStore(b, l_sizet_const(0), v_resvaluep);
+					LLVMBuildStore(b, l_sbool_const(true), v_resnullp);
+					LLVMBuildBr(b, b_next);
+					break;
+				}
+
+			case EPOP_BOOL_NOT:
+				{
+					LLVMBasicBlockRef b_negate;
+					LLVMValueRef v_value;
+
+					b_negate = l_bb_append(eval_fn, "b.op.%d.negate", i);
+
+					/* NOT NULL is NULL */
+					LLVMBuildCondBr(b,
+									l_sbool_is_true(b,
+									  LLVMBuildLoad2(b, TypeStorageBool,
+													 v_resnullp, "")),
+									b_next, b_negate);
+
+					LLVMPositionBuilderAtEnd(b, b_negate);
+					v_value = LLVMBuildLoad2(b, TypeSizeT, v_resvaluep, "");
+					LLVMBuildStore(b,
+								   l_bool_datum(b,
+												LLVMBuildNot(b,
+												l_datum_is_true(b, v_value),
+															 "")),
+								   v_resvaluep);
+					LLVMBuildBr(b, b_next);
+					break;
+				}
+
+			case EPOP_NULLTEST_ISNULL:
+			case EPOP_NULLTEST_ISNOTNULL:
+				{
+					LLVMValueRef v_isnull;
+
+					v_isnull = l_sbool_is_true(b,
+											   LLVMBuildLoad2(b,
+															TypeStorageBool,
+															  v_resnullp, ""));
+					if (op->opcode == EPOP_NULLTEST_ISNOTNULL)
+						v_isnull = LLVMBuildNot(b, v_isnull, "");
+					LLVMBuildStore(b, l_bool_datum(b, v_isnull), v_resvaluep);
+					LLVMBuildStore(b, l_sbool_const(false), v_resnullp);
+					LLVMBuildBr(b, b_next);
+					break;
+				}
+
+			case EPOP_BOOLTEST_IS_TRUE:
+			case EPOP_BOOLTEST_IS_NOT_TRUE:
+			case EPOP_BOOLTEST_IS_FALSE:
+			case EPOP_BOOLTEST_IS_NOT_FALSE:
+				{
+					LLVMBasicBlockRef b_isnull;
+					LLVMBasicBlockRef b_notnull;
+					bool		nullresult;
+					bool		negate;
+
+					/* the result for a NULL input, and for others */
+					nullresult = (op->opcode == EPOP_BOOLTEST_IS_NOT_TRUE ||
+								  op->opcode == EPOP_BOOLTEST_IS_NOT_FALSE);
+					negate = (op->opcode == EPOP_BOOLTEST_IS_NOT_TRUE ||
+							  op->opcode == EPOP_BOOLTEST_IS_FALSE);
+
+					b_isnull = l_bb_append(eval_fn, "b.op.%d.isnull", i);
+					b_notnull = l_bb_append(eval_fn, "b.op.%d.notnull", i);
+
+					LLVMBuildCondBr(b,
+									l_sbool_is_true(b,
+									  LLVMBuildLoad2(b, TypeStorageBool,
+													 v_resnullp, "")),
+									b_isnull, b_notnull);
+
+					LLVMPositionBuilderAtEnd(b, b_isnull);
+					LLVMBuildStore(b, l_sizet_const(BoolGetDatum(nullresult)),
+								   v_resvaluep);
+					LLVMBuildStore(b, l_sbool_const(false), v_resnullp);
+					LLVMBuildBr(b, b_next);
+
+					LLVMPositionBuilderAtEnd(b, b_notnull);
+					if (negate)
+					{
+						LLVMValueRef v_value;
+
+						v_value = LLVMBuildLoad2(b, TypeSizeT, v_resvaluep, "");
+						LLVMBuildStore(b,
+									   l_bool_datum(b,
+													LLVMBuildNot(b,
+												l_datum_is_true(b, v_value),
+																 "")),
+									   v_resvaluep);
+					}
+					LLVMBuildBr(b, b_next);
+					break;
+				}
+
+			case EPOP_LAST:
+				elog(ERROR, "invalid expression program step");
+				break;
+		}
+	}
+
+	code = llvm_finish_build(&build, funcname, starttime);
+
+	state->xprstate.evalfunc = (ExprStateEvalFunc) code;
+
+	pfree(opblocks);
+	pfree(funcname);
+
+	return true;
+}
+
+/*
+ * Compile the transition function calls of an Agg node into a function
+ * that replaces advance_aggregates(), and install it.
+ *
+ * Only the common case is handled: a single grouping set, and transition
+ * values passed by value, so that they never need to be copied into or
+ * freed from the aggregate context, and no DISTINCT or ORDER BY.
+ */
+static bool
+llvm_compile_agg_advance(AggState *aggstate)
+{
+	LLVMJitContext *context;
+	LLVMJitBuild build;
+	LLVMBuilderRef b;
+	LLVMTypeRef param_types[2];
+	LLVMValueRef advance_fn;
+	LLVMValueRef v_aggstate;
+	LLVMValueRef v_pergroup;
+	LLVMValueRef v_filternullp = NULL;
+	LLVMValueRef v_memcxtp;
+	LLVMBasicBlockRef b_entry;
+	LLVMBasicBlockRef *transblocks;
+	instr_time	starttime;
+	char	   *funcname;
+	void	   *code;
+	int			transno;
+
+	if (aggstate->maxsets > 1)
+		return false;
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		AggStatePerTrans pertrans = &aggstate->pertrans[transno];
+
+		if (pertrans->numSortCols > 0 || !pertrans->transtypeByVal)
+			return false;
+	}
+
+	context = llvm_get_context(aggstate->ss.ps.state);
+
+	INSTR_TIME_SET_CURRENT(starttime);
+
+	llvm_start_build(&build, context);
+	b = build.b;
+
+	/* void advance(AggState *aggstate, AggStatePerGroup pergroup) */
+	funcname = llvm_expand_funcname("advance_agg");
+	param_types[0] = TypePtr;
+	param_types[1] = TypePtr;
+	advance_fn = LLVMAddFunction(build.module, funcname,
+								 LLVMFunctionType(TypeVoid, param_types, 2,
+												  false));
+	LLVMSetLinkage(advance_fn, LLVMExternalLinkage);
+	LLVMSetVisibility(advance_fn, LLVMDefaultVisibility);
+
+	b_entry = LLVMAppendBasicBlockInContext(llvm_context, advance_fn,
+											"entry");
+	transblocks = palloc((aggstate->numtrans + 1) * sizeof(LLVMBasicBlockRef));
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+		transblocks[transno] = l_bb_append(advance_fn, "b.trans.%d.start",
+										   transno);
+	transblocks[aggstate->numtrans] =
+		LLVMAppendBasicBlockInContext(llvm_context, advance_fn, "out");
+
+	LLVMPositionBuilderAtEnd(b, b_entry);
+	v_aggstate = LLVMGetParam(advance_fn, 0);
+	v_pergroup = LLVMGetParam(advance_fn, 1);
+	v_memcxtp = l_ptr_const(&CurrentMemoryContext, TypePtr);
+
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		if (aggstate->pertrans[transno].aggfilter)
+		{
+			v_filternullp = LLVMBuildAlloca(b, TypeStorageBool,
+											"filternull");
+			break;
+		}
+	}
+
+	/* there's just one grouping set */
+	l_store_field(b, l_int32_const(0), v_aggstate,
+				  offsetof(AggState, current_set));
+	LLVMBuildBr(b, transblocks[0]);
+
+	for (transno = 0; transno < aggstate->numtrans; transno++)
+	{
+		AggStatePerTrans pertrans = &aggstate->pertrans[transno];
+		int			numTransInputs = pertrans->numTransInputs;
+		LLVMBasicBlockRef b_next = transblocks[transno + 1];
+		LLVMBasicBlockRef b_call;
+		LLVMValueRef v_fcinfo;
+		LLVMValueRef v_pergroupstate;
+		LLVMValueRef v_slot;
+		LLVMValueRef v_values;
+		LLVMValueRef v_nulls;
+		LLVMValueRef v_oldcxt;
+		LLVMValueRef v_newval;
+		LLVMValueRef args[4];
+		int			i;
+
+		LLVMPositionBuilderAtEnd(b, transblocks[transno]);
+
+		v_fcinfo = l_ptr_const(&pertrans->transfn_fcinfo, TypePtr);
+		v_pergroupstate = l_field_ptr(b, v_pergroup,
+									  transno * sizeof(AggStatePerGroupData),
+									  TypeInt8);
+
+		/* skip anything FILTERed out */
+		if (pertrans->aggfilter)
+		{
+			LLVMBasicBlockRef b_filtered;
+			LLVMValueRef v_res;
+
+			b_filtered = l_bb_append(advance_fn, "b.trans.%d.filtered",
+									 transno);
+
+			args[0] = l_ptr_const(pertrans->aggfilter, TypePtr);
+			args[1] = l_ptr_const(aggstate->tmpcontext, TypePtr);
+			args[2] = v_filternullp;
+			args[3] = l_ptr_const(NULL, TypePtr);
+			v_res = l_call(b, TypeSizeT, ExecEvalExprSwitchContext,
+						   args, 4, "filter");
+			LLVMBuildCondBr(b,
+							LLVMBuildOr(b,
+										l_sbool_is_true(b,
+										LLVMBuildLoad2(b, TypeStorageBool,
+													   v_filternullp, "")),
+										LLVMBuildNot(b,
+													 l_datum_is_true(b, v_res),
+													 ""),
+										""),
+							b_next, b_filtered);
+			LLVMPositionBuilderAtEnd(b, b_filtered);
+		}
+
+		/* evaluate the current input expressions for this aggregate */
+		args[0] = l_ptr_const(pertrans->evalproj, TypePtr);
+		args[1] = l_ptr_const(NULL, TypePtr);
+		v_slot = l_call(b, TypePtr, ExecProject, args, 2, "slot");
+		v_values = l_load_field(b, v_slot, offsetof(TupleTableSlot, tts_values),
+								LLVMPointerType(TypeSizeT, 0), "values");
+		v_nulls = l_load_field(b, v_slot, offsetof(TupleTableSlot, tts_isnull),
+							   LLVMPointerType(TypeStorageBool, 0), "nulls");
+
+		/* load values into fcinfo, starting from 1 */
+		for (i = 0; i < numTransInputs; i++)
+		{
+			LLVMValueRef v_i = l_int32_const(i);
+
+			l_store_field(b,
+						  LLVMBuildLoad2(b, TypeSizeT,
+								l_array_elem_ptr(b, TypeSizeT, v_values, v_i),
+										 ""),
+						  v_fcinfo,
+						  offsetof(FunctionCallInfoData, arg) +
+						  (i + 1) * sizeof(Datum));
+			l_store_field(b,
+						  LLVMBuildLoad2(b, TypeStorageBool,
+						  l_array_elem_ptr(b, TypeStorageBool, v_nulls, v_i),
+										 ""),
+						  v_fcinfo,
+						  offsetof(FunctionCallInfoData, argnull) +
+						  (i + 1) * sizeof(bool));
+		}
+
+		b_call = l_bb_append(advance_fn, "b.trans.%d.call", transno);
+
+		if (pertrans->transfn.fn_strict)
+		{
+			LLVMBasicBlockRef b_notransvalue;
+			LLVMBasicBlockRef b_checktransnull;
+
+			/* nothing happens for a NULL input */
+			for (i = 1; i <= numTransInputs; i++)
+			{
+				LLVMBasicBlockRef b_argnotnull;
+
+				b_argnotnull = l_bb_append(advance_fn, "b.strict.arg.%d", i);
+				LLVMBuildCondBr(b,
+								l_sbool_is_true(b,
+								l_load_field(b, v_fcinfo,
+									  offsetof(FunctionCallInfoData, argnull) +
+											 i * sizeof(bool),
+											 TypeStorageBool, "")),
+								b_next, b_argnotnull);
+				LLVMPositionBuilderAtEnd(b, b_argnotnull);
+			}
+
+			/*
+			 * The first non-NULL input becomes the initial transition value,
+			 * without copying since it's passed by value.
+			 */
+			b_notransvalue = l_bb_append(advance_fn, "b.trans.%d.notrans",
+										 transno);
+			b_checktransnull = l_bb_append(advance_fn,
+										   "b.trans.%d.checktransnull",
+										   transno);
+			LLVMBuildCondBr(b,
+							l_sbool_is_true(b,
+							  l_load_field(b, v_pergroupstate,
+								  offsetof(AggStatePerGroupData, noTransValue),
+										   TypeStorageBool, "")),
+							b_notransvalue, b_checktransnull);
+
+			LLVMPositionBuilderAtEnd(b, b_notransvalue);
+			l_store_field(b,
+						  l_load_field(b, v_fcinfo,
+									   offsetof(FunctionCallInfoData, arg) +
+									   sizeof(Datum),
+									   TypeSizeT, ""),
+						  v_pergroupstate,
+						  offsetof(AggStatePerGroupData, transValue));
+			l_store_field(b, l_sbool_const(false), v_pergroupstate,
+						  offsetof(AggStatePerGroupData, transValueIsNull));
+			l_store_field(b, l_sbool_const(false), v_pergroupstate,
+						  offsetof(AggStatePerGroupData, noTransValue));
+			LLVMBuildBr(b, b_next);
+
+			/* don't call a strict function with a NULL transition value */
+			LLVMPositionBuilderAtEnd(b, b_checktransnull);
+			LLVMBuildCondBr(b,
+							l_sbool_is_true(b,
+							  l_load_field(b, v_pergroupstate,
+							  offsetof(AggStatePerGroupData, transValueIsNull),
+										   TypeStorageBool, "")),
+							b_next, b_call);
+		}
+		else
+			LLVMBuildBr(b, b_call);
+
+		/*
+		 * Call the transition function in the per-input-tuple memory
+		 * context, with aggstate->curpertrans set for AggGetAggref().
+		 */
+		LLVMPositionBuilderAtEnd(b, b_call);
+		v_oldcxt = LLVMBuildLoad2(b, TypePtr,
+								  LLVMBuildBitCast(b, v_memcxtp,
+												LLVMPointerType(TypePtr, 0),
+												   ""),
+								  "oldcxt");
+		l_store_field(b,
+					  l_ptr_const(aggstate->tmpcontext->ecxt_per_tuple_memory,
+								  TypePtr),
+					  v_memcxtp, 0);
+		l_store_field(b, l_ptr_const(pertrans, TypePtr), v_aggstate,
+					  offsetof(AggState, curpertrans));
+
+		l_store_field(b,
+					  l_load_field(b, v_pergroupstate,
+								   offsetof(AggStatePerGroupData, transValue),
+								   TypeSizeT, ""),
+					  v_fcinfo, offsetof(FunctionCallInfoData, arg));
+		l_store_field(b,
+					  l_load_field(b, v_pergroupstate,
+							  offsetof(AggStatePerGroupData, transValueIsNull),
+								   TypeStorageBool, ""),
+					  v_fcinfo, offsetof(FunctionCallInfoData, argnull));
+		l_store_field(b, l_sbool_const(false), v_fcinfo,
+					  offsetof(FunctionCallInfoData, isnull));
+
+		v_newval = l_call(b, TypeSizeT, pertrans->transfn.fn_addr,
+						  &v_fcinfo, 1, "transvalue");
+
+		l_store_field(b, l_ptr_const(NULL, TypePtr), v_aggstate,
+					  offsetof(AggState, curpertrans));
+		l_store_field(b, v_newval, v_pergroupstate,
+					  offsetof(AggStatePerGroupData, transValue));
+		l_store_field(b,
+					  l_load_field(b, v_fcinfo,
+								   offsetof(FunctionCallInfoData, isnull),
+								   TypeStorageBool, ""),
+					  v_pergroupstate,
+					  offsetof(AggStatePerGroupData, transValueIsNull));
+		l_store_field(b, v_oldcxt, v_memcxtp, 0);
+		LLVMBuildBr(b, b_next);
+	}
+
+	LLVMPositionBuilderAtEnd(b, transblocks[aggstate->numtrans]);
+	LLVMBuildRetVoid(b);
+
+	code = llvm_finish_build(&build, funcname, starttime);
+
+	aggstate->jit_advance = (void (*) (AggState *, AggStatePerGroup)) code;
+
+	pfree(transblocks);
+	pfree(funcname);
+
+	return true;
+}
@@ -1402,6 +1402,7 @@ _readPlannedStmt(void)
 	READ_NODE_FIELD(relationOids);
 	READ_NODE_FIELD(invalItems);
 	READ_INT_FIELD(nParamExec);
+	READ_INT_FIELD(jitFlags);
 
 	READ_DONE();
 }
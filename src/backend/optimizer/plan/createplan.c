@@ -3931,6 +3931,18 @@ create_hashjoin_plan(PlannerInfo *root,
 	copy_plan_costsize(&hash_plan->plan, inner_plan);
 	hash_plan->plan.startup_cost = hash_plan->plan.total_cost;
 
+	/*
+	 * If the join is partial, each participant of the parallel query would
+	 * otherwise build an identical private copy of the hash table, so let
+	 * them share one instead.  The executor can only share a table that is
+	 * expected to fit in a single batch, as batch files are private to each
+	 * participant, and whose inner relation doesn't depend on parameters.
+	 */
+	hash_plan->plan.parallel_aware = enable_parallel_hash &&
+		best_path->jpath.path.parallel_workers > 0 &&
+		best_path->num_batches == 1 &&
+		PATH_REQ_OUTER(best_path->jpath.innerjoinpath) == NULL;
+
 	join_plan = make_hashjoin(tlist,
 							  joinclauses,
 							  otherclauses,
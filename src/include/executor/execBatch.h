@@ -0,0 +1,54 @@
+/*-------------------------------------------------------------------------
+ *
+ * execBatch.h
+ *	  Batch-at-a-time execution support
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/executor/execBatch.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef EXECBATCH_H
+#define EXECBATCH_H
+
+#include "access/htup.h"
+#include "access/tupdesc.h"
+#include "nodes/pg_list.h"
+
+/*
+ * A set of tuples deformed into per-column arrays, as produced by a node
+ * executed with ExecProcNodeBatch().  Only the first natts columns are
+ * deformed.  By-reference values point into storage owned by the producing
+ * node, and remain valid until it is asked for the next batch.
+ *
+ * Rows that have been filtered out stay in the arrays; the selection vector
+ * sel[0 .. nsel - 1] lists the rows that remain, in ascending order.
+ */
+typedef struct TupleBatch
+{
+	TupleDesc	tupdesc;		/* descriptor of the deformed tuples */
+	int			natts;			/* number of leading columns deformed */
+	int			maxrows;		/* allocated length of the arrays */
+	int			nrows;			/* number of rows stored */
+	Datum	  **values;			/* values[attnum][row], attnum zero-based */
+	bool	  **isnull;			/* isnull[attnum][row] */
+	int			nsel;			/* number of rows selected */
+	int		   *sel;			/* indexes of the selected rows */
+} TupleBatch;
+
+/* a scan qual, prepared for evaluation over batches; private to execBatch.c */
+typedef struct BatchQual BatchQual;
+
+/* GUC */
+extern bool batch_execution;
+
+extern TupleBatch *ExecCreateTupleBatch(TupleDesc tupdesc, int natts,
+					 int maxrows);
+extern void ExecBatchStoreTuple(TupleBatch *batch, HeapTuple tuple);
+extern void ExecBatchSelectAll(TupleBatch *batch);
+extern BatchQual *ExecInitBatchQual(List *qual, Index scanrelid, int *natts);
+extern void ExecBatchQual(BatchQual *bqual, TupleBatch *batch);
+
+#endif   /* EXECBATCH_H */
@@ -0,0 +1,133 @@
+/*-------------------------------------------------------------------------
+ *
+ * execExprProgram.h
+ *	  Flat step programs for expression evaluation
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/executor/execExprProgram.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef EXECEXPRPROGRAM_H
+#define EXECEXPRPROGRAM_H
+
+#include "fmgr.h"
+#include "nodes/execnodes.h"
+
+/*
+ * Operations a step of an ExprProgramState can perform.  Most steps store
+ * their result in *resvalue and *resnull, which point either at the result of
+ * the whole program or at an argument of a later function call step.
+ */
+typedef enum ExprProgramOp
+{
+	/* end of program */
+	EPOP_DONE,
+
+	/* deform a slot's tuple up to and including attribute d.fetch.last */
+	EPOP_SCAN_FETCHSOME,
+	EPOP_INNER_FETCHSOME,
+	EPOP_OUTER_FETCHSOME,
+
+	/* fetch deformed attribute d.var.attnum of a slot */
+	EPOP_SCAN_VAR,
+	EPOP_INNER_VAR,
+	EPOP_OUTER_VAR,
+
+	/* a constant */
+	EPOP_CONST,
+
+	/* call a function, whose arguments are already in place */
+	EPOP_FUNC,
+	EPOP_FUNC_STRICT,
+
+	/* call a strict two-argument function on a scan Var and a Const */
+	EPOP_FUNC_STRICT_VAR_CONST,
+
+	/* call a function, keeping track of it for track_functions */
+	EPOP_FUNC_FUSAGE,
+
+	/* process an argument of an AND, and jump to the end if it's false */
+	EPOP_BOOL_AND_STEP_FIRST,
+	EPOP_BOOL_AND_STEP,
+	EPOP_BOOL_AND_STEP_LAST,
+
+	/* process an argument of an OR, and jump to the end if it's true */
+	EPOP_BOOL_OR_STEP_FIRST,
+	EPOP_BOOL_OR_STEP,
+	EPOP_BOOL_OR_STEP_LAST,
+
+	EPOP_BOOL_NOT,
+
+	/* NullTest and BooleanTest, applied to the value in *resvalue */
+	EPOP_NULLTEST_ISNULL,
+	EPOP_NULLTEST_ISNOTNULL,
+	EPOP_BOOLTEST_IS_TRUE,
+	EPOP_BOOLTEST_IS_NOT_TRUE,
+	EPOP_BOOLTEST_IS_FALSE,
+	EPOP_BOOLTEST_IS_NOT_FALSE,
+
+	EPOP_LAST					/* must be last */
+} ExprProgramOp;
+
+typedef struct ExprProgramStep
+{
+	/*
+	 * The ExprProgramOp to perform.  When the interpreter is built with
+	 * computed goto support, it's replaced with the address of the code
+	 * implementing the operation once the program is complete.
+	 */
+	intptr_t	opcode;
+
+	/* where to store the result of the step */
+	Datum	   *resvalue;
+	bool	   *resnull;
+
+	union
+	{
+		/* for EPOP_*_FETCHSOME */
+		struct
+		{
+			int			last;	/* highest attribute number to deform */
+		}			fetch;
+
+		/* for EPOP_*_VAR */
+		struct
+		{
+			int			attnum; /* attribute number, zero-based */
+			Oid			vartype;	/* type expected, for sanity checks */
+		}			var;
+
+		/* for EPOP_CONST */
+		struct
+		{
+			Datum		value;
+			bool		isnull;
+		}			constval;
+
+		/* for EPOP_FUNC* */
+		struct
+		{
+			FmgrInfo   *finfo;
+			FunctionCallInfo fcinfo;
+			int			nargs;
+			bool		strict;
+			/* for EPOP_FUNC_STRICT_VAR_CONST: the Var's zero-based attnum */
+			int			attnum;
+			Oid			vartype;
+		}			func;
+
+		/* for EPOP_BOOL_*_STEP* */
+		struct
+		{
+			bool	   *anynull;	/* has any argument been NULL? */
+			int			jumpdone;	/* step to jump to once result known */
+		}			boolexpr;
+	}			d;
+} ExprProgramStep;
+
+extern ExprState *ExecCompileExpr(Expr *node);
+
+#endif   /* EXECEXPRPROGRAM_H */
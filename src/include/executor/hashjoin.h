@@ -15,7 +15,9 @@
 #define HASHJOIN_H
 
 #include "nodes/execnodes.h"
+#include "port/atomics.h"
 #include "storage/buffile.h"
+#include "storage/spin.h"
 
 /* ----------------------------------------------------------------
  *				hash-join hash table structures
@@ -54,6 +56,14 @@
  * inner batch file.  Subsequently, while reading either inner or outer batch
  * files, we might find tuples that no longer belong to the current batch;
  * if so, we just dump them out to the correct batch file.
+ *
+ * In a parallel query, the inner side of a hash join below Gather is run to
+ * completion by every participant, so each of them would build an identical
+ * private table.  To avoid that, a single-batch table can instead be built
+ * jointly into a ParallelHashJoinState in the query's dynamic shared memory
+ * segment and probed by all participants.  The segment is mapped at a
+ * different address in each process, so links inside a shared table are
+ * stored as byte offsets from the start of the ParallelHashJoinState.
  * ----------------------------------------------------------------
  */
 
@@ -63,7 +73,12 @@
 
 typedef struct HashJoinTupleData
 {
-	struct HashJoinTupleData *next;		/* link to next tuple in same bucket */
+	/* link to next tuple in same bucket */
+	union
+	{
+		struct HashJoinTupleData *unshared;		/* private table */
+		Size		shared;		/* offset in shared table, or 0 */
+	}			next;
 	uint32		hashvalue;		/* tuple's hash code */
 	/* Tuple data, in MinimalTuple format, follows on a MAXALIGN boundary */
 }	HashJoinTupleData;
@@ -123,6 +138,66 @@ typedef struct HashMemoryChunkData *HashMemoryChunk;
 #define HASH_CHUNK_SIZE			(32 * 1024L)
 #define HASH_CHUNK_THRESHOLD	(HASH_CHUNK_SIZE / 4)
 
+/*
+ * Shared hash table for a parallel hash join.  The hash space is divided into
+ * nslices slices, one per planned participant.  Each participant arriving
+ * during the load claims a slice, runs the inner plan and inserts the tuples
+ * of its slice only, so all of them load the table concurrently.  Tuples are
+ * packed into chunks carved out of the space following this header, and are
+ * pushed onto their buckets with atomic compare-and-exchange.  After its
+ * first pass, a participant keeps claiming one slice at a time while others
+ * are loading too, but takes all remaining slices if it's loading alone, so
+ * the inner plan isn't run over and over if some workers never show up.
+ *
+ * The last participant to finish loading acts as a barrier: the others wait
+ * for it to grow the bucket array if the table ended up overfull, and to mark
+ * the table done.  The space is reserved when the DSM segment is created and
+ * can't grow, and batch files are private to each process.  So if a
+ * participant runs out of space, the table would need more batches, and all
+ * participants switch to building private, multi-batch tables together.
+ */
+typedef enum ParallelHashJoinStatus
+{
+	PHJ_BUILD_LOADING,			/* participants are loading the table */
+	PHJ_BUILD_FINISHING,		/* the last of them is finishing it */
+	PHJ_BUILD_DONE,				/* table is ready to be probed */
+	PHJ_BUILD_FAILED			/* didn't fit; use private tables */
+} ParallelHashJoinStatus;
+
+/* header of a chunk of tuples in a shared table */
+typedef struct ParallelHashChunkData
+{
+	uint32		size;			/* size of the chunk, including this header */
+	uint32		used;			/* bytes used by tuples, including header */
+} ParallelHashChunkData;
+
+#define PHJ_CHUNK_HEADER_SIZE	MAXALIGN(sizeof(ParallelHashChunkData))
+
+/*
+ * The shared space is limited to work_mem, so offsets into it fit in 32 bits
+ * and bucket heads can be swapped with 32-bit atomics.
+ */
+typedef struct ParallelHashJoinState
+{
+	slock_t		mutex;			/* protects the fields up to waiters */
+	ParallelHashJoinStatus status;
+	int			nattached;		/* # participants currently loading */
+	int			nextslice;		/* first slice nobody has claimed yet */
+	double		totalTuples;	/* # tuples loaded by detached participants */
+	int			nwaiters;		/* # participants waiting for the build */
+	int			maxwaiters;		/* allocated length of waiters array */
+	Size		waiters;		/* offset of array of their pgprocnos */
+	int			nslices;		/* # slices of the hash space */
+	int			nbuckets;		/* # buckets */
+	int			log2_nbuckets;	/* its log2 */
+	Size		buckets;		/* offset of array of bucket head offsets */
+	Size		chunks;			/* offset of first chunk of tuples */
+	Size		spaceUsed;		/* bytes used by tuples and buckets */
+	Size		size;			/* total size, including this header */
+	pg_atomic_uint32 used;		/* offset of first free byte */
+	pg_atomic_uint32 outOfSpace;	/* set once a chunk can't be allocated */
+} ParallelHashJoinState;
+
 typedef struct HashJoinTableData
 {
 	int			nbuckets;		/* # buckets in the in-memory hash table */
@@ -186,6 +261,9 @@ typedef struct HashJoinTableData
 
 	/* used for dense allocation of tuples (into linked chunks) */
 	HashMemoryChunk chunks;		/* one list for the whole batch */
+
+	/* shared table we're probing instead of buckets, or NULL if private */
+	ParallelHashJoinState *parallel_state;
 }	HashJoinTableData;
 
 #endif   /* HASHJOIN_H */
@@ -0,0 +1,91 @@
+/*-------------------------------------------------------------------------
+ *
+ * jit.h
+ *	  Provider independent JIT infrastructure.
+ *
+ * Copyright (c) 2016, PostgreSQL Global Development Group
+ *
+ * src/include/jit/jit.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef JIT_H
+#define JIT_H
+
+#include "portability/instr_time.h"
+#include "utils/resowner.h"
+
+
+/* Flags determining what kind of JIT operations to perform */
+#define PGJIT_NONE		0
+#define PGJIT_PERFORM	(1 << 0)
+#define PGJIT_OPT3		(1 << 1)
+#define PGJIT_EXPR		(1 << 2)
+#define PGJIT_DEFORM	(1 << 3)
+
+
+typedef struct JitInstrumentation
+{
+	/* number of emitted functions */
+	size_t		created_functions;
+
+	/* accumulated time to generate code */
+	instr_time	generation_counter;
+
+	/* accumulated time for optimization */
+	instr_time	optimization_counter;
+
+	/* accumulated time for code emission */
+	instr_time	emission_counter;
+} JitInstrumentation;
+
+/*
+ * Code compiled for one EState.  Providers embed this at the start of
+ * their own struct, carrying whatever they need to release the code again.
+ */
+typedef struct JitContext
+{
+	/* see PGJIT_* above */
+	int			flags;
+
+	/* resource owner the context is registered with */
+	ResourceOwner resowner;
+
+	JitInstrumentation instr;
+} JitContext;
+
+struct ExprProgramState;
+struct ExprContext;
+struct AggState;
+
+typedef struct JitProviderCallbacks JitProviderCallbacks;
+
+typedef void (*JitProviderInit) (JitProviderCallbacks *cb);
+typedef void (*JitProviderReleaseContextCB) (JitContext *context);
+typedef bool (*JitProviderCompileExprCB) (struct ExprProgramState *state,
+													  struct ExprContext *econtext);
+typedef bool (*JitProviderCompileAggAdvanceCB) (struct AggState *aggstate);
+
+struct JitProviderCallbacks
+{
+	JitProviderReleaseContextCB release_context;
+	JitProviderCompileExprCB compile_expr;
+	JitProviderCompileAggAdvanceCB compile_agg_advance;
+};
+
+
+/* GUCs */
+extern bool jit_enabled;
+extern char *jit_provider;
+extern bool jit_expressions;
+extern bool jit_tuple_deforming;
+extern double jit_above_cost;
+extern double jit_optimize_above_cost;
+
+
+extern void jit_release_context(JitContext *context);
+extern bool jit_compile_expr(struct ExprProgramState *state,
+				 struct ExprContext *econtext);
+extern bool jit_compile_agg_advance(struct AggState *aggstate);
+
+#endif   /* JIT_H */
@@ -421,6 +421,14 @@ typedef struct EState
 	HeapTuple  *es_epqTuple;	/* array of EPQ substitute tuples */
 	bool	   *es_epqTupleSet; /* true if EPQ tuple is provided */
 	bool	   *es_epqScanDone; /* true if EPQ tuple has been fetched */
+
+	/*
+	 * JIT compilation: es_jit_flags is the OR of the PGJIT_* flags the
+	 * planner chose for this query (see jit/jit.h), and es_jit holds the
+	 * code compiled so far, or NULL if none has been.
+	 */
+	int			es_jit_flags;
+	struct JitContext *es_jit;
 } EState;
 
 
@@ -1005,6 +1013,24 @@ typedef struct DomainConstraintState
 	ExprState  *check_expr;		/* for CHECK, a boolean expression */
 } DomainConstraintState;
 
+/* ----------------
+ *		ExprProgramState node
+ *
+ * An expression compiled into a flat array of steps, which is evaluated
+ * without recursing through per-node evalfuncs; see execExprProgram.c.
+ * ExecInitExpr produces this in place of a tree of ExprStates when every
+ * node of the expression is of a kind the step interpreter supports.
+ * ----------------
+ */
+typedef struct ExprProgramState
+{
+	ExprState	xprstate;
+	struct ExprProgramStep *steps;		/* steps, ending with EPOP_DONE */
+	int			nsteps;			/* number of steps */
+	Datum		resvalue;		/* result of the whole expression */
+	bool		resnull;
+} ExprProgramState;
+
 
 /* ----------------------------------------------------------------
  *				 Executor State Trees
@@ -1260,6 +1286,9 @@ typedef struct SeqScanState
 {
 	ScanState	ss;				/* its first field is NodeTag */
 	Size		pscan_len;		/* size of parallel heap scan descriptor */
+	/* for batch mode, see ExecSeqScanInitBatch: */
+	struct TupleBatch *batch;	/* page of tuples being returned */
+	struct BatchQual *batchqual;	/* qual, prepared for batches */
 } SeqScanState;
 
 /* ----------------
@@ -1813,11 +1842,13 @@ typedef struct GroupState
  *	expressions and run the aggregate transition functions.
  * -------------------------
  */
-/* these structs are private in nodeAgg.c: */
+/* these structs are defined in executor/nodeAgg.h: */
 typedef struct AggStatePerAggData *AggStatePerAgg;
 typedef struct AggStatePerTransData *AggStatePerTrans;
 typedef struct AggStatePerGroupData *AggStatePerGroup;
 typedef struct AggStatePerPhaseData *AggStatePerPhase;
+/* this one is private in nodeAgg.c: */
+typedef struct HashAggSpillData *HashAggSpill;
 
 typedef struct AggState
 {
@@ -1857,6 +1888,24 @@ typedef struct AggState
 	List	   *hash_needed;	/* list of columns needed in hash table */
 	bool		table_filled;	/* hash table filled yet? */
 	TupleHashIterator hashiter; /* for iterating through hash table */
+	Size		hash_mem_limit; /* memory allowed for the hash table */
+	bool		hash_spill_mode;	/* table is full; spill new groups */
+	HashAggSpill hash_spill;	/* partitions being written, or NULL */
+	int			hash_used_bits; /* hash bits that partitioned current input */
+	int			hash_spill_level;	/* # partitioning passes behind it */
+	double		hash_input_groups;	/* expected # groups in current input */
+	List	   *hash_batches;	/* spilled batches still to process */
+	TupleTableSlot *hash_spill_slot;	/* slot for reading spilled tuples */
+	int			hash_batches_used;	/* # batches processed, for EXPLAIN */
+	int			hash_spill_levels;	/* deepest partitioning, for EXPLAIN */
+	Size		hash_mem_peak;	/* peak memory used, for EXPLAIN */
+	long		hash_disk_used; /* temp file blocks written, for EXPLAIN */
+	/* JIT-compiled replacement for advance_aggregates, if any: */
+	void		(*jit_advance) (struct AggState *aggstate,
+											AggStatePerGroup pergroup);
+	bool		jit_advance_tried;	/* tried to compile jit_advance yet? */
+	/* true if input is consumed a TupleBatch at a time, see execBatch.c */
+	bool		batch_mode;
 } AggState;
 
 /* ----------------
@@ -1972,6 +2021,8 @@ typedef struct HashState
 	HashJoinTable hashtable;	/* hash table for the hashjoin */
 	List	   *hashkeys;		/* list of ExprState nodes */
 	/* hashkeys is same as parent's hj_InnerHashKeys */
+	struct ParallelHashJoinState *parallel_state;	/* shared table, if any */
+	Size		pstate_len;		/* size of shared table in DSM */
 } HashState;
 
 /* ----------------
@@ -73,6 +73,8 @@ typedef struct PlannedStmt
 	List	   *invalItems;		/* other dependencies, as PlanInvalItems */
 
 	int			nParamExec;		/* number of PARAM_EXEC Params used */
+
+	int			jitFlags;		/* which forms of JIT should be performed */
 } PlannedStmt;
 
 /* macro for fetching the Plan associated with a SubPlan node */
@@ -1073,6 +1073,11 @@ pgstat_report_wait_end(void)
 		if ((rel)->pgstat_info != NULL)								\
 			(rel)->pgstat_info->t_counts.t_tuples_returned++;		\
 	} while (0)
+#define pgstat_count_heap_getnext_multi(rel, n)						\
+	do {															\
+		if ((rel)->pgstat_info != NULL)								\
+			(rel)->pgstat_info->t_counts.t_tuples_returned += (n);	\
+	} while (0)
 #define pgstat_count_heap_fetch(rel)								\
 	do {															\
 		if ((rel)->pgstat_info != NULL)								\
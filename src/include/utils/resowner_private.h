@@ -16,6 +16,7 @@
 #ifndef RESOWNER_PRIVATE_H
 #define RESOWNER_PRIVATE_H
 
+#include "jit/jit.h"
 #include "storage/dsm.h"
 #include "storage/fd.h"
 #include "storage/lock.h"
@@ -88,4 +89,11 @@ extern void ResourceOwnerRememberDSM(ResourceOwner owner,
 extern void ResourceOwnerForgetDSM(ResourceOwner owner,
 					   dsm_segment *);
 
+/* support for JIT context management */
+extern void ResourceOwnerEnlargeJIT(ResourceOwner owner);
+extern void ResourceOwnerRememberJIT(ResourceOwner owner,
+						 JitContext *context);
+extern void ResourceOwnerForgetJIT(ResourceOwner owner,
+					   JitContext *context);
+
 #endif   /* RESOWNER_PRIVATE_H */
@@ -824,3 +824,38 @@ create aggregate my_half_sum(int4)
 select my_sum(one),my_half_sum(one) from (values(1),(2),(3),(4)) t(one);
 
 rollback;
+
+-- Test hash aggregation spilling to disk when it exceeds work_mem
+create function explain_hashagg(query text) returns json language plpgsql as
+$$
+declare
+  plan json;
+begin
+  execute 'explain (analyze, costs off, timing off, format json) ' || query
+    into plan;
+  return plan->0->'Plan';
+end;
+$$;
+begin;
+set local work_mem = '64kB';
+set local enable_sort = false;
+explain (costs off)
+  select g % 10000 as k, count(*), sum(g::numeric)
+  from generate_series(0, 39999) g group by 1;
+select count(*), sum(c), min(c), max(c), sum(s)
+from (select g % 10000 as k, count(*) as c, sum(g::numeric) as s
+      from generate_series(0, 39999) g group by 1) t;
+select (p->>'HashAgg Batches')::int > 1 as spilled,
+       (p->>'Disk Usage')::int > 0 as used_disk
+from explain_hashagg('select g % 10000, count(*), sum(g::numeric)
+                      from generate_series(0, 39999) g group by 1') p;
+-- batches that still don't fit in work_mem are partitioned again
+select (p->>'HashAgg Batches')::int > 1 as spilled,
+       (p->>'Partition Levels')::int > 1 as repartitioned
+from explain_hashagg('select g % 100000, count(*), sum(g::numeric)
+                      from generate_series(0, 199999) g group by 1') p;
+select count(*), sum(c), min(c), max(c), sum(s)
+from (select g % 100000 as k, count(*) as c, sum(g::numeric) as s
+      from generate_series(0, 199999) g group by 1) t;
+rollback;
+drop function explain_hashagg(text);
@@ -0,0 +1,39 @@
+--
+-- BATCH
+-- Test batch execution of plain aggregates over sequential scans
+--
+CREATE TABLE batch_tbl (a int4, b int8, c numeric, v varchar);
+INSERT INTO batch_tbl
+  SELECT i, i * 10, i * 0.25, 'x' || i % 3 FROM generate_series(1, 1000) i;
+INSERT INTO batch_tbl VALUES (NULL, NULL, NULL, NULL), (NULL, 5, 1, 'x0'),
+  (7, NULL, NULL, 'x1');
+SET batch_execution = on;
+-- int4 and int8 comparisons run in specialized loops
+EXPLAIN (COSTS OFF)
+SELECT count(*), sum(a), sum(b) FROM batch_tbl WHERE a > 100 AND b <= 9000::bigint;
+SELECT count(*), sum(a), sum(b) FROM batch_tbl WHERE a > 100 AND b <= 9000::bigint;
+-- other strict operators are called through the function manager
+EXPLAIN (COSTS OFF)
+SELECT count(*), sum(a), sum(c) FROM batch_tbl WHERE c >= 200 AND b < 9000;
+SELECT count(*), sum(a), sum(c) FROM batch_tbl WHERE c >= 200 AND b < 9000;
+-- NULL inputs are skipped by the aggregates and fail the quals
+EXPLAIN (COSTS OFF)
+SELECT count(*), count(a), count(b), sum(a), sum(b), max(c) FROM batch_tbl;
+SELECT count(*), count(a), count(b), sum(a), sum(b), max(c) FROM batch_tbl;
+SELECT count(*), count(b), sum(a), sum(b) FROM batch_tbl WHERE a <= 9;
+-- operands that don't exactly match the operator's input types, like the
+-- varchar column relabeled to text here, are left to the tuple path
+EXPLAIN (COSTS OFF)
+SELECT count(*) FROM batch_tbl WHERE v = 'x1';
+SELECT count(*) FROM batch_tbl WHERE v = 'x1';
+-- the results match tuple at a time execution
+SET batch_execution = off;
+EXPLAIN (COSTS OFF)
+SELECT count(*), sum(a), sum(b) FROM batch_tbl WHERE a > 100 AND b <= 9000::bigint;
+SELECT count(*), sum(a), sum(b) FROM batch_tbl WHERE a > 100 AND b <= 9000::bigint;
+SELECT count(*), sum(a), sum(c) FROM batch_tbl WHERE c >= 200 AND b < 9000;
+SELECT count(*), count(a), count(b), sum(a), sum(b), max(c) FROM batch_tbl;
+SELECT count(*), count(b), sum(a), sum(b) FROM batch_tbl WHERE a <= 9;
+SELECT count(*) FROM batch_tbl WHERE v = 'x1';
+RESET batch_execution;
+DROP TABLE batch_tbl;
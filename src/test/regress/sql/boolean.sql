@@ -201,6 +201,50 @@ SELECT '' AS "Not True", f1
    FROM BOOLTBL2
    WHERE f1 IS NOT TRUE;
 
+--
+-- Three-valued logic with NULLs.  The operands are table columns, so these
+-- are evaluated by the executor rather than folded by the planner.
+--
+
+CREATE TABLE BOOLTBL3 (d text, b bool, n int4, o int4);
+
+INSERT INTO BOOLTBL3 (d, b, n, o) VALUES ('true', true, 1, 1);
+
+INSERT INTO BOOLTBL3 (d, b, n, o) VALUES ('false', false, 2, 2);
+
+INSERT INTO BOOLTBL3 (d, b, n, o) VALUES ('null', null, null, 3);
+
+SELECT t1.d AS x, t2.d AS y,
+       t1.b AND t2.b AS "and", t1.b OR t2.b AS "or", NOT t1.b AS "not"
+   FROM BOOLTBL3 t1, BOOLTBL3 t2
+   ORDER BY t1.o, t2.o;
+
+SELECT d, b IS TRUE AS istrue, b IS NOT TRUE AS isnottrue,
+       b IS FALSE AS isfalse, b IS NOT FALSE AS isnotfalse,
+       b IS UNKNOWN AS isunknown, b IS NOT UNKNOWN AS isnotunknown
+   FROM BOOLTBL3
+   ORDER BY o;
+
+-- strict operators comparing a column with a constant, on a NULL column
+SELECT d, n < 2 AS lt, NOT (n < 2) AS nlt, (n < 2) IS UNKNOWN AS unk
+   FROM BOOLTBL3
+   ORDER BY o;
+
+SELECT d
+   FROM BOOLTBL3
+   WHERE n < 2 OR n IS NULL
+   ORDER BY o;
+
+SELECT d
+   FROM BOOLTBL3
+   WHERE NOT (n < 2)
+   ORDER BY o;
+
+-- and with a NULL constant
+SELECT d, n < NULL::int4 AS lt, (n < NULL::int4) IS UNKNOWN AS unk
+   FROM BOOLTBL3
+   ORDER BY o;
+
 --
 -- Clean up
 -- Many tables are retained by the regression test, but these do not seem
@@ -211,3 +255,5 @@ SELECT '' AS "Not True", f1
 DROP TABLE  BOOLTBL1;
 
 DROP TABLE  BOOLTBL2;
+
+DROP TABLE  BOOLTBL3;
@@ -39,6 +39,26 @@ explain (costs off)
 	select  sum(parallel_restricted(unique1)) from tenk1
 	group by(parallel_restricted(unique1));
 
+-- test that a partial hash join shares its hash table between workers
+set enable_nestloop=off;
+set enable_mergejoin=off;
+explain (costs off)
+  select count(*) from tenk1 join onek using (unique1);
+select count(*) from tenk1 join onek using (unique1);
+-- each inner key occurs 10 times, so every bucket chain must be complete
+select count(*), sum(tenk1.unique1), sum(onek.unique2)
+  from tenk1 join onek using (hundred);
+-- a join expected to need several batches doesn't share its table
+set work_mem='64kB';
+explain (costs off)
+  select sum(length(onek.stringu1 || onek.stringu2 || onek.string4))
+  from tenk1 join onek using (unique1);
+select sum(length(onek.stringu1 || onek.stringu2 || onek.string4))
+  from tenk1 join onek using (unique1);
+reset work_mem;
+reset enable_nestloop;
+reset enable_mergejoin;
+
 set force_parallel_mode=1;
 
 explain (costs off)